@@ -0,0 +1,330 @@
+/*
+ * Vmu2Png.cxx
+ *
+ * Program to convert Hamamatsu Uncompressed Virtual Microscope
+ * Specimen (.vmu) files to PNG, TIFF or MHA format
+ *
+ * Example of usage:
+ *
+ *  $ ./vmu2png -j 8 -o png slides/slide*.vmu
+ *
+ * This converts every .vmu file in directory slides/ to an RGB PNG
+ * file with the same name and extension .png in directory png/. Up
+ * to 8 files are converted at the same time, each one by a different
+ * thread that decodes and compresses it.
+ *
+ * The image file (.ngr) of each .vmu header is memory-mapped and
+ * decoded directly into the output image (see
+ * matlab/FileFormatToolbox/VmuReader.h). The pixel size from the
+ * header is saved as the image spacing.
+ *
+ * Options:
+ *
+ *   -f --format   Output format: png (default), tif or mha.
+ *   -b --bits     Bits per channel: 8 (default, 8 most significant
+ *                 bits of the 12-bit microscope data) or 16 (raw
+ *                 12-bit values).
+ *   -j --threads  Number of files converted in parallel (default: one
+ *                 per processor).
+ *   -o --outdir   Output directory (default: the directory of each
+ *                 input file).
+ *   -v --verbose  Print the name of each file converted.
+ *
+ * This program replaces the Matlab Compiler build of vmu2png.m, and
+ * doesn't need the Matlab Compiler Runtime.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifdef _MSC_VER
+#pragma warning ( disable : 4786 )
+#endif
+
+// C++ functions
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Boost libraries
+#include "boost/filesystem/path.hpp"
+#include "boost/filesystem/convenience.hpp"
+#include "boost/thread.hpp"
+namespace fs = boost::filesystem;
+
+// Command line parser header file
+#include <tclap/CmdLine.h>
+
+// ITK files
+#include "itkImage.h"
+#include "itkImageFileWriter.h"
+#include "itkRGBPixel.h"
+#include "itkPNGImageIO.h"
+#include "itkTIFFImageIO.h"
+#include "itkMetaImageIO.h"
+
+// Gerardus files
+#include "VmuReader.h"
+
+// ITK's object factories are not guaranteed to be thread-safe, so ITK
+// objects are created while holding this mutex
+boost::mutex itkMutex;
+
+// mutex for the console output
+boost::mutex outputMutex;
+
+// convert one .vmu file to an image file with TPixel bits per channel
+template <class TPixel>
+void convertFile(const fs::path &inPath, const fs::path &outPath,
+		 const std::string &format) {
+
+  typedef itk::RGBPixel<TPixel>                  PixelType;
+  typedef itk::Image<PixelType, 2>               ImageType;
+  typedef itk::ImageFileWriter<ImageType>        WriterType;
+
+  VmuFile vmu(inPath.string());
+
+  // create output objects
+  typename ImageType::Pointer im;
+  typename WriterType::Pointer writer;
+  itk::ImageIOBase::Pointer imageIO;
+  {
+    boost::mutex::scoped_lock lock(itkMutex);
+    im = ImageType::New();
+    writer = WriterType::New();
+    if (format == "png") {
+      imageIO = itk::PNGImageIO::New();
+    } else if (format == "tif") {
+      itk::TIFFImageIO::Pointer tiffIO = itk::TIFFImageIO::New();
+      tiffIO->SetCompressionToDeflate();
+      imageIO = tiffIO;
+    } else {
+      imageIO = itk::MetaImageIO::New();
+    }
+  }
+
+  // allocate image. ITK spacing is in mm, and the VMU header in nm
+  typename ImageType::SizeType size;
+  size[0] = vmu.GetWidth();
+  size[1] = vmu.GetHeight();
+  typename ImageType::RegionType region;
+  region.SetSize(size);
+  im->SetRegions(region);
+  typename ImageType::SpacingType spacing;
+  spacing[0] = vmu.GetPixelSize(0) * 1e-6;
+  spacing[1] = vmu.GetPixelSize(1) * 1e-6;
+  if (spacing[0] > 0.0 && spacing[1] > 0.0) {
+    im->SetSpacing(spacing);
+  }
+  im->Allocate();
+
+  // decode the whole image into the interleaved row-major buffer
+  VmuDecodeFunctor<TPixel> decoder(vmu, (TPixel *)im->GetBufferPointer(),
+				   3 * size[0], 3, 1);
+  decoder(0, decoder.GetNumberOfTiles(), 0);
+
+  // write compressed output
+  writer->SetInput(im);
+  writer->SetImageIO(imageIO);
+  writer->SetFileName(outPath.string());
+  writer->SetUseCompression(true);
+  writer->Update();
+}
+
+// worker that keeps taking the next file from the list until the list
+// is exhausted
+class ConvertWorker {
+
+public:
+
+  ConvertWorker(const std::vector<std::string> &_files, size_t &_next,
+		boost::mutex &_mutex, const fs::path &_outDir,
+		const std::string &_format, unsigned int _bits, bool _verbose,
+		size_t &_nFailed)
+    : files(_files), next(_next), mutex(_mutex), outDir(_outDir), format(_format),
+      bits(_bits), verbose(_verbose), nFailed(_nFailed) {}
+
+  void operator()() {
+    for (;;) {
+      size_t i;
+      {
+	boost::mutex::scoped_lock lock(this->mutex);
+	if (this->next >= this->files.size()) {
+	  return;
+	}
+	i = this->next++;
+      }
+
+      // output file name: same name with the extension of the format,
+      // in the output directory or the input file's directory
+      fs::path inPath(this->files[i]);
+      fs::path outPath = (this->outDir.empty() ? inPath.branch_path() : this->outDir)
+	/ fs::path(fs::basename(inPath) + "." + this->format);
+
+      try {
+	if (this->bits == 8) {
+	  convertFile<unsigned char>(inPath, outPath, this->format);
+	} else {
+	  convertFile<unsigned short>(inPath, outPath, this->format);
+	}
+	if (this->verbose) {
+	  boost::mutex::scoped_lock lock(outputMutex);
+	  std::cout << "# " << inPath.string() << " -> " << outPath.string() << std::endl;
+	}
+      } catch (const std::exception &e) {
+	boost::mutex::scoped_lock lock(outputMutex);
+	std::cerr << "Error converting " << inPath.string() << ": " << std::endl
+		  << e.what() << std::endl;
+	++this->nFailed;
+      }
+    }
+  }
+
+private:
+
+  const std::vector<std::string> &files;
+  size_t &next;
+  boost::mutex &mutex;
+  fs::path outDir;
+  std::string format;
+  unsigned int bits;
+  bool verbose;
+  size_t &nFailed;
+
+};
+
+// entry point for the program
+int main(int argc, char** argv) {
+
+  /*******************************/
+  /** Command line parser block **/
+  /*******************************/
+
+  // command line input argument types and variables
+  std::vector<std::string>      files;
+  fs::path                      outDir;
+  std::string                   format;
+  unsigned int                  bits;
+  unsigned int                  numThreads;
+  bool                          verbose;
+
+  try {
+
+    // Define the command line object, program description message, separator, version
+    TCLAP::CmdLine cmd("vmu2png: convert Hamamatsu .vmu microscope files to PNG, TIFF or MHA",
+		       ' ', "0.1.0");
+
+    // input argument: verbosity
+    TCLAP::SwitchArg verboseSwitch("v", "verbose", "Increase verbosity of program output", false);
+    cmd.add(verboseSwitch);
+
+    // input argument: output directory
+    TCLAP::ValueArg<std::string> outDirArg("o", "outdir", "Output directory", false, "", "dir");
+    cmd.add(outDirArg);
+
+    // input argument: number of threads
+    TCLAP::ValueArg<unsigned int> numThreadsArg("j", "threads",
+						"Number of files converted in parallel (default: number of processors)",
+						false, 0, "int");
+    cmd.add(numThreadsArg);
+
+    // input argument: bits per channel
+    std::vector<unsigned int> allowedBits;
+    allowedBits.push_back(8);
+    allowedBits.push_back(16);
+    TCLAP::ValuesConstraint<unsigned int> allowedBitsConstraint(allowedBits);
+    TCLAP::ValueArg<unsigned int> bitsArg("b", "bits", "Bits per channel: 8 (default) or 16",
+					  false, 8, &allowedBitsConstraint);
+    cmd.add(bitsArg);
+
+    // input argument: output format
+    std::vector<std::string> allowedFormats;
+    allowedFormats.push_back("png");
+    allowedFormats.push_back("tif");
+    allowedFormats.push_back("mha");
+    TCLAP::ValuesConstraint<std::string> allowedFormatsConstraint(allowedFormats);
+    TCLAP::ValueArg<std::string> formatArg("f", "format", "Output format: png (default), tif, mha",
+					   false, "png", &allowedFormatsConstraint);
+    cmd.add(formatArg);
+
+    // input argument: input files
+    TCLAP::UnlabeledMultiArg<std::string> filesArg("files", ".vmu files", true, "file");
+    cmd.add(filesArg);
+
+    // Parse the command line arguments
+    cmd.parse(argc, argv);
+
+    // Get the value parsed by each argument
+    files = filesArg.getValue();
+    outDir = fs::path(outDirArg.getValue());
+    format = formatArg.getValue();
+    bits = bitsArg.getValue();
+    numThreads = numThreadsArg.getValue();
+    verbose = verboseSwitch.getValue();
+
+  } catch (const TCLAP::ArgException &e) { // catch any exceptions
+    std::cerr << "Error parsing command line: " << std::endl
+	      << e.error() << " for arg " << e.argId() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  /*******************************/
+  /** Conversion block          **/
+  /*******************************/
+
+  if (numThreads == 0) {
+    numThreads = boost::thread::hardware_concurrency();
+  }
+  numThreads = std::max(1u, std::min(numThreads, (unsigned int)files.size()));
+
+  size_t next = 0;
+  size_t nFailed = 0;
+  boost::mutex mutex;
+  boost::thread_group threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.create_thread(ConvertWorker(files, next, mutex, outDir, format, bits,
+					verbose, nFailed));
+  }
+  threads.join_all();
+
+  /*******************************/
+  /** End of program            **/
+  /*******************************/
+
+  if (nFailed > 0) {
+    std::cerr << nFailed << " of " << files.size() << " files could not be converted"
+	      << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
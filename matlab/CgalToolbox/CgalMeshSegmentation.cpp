@@ -78,6 +78,50 @@
  *     with the tag Manifold_tag the function template make_surface_mesh
  *     ensures that the output mesh is a manifold surface without boundary".
  *
+ * [TRI, X] = cgal_meshseg(IM, ISOVAL, MINALPHA, MAXRAD, MAXD, [], MANIFOLD, LABELS)
+ *
+ *   Multi-label mode. LABELS is a vector of label values in the
+ *   segmentation IM. The isosurface of each label is computed on the
+ *   indicator image IM==LABELS(i), with isovalue ISOVAL. By default,
+ *   ISOVAL=0.5 in this mode.
+ *
+ *   The image is read only once, and the labels are meshed concurrently,
+ *   each one in a separate thread. The bounding sphere of each label is
+ *   derived automatically from the bounding box of the label's voxels:
+ *   the centre is the label voxel closest to the centre of the box, and
+ *   the sphere contains the box with a padding of 2 voxels. C must be
+ *   empty in this mode.
+ *
+ *   TRI and X are cell arrays with one mesh per label. TRI{i} and X{i}
+ *   are the triangles and vertices of label LABELS(i), in the same format
+ *   as above. If a label has no voxels, its mesh is empty.
+ *
+ * ... = cgal_meshseg(..., LABELS, ENGINE)
+ *
+ *   ENGINE is a string to select the meshing algorithm. Use LABELS=[] to
+ *   select the engine without the multi-label mode.
+ *
+ *     'cgal' (default): The CGAL surface mesher described above.
+ *
+ *     'nets': Dual surface nets. Much faster than the CGAL mesher, but
+ *     the triangles follow the voxel grid, and their size cannot be
+ *     controlled. Each cube of 2x2x2 voxel centres crossed by the
+ *     isosurface gets a vertex, and each voxel edge crossed by the
+ *     isosurface produces two triangles. Voxels with value >= ISOVAL are
+ *     inside the surface. The image is split into slabs that are meshed
+ *     in parallel, and vertices on the slab boundaries are shared. The
+ *     image is read directly, without making a copy.
+ *
+ *     MINALPHA, MAXRAD, MAXD, C and MANIFOLD are ignored. The mesh is
+ *     closed (the image is padded with background voxels) and the
+ *     triangles are oriented with the normals pointing outwards, but
+ *     there can be non-manifold edges at saddle configurations of the
+ *     voxels. The vertices are in real world coordinates, using the
+ *     spacing and offset of IM if it is a SCIMAT struct.
+ *
+ *     In multi-label mode, the labels are meshed one after another, each
+ *     one only in its bounding box.
+ *
  * Important!
  *
  * Note that this function can produce meshes with (1) stray vertices that
@@ -94,8 +138,8 @@
 
 /*
  * Author: Ramon Casero <rcasero@gmail.com>
- * Copyright © 2013 University of Oxford
- * Version: 0.1.4
+ * Copyright © 2013-2015 University of Oxford
+ * Version: 0.3.0
  * $Rev$
  * $Date$
  *
@@ -143,12 +187,20 @@
 #include <iostream>
 #include <algorithm>
 #include <limits>
+#include <map>
+#include <string>
+#include <vector>
 #include <math.h> // DEBUG
 
+/* Boost headers */
+#include <boost/thread/mutex.hpp>
+
 /* Gerardus headers */
 #include "MatlabImageHeader.h"
 #include "MatlabImportFilter.h"
 #include "MatlabExportFilter.h"
+#include "GerardusParallel.h"
+#include "SurfaceNetsEngine.h"
 
 /* CGAL headers */
 #include <CGAL/Surface_mesh_default_triangulation_3.h>
@@ -171,6 +223,503 @@ typedef Tr::Geom_traits GT;
 typedef CGAL::Gray_level_image_3<GT::FT, GT::Point_3> Gray_level_image;
 typedef CGAL::Implicit_surface_3<GT, Gray_level_image> Surface_3;
 
+/*
+ * LabelIndicatorFunction: implicit function for the isosurface of one
+ * label of a segmentation. The indicator function (1 for voxels ==
+ * label, 0 otherwise) is trilinearly interpolated, the same way
+ * Gray_level_image_3 interpolates the voxel values.
+ *
+ * The function reads the Matlab image buffer directly, so all labels
+ * share the same copy of the image, and it's safe to evaluate it from
+ * several threads.
+ *
+ * Points are in CGAL convention, x <-> rows, y <-> cols, and referred
+ * to an image offset of (0,0,0).
+ */
+template <class TVoxel>
+class LabelIndicatorFunction {
+
+ public:
+
+  LabelIndicatorFunction(const TVoxel *_data, const mwSize *_dim, const double *_spacing,
+			 TVoxel _label, double _isoval)
+    : data(_data), label(_label), isoval(_isoval) {
+    for (unsigned int i = 0; i < 3; ++i) {
+      this->dim[i] = _dim[i];
+      this->spacing[i] = _spacing[i];
+    }
+  }
+
+  GT::FT operator()(GT::Point_3 p) const {
+
+    double v = this->Interpolate(CGAL::to_double(p.x()),
+				 CGAL::to_double(p.y()),
+				 CGAL::to_double(p.z()));
+    if (v > this->isoval) { // inside
+      return GT::FT(-1);
+    } else if (v < this->isoval) { // outside
+      return GT::FT(1);
+    } else {
+      return GT::FT(0);
+    }
+
+  }
+
+ private:
+
+  // index and weight of the two voxels around coordinate l (in voxel
+  // units) along axis d. Returns false if l is outside the image
+  bool Axis(double l, unsigned int d, mwIndex &i0, mwIndex &i1, double &w) const {
+    if (l < 0.0 || l > (double)(this->dim[d] - 1)) {
+      return false;
+    }
+    i0 = (mwIndex)l;
+    if (i0 >= this->dim[d] - 1) {
+      i0 = i1 = this->dim[d] - 1;
+      w = 0.0;
+    } else {
+      i1 = i0 + 1;
+      w = l - i0;
+    }
+    return true;
+  }
+
+  double Indicator(mwIndex r, mwIndex c, mwIndex s) const {
+    return (this->data[r + this->dim[0] * (c + this->dim[1] * s)] == this->label) ? 1.0 : 0.0;
+  }
+
+  double Interpolate(double x, double y, double z) const {
+
+    mwIndex r0, r1, c0, c1, s0, s1;
+    double wr, wc, ws;
+    if (!this->Axis(x / this->spacing[0], 0, r0, r1, wr)
+	|| !this->Axis(y / this->spacing[1], 1, c0, c1, wc)
+	|| !this->Axis(z / this->spacing[2], 2, s0, s1, ws)) {
+      return 0.0; // value outside the image
+    }
+
+    double v0 = (1 - wr) * ((1 - wc) * this->Indicator(r0, c0, s0) + wc * this->Indicator(r0, c1, s0))
+      + wr * ((1 - wc) * this->Indicator(r1, c0, s0) + wc * this->Indicator(r1, c1, s0));
+    double v1 = (1 - wr) * ((1 - wc) * this->Indicator(r0, c0, s1) + wc * this->Indicator(r0, c1, s1))
+      + wr * ((1 - wc) * this->Indicator(r1, c0, s1) + wc * this->Indicator(r1, c1, s1));
+    return (1 - ws) * v0 + ws * v1;
+
+  }
+
+  const TVoxel *data;
+  mwSize dim[3];
+  double spacing[3];
+  TVoxel label;
+  double isoval;
+
+};
+
+/*
+ * LabelBox: bounding box of the voxels of a label, and label voxel
+ * closest to the centre of the box, in (row, col, slice) indices.
+ */
+struct LabelBox {
+
+  LabelBox() : nnz(0), dist(std::numeric_limits<double>::max()) {}
+
+  mwSize nnz;
+  mwIndex min[3];
+  mwIndex max[3];
+  mwIndex centre[3];
+  double dist;
+
+};
+
+/*
+ * LabelMesh: output mesh of a label, with 0-based vertex indices in
+ * tri, and vertices in Matlab convention x[3*i + d], (x/col, y/row,
+ * z/slice), including the image offset.
+ */
+struct LabelMesh {
+
+  std::vector<mwIndex> tri;
+  std::vector<double> x;
+
+};
+
+/*
+ * LabelMesher: functor that meshes one label per call, for
+ * parallelForDynamic().
+ */
+template <class TVoxel>
+class LabelMesher {
+
+ public:
+
+  typedef LabelIndicatorFunction<TVoxel> Function;
+  typedef CGAL::Implicit_surface_3<GT, Function> LabelSurface_3;
+  typedef typename CGAL::Surface_mesh_traits_generator_3<LabelSurface_3>::type Traits;
+  typedef CGAL::Surface_mesh_default_criteria_3<Tr> Criteria;
+
+  LabelMesher(const TVoxel *_data, const MatlabImageHeader &_header,
+	      const std::vector<double> &_labels, const std::vector<LabelBox> &_boxes,
+	      double _isoval, double _minalpha, double _maxrad, double _maxd, bool _asManifold,
+	      std::vector<LabelMesh> &_meshes)
+    : data(_data), header(_header), labels(_labels), boxes(_boxes),
+      isoval(_isoval), minalpha(_minalpha), maxrad(_maxrad), maxd(_maxd),
+      asManifold(_asManifold), meshes(_meshes) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t i = begin; i < end; ++i) {
+      if (this->boxes[i].nnz > 0) {
+	this->MeshLabel(i);
+      }
+    }
+  }
+
+ private:
+
+  void MeshLabel(size_t i) {
+
+    const LabelBox &box = this->boxes[i];
+    const double *spacing = &this->header.spacing[0];
+
+    // the centre of the bounding sphere is the label voxel closest to
+    // the centre of the bounding box, so that the implicit function is
+    // negative at the centre, as the mesher requires
+    GT::Point_3 centre(box.centre[0] * spacing[0],
+		       box.centre[1] * spacing[1],
+		       box.centre[2] * spacing[2]);
+
+    // the sphere contains the bounding box padded by 2 voxels, so that
+    // it contains the isosurface, plus 5% to avoid potential finite
+    // precision problems
+    double padding = 2 * std::max(std::max(spacing[0], spacing[1]), spacing[2]);
+    double squaredRadius = 0.0;
+    for (unsigned int d = 0; d < 3; ++d) {
+      double l = std::max(box.centre[d] - box.min[d], box.max[d] - box.centre[d]) * spacing[d]
+	+ padding;
+      squaredRadius += l * l;
+    }
+    GT::Sphere_3 boundingSphere(centre, 1.05 * squaredRadius);
+
+    // definition of the surface, with 10^-5 as relative precision
+    Function function(this->data, &this->header.size[0], spacing,
+		      static_cast<TVoxel>(this->labels[i]), this->isoval);
+    LabelSurface_3 surface(function, boundingSphere, 1e-5);
+
+    // variables to store the mesh as a triangulation
+    Tr tr;            // 3D-Delaunay triangulation
+    C2t3 c2t3(tr);    // 2D-complex in 3D-Delaunay triangulation
+    Criteria criteria(this->minalpha, this->maxrad, this->maxd);
+
+    // Meshing. This is CGAL::make_surface_mesh(), but the initial
+    // points are computed while holding a lock, because they are drawn
+    // from CGAL::default_random, that is shared by all threads
+    Traits traits;
+    {
+      boost::mutex::scoped_lock lock(LabelMesher::randomMutex);
+      traits.construct_initial_points_object()(surface, CGAL::inserter(tr), 20);
+    }
+    if (this->asManifold) {
+      typedef typename CGAL::Surface_mesher_generator<C2t3, Traits, Criteria, CGAL::Manifold_tag,
+	CGAL_SURFACE_MESHER_VERBOSITY>::type Mesher;
+      Mesher mesher(c2t3, surface, traits, criteria);
+      mesher.refine_mesh();
+    } else {
+      typedef typename CGAL::Surface_mesher_generator<C2t3, Traits, Criteria, CGAL::Non_manifold_tag,
+	CGAL_SURFACE_MESHER_VERBOSITY>::type Mesher;
+      Mesher mesher(c2t3, surface, traits, criteria);
+      mesher.refine_mesh();
+    }
+
+    // vertices coordinates, with the same convention as the
+    // single-label output
+    LabelMesh &mesh = this->meshes[i];
+    std::map<Tr::Vertex_handle, mwIndex> V;
+    mwIndex inum = 0;
+    for (Tr::Finite_vertices_iterator vit = tr.finite_vertices_begin();
+	 vit != tr.finite_vertices_end(); ++vit) {
+      // *swap to Matlab convention*
+      mesh.x.push_back(vit->point().y() + this->header.origin[1]);
+      mesh.x.push_back(vit->point().x() + this->header.origin[0]);
+      mesh.x.push_back(vit->point().z() + this->header.origin[2]);
+      V[vit] = inum++;
+    }
+
+    // triangles
+    for (C2t3::Facet_iterator fit = c2t3.facets_begin(); fit != c2t3.facets_end(); ++fit) {
+      const Tr::Cell_handle cell = fit->first;
+      const int& index = fit->second;
+      if (cell->is_facet_on_surface(index)) {
+	for (int k = 0; k < 3; ++k) {
+	  mesh.tri.push_back(V[cell->vertex(tr.vertex_triple_index(index, k))]);
+	}
+      }
+    }
+
+  }
+
+  const TVoxel *data;
+  const MatlabImageHeader &header;
+  const std::vector<double> &labels;
+  const std::vector<LabelBox> &boxes;
+  double isoval;
+  double minalpha;
+  double maxrad;
+  double maxd;
+  bool asManifold;
+  std::vector<LabelMesh> &meshes;
+
+  static boost::mutex randomMutex;
+
+};
+
+template <class TVoxel>
+boost::mutex LabelMesher<TVoxel>::randomMutex;
+
+/*
+ * computeLabelBoxes(): bounding box of each label, and label voxel
+ * closest to the centre of the box. This needs two passes through
+ * the image
+ */
+template <class TVoxel>
+void computeLabelBoxes(const TVoxel *data, const MatlabImageHeader &header,
+		       const std::vector<double> &labels, std::vector<LabelBox> &boxes) {
+
+  // map from label value to position in the labels vector
+  typedef typename std::map<TVoxel, size_t> LabelMap;
+  LabelMap labelMap;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    labelMap[static_cast<TVoxel>(labels[i])] = i;
+  }
+  boxes.assign(labels.size(), LabelBox());
+
+  const mwSize *size = &header.size[0];
+  for (int pass = 0; pass < 2; ++pass) {
+    mwIndex idx = 0;
+    for (mwIndex s = 0; s < size[2]; ++s) {
+      for (mwIndex c = 0; c < size[1]; ++c) {
+	for (mwIndex r = 0; r < size[0]; ++r, ++idx) {
+
+	  typename LabelMap::const_iterator it = labelMap.find(data[idx]);
+	  if (it == labelMap.end()) {
+	    continue;
+	  }
+	  LabelBox &box = boxes[it->second];
+	  mwIndex v[3] = {r, c, s};
+
+	  if (pass == 0) {
+	    // bounding box
+	    for (unsigned int d = 0; d < 3; ++d) {
+	      box.min[d] = (box.nnz == 0) ? v[d] : std::min(box.min[d], v[d]);
+	      box.max[d] = (box.nnz == 0) ? v[d] : std::max(box.max[d], v[d]);
+	    }
+	    box.nnz++;
+	  } else {
+	    // closest voxel to the box centre, in real world distance
+	    double dist = 0.0;
+	    for (unsigned int d = 0; d < 3; ++d) {
+	      double delta = (v[d] - 0.5 * (box.min[d] + box.max[d])) * header.spacing[d];
+	      dist += delta * delta;
+	    }
+	    if (dist < box.dist) {
+	      box.dist = dist;
+	      std::copy(v, v + 3, box.centre);
+	    }
+	  }
+
+	}
+      }
+    }
+  }
+
+}
+
+/*
+ * netsToWorld(): convert surface nets vertices from (row, col, slice)
+ * voxel indices to real world coordinates in Matlab convention, x[3*i
+ * + d], (x/col, y/row, z/slice)
+ */
+inline
+void netsToWorld(const std::vector<double> &idx, const MatlabImageHeader &header,
+		 std::vector<double> &x) {
+
+  x.resize(idx.size());
+  for (size_t i = 0; i < idx.size(); i += 3) {
+    // *swap to Matlab convention*
+    x[i]     = header.origin[1] + idx[i + 1] * header.spacing[1];
+    x[i + 1] = header.origin[0] + idx[i]     * header.spacing[0];
+    x[i + 2] = header.origin[2] + idx[i + 2] * header.spacing[2];
+  }
+
+}
+
+/*
+ * runSurfaceNets(): mesh the isosurface of a grayscale image or
+ * segmentation with dual surface nets
+ */
+template <class TVoxel>
+void runSurfaceNets(MatlabImportFilter::Pointer matlabImport,
+		    MatlabExportFilter::Pointer matlabExport,
+		    MatlabExportFilter::MatlabOutputPointer outTRI,
+		    MatlabExportFilter::MatlabOutputPointer outX) {
+
+  // get image header. The voxels are read directly from the Matlab
+  // buffer, without making a copy
+  MatlabImportFilter::MatlabInputPointer inIM = matlabImport->GetRegisteredInput("IM");
+  MatlabImageHeader header(inIM->pm, inIM->name);
+  if (header.size.size() != 3) {
+    mexErrMsgTxt(("Input " + inIM->name + " must be a 3D image.").c_str());
+  }
+  double isoval = matlabImport->ReadScalarFromMatlab<double>(matlabImport->GetRegisteredInput("ISO"), 0.5);
+
+  // mesh the whole image
+  const size_t size[3] = {header.size[0], header.size[1], header.size[2]};
+  const size_t lo[3] = {0, 0, 0};
+  const size_t hi[3] = {size[0] - 1, size[1] - 1, size[2] - 1};
+  GrayLevelSampler<TVoxel> sampler((const TVoxel *)mxGetData(header.data), size);
+  std::vector<double> idx;
+  std::vector<size_t> triNets;
+  surfaceNets(sampler, lo, hi, isoval, idx, triNets);
+  std::vector<double> xNets;
+  netsToWorld(idx, header, xNets);
+
+  // copy mesh to Matlab. Note that Matlab indices go like 1, 2,
+  // 3..., while C++ indices go like 0, 1, 2...
+  mwSize ntri = triNets.size() / 3;
+  mwSize nx = xNets.size() / 3;
+  double *tri = matlabExport->AllocateMatrixInMatlab<double>(outTRI, ntri, 3);
+  for (mwIndex j = 0; j < ntri; ++j) {
+    for (mwIndex k = 0; k < 3; ++k) {
+      tri[j + k * ntri] = triNets[3 * j + k] + 1;
+    }
+  }
+  if (outX->isRequested) {
+    double *x = matlabExport->AllocateMatrixInMatlab<double>(outX, nx, 3);
+    for (mwIndex j = 0; j < nx; ++j) {
+      for (mwIndex k = 0; k < 3; ++k) {
+	x[j + k * nx] = xNets[3 * j + k];
+      }
+    }
+  }
+
+}
+
+/*
+ * meshLabelsWithSurfaceNets(): mesh each label of a segmentation with
+ * dual surface nets, within the label's bounding box. The labels are
+ * meshed one after another, and each label is split into slabs that
+ * are meshed in parallel
+ */
+template <class TVoxel>
+void meshLabelsWithSurfaceNets(const TVoxel *data, const MatlabImageHeader &header,
+			       const std::vector<double> &labels,
+			       const std::vector<LabelBox> &boxes,
+			       double isoval, std::vector<LabelMesh> &meshes) {
+
+  const size_t size[3] = {header.size[0], header.size[1], header.size[2]};
+  for (size_t i = 0; i < labels.size(); ++i) {
+    if (boxes[i].nnz == 0) {
+      continue;
+    }
+    const size_t lo[3] = {boxes[i].min[0], boxes[i].min[1], boxes[i].min[2]};
+    const size_t hi[3] = {boxes[i].max[0], boxes[i].max[1], boxes[i].max[2]};
+    LabelSampler<TVoxel> sampler(data, size, static_cast<TVoxel>(labels[i]));
+    std::vector<double> idx;
+    std::vector<size_t> tri;
+    surfaceNets(sampler, lo, hi, isoval, idx, tri);
+    meshes[i].tri.assign(tri.begin(), tri.end());
+    netsToWorld(idx, header, meshes[i].x);
+  }
+
+}
+
+/*
+ * runMultiLabelMeshing(): mesh several labels of a segmentation. With
+ * the CGAL mesher, the labels are meshed concurrently, one thread per
+ * label
+ */
+template <class TVoxel>
+void runMultiLabelMeshing(MatlabImportFilter::Pointer matlabImport,
+			  MatlabExportFilter::Pointer matlabExport,
+			  const std::vector<double> &labels, bool useNets,
+			  MatlabExportFilter::MatlabOutputPointer outTRI,
+			  MatlabExportFilter::MatlabOutputPointer outX) {
+
+  // get image header. The voxels are read directly from the Matlab
+  // buffer, without making a copy
+  MatlabImportFilter::MatlabInputPointer inIM = matlabImport->GetRegisteredInput("IM");
+  MatlabImageHeader header(inIM->pm, inIM->name);
+  if (header.size.size() != 3) {
+    mexErrMsgTxt(("Input " + inIM->name + " must be a 3D image.").c_str());
+  }
+  const TVoxel *data = (const TVoxel *)mxGetData(header.data);
+
+  // get input parameters
+  double isoval   = matlabImport->ReadScalarFromMatlab<double>(matlabImport->GetRegisteredInput("ISO"), 0.5);
+  double minalpha = matlabImport->ReadScalarFromMatlab<double>(matlabImport->GetRegisteredInput("MINALPHA"), 30.0);
+  bool asManifold = matlabImport->ReadScalarFromMatlab<bool>(matlabImport->GetRegisteredInput("MANIFOLD"), false);
+  double defRadAndD = std::min(std::min(header.spacing[0], header.spacing[1]), header.spacing[2]);
+  double maxrad   = matlabImport->ReadScalarFromMatlab<double>(matlabImport->GetRegisteredInput("MAXRAD"), defRadAndD * 0.5);
+  double maxd     = matlabImport->ReadScalarFromMatlab<double>(matlabImport->GetRegisteredInput("MAXD"), defRadAndD * 0.5);
+
+  // bounding boxes of the labels
+  std::vector<LabelBox> boxes;
+  computeLabelBoxes<TVoxel>(data, header, labels, boxes);
+
+  std::vector<LabelMesh> meshes(labels.size());
+  if (useNets) {
+
+    // surface nets parallelise each label internally
+    meshLabelsWithSurfaceNets<TVoxel>(data, header, labels, boxes, isoval, meshes);
+
+  } else {
+
+    // mesh the labels in parallel
+    LabelMesher<TVoxel> mesher(data, header, labels, boxes,
+			       isoval, minalpha, maxrad, maxd, asManifold, meshes);
+    parallelForDynamic(0, labels.size(), 1, mesher);
+
+  }
+
+  // create a cell per label for each output
+  const mwSize cellDims[2] = {1, labels.size()};
+  *outTRI->ppm = mxCreateCellArray(2, cellDims);
+  if (*outTRI->ppm == NULL) {
+    mexErrMsgTxt("Cannot allocate memory for output TRI");
+  }
+  if (outX->isRequested) {
+    *outX->ppm = mxCreateCellArray(2, cellDims);
+    if (*outX->ppm == NULL) {
+      mexErrMsgTxt("Cannot allocate memory for output X");
+    }
+  }
+
+  // copy meshes to Matlab
+  for (size_t i = 0; i < labels.size(); ++i) {
+
+    const LabelMesh &mesh = meshes[i];
+    mwSize ntri = mesh.tri.size() / 3;
+    mwSize nx = mesh.x.size() / 3;
+
+    // note that Matlab indices go like 1, 2, 3..., while C++ indices
+    // go like 0, 1, 2...
+    double *tri = matlabExport->AllocateMatrixInCellInMatlab<double>(outTRI, i, ntri, 3);
+    for (mwIndex j = 0; j < ntri; ++j) {
+      for (mwIndex k = 0; k < 3; ++k) {
+	tri[j + k * ntri] = mesh.tri[3 * j + k] + 1;
+      }
+    }
+
+    if (outX->isRequested) {
+      double *x = matlabExport->AllocateMatrixInCellInMatlab<double>(outX, i, nx, 3);
+      for (mwIndex j = 0; j < nx; ++j) {
+	for (mwIndex k = 0; k < 3; ++k) {
+	  x[j + k * nx] = mesh.x[3 * j + k];
+	}
+      }
+    }
+
+  }
+
+}
+
 /*
  * mexFunction(): entry point for the mex function
  */
@@ -178,7 +727,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
   // interface to deal with input arguments from Matlab
   enum InputIndexType {IN_IM, IN_ISO, 
-		       IN_MINALPHA, IN_MAXRAD, IN_MAXD, IN_C, IN_MANIFOLD, InputIndexType_MAX};
+		       IN_MINALPHA, IN_MAXRAD, IN_MAXD, IN_C, IN_MANIFOLD, IN_LABELS,
+		       IN_ENGINE, InputIndexType_MAX};
   MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
   matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
 
@@ -193,12 +743,19 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   MatlabInputPointer inMAXRAD   = matlabImport->RegisterInput(IN_MAXRAD, "MAXRAD");
   MatlabInputPointer inMAXD     = matlabImport->RegisterInput(IN_MAXD, "MAXD");
   MatlabInputPointer inC        = matlabImport->RegisterInput(IN_C, "C");
-  MatlabInputPointer inMANIFOLD = matlabImport->RegisterInput(IN_MANIFOLD, "C");
+  MatlabInputPointer inMANIFOLD = matlabImport->RegisterInput(IN_MANIFOLD, "MANIFOLD");
+  MatlabInputPointer inLABELS   = matlabImport->RegisterInput(IN_LABELS, "LABELS");
+  MatlabInputPointer inENGINE   = matlabImport->RegisterInput(IN_ENGINE, "ENGINE");
 
   // get input parameters
   double isoval   = matlabImport->ReadScalarFromMatlab<double>(inISO, 0.5);
   double minalpha = matlabImport->ReadScalarFromMatlab<double>(inMINALPHA, 30.0);
   bool asManifold = matlabImport->ReadScalarFromMatlab<bool>(inMANIFOLD, false);
+  std::string engine = matlabImport->ReadStringFromMatlab(inENGINE, "cgal");
+  if (engine != "cgal" && engine != "nets") {
+    mexErrMsgTxt(("Input " + inENGINE->name + " must be 'cgal' or 'nets'").c_str());
+  }
+  bool useNets = (engine == "nets");
 
   // interface to deal with outputs to Matlab
   enum OutputIndexType {OUT_TRI, OUT_X, OutputIndexType_MAX};
@@ -220,6 +777,106 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     return;
   }  
 
+  // multi-label mode
+  if (inLABELS->isProvided) {
+
+    if (inC->isProvided && !useNets) {
+      mexErrMsgTxt("C must be empty in multi-label mode. The bounding sphere of each label is computed automatically");
+    }
+
+    // read label values
+    std::vector<double> labels(mxGetNumberOfElements(inLABELS->pm));
+    for (size_t i = 0; i < labels.size(); ++i) {
+      labels[i] = matlabImport->ReadScalarFromMatlab<double>
+	(inLABELS, (mxGetM(inLABELS->pm) == 1) ? 0 : i, (mxGetM(inLABELS->pm) == 1) ? i : 0,
+	 mxGetNaN());
+    }
+
+    switch (mxGetClassID(inIM->pm)) {
+    case mxLOGICAL_CLASS:
+      runMultiLabelMeshing<mxLogical>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxDOUBLE_CLASS:
+      runMultiLabelMeshing<double>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxSINGLE_CLASS:
+      runMultiLabelMeshing<float>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxINT8_CLASS:
+      runMultiLabelMeshing<int8_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxUINT8_CLASS:
+      runMultiLabelMeshing<uint8_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxINT16_CLASS:
+      runMultiLabelMeshing<int16_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxUINT16_CLASS:
+      runMultiLabelMeshing<uint16_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxINT32_CLASS:
+      runMultiLabelMeshing<int32_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxUINT32_CLASS:
+      runMultiLabelMeshing<uint32_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxINT64_CLASS:
+      runMultiLabelMeshing<int64_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    case mxUINT64_CLASS:
+      runMultiLabelMeshing<uint64_T>(matlabImport, matlabExport, labels, useNets, outTRI, outX);
+      break;
+    default:
+      mexErrMsgTxt(("Input " + inIM->name + " has invalid type.").c_str());
+    }
+    return;
+
+  }
+
+  // surface nets
+  if (useNets) {
+
+    switch (mxGetClassID(inIM->pm)) {
+    case mxLOGICAL_CLASS:
+      runSurfaceNets<mxLogical>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxDOUBLE_CLASS:
+      runSurfaceNets<double>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxSINGLE_CLASS:
+      runSurfaceNets<float>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxINT8_CLASS:
+      runSurfaceNets<int8_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxUINT8_CLASS:
+      runSurfaceNets<uint8_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxINT16_CLASS:
+      runSurfaceNets<int16_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxUINT16_CLASS:
+      runSurfaceNets<uint16_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxINT32_CLASS:
+      runSurfaceNets<int32_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxUINT32_CLASS:
+      runSurfaceNets<uint32_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxINT64_CLASS:
+      runSurfaceNets<int64_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    case mxUINT64_CLASS:
+      runSurfaceNets<uint64_T>(matlabImport, matlabExport, outTRI, outX);
+      break;
+    default:
+      mexErrMsgTxt(("Input " + inIM->name + " has invalid type.").c_str());
+    }
+    return;
+
+  }
+
   // if the image is of type bool, the mesher enters an infinite loop
   // for some reason
   if ((mxGetClassID(inIM->pm) == mxLOGICAL_CLASS) || (mxGetClassID(inIM->pm) == mxINT64_CLASS)) {
@@ -32,7 +32,7 @@
 /*
  * Author: Ramon Casero <rcasero@gmail.com>
  * Copyright © 2013 University of Oxford
- * Version: 0.1.1
+ * Version: 0.1.2
  * $Rev$
  * $Date$
  *
@@ -76,13 +76,15 @@
 /* CGAL headers */
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Polyhedron_3.h>
+#include <CGAL/Polyhedron_items_with_id_3.h>
 #include <CGAL/triangulate_polyhedron.h>
 #include "PolyhedronBuilder.h"
 
 typedef MatlabImportFilter::MatlabInputPointer               MatlabInputPointer;
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel  Kernel;
-typedef CGAL::Polyhedron_3<Kernel>                           Polyhedron;
+typedef CGAL::Polyhedron_3<Kernel,
+                            CGAL::Polyhedron_items_with_id_3> Polyhedron;
 typedef CGAL::Point_3<Kernel>                                Point;
 typedef Polyhedron::Facet                                    Facet;
 typedef Polyhedron::Facet_iterator                           Facet_iterator;
@@ -196,43 +198,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
   std::vector<double> nout(1, n);
   matlabExport->CopyVectorOfScalarsToMatlab<double, std::vector<double> >(outN, nout, 1);
 
-  // allocate memory for Matlab outputs
-  double *tri = matlabExport->AllocateMatrixInMatlab<double>(outTRI, mesh.size_of_facets(), 3);
+  // write the mesh to the outputs
+  polyhedronToMatlab(mesh, matlabExport, outTRI);
 
-   // extract the triangles of the solution
-  // snippet adapted from CgalMeshSegmentation.cpp
-
-  // vertices coordinates. Assign indices to the vertices by defining
-  // a map between their handles and the index
-  std::map<Vertex_handle, int> V;
-  int inum = 0;
-  for(Vertex_iterator vit = mesh.vertices_begin(); vit != mesh.vertices_end(); ++vit) {
-
-    // save to internal list of vertices
-    V[vit] = inum++;
-
-  }  
-
-  // triangles given as (i,j,k), where each index corresponds to a vertex in x
-  mwIndex row = 0;
-  for (Facet_iterator fit = mesh.facets_begin(); fit != mesh.facets_end(); ++fit, ++row) {
-
-    if (fit->facet_degree() != 3) {
-      std::cerr << "Facet has " << fit->facet_degree() << " edges" << std::endl;
-      mexErrMsgTxt("Facet does not have 3 edges");
-    }
-
-    // go around the half-edges of the facet, to extract the vertices
-    Halfedge_around_facet_circulator heit = fit->facet_begin();
-    int idx = 0;
-    do {
-      
-      // extract triangle indices and save to Matlab output
-      // note that Matlab indices go like 1, 2, 3..., while C++ indices go like 0, 1, 2...
-      tri[row + idx * mesh.size_of_facets()] = 1 + V[heit->vertex()];
-      idx++;
-
-    } while (++heit != fit->facet_begin());
-    
-  }
 }
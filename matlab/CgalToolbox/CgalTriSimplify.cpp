@@ -32,13 +32,34 @@
  *
  *   TRI2, X2 is the description of the simplified output mesh.
  *
+ * ... = cgal_tri_simplify(TRI, X, RATIO, ENGINE, TOL)
+ *
+ *   ENGINE is a string to select the simplification algorithm:
+ *
+ *     'cgal' (default): CGAL's edge collapse, as described above. TOL is
+ *     ignored.
+ *
+ *     'quadric': Edge collapse with quadric error metrics (Garland and
+ *     Heckbert) on arrays of vertices and triangles, without building a
+ *     CGAL polyhedron. In each pass, the cheapest collapses that are far
+ *     apart from each other (their 1-rings don't overlap) are selected
+ *     and applied in parallel. Vertices on the mesh border are not moved.
+ *
+ *     TOL is the error bound. Each vertex of the simplified mesh is at
+ *     most at distance TOL from the planes of all the original triangles
+ *     merged into it (the quadric error is <= TOL^2). By default, TOL=Inf.
+ *     The algorithm stops when no more collapses satisfy the bound, or
+ *     when the number of undirected edges reaches RATIO * number of
+ *     original undirected edges. With RATIO=0, only TOL stops the
+ *     simplification.
+ *
  * See also: cgal_surfsubdivision.
  */
 
 /*
  * Author: Ramon Casero <rcasero@gmail.com>
- * Copyright © 2013 University of Oxford
- * Version: 0.1.0
+ * Copyright © 2013-2015 University of Oxford
+ * Version: 0.2.1
  * $Rev$
  * $Date$
  *
@@ -74,6 +95,8 @@
 
 /* C++ headers */
 #include <iostream>
+#include <string>
+#include <vector>
 
 /* Gerardus headers */
 #include "MatlabImportFilter.h"
@@ -82,7 +105,9 @@
 /* CGAL headers */
 #include <CGAL/Simple_cartesian.h>
 #include <CGAL/Polyhedron_3.h>
+#include <CGAL/Polyhedron_items_with_id_3.h>
 #include "PolyhedronBuilder.h"
+#include "QuadricSimplificationEngine.h"
 
 typedef MatlabImportFilter::MatlabInputPointer               MatlabInputPointer;
 
@@ -95,7 +120,8 @@ typedef MatlabImportFilter::MatlabInputPointer               MatlabInputPointer;
 #include <CGAL/Surface_mesh_simplification/Policies/Edge_collapse/Count_ratio_stop_predicate.h>
 
 typedef CGAL::Simple_cartesian<double>                       Kernel;
-typedef CGAL::Polyhedron_3<Kernel>                           Polyhedron; 
+typedef CGAL::Polyhedron_3<Kernel,
+                            CGAL::Polyhedron_items_with_id_3> Polyhedron; 
 namespace SMS = CGAL::Surface_mesh_simplification;
 
 typedef Polyhedron::Facet_iterator                           Facet_iterator;
@@ -103,6 +129,95 @@ typedef Polyhedron::Vertex_handle                            Vertex_handle;
 typedef Polyhedron::Vertex_iterator                          Vertex_iterator;
 typedef Polyhedron::Halfedge_around_facet_circulator         Halfedge_around_facet_circulator;
 
+/*
+ * runQuadricSimplification(): simplify the mesh with the quadric
+ * error engine, working directly on the arrays
+ */
+void runQuadricSimplification(MatlabImportFilter::Pointer matlabImport,
+			      MatlabExportFilter::Pointer matlabExport,
+			      MatlabInputPointer inTRI, MatlabInputPointer inX,
+			      double ratio, double tol,
+			      MatlabExportFilter::MatlabOutputPointer outTRI,
+			      MatlabExportFilter::MatlabOutputPointer outX) {
+
+  mwSize nrowsTri = mxGetM(inTRI->pm);
+  mwSize nrowsX = mxGetM(inX->pm);
+  if ((mxGetN(inTRI->pm) != 3) || (mxGetN(inX->pm) != 3)) {
+    mexErrMsgTxt("TRI and X inputs must have 3 columns");
+  }
+
+  // read the mesh, with triangle indices from Matlab's convention (1,
+  // 2, 3, ...) to C++ convention (0, 1, 2, ...), and vertex
+  // coordinates interleaved, x[3*i + d]
+  std::vector<mwIndex> tri;
+  switch (mxGetClassID(inTRI->pm)) {
+  case mxDOUBLE_CLASS:
+    readTriangleIndices((double *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxSINGLE_CLASS:
+    readTriangleIndices((float *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxINT8_CLASS:
+    readTriangleIndices((int8_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxUINT8_CLASS:
+    readTriangleIndices((uint8_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxINT16_CLASS:
+    readTriangleIndices((int16_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxUINT16_CLASS:
+    readTriangleIndices((uint16_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxINT32_CLASS:
+    readTriangleIndices((int32_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxUINT32_CLASS:
+    readTriangleIndices((uint32_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxINT64_CLASS:
+    readTriangleIndices((int64_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  case mxUINT64_CLASS:
+    readTriangleIndices((uint64_T *)mxGetData(inTRI->pm), nrowsTri, nrowsX, tri, inTRI->name);
+    break;
+  default:
+    mexErrMsgTxt(("Input " + inTRI->name + " has invalid type.").c_str());
+  }
+  std::vector<double> xcol = matlabImport->ReadArrayAsVectorFromMatlab<double, std::vector<double> >
+    (inX, std::vector<double>());
+  std::vector<double> x(3 * nrowsX);
+  for (mwIndex i = 0; i < nrowsX; ++i) {
+    for (mwIndex d = 0; d < 3; ++d) {
+      x[3 * i + d] = xcol[i + d * nrowsX];
+    }
+  }
+
+  // simplify
+  QuadricSimplifier simplifier(x, std::vector<size_t>(tri.begin(), tri.end()));
+  simplifier.Run(tol, ratio);
+  std::vector<double> x2;
+  std::vector<size_t> tri2;
+  simplifier.GetMesh(x2, tri2);
+
+  // copy the simplified mesh to the outputs
+  mwSize ntri2 = tri2.size() / 3;
+  mwSize nx2 = x2.size() / 3;
+  double *triOut = matlabExport->AllocateMatrixInMatlab<double>(outTRI, ntri2, 3);
+  for (mwIndex i = 0; i < ntri2; ++i) {
+    for (mwIndex k = 0; k < 3; ++k) {
+      triOut[i + k * ntri2] = tri2[3 * i + k] + 1;
+    }
+  }
+  double *xOut = matlabExport->AllocateMatrixInMatlab<double>(outX, nx2, 3);
+  for (mwIndex i = 0; i < nx2; ++i) {
+    for (mwIndex d = 0; d < 3; ++d) {
+      xOut[i + d * nx2] = x2[3 * i + d];
+    }
+  }
+
+}
+
 /*
  * mexFunction(): entry point for the mex function
  */
@@ -110,7 +225,7 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		 int nrhs, const mxArray *prhs[]) {
 
   // interface to deal with input arguments from Matlab
-  enum InputIndexType {IN_TRI, IN_X, IN_R, InputIndexType_MAX};
+  enum InputIndexType {IN_TRI, IN_X, IN_R, IN_ENGINE, IN_TOL, InputIndexType_MAX};
   MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
   matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
 
@@ -121,6 +236,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
   MatlabInputPointer inTRI =        matlabImport->RegisterInput(IN_TRI, "TRI");
   MatlabInputPointer inX =          matlabImport->RegisterInput(IN_X, "X");
   MatlabInputPointer inR =          matlabImport->RegisterInput(IN_R, "R");
+  MatlabInputPointer inENGINE =     matlabImport->RegisterInput(IN_ENGINE, "ENGINE");
+  MatlabInputPointer inTOL =        matlabImport->RegisterInput(IN_TOL, "TOL");
 
   // interface to deal with outputs to Matlab
   enum OutputIndexType {OUT_TRI, OUT_X, OutputIndexType_MAX};
@@ -144,6 +261,16 @@ void mexFunction(int nlhs, mxArray *plhs[],
 
   // read input parameters
   double ratio = matlabImport->ReadScalarFromMatlab<double>(inR, 0.1);
+  std::string engine = matlabImport->ReadStringFromMatlab(inENGINE, "cgal");
+  double tol = matlabImport->ReadScalarFromMatlab<double>(inTOL, mxGetInf());
+
+  if (engine == "quadric") {
+    runQuadricSimplification(matlabImport, matlabExport, inTRI, inX, ratio, tol,
+			     outTRI, outX);
+    return;
+  } else if (engine != "cgal") {
+    mexErrMsgTxt(("Input " + inENGINE->name + " must be 'cgal' or 'quadric'").c_str());
+  }
 
   // polyhedron to contain the input mesh
   Polyhedron mesh;
@@ -172,56 +299,13 @@ void mexFunction(int nlhs, mxArray *plhs[],
   
   // This the actual call to the simplification algorithm.
   // The surface and stop conditions are mandatory arguments.
-  // The index maps are needed because the vertices and edges
-  // of this surface lack an "id()" field.
+  // The index maps are external, so the "id()" fields of the
+  // vertices and edges don't need to be initialised.
   SMS::edge_collapse(mesh, stop,
 		     CGAL::vertex_index_map(boost::get(CGAL::vertex_external_index, mesh)) 
 		     .edge_index_map(boost::get(CGAL::edge_external_index, mesh)));
 
-  // allocate memory for Matlab outputs
-  double *tri = matlabExport->AllocateMatrixInMatlab<double>(outTRI, mesh.size_of_facets(), 3);
-  double *x = matlabExport->AllocateMatrixInMatlab<double>(outX, mesh.size_of_vertices(), 3);
-
-   // extract the triangles of the solution
-  // snippet adapted from CgalMeshSegmentation.cpp
-
-  // vertices coordinates. Assign indices to the vertices by defining
-  // a map between their handles and the index
-  std::map<Vertex_handle, int> V;
-  int inum = 0;
-  for(Vertex_iterator vit = mesh.vertices_begin(); vit != mesh.vertices_end(); ++vit) {
-
-   // save to Matlab output
-    x[inum] = vit->point().x();
-    x[inum + mesh.size_of_vertices()] = vit->point().y();
-    x[inum + 2*mesh.size_of_vertices()] = vit->point().z();
-
-    // save to internal list of vertices
-    V[vit] = inum++;
-
-  }  
-
-  // triangles given as (i,j,k), where each index corresponds to a vertex in x
-  mwIndex row = 0;
-  for (Facet_iterator fit = mesh.facets_begin(); fit != mesh.facets_end(); ++fit, ++row) {
-
-    if (fit->facet_degree() != 3) {
-      std::cerr << "Facet has " << fit->facet_degree() << " edges" << std::endl;
-      mexErrMsgTxt("Facet does not have 3 edges");
-    }
-
-    // go around the half-edges of the facet, to extract the vertices
-    Halfedge_around_facet_circulator heit = fit->facet_begin();
-    int idx = 0;
-    do {
-      
-      // extract triangle indices and save to Matlab output
-      // note that Matlab indices go like 1, 2, 3..., while C++ indices go like 0, 1, 2...
-      tri[row + idx * mesh.size_of_facets()] = 1 + V[heit->vertex()];
-      idx++;
-
-    } while (++heit != fit->facet_begin());
-    
-  }
+  // write the mesh to the outputs
+  polyhedronToMatlab(mesh, matlabExport, outTRI, outX);
 
 }
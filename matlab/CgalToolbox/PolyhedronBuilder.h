@@ -4,14 +4,29 @@
  *
  * This class has code specific to Gerardus and to CGAL.
  *
+ * The polyhedron is built in bulk from the arrays, instead of vertex
+ * by vertex and facet by facet with
+ * CGAL::Polyhedron_incremental_builder_3. The halfedges of all
+ * triangles are sorted by their undirected edge to pair them with
+ * their opposites, and then the vertices, halfedges and facets are
+ * created and linked directly in the halfedge data structure. This is
+ * much faster for large meshes.
+ *
+ * polyhedronToMatlab(): write a polyhedron back to Matlab as TRI, X
+ * arrays. The polyhedron must have items with id
+ * (CGAL::Polyhedron_items_with_id_3), that are used to number the
+ * vertices instead of a map.
+ *
  * An example of how to use this class in a MEX Matlab function:
  *
  * #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
  * #include <CGAL/Polyhedron_3.h>
+ * #include <CGAL/Polyhedron_items_with_id_3.h>
  * #include "PolyhedronBuilder.h"
  *
  * typedef CGAL::Exact_predicates_inexact_constructions_kernel  Kernel;
- * typedef CGAL::Polyhedron_3<Kernel>                           Polyhedron;
+ * typedef CGAL::Polyhedron_3<Kernel,
+ *                            CGAL::Polyhedron_items_with_id_3> Polyhedron;
  *
  * void mexFunction(int nlhs, mxArray *plhs[], 
  *		    int nrhs, const mxArray *prhs[]) {
@@ -33,14 +48,19 @@
  *   PolyhedronBuilder<Polyhedron> builder(matlabImport, inTRI, inX);
  *   mesh.delegate(builder);
  *
+ *   [...]
+ *
+ *   // write the mesh to the outputs
+ *   polyhedronToMatlab(mesh, matlabExport, outTRI, outX);
+ *
  * }
  *
  */
 
 /*
  * Author: Ramon Casero <rcasero@gmail.com>
- * Copyright © 2013 University of Oxford
- * Version: 0.1.1
+ * Copyright © 2013-2015 University of Oxford
+ * Version: 0.2.0
  * $Rev$
  * $Date$
  *
@@ -73,13 +93,39 @@
 #define POLYHEDRONBUILDER_H
 
 /* Gerardus headers */
+#include "GerardusCommon.h"
 #include "MatlabImportFilter.h"
+#include "MatlabExportFilter.h"
 
 /* C++ headers */
+#include <algorithm>
 #include <exception>
+#include <vector>
 
 /* CGAL headers */
-#include <CGAL/Polyhedron_incremental_builder_3.h>
+#include <CGAL/Modifier_base.h>
+#include <CGAL/HalfedgeDS_decorator.h>
+
+/*
+ * readTriangleIndices(): copy the TRI matrix to 0-based indices,
+ * tri[3*i + k], checking that they are valid vertex indices
+ */
+template <class TIndex>
+void readTriangleIndices(const TIndex *p, mwSize ntri, mwSize nx,
+			 std::vector<mwIndex> &tri, const std::string &name) {
+
+  tri.resize(3 * ntri);
+  for (mwIndex i = 0; i < ntri; ++i) {
+    for (mwIndex k = 0; k < 3; ++k) {
+      double v = (double)p[i + k * ntri];
+      if (!(v >= 1.0 && v <= (double)nx) || v != (double)(mwIndex)v) {
+	mexErrMsgTxt(("Input " + name + ": Triangle indices must be integers between 1 and the number of vertices").c_str());
+      }
+      tri[3 * i + k] = (mwIndex)v - 1;
+    }
+  }
+
+}
 
 template <class Polyhedron>
 class PolyhedronBuilder : public CGAL::Modifier_base<typename Polyhedron::HalfedgeDS> {
@@ -96,12 +142,14 @@ public:
     : matlabImport(_matlabImport), inTri(_inTri), inX(_inX) { }
   void operator()(HalfedgeDS& hds) {
 
-    typedef typename HalfedgeDS::Vertex   Vertex;
+    typedef typename HalfedgeDS::Vertex          Vertex;
+    typedef typename HalfedgeDS::Halfedge        Halfedge;
+    typedef typename HalfedgeDS::Face            Face;
+    typedef typename HalfedgeDS::Vertex_handle   Vertex_handle;
+    typedef typename HalfedgeDS::Halfedge_handle Halfedge_handle;
+    typedef typename HalfedgeDS::Face_handle     Face_handle;
     typedef typename Vertex::Point Point;
 
-    // instantiate incremental builder
-    CGAL::Polyhedron_incremental_builder_3<HalfedgeDS> builder(hds, true);
-
     // get size of input matrix with the points
     mwSize nrowsTri = mxGetM(inTri->pm);
     mwSize ncolsTri = mxGetN(inTri->pm);
@@ -111,68 +159,305 @@ public:
       mexErrMsgTxt("TRI and X inputs must have 3 columns");
     }
 
-    // allocate space in the polyhedron
-    builder.begin_surface(nrowsX, nrowsTri);
+    // read vertex coordinates, X(:)
+    std::vector<double> x = matlabImport->ReadArrayAsVectorFromMatlab<double, std::vector<double> >
+      (inX, std::vector<double>());
+    for (mwIndex i = 0; i < x.size(); ++i) {
+      if (mxIsNaN(x[i])) {
+	mexErrMsgTxt(("Input " + inX->name + ": Vertex coordinates are NaN").c_str());
+      }
+    }
 
-    // default coordinates are NaN values, so that the user can spot
-    // whether there was any problem reading them
-    Point xDef(mxGetNaN(), mxGetNaN(), mxGetNaN());
+    // read triangles, with indices converted from Matlab's convention
+    // (1, 2, 3, ...) to C++ convention (0, 1, 2, ...)
+    std::vector<mwIndex> tri;
+    switch (mxGetClassID(inTri->pm)) {
+    case mxDOUBLE_CLASS:
+      readTriangleIndices((double *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxSINGLE_CLASS:
+      readTriangleIndices((float *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxINT8_CLASS:
+      readTriangleIndices((int8_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxUINT8_CLASS:
+      readTriangleIndices((uint8_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxINT16_CLASS:
+      readTriangleIndices((int16_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxUINT16_CLASS:
+      readTriangleIndices((uint16_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxINT32_CLASS:
+      readTriangleIndices((int32_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxUINT32_CLASS:
+      readTriangleIndices((uint32_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxINT64_CLASS:
+      readTriangleIndices((int64_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    case mxUINT64_CLASS:
+      readTriangleIndices((uint64_T *)mxGetData(inTri->pm), nrowsTri, nrowsX, tri, inTri->name);
+      break;
+    default:
+      mexErrMsgTxt(("Input " + inTri->name + " has invalid type.").c_str());
+    }
+    for (mwIndex i = 0; i < nrowsTri; ++i) {
+      if (tri[3 * i] == tri[3 * i + 1] || tri[3 * i + 1] == tri[3 * i + 2]
+	  || tri[3 * i + 2] == tri[3 * i]) {
+	mexErrMsgTxt(("Inputs " + inTri->name + " and " + inX->name 
+		      + " do not form a valid polyhedron: degenerate triangle").c_str());
+      }
+    }
 
-    // add mesh vertices
-    for (mwIndex i = 0; i < nrowsX; ++i) {
+    // exit if user pressed Ctrl+C
+    ctrlcCheckPoint(__FILE__, __LINE__);
 
-      // exit if user pressed Ctrl+C
-      ctrlcCheckPoint(__FILE__, __LINE__);
-      
-      // get coordinates of the vertex
-      Point x = matlabImport->ReadRowVectorFromMatlab<void, Point>(inX, i, xDef);
+    // halfedge h = 3*i + k of triangle i goes from vertex tri[h] to
+    // vertex tri[next(h)]. Sort the halfedges by the lower index of
+    // their edge's vertices (counting sort), and then by the higher
+    // index within each bucket, so that the two halfedges of each
+    // edge are consecutive
+    mwSize nhalf = 3 * nrowsTri;
+    std::vector<mwIndex> first(nrowsX + 1, 0);
+    for (mwIndex h = 0; h < nhalf; ++h) {
+      first[std::min(tri[h], tri[NextHalfedge(h)]) + 1]++;
+    }
+    for (mwIndex v = 0; v < nrowsX; ++v) {
+      first[v + 1] += first[v];
+    }
+    std::vector<mwIndex> sorted(nhalf);
+    {
+      std::vector<mwIndex> pos(first.begin(), first.end() - 1);
+      for (mwIndex h = 0; h < nhalf; ++h) {
+	sorted[pos[std::min(tri[h], tri[NextHalfedge(h)])]++] = h;
+      }
+    }
+    HigherVertexLess higherLess(tri);
+    for (mwIndex v = 0; v < nrowsX; ++v) {
+      if (first[v + 1] - first[v] > 1) {
+	std::sort(sorted.begin() + first[v], sorted.begin() + first[v + 1], higherLess);
+      }
+    }
 
-      if (mxIsNaN(x.x()) || mxIsNaN(x.y()) || mxIsNaN(x.z())) {
-	mexErrMsgTxt(("Input " + inX->name + ": Vertex coordinates are NaN").c_str());
+    // pair each halfedge with its opposite. Unpaired halfedges are on
+    // the border
+    const mwIndex NONE = nhalf;
+    std::vector<mwIndex> opposite(nhalf, NONE);
+    mwSize nedges = 0;
+    for (mwIndex j = 0; j < nhalf; ) {
+      mwIndex h = sorted[j];
+      mwIndex n = 1;
+      while (j + n < nhalf && higherLess.SameEdge(h, sorted[j + n])) {
+	++n;
+      }
+      if (n > 2) {
+	mexErrMsgTxt(("Inputs " + inTri->name + " and " + inX->name 
+		      + " do not form a valid polyhedron: edge shared by more than two triangles").c_str());
       }
-      
-      // add vertex to the mesh
-      builder.add_vertex(x);
+      if (n == 2) {
+	mwIndex g = sorted[j + 1];
+	if (tri[h] == tri[g]) {
+	  mexErrMsgTxt(("Inputs " + inTri->name + " and " + inX->name 
+			+ " do not form a valid polyhedron: inconsistent triangle orientation").c_str());
+	}
+	opposite[h] = g;
+	opposite[g] = h;
+      }
+      ++nedges;
+      j += n;
+    }
+
+    // exit if user pressed Ctrl+C
+    ctrlcCheckPoint(__FILE__, __LINE__);
+
+    // create vertices, edges and facets
+    CGAL::HalfedgeDS_decorator<HalfedgeDS> decorator(hds);
+    hds.reserve(nrowsX, 2 * nedges, nrowsTri);
+
+    std::vector<Vertex_handle> vertex(nrowsX);
+    for (mwIndex v = 0; v < nrowsX; ++v) {
+      vertex[v] = hds.vertices_push_back(Vertex(Point(x[v], x[v + nrowsX], x[v + 2 * nrowsX])));
     }
-    
-    // add mesh triangles
+
+    // halfedge handle of each triangle halfedge, and of the border
+    // halfedge opposite each unpaired triangle halfedge
+    std::vector<Halfedge_handle> halfedge(nhalf);
+    std::vector<Halfedge_handle> border(nhalf);
+    for (mwIndex h = 0; h < nhalf; ++h) {
+      if (opposite[h] == NONE) {
+	halfedge[h] = hds.edges_push_back(Halfedge(), Halfedge());
+	border[h] = halfedge[h]->opposite();
+      } else if (h < opposite[h]) {
+	halfedge[h] = hds.edges_push_back(Halfedge(), Halfedge());
+	halfedge[opposite[h]] = halfedge[h]->opposite();
+      }
+    }
+
+    // link the triangle halfedges
     for (mwIndex i = 0; i < nrowsTri; ++i) {
-      
-      // exit if user pressed Ctrl+C
-      ctrlcCheckPoint(__FILE__, __LINE__);
-      
-      // get indices of the 3 vertices of each triangle. These indices
-      // follow Matlab's convention v0 = 1, 2, ..., n
-      mwIndex v0 = matlabImport->ReadScalarFromMatlab<mwIndex>(inTri, i, 0, mxGetNaN());
-      mwIndex v1 = matlabImport->ReadScalarFromMatlab<mwIndex>(inTri, i, 1, mxGetNaN());
-      mwIndex v2 = matlabImport->ReadScalarFromMatlab<mwIndex>(inTri, i, 2, mxGetNaN());
-      if (mxIsNaN(v0) || mxIsNaN(v1) || mxIsNaN(v2)) {
-	mexErrMsgTxt(("Input " + inTri->name + ": Triangle indices are NaN").c_str());
+      Face_handle face = hds.faces_push_back(Face());
+      decorator.set_face_halfedge(face, halfedge[3 * i + 2]);
+      for (mwIndex k = 0; k < 3; ++k) {
+	mwIndex h = 3 * i + k;
+	mwIndex hn = NextHalfedge(h);
+	halfedge[h]->HBase::set_next(halfedge[hn]);
+	decorator.set_prev(halfedge[hn], halfedge[h]);
+	decorator.set_vertex(halfedge[h], vertex[tri[hn]]);
+	decorator.set_vertex_halfedge(vertex[tri[hn]], halfedge[h]);
+	decorator.set_face(halfedge[h], face);
       }
+    }
 
-      // add triangle. Note that we have to substract 1 from the index
-      // to change from Matlab index convention (1, 2, 3, ...) to C++
-      // index convention (0, 1, 2, ...)
-      builder.begin_facet();
-      builder.add_vertex_to_facet(v0-1);
-      builder.add_vertex_to_facet(v1-1);
-      builder.add_vertex_to_facet(v2-1);
-      builder.end_facet();
-      
-      // if the facet couldn't be added successfully, we exit with an
-      // error. Otherwise, when we try builder.end_surface(), Matlab
-      // will throw a segmentation error
-      if (builder.error()) {
+    // link the border halfedges. The border halfedge g opposite to
+    // triangle halfedge h, a->b, goes b->a. The next border halfedge
+    // leaves a, and it is found rotating around a through the
+    // triangles of the fan that contains h, until the fan's other
+    // border edge
+    for (mwIndex h = 0; h < nhalf; ++h) {
+      if (opposite[h] == NONE) {
+	mwIndex a = tri[h];
+	Halfedge_handle g = border[h];
+	decorator.set_vertex(g, vertex[a]);
+	decorator.set_face(g, Face_handle());
+	decorator.set_vertex_halfedge(vertex[a], g);
+	mwIndex e = h;
+	mwIndex p = PrevHalfedge(e);
+	while (opposite[p] != NONE) {
+	  e = opposite[p];
+	  p = PrevHalfedge(e);
+	}
+	g->HBase::set_next(border[p]);
+	decorator.set_prev(border[p], g);
+      }
+    }
+
+    // each vertex must have a single fan of triangles around it, so
+    // rotating around the vertex has to visit all its incoming
+    // halfedges
+    std::vector<mwSize> degree(nrowsX, 0);
+    for (mwIndex h = 0; h < nhalf; ++h) {
+      degree[tri[NextHalfedge(h)]]++;
+      if (opposite[h] == NONE) {
+	degree[tri[h]]++;
+      }
+    }
+    for (mwIndex v = 0; v < nrowsX; ++v) {
+      if (degree[v] == 0) {
+	continue;
+      }
+      Halfedge_handle start = vertex[v]->halfedge();
+      Halfedge_handle h = start;
+      mwSize n = 0;
+      do {
+	++n;
+	h = h->next()->opposite();
+      } while (h != start && n <= degree[v]);
+      if (n != degree[v]) {
 	mexErrMsgTxt(("Inputs " + inTri->name + " and " + inX->name 
-		      + " do not form a valid polyhedron").c_str());
+		      + " do not form a valid polyhedron: non-manifold vertex").c_str());
       }
- 
     }
-     
-    // finish up surface
-    builder.end_surface();
 
   }
+
+ private:
+
+  // Polyhedron_3 hides set_next() of the halfedges, but the halfedge
+  // base class is accessible to modifiers
+  typedef typename HalfedgeDS::Halfedge::Base HBase;
+
+  static mwIndex NextHalfedge(mwIndex h) {
+    return (h % 3 == 2) ? h - 2 : h + 1;
+  }
+
+  static mwIndex PrevHalfedge(mwIndex h) {
+    return (h % 3 == 0) ? h + 2 : h - 1;
+  }
+
+  // order of halfedges with the same lower vertex, by their higher
+  // vertex
+  class HigherVertexLess {
+  public:
+    HigherVertexLess(const std::vector<mwIndex> &_tri) : tri(_tri) {}
+    mwIndex Lower(mwIndex h) const {
+      return std::min(this->tri[h], this->tri[NextHalfedge(h)]);
+    }
+    mwIndex Higher(mwIndex h) const {
+      return std::max(this->tri[h], this->tri[NextHalfedge(h)]);
+    }
+    bool operator()(mwIndex h, mwIndex g) const {
+      return this->Higher(h) < this->Higher(g);
+    }
+    bool SameEdge(mwIndex h, mwIndex g) const {
+      return this->Lower(h) == this->Lower(g) && this->Higher(h) == this->Higher(g);
+    }
+  private:
+    const std::vector<mwIndex> &tri;
+  };
+
 };
 
+/*
+ * polyhedronToMatlab(): write the vertices and triangular facets of a
+ * polyhedron to Matlab outputs TRI and X. The vertex ids are
+ * overwritten with the vertex indices. If outX is not given, only TRI
+ * is written
+ */
+template <class Polyhedron>
+void polyhedronToMatlab(Polyhedron &mesh, MatlabExportFilter::Pointer matlabExport,
+			MatlabExportFilter::MatlabOutputPointer outTRI,
+			MatlabExportFilter::MatlabOutputPointer outX, bool writeX = true) {
+
+  typedef typename Polyhedron::Vertex_iterator Vertex_iterator;
+  typedef typename Polyhedron::Facet_iterator  Facet_iterator;
+  typedef typename Polyhedron::Halfedge_around_facet_circulator Halfedge_around_facet_circulator;
+
+  mwSize nx = mesh.size_of_vertices();
+  mwSize ntri = mesh.size_of_facets();
+
+  // number the vertices, and copy their coordinates
+  double *x = NULL;
+  if (writeX) {
+    x = matlabExport->AllocateMatrixInMatlab<double>(outX, nx, 3);
+  }
+  mwIndex i = 0;
+  for (Vertex_iterator vit = mesh.vertices_begin(); vit != mesh.vertices_end(); ++vit, ++i) {
+    vit->id() = i;
+    if (x != NULL) {
+      x[i] = CGAL::to_double(vit->point().x());
+      x[i + nx] = CGAL::to_double(vit->point().y());
+      x[i + 2 * nx] = CGAL::to_double(vit->point().z());
+    }
+  }
+
+  // triangles given as (i,j,k), where each index corresponds to a
+  // vertex in x. Note that Matlab indices go like 1, 2, 3..., while
+  // C++ indices go like 0, 1, 2...
+  double *tri = matlabExport->AllocateMatrixInMatlab<double>(outTRI, ntri, 3);
+  mwIndex row = 0;
+  for (Facet_iterator fit = mesh.facets_begin(); fit != mesh.facets_end(); ++fit, ++row) {
+
+    if (fit->facet_degree() != 3) {
+      mexErrMsgTxt("Facet does not have 3 edges");
+    }
+
+    Halfedge_around_facet_circulator heit = fit->facet_begin();
+    for (mwIndex k = 0; k < 3; ++k, ++heit) {
+      tri[row + k * ntri] = 1 + heit->vertex()->id();
+    }
+
+  }
+
+}
+
+template <class Polyhedron>
+void polyhedronToMatlab(Polyhedron &mesh, MatlabExportFilter::Pointer matlabExport,
+			MatlabExportFilter::MatlabOutputPointer outTRI) {
+  polyhedronToMatlab(mesh, matlabExport, outTRI, outTRI, false);
+}
+
 #endif /* POLYHEDRONBUILDER_H */
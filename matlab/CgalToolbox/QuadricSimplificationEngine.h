@@ -0,0 +1,587 @@
+/*
+ * QuadricSimplificationEngine.h
+ *
+ * Triangular mesh simplification by edge collapse with quadric error
+ * metrics (Garland and Heckbert), bounded by a maximum error, with
+ * batches of independent collapses processed in parallel
+ * (cgal_tri_simplify(..., 'quadric')).
+ *
+ * The mesh is kept as arrays of vertex coordinates and triangle
+ * indices. Each vertex has the quadric of the planes of the original
+ * triangles around it, and when an edge is collapsed, the quadrics of
+ * both vertices are added. The quadric error of a vertex is the sum
+ * of squared distances to those planes, so if it is <= tol^2, then
+ * the vertex is at most at distance tol from each of the planes of the
+ * original triangles merged into it.
+ *
+ * The simplification runs in passes. In each pass:
+ *
+ *   1. The edges are listed, and the cost and optimal position of
+ *      every interior edge are computed (in parallel).
+ *
+ *   2. The edges with error <= tol^2 are sorted by cost, and a set of
+ *      independent edges is selected greedily: an edge is taken only
+ *      if none of its vertices is in the 1-ring of a previously
+ *      selected edge. Thus, the triangles changed by each collapse are
+ *      not touched by any other collapse in the batch.
+ *
+ *   3. The selected collapses are checked (link condition, triangle
+ *      flips) and applied (in parallel).
+ *
+ * Passes are repeated until there are no more valid collapses below
+ * the error bound, or the number of edges reaches the target.
+ *
+ * Vertices on the mesh border are not moved, so that borders are
+ * preserved.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef QUADRICSIMPLIFICATIONENGINE_H
+#define QUADRICSIMPLIFICATIONENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <vector>
+
+/* Gerardus headers */
+#include "GerardusParallel.h"
+
+/*
+ * Quadric: symmetric 4x4 matrix Q of the plane quadric error
+ * v'Qv, with v = (x, y, z, 1). Only the upper triangle is stored.
+ */
+struct Quadric {
+
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+  Quadric() : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0) {}
+
+  // quadric of plane a*x + b*y + c*z + d = 0, with (a, b, c) unit
+  // normal
+  Quadric(double a, double b, double c, double d)
+    : a2(a*a), ab(a*b), ac(a*c), ad(a*d), b2(b*b), bc(b*c), bd(b*d),
+      c2(c*c), cd(c*d), d2(d*d) {}
+
+  Quadric &operator+=(const Quadric &q) {
+    a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad; b2 += q.b2;
+    bc += q.bc; bd += q.bd; c2 += q.c2; cd += q.cd; d2 += q.d2;
+    return *this;
+  }
+
+  double Error(const double *v) const {
+    double x = v[0], y = v[1], z = v[2];
+    return a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+      + b2*y*y + 2*bc*y*z + 2*bd*y
+      + c2*z*z + 2*cd*z + d2;
+  }
+
+  // position that minimises the error. Returns false if the system is
+  // ill-conditioned
+  bool Minimiser(double *v) const {
+    double det = a2*(b2*c2 - bc*bc) - ab*(ab*c2 - bc*ac) + ac*(ab*bc - b2*ac);
+    double scale = a2*a2 + b2*b2 + c2*c2;
+    if (std::fabs(det) <= 1e-12 * scale * std::sqrt(scale)) {
+      return false;
+    }
+    // Cramer's rule for A*v = -(ad, bd, cd)
+    double r0 = -ad, r1 = -bd, r2 = -cd;
+    v[0] = (r0*(b2*c2 - bc*bc) - ab*(r1*c2 - bc*r2) + ac*(r1*bc - b2*r2)) / det;
+    v[1] = (a2*(r1*c2 - r2*bc) - r0*(ab*c2 - bc*ac) + ac*(ab*r2 - r1*ac)) / det;
+    v[2] = (a2*(b2*r2 - bc*r1) - ab*(ab*r2 - r1*ac) + r0*(ab*bc - b2*ac)) / det;
+    return true;
+  }
+
+};
+
+/*
+ * QuadricSimplifier: the simplification engine.
+ *
+ * x:   vertex coordinates, x[3*i + d]
+ * tri: triangles, 0-based vertex indices, tri[3*j + k]
+ */
+class QuadricSimplifier {
+
+ public:
+
+  QuadricSimplifier(const std::vector<double> &_x, const std::vector<size_t> &_tri,
+		    unsigned int _numThreads = 0)
+    : x(_x), tri(_tri), numThreads(getNumberOfThreads(_numThreads)) {
+    this->nx = this->x.size() / 3;
+    this->ntri = this->tri.size() / 3;
+    this->faceAlive.assign(this->ntri, 1);
+    this->InitQuadrics();
+  }
+
+  /*
+   * Run(): simplify the mesh.
+   *
+   * tol:         maximum distance of a vertex to the planes of the
+   *              original triangles merged into it. Collapses with a
+   *              larger quadric error are not performed.
+   * ratio:       the simplification stops when the number of
+   *              undirected edges is <= ratio * number of original
+   *              undirected edges. With ratio = 0, only the error
+   *              bound stops the simplification.
+   */
+  void Run(double tol, double ratio) {
+
+    double maxError = tol * tol;
+    size_t targetEdges = 0;
+    for (bool firstPass = true; ; firstPass = false) {
+
+      // vertex-triangle incidence and edges of the current mesh
+      this->BuildIncidence();
+      size_t nedges = this->BuildEdges();
+      if (firstPass) {
+	targetEdges = (size_t)(ratio * nedges);
+      }
+      if (nedges <= targetEdges || this->candidates.empty()) {
+	break;
+      }
+
+      // cost of the candidate collapses
+      std::vector<Collapse> collapses(this->candidates.size());
+      CostFunctor cost(*this, collapses);
+      parallelFor(0, collapses.size(), cost, this->numThreads);
+
+      // keep the collapses below the error bound, cheapest first.
+      // Collapses with infinite cost (border vertices) are never
+      // performed, even if tol is infinite
+      std::vector<Collapse> below;
+      below.reserve(collapses.size());
+      for (size_t i = 0; i < collapses.size(); ++i) {
+	if (collapses[i].cost <= maxError
+	    && collapses[i].cost < std::numeric_limits<double>::infinity()) {
+	  below.push_back(collapses[i]);
+	}
+      }
+      if (below.empty()) {
+	break;
+      }
+      std::sort(below.begin(), below.end());
+
+      // greedy independent set. Each interior collapse removes 3
+      // edges, so don't select more than needed to reach the target
+      size_t maxCollapses = (nedges - targetEdges + 2) / 3;
+      std::vector<Collapse> batch;
+      this->SelectIndependent(below, maxCollapses, batch);
+
+      // check and apply the collapses in parallel
+      std::vector<char> done(batch.size(), 0);
+      ApplyFunctor apply(*this, batch, done);
+      parallelFor(0, batch.size(), apply, this->numThreads);
+      size_t ndone = 0;
+      for (size_t i = 0; i < done.size(); ++i) {
+	ndone += done[i];
+      }
+      if (ndone == 0) {
+	break;
+      }
+
+    }
+
+  }
+
+  /*
+   * GetMesh(): output mesh, without removed vertices and triangles
+   */
+  void GetMesh(std::vector<double> &xOut, std::vector<size_t> &triOut) const {
+
+    std::vector<size_t> newIndex(this->nx, (size_t)-1);
+    size_t nxOut = 0;
+    for (size_t f = 0; f < this->ntri; ++f) {
+      if (!this->faceAlive[f]) {
+	continue;
+      }
+      for (unsigned int k = 0; k < 3; ++k) {
+	size_t v = this->tri[3 * f + k];
+	if (newIndex[v] == (size_t)-1) {
+	  newIndex[v] = nxOut++;
+	}
+      }
+    }
+
+    xOut.resize(3 * nxOut);
+    for (size_t v = 0; v < this->nx; ++v) {
+      if (newIndex[v] != (size_t)-1) {
+	std::copy(&this->x[3 * v], &this->x[3 * v] + 3, &xOut[3 * newIndex[v]]);
+      }
+    }
+    triOut.clear();
+    for (size_t f = 0; f < this->ntri; ++f) {
+      if (this->faceAlive[f]) {
+	for (unsigned int k = 0; k < 3; ++k) {
+	  triOut.push_back(newIndex[this->tri[3 * f + k]]);
+	}
+      }
+    }
+
+  }
+
+ private:
+
+  // candidate edge collapse a <- b, with the position and cost of the
+  // merged vertex
+  struct Collapse {
+    size_t a, b;
+    double pos[3];
+    double cost;
+    bool operator<(const Collapse &c) const {
+      return this->cost < c.cost;
+    }
+  };
+
+  // normal of triangle (p, q, r), not normalised
+  static void Normal(const double *p, const double *q, const double *r, double *n) {
+    double u[3] = {q[0] - p[0], q[1] - p[1], q[2] - p[2]};
+    double w[3] = {r[0] - p[0], r[1] - p[1], r[2] - p[2]};
+    n[0] = u[1] * w[2] - u[2] * w[1];
+    n[1] = u[2] * w[0] - u[0] * w[2];
+    n[2] = u[0] * w[1] - u[1] * w[0];
+  }
+
+  // quadric of each vertex from the planes of its triangles
+  void InitQuadrics() {
+    this->quadric.assign(this->nx, Quadric());
+    for (size_t f = 0; f < this->ntri; ++f) {
+      const size_t *t = &this->tri[3 * f];
+      double n[3];
+      Normal(&this->x[3 * t[0]], &this->x[3 * t[1]], &this->x[3 * t[2]], n);
+      double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      if (len == 0.0) {
+	continue;
+      }
+      n[0] /= len; n[1] /= len; n[2] /= len;
+      const double *p = &this->x[3 * t[0]];
+      Quadric q(n[0], n[1], n[2], -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]));
+      for (unsigned int k = 0; k < 3; ++k) {
+	this->quadric[t[k]] += q;
+      }
+    }
+  }
+
+  // triangles around each vertex, in compressed format: the triangles
+  // of vertex v are faces[first[v]], ..., faces[first[v+1]-1]
+  void BuildIncidence() {
+    this->first.assign(this->nx + 1, 0);
+    for (size_t f = 0; f < this->ntri; ++f) {
+      if (this->faceAlive[f]) {
+	for (unsigned int k = 0; k < 3; ++k) {
+	  this->first[this->tri[3 * f + k] + 1]++;
+	}
+      }
+    }
+    for (size_t v = 0; v < this->nx; ++v) {
+      this->first[v + 1] += this->first[v];
+    }
+    this->faces.resize(this->first[this->nx]);
+    std::vector<size_t> pos(this->first.begin(), this->first.end() - 1);
+    for (size_t f = 0; f < this->ntri; ++f) {
+      if (this->faceAlive[f]) {
+	for (unsigned int k = 0; k < 3; ++k) {
+	  this->faces[pos[this->tri[3 * f + k]]++] = f;
+	}
+      }
+    }
+  }
+
+  // count undirected edges, find border vertices, and list the
+  // interior edges as candidate collapses. Each edge (v, w) is counted
+  // and listed by its lower vertex v, so that vertices can be
+  // processed in parallel
+  size_t BuildEdges() {
+
+    this->border.assign(this->nx, 0);
+    this->nUpper.assign(this->nx, 0);
+    this->interiorFirst.assign(this->nx + 1, 0);
+    EdgeFunctor count(*this, false);
+    parallelFor(0, this->nx, count, this->numThreads);
+
+    size_t nedges = 0;
+    for (size_t v = 0; v < this->nx; ++v) {
+      nedges += this->nUpper[v];
+      this->interiorFirst[v + 1] += this->interiorFirst[v];
+    }
+
+    this->candidates.resize(this->interiorFirst[this->nx]);
+    EdgeFunctor list(*this, true);
+    parallelFor(0, this->nx, list, this->numThreads);
+
+    return nedges;
+  }
+
+  // edges of vertex v. An edge is interior if it belongs to two
+  // triangles, i.e. the neighbour appears twice in the 1-ring of v.
+  // Otherwise, v is a border (or non-manifold) vertex
+  void VertexEdges(size_t v, std::vector<size_t> &ring, bool listEdges) {
+    this->Ring(v, ring);
+    std::sort(ring.begin(), ring.end());
+    size_t nInterior = 0;
+    for (size_t i = 0; i < ring.size(); ) {
+      size_t w = ring[i];
+      size_t n = 1;
+      while (i + n < ring.size() && ring[i + n] == w) {
+	++n;
+      }
+      if (n != 2) {
+	this->border[v] = 1;
+      }
+      if (w > v) {
+	if (listEdges) {
+	  if (n == 2) {
+	    this->candidates[this->interiorFirst[v] + nInterior] = std::make_pair(v, w);
+	  }
+	} else {
+	  this->nUpper[v]++;
+	}
+	if (n == 2) {
+	  ++nInterior;
+	}
+      }
+      i += n;
+    }
+    if (!listEdges) {
+      this->interiorFirst[v + 1] = nInterior;
+    }
+  }
+
+  // 1-ring of vertex v (with repetitions)
+  void Ring(size_t v, std::vector<size_t> &ring) const {
+    ring.clear();
+    for (size_t i = this->first[v]; i < this->first[v + 1]; ++i) {
+      const size_t *t = &this->tri[3 * this->faces[i]];
+      for (unsigned int k = 0; k < 3; ++k) {
+	if (t[k] != v) {
+	  ring.push_back(t[k]);
+	}
+      }
+    }
+  }
+
+  // greedy selection of collapses whose 1-rings don't overlap
+  void SelectIndependent(const std::vector<Collapse> &sorted, size_t maxCollapses,
+			 std::vector<Collapse> &batch) {
+    std::vector<char> taken(this->nx, 0);
+    std::vector<size_t> ring;
+    for (size_t i = 0; i < sorted.size() && batch.size() < maxCollapses; ++i) {
+      const Collapse &c = sorted[i];
+      if (taken[c.a] || taken[c.b]) {
+	continue;
+      }
+      batch.push_back(c);
+      taken[c.a] = taken[c.b] = 1;
+      this->Ring(c.a, ring);
+      for (size_t j = 0; j < ring.size(); ++j) {
+	taken[ring[j]] = 1;
+      }
+      this->Ring(c.b, ring);
+      for (size_t j = 0; j < ring.size(); ++j) {
+	taken[ring[j]] = 1;
+      }
+    }
+  }
+
+  // cost and position of collapse of edge (a, b)
+  void Evaluate(size_t a, size_t b, Collapse &c) const {
+    c.a = a;
+    c.b = b;
+    if (this->border[a] || this->border[b]) {
+      c.cost = std::numeric_limits<double>::infinity();
+      c.pos[0] = c.pos[1] = c.pos[2] = 0.0;
+      return;
+    }
+    Quadric q = this->quadric[a];
+    q += this->quadric[b];
+    if (q.Minimiser(c.pos)) {
+      c.cost = q.Error(c.pos);
+      return;
+    }
+    // ill-conditioned quadric: best of the end points and midpoint
+    const double *pa = &this->x[3 * a];
+    const double *pb = &this->x[3 * b];
+    double mid[3] = {0.5 * (pa[0] + pb[0]), 0.5 * (pa[1] + pb[1]), 0.5 * (pa[2] + pb[2])};
+    const double *options[3] = {pa, pb, mid};
+    c.cost = std::numeric_limits<double>::infinity();
+    for (unsigned int i = 0; i < 3; ++i) {
+      double e = q.Error(options[i]);
+      if (e < c.cost) {
+	c.cost = e;
+	std::copy(options[i], options[i] + 3, c.pos);
+      }
+    }
+  }
+
+  // check the collapse a <- b and apply it. The triangles around a
+  // and b are not touched by any other collapse of the batch
+  bool CheckAndApply(const Collapse &c) {
+
+    size_t a = c.a;
+    size_t b = c.b;
+
+    // link condition: the only common neighbours of a and b are the
+    // opposite vertices of the two triangles of the edge
+    std::vector<size_t> ringA, ringB, common;
+    this->Ring(a, ringA);
+    this->Ring(b, ringB);
+    std::sort(ringA.begin(), ringA.end());
+    ringA.erase(std::unique(ringA.begin(), ringA.end()), ringA.end());
+    std::sort(ringB.begin(), ringB.end());
+    ringB.erase(std::unique(ringB.begin(), ringB.end()), ringB.end());
+    std::set_intersection(ringA.begin(), ringA.end(), ringB.begin(), ringB.end(),
+			  std::back_inserter(common));
+    if (common.size() != 2) {
+      return false;
+    }
+
+    // the merged vertex must keep at least 3 neighbours
+    if (ringA.size() + ringB.size() - 4 < 3) {
+      return false;
+    }
+
+    // the triangles that are kept must not flip
+    for (unsigned int side = 0; side < 2; ++side) {
+      size_t v = (side == 0) ? a : b;
+      size_t other = (side == 0) ? b : a;
+      for (size_t i = this->first[v]; i < this->first[v + 1]; ++i) {
+	const size_t *t = &this->tri[3 * this->faces[i]];
+	if (t[0] == other || t[1] == other || t[2] == other) {
+	  continue;
+	}
+	const double *p[3];
+	const double *q[3];
+	for (unsigned int k = 0; k < 3; ++k) {
+	  p[k] = &this->x[3 * t[k]];
+	  q[k] = (t[k] == v) ? c.pos : p[k];
+	}
+	double n0[3], n1[3];
+	Normal(p[0], p[1], p[2], n0);
+	Normal(q[0], q[1], q[2], n1);
+	if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0) {
+	  return false;
+	}
+      }
+    }
+
+    // remove the triangles of the edge, and move the rest of b's
+    // triangles to a
+    for (size_t i = this->first[b]; i < this->first[b + 1]; ++i) {
+      size_t f = this->faces[i];
+      size_t *t = &this->tri[3 * f];
+      if (t[0] == a || t[1] == a || t[2] == a) {
+	this->faceAlive[f] = 0;
+      } else {
+	for (unsigned int k = 0; k < 3; ++k) {
+	  if (t[k] == b) {
+	    t[k] = a;
+	  }
+	}
+      }
+    }
+    std::copy(c.pos, c.pos + 3, &this->x[3 * a]);
+    this->quadric[a] += this->quadric[b];
+
+    return true;
+  }
+
+  // functor for parallelFor() to count or list the edges of vertices
+  class EdgeFunctor {
+  public:
+    EdgeFunctor(QuadricSimplifier &_s, bool _listEdges)
+      : s(_s), listEdges(_listEdges) {}
+    void operator()(size_t begin, size_t end, unsigned int) {
+      std::vector<size_t> ring;
+      for (size_t v = begin; v < end; ++v) {
+	this->s.VertexEdges(v, ring, this->listEdges);
+      }
+    }
+  private:
+    QuadricSimplifier &s;
+    bool listEdges;
+  };
+
+  // functor for parallelFor() to evaluate the candidates
+  class CostFunctor {
+  public:
+    CostFunctor(const QuadricSimplifier &_s, std::vector<Collapse> &_collapses)
+      : s(_s), collapses(_collapses) {}
+    void operator()(size_t begin, size_t end, unsigned int) {
+      for (size_t i = begin; i < end; ++i) {
+	this->s.Evaluate(this->s.candidates[i].first, this->s.candidates[i].second,
+			 this->collapses[i]);
+      }
+    }
+  private:
+    const QuadricSimplifier &s;
+    std::vector<Collapse> &collapses;
+  };
+
+  // functor for parallelFor() to apply a batch of collapses
+  class ApplyFunctor {
+  public:
+    ApplyFunctor(QuadricSimplifier &_s, const std::vector<Collapse> &_batch,
+		 std::vector<char> &_done)
+      : s(_s), batch(_batch), done(_done) {}
+    void operator()(size_t begin, size_t end, unsigned int) {
+      for (size_t i = begin; i < end; ++i) {
+	this->done[i] = this->s.CheckAndApply(this->batch[i]) ? 1 : 0;
+      }
+    }
+  private:
+    QuadricSimplifier &s;
+    const std::vector<Collapse> &batch;
+    std::vector<char> &done;
+  };
+
+  std::vector<double> x;
+  std::vector<size_t> tri;
+  size_t nx;
+  size_t ntri;
+  unsigned int numThreads;
+  std::vector<Quadric> quadric;
+  std::vector<char> faceAlive;
+  std::vector<char> border;
+  std::vector<size_t> nUpper;
+  std::vector<size_t> interiorFirst;
+  std::vector<size_t> first;
+  std::vector<size_t> faces;
+  std::vector<std::pair<size_t, size_t> > candidates;
+
+};
+
+#endif /* QUADRICSIMPLIFICATIONENGINE_H */
@@ -0,0 +1,427 @@
+/*
+ * SurfaceNetsEngine.h
+ *
+ * Fast surface meshing of an isosurface of an image with dual surface
+ * nets (cgal_meshseg(..., 'nets')).
+ *
+ * Each cube of 2x2x2 voxel centres that the isosurface goes through
+ * gets one vertex, at the mean of the points where the isosurface
+ * crosses the edges of the cube (linear interpolation). Each voxel
+ * edge crossed by the isosurface is shared by 4 cubes, and produces a
+ * quad (two triangles) connecting their vertices. The image is padded
+ * with one layer of outside voxels, so the surface is always closed,
+ * even if the segmentation touches the image boundary. Triangles are
+ * oriented with their normals pointing outwards.
+ *
+ * The image is split into slabs of cube layers that are meshed in
+ * parallel. Each slab keeps its vertices sorted by cube index, so
+ * that vertices are shared between triangles without a global
+ * map. The quads on the first voxel plane of a slab also connect to
+ * vertices of the last cube layer of the previous slab. Those are
+ * looked up in the previous slab's index once all slabs are done,
+ * and then the triangles of all slabs are written in parallel with
+ * global vertex indices.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef SURFACENETSENGINE_H
+#define SURFACENETSENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+/* Gerardus headers */
+#include "GerardusParallel.h"
+
+/*
+ * GrayLevelSampler: voxel values of a Matlab image, in (row, col,
+ * slice) indices.
+ */
+template <class TVoxel>
+class GrayLevelSampler {
+
+ public:
+
+  GrayLevelSampler(const TVoxel *_data, const size_t *_size)
+    : data(_data), nrows(_size[0]), nrowscols(_size[0] * _size[1]) {}
+
+  double operator()(size_t r, size_t c, size_t s) const {
+    return (double)this->data[r + this->nrows * c + this->nrowscols * s];
+  }
+
+ private:
+
+  const TVoxel *data;
+  size_t nrows;
+  size_t nrowscols;
+
+};
+
+/*
+ * LabelSampler: indicator function of one label of a Matlab
+ * segmentation (1 for voxels == label, 0 otherwise).
+ */
+template <class TVoxel>
+class LabelSampler {
+
+ public:
+
+  LabelSampler(const TVoxel *_data, const size_t *_size, TVoxel _label)
+    : data(_data), nrows(_size[0]), nrowscols(_size[0] * _size[1]), label(_label) {}
+
+  double operator()(size_t r, size_t c, size_t s) const {
+    return (this->data[r + this->nrows * c + this->nrowscols * s] == this->label) ? 1.0 : 0.0;
+  }
+
+ private:
+
+  const TVoxel *data;
+  size_t nrows;
+  size_t nrowscols;
+  TVoxel label;
+
+};
+
+/*
+ * SurfaceNetsSlab: vertices and triangles of one slab.
+ *
+ * Before the vertices are numbered globally, the triangles refer to
+ * the vertices by the index of their cube.
+ */
+struct SurfaceNetsSlab {
+
+  std::vector<size_t> cube;   // cube index of each vertex, sorted
+  std::vector<double> x;      // vertex coordinates, x[3*i + d]
+  std::vector<size_t> tri;    // cube index of triangle vertices, tri[3*j + k]
+  size_t offset;              // global index of the first vertex
+
+};
+
+/*
+ * SurfaceNets: functor that meshes slabs of cube layers, for
+ * parallelForDynamic().
+ *
+ * The mesh is computed in a region [lo, hi] (inclusive) of voxel
+ * indices in (row, col, slice) format. Samples outside the region
+ * are outside the surface. Voxels with value >= isoval are inside.
+ *
+ * Local sample coordinates go from -1 to n (padding), and cube
+ * (i, j, k) has its first corner at sample (i, j, k), i = -1, ..., n-1.
+ * Vertex coordinates are returned in (row, col, slice) voxel indices
+ * of the image.
+ */
+template <class TSampler>
+class SurfaceNets {
+
+ public:
+
+  SurfaceNets(const TSampler &_sampler, const size_t *_lo, const size_t *_hi,
+	      double _isoval, size_t _slabSize, std::vector<SurfaceNetsSlab> &_slabs)
+    : sampler(_sampler), isoval(_isoval), slabSize(_slabSize), slabs(_slabs) {
+    for (unsigned int d = 0; d < 3; ++d) {
+      this->lo[d] = _lo[d];
+      this->n[d] = _hi[d] - _lo[d] + 1;
+    }
+  }
+
+  // number of cube layers, i.e. slices of the padded region minus 1
+  size_t GetNumberOfLayers() const {
+    return this->n[2] + 1;
+  }
+
+  // phase 1: vertices and triangles of slabs [begin, end)
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t b = begin; b < end; ++b) {
+      this->MeshSlab(b);
+    }
+  }
+
+ private:
+
+  // sample value at local coordinates. Padding samples are -infinity
+  double Sample(long i, long j, long k) const {
+    if (i < 0 || j < 0 || k < 0
+	|| i >= (long)this->n[0] || j >= (long)this->n[1] || k >= (long)this->n[2]) {
+      return -std::numeric_limits<double>::infinity();
+    }
+    return this->sampler(this->lo[0] + i, this->lo[1] + j, this->lo[2] + k);
+  }
+
+  // linear index of cube (i, j, k)
+  size_t CubeIndex(long i, long j, long k) const {
+    return (size_t)(i + 1) + (this->n[0] + 1) * ((size_t)(j + 1) + (this->n[1] + 1) * (size_t)(k + 1));
+  }
+
+  // compute the vertex of cube (i, j, k), if the isosurface goes
+  // through it
+  void CubeVertex(long i, long j, long k, std::vector<size_t> &cube,
+		  std::vector<double> &x) const {
+
+    double v[8];
+    unsigned int mask = 0;
+    for (unsigned int corner = 0; corner < 8; ++corner) {
+      v[corner] = this->Sample(i + (corner & 1), j + ((corner >> 1) & 1), k + ((corner >> 2) & 1));
+      if (v[corner] >= this->isoval) {
+	mask |= 1u << corner;
+      }
+    }
+    if (mask == 0 || mask == 255) {
+      return;
+    }
+
+    // mean of the crossings of the edges of the cube
+    double p[3] = {0.0, 0.0, 0.0};
+    unsigned int ncross = 0;
+    for (unsigned int d = 0; d < 3; ++d) {
+      for (unsigned int corner = 0; corner < 8; ++corner) {
+	if (corner & (1u << d)) {
+	  continue;
+	}
+	unsigned int other = corner | (1u << d);
+	if (((mask >> corner) & 1) == ((mask >> other) & 1)) {
+	  continue;
+	}
+	// one of the values can be -infinity (padding), then the
+	// crossing is at the voxel inside
+	double t;
+	if (v[corner] == -std::numeric_limits<double>::infinity()) {
+	  t = 1.0;
+	} else if (v[other] == -std::numeric_limits<double>::infinity()) {
+	  t = 0.0;
+	} else {
+	  t = (this->isoval - v[corner]) / (v[other] - v[corner]);
+	}
+	for (unsigned int e = 0; e < 3; ++e) {
+	  double a = (corner >> e) & 1;
+	  p[e] += (e == d) ? a + t : a;
+	}
+	++ncross;
+      }
+    }
+
+    cube.push_back(this->CubeIndex(i, j, k));
+    x.push_back((double)this->lo[0] + i + p[0] / ncross);
+    x.push_back((double)this->lo[1] + j + p[1] / ncross);
+    x.push_back((double)this->lo[2] + k + p[2] / ncross);
+
+  }
+
+  // add the quad of the edge from sample p along axis d, if the
+  // isosurface crosses it
+  void EdgeQuad(long i, long j, long k, unsigned int d, std::vector<size_t> &tri) const {
+
+    long p[3] = {i, j, k};
+    long q[3] = {i, j, k};
+    q[d]++;
+    bool inP = this->Sample(p[0], p[1], p[2]) >= this->isoval;
+    bool inQ = this->Sample(q[0], q[1], q[2]) >= this->isoval;
+    if (inP == inQ) {
+      return;
+    }
+
+    // the 4 cubes around the edge, counter-clockwise seen from the
+    // end of the edge in the (d1, d2, d) right-handed frame
+    unsigned int d1 = (d + 1) % 3;
+    unsigned int d2 = (d + 2) % 3;
+    const long o1[4] = {0, -1, -1, 0};
+    const long o2[4] = {0, 0, -1, -1};
+    size_t c[4];
+    for (unsigned int m = 0; m < 4; ++m) {
+      long a[3] = {i, j, k};
+      a[d1] += o1[m];
+      a[d2] += o2[m];
+      c[m] = this->CubeIndex(a[0], a[1], a[2]);
+    }
+
+    // with the inside at p, the quad's normal points along +d in the
+    // (row, col, slice) frame. But the world frame is (x/col, y/row,
+    // z/slice), that swaps the handedness, so the order is reversed
+    if (inP) {
+      std::swap(c[1], c[3]);
+    }
+    tri.push_back(c[0]); tri.push_back(c[1]); tri.push_back(c[2]);
+    tri.push_back(c[0]); tri.push_back(c[2]); tri.push_back(c[3]);
+
+  }
+
+  void MeshSlab(size_t b) {
+
+    SurfaceNetsSlab &slab = this->slabs[b];
+    long k0 = (long)(b * this->slabSize) - 1;
+    long k1 = std::min((long)((b + 1) * this->slabSize), (long)this->GetNumberOfLayers()) - 1;
+
+    // vertices of the cube layers of this slab
+    for (long k = k0; k < k1; ++k) {
+      for (long j = -1; j < (long)this->n[1]; ++j) {
+	for (long i = -1; i < (long)this->n[0]; ++i) {
+	  this->CubeVertex(i, j, k, slab.cube, slab.x);
+	}
+      }
+    }
+
+    // quads of the edges along the slices in the cube layers of this
+    // slab, and of the edges along the rows and columns on the first
+    // voxel plane of each cube layer. The latter also use the previous
+    // cube layer
+    for (long k = k0; k < k1; ++k) {
+      for (long j = 0; j < (long)this->n[1]; ++j) {
+	for (long i = 0; i < (long)this->n[0]; ++i) {
+	  this->EdgeQuad(i, j, k, 2, slab.tri);
+	}
+      }
+      if (k < 0) {
+	continue;
+      }
+      for (long j = 0; j < (long)this->n[1]; ++j) {
+	for (long i = -1; i < (long)this->n[0]; ++i) {
+	  this->EdgeQuad(i, j, k, 0, slab.tri);
+	}
+      }
+      for (long j = -1; j < (long)this->n[1]; ++j) {
+	for (long i = 0; i < (long)this->n[0]; ++i) {
+	  this->EdgeQuad(i, j, k, 1, slab.tri);
+	}
+      }
+    }
+
+  }
+
+  const TSampler &sampler;
+  size_t lo[3];
+  size_t n[3];
+  double isoval;
+  size_t slabSize;
+  std::vector<SurfaceNetsSlab> &slabs;
+
+};
+
+/*
+ * SurfaceNetsResolve: functor that writes the vertices and triangles
+ * of each slab with global vertex indices, for parallelFor().
+ */
+class SurfaceNetsResolve {
+
+ public:
+
+  SurfaceNetsResolve(const std::vector<SurfaceNetsSlab> &_slabs,
+		     const std::vector<size_t> &_triOffset,
+		     std::vector<double> &_x, std::vector<size_t> &_tri)
+    : slabs(_slabs), triOffset(_triOffset), x(_x), tri(_tri) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t b = begin; b < end; ++b) {
+      const SurfaceNetsSlab &slab = this->slabs[b];
+      std::copy(slab.x.begin(), slab.x.end(), this->x.begin() + 3 * slab.offset);
+      for (size_t i = 0; i < slab.tri.size(); ++i) {
+	this->tri[this->triOffset[b] + i] = this->Lookup(b, slab.tri[i]);
+      }
+    }
+  }
+
+ private:
+
+  // global index of the vertex of a cube, that is in slab b or in the
+  // last layer of slab b-1
+  size_t Lookup(size_t b, size_t cube) const {
+    const SurfaceNetsSlab &slab = this->slabs[b];
+    std::vector<size_t>::const_iterator it
+      = std::lower_bound(slab.cube.begin(), slab.cube.end(), cube);
+    if (it != slab.cube.end() && *it == cube) {
+      return slab.offset + (it - slab.cube.begin());
+    }
+    if (b > 0) {
+      const SurfaceNetsSlab &prev = this->slabs[b - 1];
+      it = std::lower_bound(prev.cube.begin(), prev.cube.end(), cube);
+      if (it != prev.cube.end() && *it == cube) {
+	return prev.offset + (it - prev.cube.begin());
+      }
+    }
+    throw std::runtime_error("Surface nets: vertex of a boundary quad not found");
+  }
+
+  const std::vector<SurfaceNetsSlab> &slabs;
+  const std::vector<size_t> &triOffset;
+  std::vector<double> &x;
+  std::vector<size_t> &tri;
+
+};
+
+/*
+ * surfaceNets(): mesh the isosurface of the sampler in the region
+ * [lo, hi] of voxel indices.
+ *
+ * x:   output vertices, x[3*i + d], in (row, col, slice) voxel indices
+ * tri: output triangles, with 0-based indices, tri[3*j + k]
+ */
+template <class TSampler>
+void surfaceNets(const TSampler &sampler, const size_t *lo, const size_t *hi,
+		 double isoval, std::vector<double> &x, std::vector<size_t> &tri,
+		 unsigned int numThreads = 0) {
+
+  // several slabs per thread, so that the dynamic scheduler can
+  // balance slabs with very different amounts of surface
+  numThreads = getNumberOfThreads(numThreads);
+  size_t nlayers = hi[2] - lo[2] + 2;
+  size_t slabSize = std::max((size_t)2, nlayers / (4 * (size_t)numThreads));
+  size_t nslabs = (nlayers + slabSize - 1) / slabSize;
+
+  // phase 1: mesh each slab
+  std::vector<SurfaceNetsSlab> slabs(nslabs);
+  SurfaceNets<TSampler> nets(sampler, lo, hi, isoval, slabSize, slabs);
+  parallelForDynamic(0, nslabs, 1, nets, numThreads);
+
+  // phase 2: global numbering of vertices and triangles
+  size_t nx = 0;
+  size_t ntri = 0;
+  std::vector<size_t> triOffset(nslabs);
+  for (size_t b = 0; b < nslabs; ++b) {
+    slabs[b].offset = nx;
+    triOffset[b] = ntri;
+    nx += slabs[b].cube.size();
+    ntri += slabs[b].tri.size();
+  }
+
+  // phase 3: write vertices and triangles
+  x.resize(3 * nx);
+  tri.resize(ntri);
+  SurfaceNetsResolve resolve(slabs, triOffset, x, tri);
+  parallelFor(0, nslabs, resolve, numThreads);
+
+}
+
+#endif /* SURFACENETSENGINE_H */
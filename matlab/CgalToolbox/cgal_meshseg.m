@@ -77,6 +77,50 @@ function varargout = cgal_meshseg(varargin)
 %     with the tag Manifold_tag the function template make_surface_mesh
 %     ensures that the output mesh is a manifold surface without boundary".
 %
+% [TRI, X] = cgal_meshseg(IM, ISOVAL, MINALPHA, MAXRAD, MAXD, [], MANIFOLD, LABELS)
+%
+%   Multi-label mode. LABELS is a vector of label values in the
+%   segmentation IM. The isosurface of each label is computed on the
+%   indicator image IM==LABELS(i), with isovalue ISOVAL. By default,
+%   ISOVAL=0.5 in this mode.
+%
+%   The image is read only once, and the labels are meshed concurrently,
+%   each one in a separate thread. The bounding sphere of each label is
+%   derived automatically from the bounding box of the label's voxels:
+%   the centre is the label voxel closest to the centre of the box, and
+%   the sphere contains the box with a padding of 2 voxels. C must be
+%   empty in this mode.
+%
+%   TRI and X are cell arrays with one mesh per label. TRI{i} and X{i}
+%   are the triangles and vertices of label LABELS(i), in the same format
+%   as above. If a label has no voxels, its mesh is empty.
+%
+% ... = cgal_meshseg(..., LABELS, ENGINE)
+%
+%   ENGINE is a string to select the meshing algorithm. Use LABELS=[] to
+%   select the engine without the multi-label mode.
+%
+%     'cgal' (default): The CGAL surface mesher described above.
+%
+%     'nets': Dual surface nets. Much faster than the CGAL mesher, but
+%     the triangles follow the voxel grid, and their size cannot be
+%     controlled. Each cube of 2x2x2 voxel centres crossed by the
+%     isosurface gets a vertex, and each voxel edge crossed by the
+%     isosurface produces two triangles. Voxels with value >= ISOVAL are
+%     inside the surface. The image is split into slabs that are meshed
+%     in parallel, and vertices on the slab boundaries are shared. The
+%     image is read directly, without making a copy.
+%
+%     MINALPHA, MAXRAD, MAXD, C and MANIFOLD are ignored. The mesh is
+%     closed (the image is padded with background voxels) and the
+%     triangles are oriented with the normals pointing outwards, but
+%     there can be non-manifold edges at saddle configurations of the
+%     voxels. The vertices are in real world coordinates, using the
+%     spacing and offset of IM if it is a SCIMAT struct.
+%
+%     In multi-label mode, the labels are meshed one after another, each
+%     one only in its bounding box.
+%
 % Important!
 %
 % Note that this function can produce meshes with (1) stray vertices that
@@ -91,8 +135,8 @@ function varargout = cgal_meshseg(varargin)
 % See also: bwmesh, tri_squeeze, meshcheckrepair, cgal_tri_fillholes.
 
 % Author: Ramon Casero <rcasero@gmail.com>
-% Copyright © 2013 University of Oxford
-% Version: 0.1.1
+% Copyright © 2013-2015 University of Oxford
+% Version: 0.3.0
 % $Rev$
 % $Date$
 %
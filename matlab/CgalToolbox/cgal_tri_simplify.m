@@ -32,11 +32,32 @@ function varargout = cgal_tri_simplify(varargin)
 %
 %   TRI2, X2 is the description of the simplified output mesh.
 %
+% ... = cgal_tri_simplify(TRI, X, RATIO, ENGINE, TOL)
+%
+%   ENGINE is a string to select the simplification algorithm:
+%
+%     'cgal' (default): CGAL's edge collapse, as described above. TOL is
+%     ignored.
+%
+%     'quadric': Edge collapse with quadric error metrics (Garland and
+%     Heckbert) on arrays of vertices and triangles, without building a
+%     CGAL polyhedron. In each pass, the cheapest collapses that are far
+%     apart from each other (their 1-rings don't overlap) are selected
+%     and applied in parallel. Vertices on the mesh border are not moved.
+%
+%     TOL is the error bound. Each vertex of the simplified mesh is at
+%     most at distance TOL from the planes of all the original triangles
+%     merged into it (the quadric error is <= TOL^2). By default, TOL=Inf.
+%     The algorithm stops when no more collapses satisfy the bound, or
+%     when the number of undirected edges reaches RATIO * number of
+%     original undirected edges. With RATIO=0, only TOL stops the
+%     simplification.
+%
 % See also: cgal_surfsubdivision.
 
 % Author: Ramon Casero <rcasero@gmail.com>
-% Copyright © 2013 University of Oxford
-% Version: 0.1.0
+% Copyright © 2013-2015 University of Oxford
+% Version: 0.2.0
 % $Rev$
 % $Date$
 %
@@ -0,0 +1,746 @@
+/*
+ * ChunkedVolume.h
+ *
+ * Chunked compressed container for SCIMAT volumes, used by MEX
+ * functions scimat_save_chunked.cpp and scimat_load_chunked.cpp.
+ *
+ * A chunked volume is a directory with a layout similar to Zarr v2
+ * and N5:
+ *
+ *   volume/attributes.json   metadata
+ *   volume/0.0.0             chunk (0, 0, 0)
+ *   volume/1.0.0             chunk (1, 0, 0)
+ *   ...
+ *
+ * attributes.json is a flat JSON object, e.g.
+ *
+ *   {
+ *     "format": "gerardus-chunked",
+ *     "version": 1,
+ *     "order": "F",
+ *     "dataType": "single",
+ *     "dimensions": [415, 460, 900],
+ *     "chunkSize": [64, 64, 64],
+ *     "compression": "zlib",
+ *     "level": 1,
+ *     "shuffle": true,
+ *     "spacing": [2.5e-05, 2.5e-05, 2.5e-05],
+ *     "min": [0, 0, 0],
+ *     "rotmat": [1, 0, 0, 0, 1, 0, 0, 0, 1]
+ *   }
+ *
+ * Dimensions are in Matlab order (rows first), and voxels are stored
+ * in column-major order. "spacing", "min" and "rotmat" are the SCIMAT
+ * axis and rotation matrix metadata (rotmat in column-major order).
+ *
+ * The volume is split into chunks of chunkSize voxels. Chunks on the
+ * edge of the volume are clipped to the volume size. Each chunk file
+ * has the chunk voxels in column-major order, byte-shuffled as in
+ * Blosc (first the first byte of every voxel, then the second byte,
+ * etc.), which makes floating point and multi-byte integer data more
+ * compressible, and compressed with zlib. Chunks that are all zeros
+ * are not written, and chunk files that don't exist are read as
+ * zeros.
+ *
+ * Chunks are independent, so they can be compressed and decompressed
+ * in parallel, and a region of interest can be read decoding only the
+ * chunks that intersect it.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef CHUNKEDVOLUME_H
+#define CHUNKEDVOLUME_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* zlib headers */
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// maximum number of dimensions of a chunked volume
+#define CHUNKED_MAX_DIMS 4
+
+/*
+ * chunkedDataTypeSize(): number of bytes of a data type name, or 0 if
+ * the name is not valid.
+ */
+inline size_t chunkedDataTypeSize(const std::string &dataType) {
+  if (dataType == "uint8" || dataType == "int8" || dataType == "logical") {
+    return 1;
+  } else if (dataType == "uint16" || dataType == "int16") {
+    return 2;
+  } else if (dataType == "uint32" || dataType == "int32" || dataType == "single") {
+    return 4;
+  } else if (dataType == "uint64" || dataType == "int64" || dataType == "double") {
+    return 8;
+  }
+  return 0;
+}
+
+/*
+ * chunkedShuffle(): byte shuffle of n elements of es bytes, as in
+ * Blosc. Byte b of element i goes to out[b * n + i]. in and out must
+ * not overlap.
+ */
+inline void chunkedShuffle(const unsigned char *in, unsigned char *out,
+			   size_t n, size_t es) {
+  for (size_t b = 0; b < es; ++b) {
+    const unsigned char *pin = in + b;
+    unsigned char *pout = out + b * n;
+    for (size_t i = 0; i < n; ++i) {
+      pout[i] = pin[i * es];
+    }
+  }
+}
+
+/*
+ * chunkedUnshuffle(): inverse of chunkedShuffle().
+ */
+inline void chunkedUnshuffle(const unsigned char *in, unsigned char *out,
+			     size_t n, size_t es) {
+  for (size_t b = 0; b < es; ++b) {
+    const unsigned char *pin = in + b * n;
+    unsigned char *pout = out + b;
+    for (size_t i = 0; i < n; ++i) {
+      pout[i * es] = pin[i];
+    }
+  }
+}
+
+/*
+ * chunkedMakeDirectory(): create a directory, if it doesn't exist
+ * already. Throws std::runtime_error on failure.
+ */
+inline void chunkedMakeDirectory(const std::string &dirName) {
+#ifdef _WIN32
+  int err = _mkdir(dirName.c_str());
+#else
+  int err = mkdir(dirName.c_str(), 0777);
+#endif
+  if (err != 0 && errno != EEXIST) {
+    throw std::runtime_error("Cannot create directory " + dirName);
+  }
+}
+
+/*
+ * ChunkedVolumeInfo: metadata of a chunked volume, stored in file
+ * attributes.json in the volume directory.
+ */
+class ChunkedVolumeInfo {
+
+ public:
+
+  // data type name: "double", "single", "(u)int8/16/32/64" or
+  // "logical"
+  std::string dataType;
+
+  // number of dimensions (1 to CHUNKED_MAX_DIMS), volume size and
+  // chunk size. Dimensions beyond ndims have size 1
+  unsigned int ndims;
+  size_t size[CHUNKED_MAX_DIMS];
+  size_t chunkSize[CHUNKED_MAX_DIMS];
+
+  // "zlib" or "raw", and zlib compression level (1 to 9)
+  std::string compression;
+  int level;
+
+  // byte shuffle before compression
+  bool shuffle;
+
+  // SCIMAT metadata: axis spacing and min (one value per dimension),
+  // and rotation matrix (column-major, empty if there's none)
+  std::vector<double> spacing;
+  std::vector<double> min;
+  std::vector<double> rotmat;
+
+  ChunkedVolumeInfo()
+    : dataType("double"), ndims(0), compression("zlib"), level(1),
+      shuffle(true) {
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      this->size[d] = 1;
+      this->chunkSize[d] = 1;
+    }
+  }
+
+  size_t GetElementSize() const {
+    return chunkedDataTypeSize(this->dataType);
+  }
+
+  // number of chunks along dimension d
+  size_t GetNumberOfChunks(unsigned int d) const {
+    return (this->size[d] + this->chunkSize[d] - 1) / this->chunkSize[d];
+  }
+
+  // total number of chunks
+  size_t GetNumberOfChunks() const {
+    size_t n = 1;
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      n *= this->GetNumberOfChunks(d);
+    }
+    return n;
+  }
+
+  // convert a linear chunk index to chunk grid coordinates (first
+  // dimension runs fastest)
+  void GetChunkCoordinates(size_t idx, size_t *coord) const {
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      size_t nc = this->GetNumberOfChunks(d);
+      coord[d] = idx % nc;
+      idx /= nc;
+    }
+  }
+
+  // first voxel and size of the chunk with grid coordinates
+  // coord. Chunks on the edge of the volume are smaller than
+  // chunkSize
+  void GetChunkRegion(const size_t *coord, size_t *first, size_t *sz) const {
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      first[d] = coord[d] * this->chunkSize[d];
+      sz[d] = std::min(this->chunkSize[d], this->size[d] - first[d]);
+    }
+  }
+
+  // name of the chunk file, e.g. "2.0.5" for a 3D volume
+  std::string GetChunkFileName(const std::string &dirName, const size_t *coord) const {
+    std::ostringstream s;
+    s << dirName << "/";
+    for (unsigned int d = 0; d < this->ndims; ++d) {
+      s << (d == 0 ? "" : ".") << coord[d];
+    }
+    return s.str();
+  }
+
+  // check that the metadata are consistent. Throws
+  // std::runtime_error otherwise
+  void Validate() const {
+    if (this->GetElementSize() == 0) {
+      throw std::runtime_error("Unknown data type: " + this->dataType);
+    }
+    if (this->ndims < 1 || this->ndims > CHUNKED_MAX_DIMS) {
+      throw std::runtime_error("Chunked volumes must have between 1 and 4 dimensions");
+    }
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      if (this->chunkSize[d] < 1) {
+	throw std::runtime_error("Chunk size must be >= 1");
+      }
+      if (d >= this->ndims && this->size[d] != 1) {
+	throw std::runtime_error("Volume size has more dimensions than ndims");
+      }
+    }
+    if (this->compression != "zlib" && this->compression != "raw") {
+      throw std::runtime_error("Unknown compression: " + this->compression);
+    }
+    if (this->level < 1 || this->level > 9) {
+      throw std::runtime_error("Compression level must be between 1 and 9");
+    }
+    if (!this->spacing.empty() && this->spacing.size() != this->ndims) {
+      throw std::runtime_error("spacing must have one value per dimension");
+    }
+    if (!this->min.empty() && this->min.size() != this->ndims) {
+      throw std::runtime_error("min must have one value per dimension");
+    }
+  }
+
+  // write attributes.json in directory dirName
+  void Write(const std::string &dirName) const {
+    this->Validate();
+    std::string fileName = dirName + "/attributes.json";
+    std::ofstream f(fileName.c_str());
+    if (!f) {
+      throw std::runtime_error("Cannot write " + fileName);
+    }
+    f << std::setprecision(17);
+    f << "{\n"
+      << "  \"format\": \"gerardus-chunked\",\n"
+      << "  \"version\": 1,\n"
+      << "  \"order\": \"F\",\n"
+      << "  \"dataType\": \"" << this->dataType << "\",\n"
+      << "  \"dimensions\": ";
+    WriteArray(f, this->size, this->ndims);
+    f << ",\n  \"chunkSize\": ";
+    WriteArray(f, this->chunkSize, this->ndims);
+    f << ",\n  \"compression\": \"" << this->compression << "\",\n"
+      << "  \"level\": " << this->level << ",\n"
+      << "  \"shuffle\": " << (this->shuffle ? "true" : "false") << ",\n"
+      << "  \"spacing\": ";
+    WriteArray(f, this->spacing.empty() ? NULL : &this->spacing[0], this->spacing.size());
+    f << ",\n  \"min\": ";
+    WriteArray(f, this->min.empty() ? NULL : &this->min[0], this->min.size());
+    f << ",\n  \"rotmat\": ";
+    WriteArray(f, this->rotmat.empty() ? NULL : &this->rotmat[0], this->rotmat.size());
+    f << "\n}\n";
+    if (!f) {
+      throw std::runtime_error("Error writing " + fileName);
+    }
+  }
+
+  // read attributes.json from directory dirName
+  void Read(const std::string &dirName) {
+    std::string fileName = dirName + "/attributes.json";
+    std::ifstream f(fileName.c_str());
+    if (!f) {
+      throw std::runtime_error("Cannot read " + fileName);
+    }
+    std::ostringstream buf;
+    buf << f.rdbuf();
+    const std::string s = buf.str();
+
+    // parse the flat JSON object into strings and numeric arrays
+    std::map<std::string, std::string> str;
+    std::map<std::string, std::vector<double> > num;
+    size_t pos = 0;
+    Expect(s, pos, '{');
+    while (true) {
+      SkipSpace(s, pos);
+      if (pos < s.size() && s[pos] == '}') {
+	break;
+      }
+      std::string key = ParseString(s, pos);
+      Expect(s, pos, ':');
+      SkipSpace(s, pos);
+      if (pos >= s.size()) {
+	throw std::runtime_error("Unexpected end of " + fileName);
+      }
+      if (s[pos] == '"') {
+	str[key] = ParseString(s, pos);
+      } else if (s[pos] == '[') {
+	++pos;
+	std::vector<double> &v = num[key];
+	SkipSpace(s, pos);
+	if (pos < s.size() && s[pos] == ']') {
+	  ++pos;
+	} else {
+	  while (true) {
+	    v.push_back(ParseNumber(s, pos));
+	    SkipSpace(s, pos);
+	    if (pos < s.size() && s[pos] == ',') {
+	      ++pos;
+	    } else {
+	      Expect(s, pos, ']');
+	      break;
+	    }
+	  }
+	}
+      } else if (s.compare(pos, 4, "true") == 0) {
+	num[key] = std::vector<double>(1, 1.0);
+	pos += 4;
+      } else if (s.compare(pos, 5, "false") == 0) {
+	num[key] = std::vector<double>(1, 0.0);
+	pos += 5;
+      } else {
+	num[key] = std::vector<double>(1, ParseNumber(s, pos));
+      }
+      SkipSpace(s, pos);
+      if (pos < s.size() && s[pos] == ',') {
+	++pos;
+      }
+    }
+
+    if (str["format"] != "gerardus-chunked") {
+      throw std::runtime_error(fileName + " is not a Gerardus chunked volume");
+    }
+    if (str.count("order") && str["order"] != "F") {
+      throw std::runtime_error("Only column-major (\"F\") order is supported");
+    }
+    this->dataType = str["dataType"];
+    this->compression = str["compression"];
+    const std::vector<double> &sz = num["dimensions"];
+    const std::vector<double> &csz = num["chunkSize"];
+    if (sz.empty() || sz.size() > CHUNKED_MAX_DIMS || csz.size() != sz.size()) {
+      throw std::runtime_error("Invalid dimensions or chunkSize in " + fileName);
+    }
+    this->ndims = sz.size();
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      this->size[d] = (d < this->ndims) ? (size_t)sz[d] : 1;
+      this->chunkSize[d] = (d < this->ndims) ? (size_t)csz[d] : 1;
+    }
+    this->level = num["level"].empty() ? 1 : (int)num["level"][0];
+    this->shuffle = !num["shuffle"].empty() && num["shuffle"][0] != 0.0;
+    this->spacing = num["spacing"];
+    this->min = num["min"];
+    this->rotmat = num["rotmat"];
+    this->Validate();
+  }
+
+ private:
+
+  template <class T>
+  static void WriteArray(std::ostream &f, const T *v, size_t n) {
+    f << "[";
+    for (size_t i = 0; i < n; ++i) {
+      f << (i == 0 ? "" : ", ") << v[i];
+    }
+    f << "]";
+  }
+
+  static void SkipSpace(const std::string &s, size_t &pos) {
+    while (pos < s.size() && std::isspace((unsigned char)s[pos])) {
+      ++pos;
+    }
+  }
+
+  static void Expect(const std::string &s, size_t &pos, char c) {
+    SkipSpace(s, pos);
+    if (pos >= s.size() || s[pos] != c) {
+      throw std::runtime_error(std::string("Invalid attributes.json: expected '")
+			       + c + "'");
+    }
+    ++pos;
+  }
+
+  // strings in attributes.json have no escape sequences
+  static std::string ParseString(const std::string &s, size_t &pos) {
+    Expect(s, pos, '"');
+    size_t end = s.find('"', pos);
+    if (end == std::string::npos) {
+      throw std::runtime_error("Invalid attributes.json: unterminated string");
+    }
+    std::string val = s.substr(pos, end - pos);
+    pos = end + 1;
+    return val;
+  }
+
+  static double ParseNumber(const std::string &s, size_t &pos) {
+    SkipSpace(s, pos);
+    const char *start = s.c_str() + pos;
+    char *end;
+    double val = std::strtod(start, &end);
+    if (end == start) {
+      throw std::runtime_error("Invalid attributes.json: expected a number");
+    }
+    pos += end - start;
+    return val;
+  }
+
+};
+
+/*
+ * ChunkedBuffers: per-thread work buffers for chunk (de)compression.
+ */
+class ChunkedBuffers {
+
+ public:
+
+  std::vector<unsigned char> raw;
+  std::vector<unsigned char> shuffled;
+  std::vector<unsigned char> compressed;
+
+};
+
+/*
+ * ChunkedWriteFunctor: write chunks [begin, end) of a volume to the
+ * chunk files. data is the whole volume in column-major order, with
+ * the size and data type in info.
+ *
+ * Each chunk is copied from the volume, byte-shuffled, compressed and
+ * written to its own file, so chunks can be processed in parallel.
+ */
+class ChunkedWriteFunctor {
+
+ public:
+
+  ChunkedWriteFunctor(const ChunkedVolumeInfo &_info, const std::string &_dirName,
+		      const void *_data, unsigned int numThreads)
+    : info(_info), dirName(_dirName), data((const unsigned char *)_data),
+      buffers(numThreads) {}
+
+  size_t GetNumberOfChunks() const {
+    return this->info.GetNumberOfChunks();
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t es = this->info.GetElementSize();
+    ChunkedBuffers &buf = this->buffers[thread];
+    size_t coord[CHUNKED_MAX_DIMS], first[CHUNKED_MAX_DIMS], sz[CHUNKED_MAX_DIMS];
+    for (size_t idx = begin; idx < end; ++idx) {
+      this->info.GetChunkCoordinates(idx, coord);
+      this->info.GetChunkRegion(coord, first, sz);
+      const size_t n = sz[0] * sz[1] * sz[2] * sz[3];
+
+      // copy the chunk from the volume, one row at a time
+      buf.raw.resize(n * es);
+      const size_t rowBytes = sz[0] * es;
+      const size_t *vsz = this->info.size;
+      unsigned char *out = &buf.raw[0];
+      for (size_t t = 0; t < sz[3]; ++t) {
+	for (size_t s = 0; s < sz[2]; ++s) {
+	  for (size_t c = 0; c < sz[1]; ++c) {
+	    size_t offset = first[0]
+	      + vsz[0] * ((first[1] + c)
+			  + vsz[1] * ((first[2] + s) + vsz[2] * (first[3] + t)));
+	    std::memcpy(out, this->data + offset * es, rowBytes);
+	    out += rowBytes;
+	  }
+	}
+      }
+
+      // chunks of zeros are not stored. A file left from a previous
+      // write to the same directory must be removed
+      std::string fileName = this->info.GetChunkFileName(this->dirName, coord);
+      if (IsZero(&buf.raw[0], n * es)) {
+	std::remove(fileName.c_str());
+	continue;
+      }
+
+      // shuffle and compress
+      const unsigned char *payload = &buf.raw[0];
+      size_t payloadBytes = n * es;
+      if (this->info.shuffle && es > 1) {
+	buf.shuffled.resize(n * es);
+	chunkedShuffle(&buf.raw[0], &buf.shuffled[0], n, es);
+	payload = &buf.shuffled[0];
+      }
+      if (this->info.compression == "zlib") {
+	uLongf len = compressBound((uLong)payloadBytes);
+	buf.compressed.resize(len);
+	if (compress2(&buf.compressed[0], &len, payload, (uLong)payloadBytes,
+		      this->info.level) != Z_OK) {
+	  throw std::runtime_error("zlib compression failed");
+	}
+	payload = &buf.compressed[0];
+	payloadBytes = len;
+      }
+
+      // write the chunk file
+      std::ofstream f(fileName.c_str(), std::ios::binary);
+      f.write((const char *)payload, payloadBytes);
+      if (!f) {
+	throw std::runtime_error("Cannot write chunk " + fileName);
+      }
+    }
+  }
+
+ private:
+
+  static bool IsZero(const unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+      if (p[i] != 0) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  const ChunkedVolumeInfo &info;
+  std::string dirName;
+  const unsigned char *data;
+  std::vector<ChunkedBuffers> buffers;
+
+};
+
+/*
+ * ChunkedReadFunctor: read a region of interest (ROI) of a chunked
+ * volume.
+ *
+ * roiFirst, roiSize are the first voxel (0-based) and size of the
+ * ROI. out is the ROI in column-major order, with the data type in
+ * info.
+ *
+ * Only the chunks that intersect the ROI are read. The functor runs
+ * over the list of those chunks, and each one is read, decompressed
+ * and unshuffled into a per-thread buffer, and its intersection with
+ * the ROI copied to the output. Chunk files that don't exist are read
+ * as zeros.
+ */
+class ChunkedReadFunctor {
+
+ public:
+
+  ChunkedReadFunctor(const ChunkedVolumeInfo &_info, const std::string &_dirName,
+		     const size_t *_roiFirst, const size_t *_roiSize, void *_out,
+		     unsigned int numThreads)
+    : info(_info), dirName(_dirName), out((unsigned char *)_out),
+      buffers(numThreads) {
+    size_t chunkFirst[CHUNKED_MAX_DIMS], chunkLast[CHUNKED_MAX_DIMS];
+    bool empty = false;
+    for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+      this->roiFirst[d] = _roiFirst[d];
+      this->roiSize[d] = _roiSize[d];
+      if (_roiSize[d] == 0) {
+	empty = true;
+	continue;
+      }
+      if (_roiFirst[d] + _roiSize[d] > this->info.size[d]) {
+	throw std::runtime_error("ROI is outside the volume");
+      }
+      chunkFirst[d] = _roiFirst[d] / this->info.chunkSize[d];
+      chunkLast[d] = (_roiFirst[d] + _roiSize[d] - 1) / this->info.chunkSize[d];
+    }
+
+    // list of chunks that intersect the ROI
+    if (empty) {
+      return;
+    }
+    size_t c[CHUNKED_MAX_DIMS];
+    for (c[3] = chunkFirst[3]; c[3] <= chunkLast[3]; ++c[3]) {
+      for (c[2] = chunkFirst[2]; c[2] <= chunkLast[2]; ++c[2]) {
+	for (c[1] = chunkFirst[1]; c[1] <= chunkLast[1]; ++c[1]) {
+	  for (c[0] = chunkFirst[0]; c[0] <= chunkLast[0]; ++c[0]) {
+	    size_t idx = c[3];
+	    for (int d = 2; d >= 0; --d) {
+	      idx = idx * this->info.GetNumberOfChunks(d) + c[d];
+	    }
+	    this->chunks.push_back(idx);
+	  }
+	}
+      }
+    }
+  }
+
+  size_t GetNumberOfChunks() const {
+    return this->chunks.size();
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t es = this->info.GetElementSize();
+    ChunkedBuffers &buf = this->buffers[thread];
+    size_t coord[CHUNKED_MAX_DIMS], first[CHUNKED_MAX_DIMS], sz[CHUNKED_MAX_DIMS];
+    for (size_t i = begin; i < end; ++i) {
+      this->info.GetChunkCoordinates(this->chunks[i], coord);
+      this->info.GetChunkRegion(coord, first, sz);
+      const size_t n = sz[0] * sz[1] * sz[2] * sz[3];
+      const unsigned char *chunk = this->ReadChunk(coord, n, es, buf);
+
+      // intersection of the chunk with the ROI
+      size_t lo[CHUNKED_MAX_DIMS], hi[CHUNKED_MAX_DIMS];
+      for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+	lo[d] = std::max(first[d], this->roiFirst[d]);
+	hi[d] = std::min(first[d] + sz[d], this->roiFirst[d] + this->roiSize[d]);
+      }
+
+      // copy the intersection one row at a time
+      const size_t rowBytes = (hi[0] - lo[0]) * es;
+      const size_t *rsz = this->roiSize;
+      for (size_t t = lo[3]; t < hi[3]; ++t) {
+	for (size_t s = lo[2]; s < hi[2]; ++s) {
+	  for (size_t c = lo[1]; c < hi[1]; ++c) {
+	    size_t src = (lo[0] - first[0])
+	      + sz[0] * ((c - first[1])
+			 + sz[1] * ((s - first[2]) + sz[2] * (t - first[3])));
+	    size_t dst = (lo[0] - this->roiFirst[0])
+	      + rsz[0] * ((c - this->roiFirst[1])
+			  + rsz[1] * ((s - this->roiFirst[2])
+				      + rsz[2] * (t - this->roiFirst[3])));
+	    if (chunk == NULL) {
+	      std::memset(this->out + dst * es, 0, rowBytes);
+	    } else {
+	      std::memcpy(this->out + dst * es, chunk + src * es, rowBytes);
+	    }
+	  }
+	}
+      }
+    }
+  }
+
+ private:
+
+  // read and decode a chunk with n elements into the thread
+  // buffers. Returns a pointer to the decoded chunk, or NULL if the
+  // chunk file doesn't exist
+  const unsigned char *ReadChunk(const size_t *coord, size_t n, size_t es,
+				 ChunkedBuffers &buf) const {
+    std::string fileName = this->info.GetChunkFileName(this->dirName, coord);
+    std::ifstream f(fileName.c_str(), std::ios::binary);
+    if (!f) {
+      return NULL;
+    }
+    f.seekg(0, std::ios::end);
+    size_t fileBytes = (size_t)f.tellg();
+    f.seekg(0, std::ios::beg);
+
+    const size_t rawBytes = n * es;
+    const bool doShuffle = this->info.shuffle && es > 1;
+    bool zlib = this->info.compression == "zlib";
+
+    // the data read from file go into the compressed buffer if they
+    // need decompression, into the shuffled buffer if they only need
+    // unshuffling, or straight into the raw buffer
+    std::vector<unsigned char> &fileBuf = zlib ? buf.compressed
+      : (doShuffle ? buf.shuffled : buf.raw);
+    if (!zlib && fileBytes != rawBytes) {
+      throw std::runtime_error("Chunk " + fileName + " has the wrong size");
+    }
+    fileBuf.resize(std::max(fileBytes, (size_t)1));
+    f.read((char *)&fileBuf[0], fileBytes);
+    if (!f) {
+      throw std::runtime_error("Cannot read chunk " + fileName);
+    }
+
+    if (zlib) {
+      std::vector<unsigned char> &dst = doShuffle ? buf.shuffled : buf.raw;
+      dst.resize(rawBytes);
+      uLongf len = (uLongf)rawBytes;
+      if (uncompress(&dst[0], &len, &buf.compressed[0], (uLong)fileBytes) != Z_OK
+	  || len != rawBytes) {
+	throw std::runtime_error("Cannot decompress chunk " + fileName);
+      }
+    }
+    if (doShuffle) {
+      buf.raw.resize(rawBytes);
+      chunkedUnshuffle(&buf.shuffled[0], &buf.raw[0], n, es);
+    }
+    return &buf.raw[0];
+  }
+
+  const ChunkedVolumeInfo &info;
+  std::string dirName;
+  unsigned char *out;
+  size_t roiFirst[CHUNKED_MAX_DIMS];
+  size_t roiSize[CHUNKED_MAX_DIMS];
+  std::vector<size_t> chunks;
+  std::vector<ChunkedBuffers> buffers;
+
+};
+
+#endif /* CHUNKEDVOLUME_H */
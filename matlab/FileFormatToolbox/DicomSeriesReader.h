@@ -0,0 +1,521 @@
+/*
+ * DicomSeriesReader.h
+ *
+ * Reader for DICOM series, used by MEX function
+ * scimat_load_dicom.cpp. Files are read with GDCM, that is built as
+ * part of ITK.
+ *
+ * Reading a series is done in three steps:
+ *
+ *   1. DicomHeaderFunctor parses the headers of all the files in a
+ *      directory. Only the header is read, up to the PixelData
+ *      element, so this is fast and files can be parsed in parallel.
+ *
+ *   2. DicomSeries selects the slices of one series, checks that they
+ *      have the same size, pixel type and orientation, sorts them by
+ *      position along the slice normal, and computes the spacing,
+ *      origin and rotation matrix of the volume. The output volume
+ *      can then be allocated before any pixel is decoded.
+ *
+ *   3. DicomDecodeFunctor decodes the pixel data of each slice
+ *      straight into its place in the output volume. Slices are
+ *      independent, and are decoded in parallel.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef DICOMSERIESREADER_H
+#define DICOMSERIESREADER_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* GDCM headers */
+#include <gdcmDataSet.h>
+#include <gdcmDirectory.h>
+#include <gdcmImage.h>
+#include <gdcmImageReader.h>
+#include <gdcmReader.h>
+#include <gdcmTag.h>
+
+/*
+ * DicomSliceHeader: the header values of a DICOM file that are needed
+ * to sort the slices and decode the pixels. Spacings and positions
+ * are in mm, as in the DICOM file.
+ */
+class DicomSliceHeader {
+
+ public:
+
+  std::string fileName;
+
+  // false if the file is not a DICOM image that can be part of a
+  // volume
+  bool valid;
+
+  std::string seriesUID;           // (0020,000E) SeriesInstanceUID
+  int instanceNumber;              // (0020,0013) InstanceNumber
+  double position[3];              // (0020,0032) ImagePositionPatient
+  double orientation[6];           // (0020,0037) ImageOrientationPatient
+  double pixelSpacing[2];          // (0028,0030) PixelSpacing (rows, cols)
+  double sliceThickness;           // (0018,0050) SliceThickness
+  double spacingBetweenSlices;     // (0018,0088) SpacingBetweenSlices
+  unsigned int samplesPerPixel;    // (0028,0002) SamplesPerPixel
+  unsigned int numberOfFrames;     // (0028,0008) NumberOfFrames
+  unsigned int rows;               // (0028,0010) Rows
+  unsigned int cols;               // (0028,0011) Columns
+  unsigned int bitsAllocated;      // (0028,0100) BitsAllocated
+  unsigned int pixelRepresentation;// (0028,0103) PixelRepresentation
+  double rescaleIntercept;         // (0028,1052) RescaleIntercept
+  double rescaleSlope;             // (0028,1053) RescaleSlope
+
+  // distance of the slice to the origin along the slice normal
+  double distance;
+
+  DicomSliceHeader()
+    : valid(false), instanceNumber(0), sliceThickness(0.0),
+      spacingBetweenSlices(0.0), samplesPerPixel(1), numberOfFrames(1),
+      rows(0), cols(0), bitsAllocated(0), pixelRepresentation(0),
+      rescaleIntercept(0.0), rescaleSlope(1.0), distance(0.0) {
+    for (int i = 0; i < 3; ++i) {
+      this->position[i] = 0.0;
+    }
+    for (int i = 0; i < 6; ++i) {
+      this->orientation[i] = 0.0;
+    }
+    this->pixelSpacing[0] = this->pixelSpacing[1] = 1.0;
+  }
+
+  // parse the header of the file, without reading the pixel
+  // data. Files that cannot be parsed are marked as not valid
+  void Read(const std::string &_fileName) {
+    this->fileName = _fileName;
+    this->valid = false;
+
+    gdcm::Reader reader;
+    reader.SetFileName(this->fileName.c_str());
+    std::set<gdcm::Tag> skipTags;
+    if (!reader.ReadUpToTag(gdcm::Tag(0x7fe0, 0x0010), skipTags)) {
+      return;
+    }
+    const gdcm::DataSet &ds = reader.GetFile().GetDataSet();
+
+    // images that can be stacked into a volume need a position,
+    // orientation and size
+    if (ReadDecimalString(ds, gdcm::Tag(0x0020, 0x0032), this->position, 3) != 3
+	|| ReadDecimalString(ds, gdcm::Tag(0x0020, 0x0037), this->orientation, 6) != 6) {
+      return;
+    }
+    this->rows = ReadUnsignedShort(ds, gdcm::Tag(0x0028, 0x0010), 0);
+    this->cols = ReadUnsignedShort(ds, gdcm::Tag(0x0028, 0x0011), 0);
+    this->bitsAllocated = ReadUnsignedShort(ds, gdcm::Tag(0x0028, 0x0100), 0);
+    if (this->rows == 0 || this->cols == 0 || this->bitsAllocated == 0) {
+      return;
+    }
+    this->pixelRepresentation = ReadUnsignedShort(ds, gdcm::Tag(0x0028, 0x0103), 0);
+    this->samplesPerPixel = ReadUnsignedShort(ds, gdcm::Tag(0x0028, 0x0002), 1);
+
+    this->seriesUID = ReadString(ds, gdcm::Tag(0x0020, 0x000e));
+    ReadDecimalString(ds, gdcm::Tag(0x0018, 0x0050), &this->sliceThickness, 1);
+    ReadDecimalString(ds, gdcm::Tag(0x0018, 0x0088), &this->spacingBetweenSlices, 1);
+    ReadDecimalString(ds, gdcm::Tag(0x0028, 0x0030), this->pixelSpacing, 2);
+    ReadDecimalString(ds, gdcm::Tag(0x0028, 0x1052), &this->rescaleIntercept, 1);
+    ReadDecimalString(ds, gdcm::Tag(0x0028, 0x1053), &this->rescaleSlope, 1);
+    double v = 1.0;
+    ReadDecimalString(ds, gdcm::Tag(0x0028, 0x0008), &v, 1);
+    this->numberOfFrames = (unsigned int)std::max(v, 1.0);
+    v = 0.0;
+    ReadDecimalString(ds, gdcm::Tag(0x0020, 0x0013), &v, 1);
+    this->instanceNumber = (int)v;
+
+    this->valid = true;
+  }
+
+ private:
+
+  // value of a string element, without padding, or "" if the element
+  // is not present
+  static std::string ReadString(const gdcm::DataSet &ds, const gdcm::Tag &tag) {
+    if (!ds.FindDataElement(tag)) {
+      return "";
+    }
+    const gdcm::ByteValue *bv = ds.GetDataElement(tag).GetByteValue();
+    if (bv == NULL) {
+      return "";
+    }
+    std::string s(bv->GetPointer(), bv->GetLength());
+    size_t last = s.find_last_not_of(std::string(" \0", 2));
+    size_t first = s.find_first_not_of(' ');
+    return (last == std::string::npos) ? std::string() : s.substr(first, last - first + 1);
+  }
+
+  // read up to n values of a decimal or integer string element
+  // ("1.5\2.0\..."). Returns the number of values read
+  static size_t ReadDecimalString(const gdcm::DataSet &ds, const gdcm::Tag &tag,
+				  double *v, size_t n) {
+    std::string s = ReadString(ds, tag);
+    std::replace(s.begin(), s.end(), '\\', ' ');
+    std::istringstream is(s);
+    size_t i = 0;
+    while (i < n && (is >> v[i])) {
+      ++i;
+    }
+    return i;
+  }
+
+  // value of an unsigned short element, or def if the element is not
+  // present. Values are little-endian in all the transfer syntaxes
+  // still in use
+  static unsigned int ReadUnsignedShort(const gdcm::DataSet &ds, const gdcm::Tag &tag,
+					unsigned int def) {
+    if (!ds.FindDataElement(tag)) {
+      return def;
+    }
+    const gdcm::ByteValue *bv = ds.GetDataElement(tag).GetByteValue();
+    if (bv == NULL || bv->GetLength() < 2) {
+      return def;
+    }
+    const unsigned char *p = (const unsigned char *)bv->GetPointer();
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+  }
+
+};
+
+/*
+ * DicomHeaderFunctor: parse the headers of files [begin, end).
+ */
+class DicomHeaderFunctor {
+
+ public:
+
+  DicomHeaderFunctor(const std::vector<std::string> &_fileNames,
+		     std::vector<DicomSliceHeader> &_headers)
+    : fileNames(_fileNames), headers(_headers) {
+    this->headers.resize(this->fileNames.size());
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t i = begin; i < end; ++i) {
+      this->headers[i].Read(this->fileNames[i]);
+    }
+  }
+
+ private:
+
+  const std::vector<std::string> &fileNames;
+  std::vector<DicomSliceHeader> &headers;
+
+};
+
+// sort slices by their distance along the slice normal
+class DicomSliceDistanceLess {
+
+ public:
+
+  bool operator()(const DicomSliceHeader &a, const DicomSliceHeader &b) const {
+    return a.distance < b.distance;
+  }
+
+};
+
+/*
+ * dicomListFiles(): names of all the files in a directory and its
+ * subdirectories.
+ */
+inline std::vector<std::string> dicomListFiles(const std::string &dirName) {
+  gdcm::Directory dir;
+  dir.Load(dirName, true);
+  return dir.GetFilenames();
+}
+
+/*
+ * dicomCountSeries(): number of valid slices of each series in a list
+ * of headers.
+ */
+inline std::map<std::string, size_t>
+dicomCountSeries(const std::vector<DicomSliceHeader> &headers) {
+  std::map<std::string, size_t> count;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    if (headers[i].valid) {
+      ++count[headers[i].seriesUID];
+    }
+  }
+  return count;
+}
+
+/*
+ * DicomSeries: the slices of one series, sorted by position, and the
+ * geometry of the volume they form.
+ *
+ * Slices are sorted by their ImagePositionPatient projected on the
+ * slice normal, that is the cross product of the row and column
+ * direction cosines of ImageOrientationPatient, so the volume has a
+ * right-handed coordinate system.
+ *
+ * The constructor throws std::runtime_error if the slices cannot be
+ * stacked into a volume.
+ */
+class DicomSeries {
+
+ public:
+
+  DicomSeries(const std::vector<DicomSliceHeader> &headers, const std::string &seriesUID) {
+    for (size_t i = 0; i < headers.size(); ++i) {
+      if (headers[i].valid && headers[i].seriesUID == seriesUID) {
+	this->slices.push_back(headers[i]);
+      }
+    }
+    if (this->slices.empty()) {
+      throw std::runtime_error("No images found for series " + seriesUID);
+    }
+
+    // all slices must have the same size, pixel type and orientation
+    // as the first one
+    const DicomSliceHeader &h0 = this->slices[0];
+    if (h0.samplesPerPixel != 1) {
+      throw std::runtime_error("Only grayscale DICOM images are supported");
+    }
+    if (h0.numberOfFrames != 1) {
+      throw std::runtime_error("Multi-frame DICOM files are not supported");
+    }
+    if (h0.bitsAllocated != 8 && h0.bitsAllocated != 16 && h0.bitsAllocated != 32) {
+      throw std::runtime_error("Only 8, 16 or 32 bits allocated per pixel are supported");
+    }
+    for (size_t i = 1; i < this->slices.size(); ++i) {
+      const DicomSliceHeader &h = this->slices[i];
+      if (h.rows != h0.rows || h.cols != h0.cols
+	  || h.bitsAllocated != h0.bitsAllocated
+	  || h.pixelRepresentation != h0.pixelRepresentation
+	  || h.samplesPerPixel != h0.samplesPerPixel
+	  || h.numberOfFrames != h0.numberOfFrames) {
+	throw std::runtime_error("Slice " + h.fileName
+				 + " has a different size or pixel type than " + h0.fileName);
+      }
+      for (int j = 0; j < 6; ++j) {
+	if (std::fabs(h.orientation[j] - h0.orientation[j]) > 1e-4) {
+	  throw std::runtime_error("Slice " + h.fileName
+				   + " has a different orientation than " + h0.fileName);
+	}
+      }
+    }
+
+    // rotation matrix rows: x (row direction), y (column direction)
+    // and slice normal
+    for (int j = 0; j < 3; ++j) {
+      this->rotmat[j] = h0.orientation[j];
+      this->rotmat[3 + j] = h0.orientation[3 + j];
+    }
+    const double *u = this->rotmat;
+    const double *v = this->rotmat + 3;
+    this->rotmat[6] = u[1] * v[2] - u[2] * v[1];
+    this->rotmat[7] = u[2] * v[0] - u[0] * v[2];
+    this->rotmat[8] = u[0] * v[1] - u[1] * v[0];
+
+    // sort slices along the normal
+    for (size_t i = 0; i < this->slices.size(); ++i) {
+      DicomSliceHeader &h = this->slices[i];
+      h.distance = h.position[0] * this->rotmat[6] + h.position[1] * this->rotmat[7]
+	+ h.position[2] * this->rotmat[8];
+    }
+    std::sort(this->slices.begin(), this->slices.end(), DicomSliceDistanceLess());
+
+    // slice spacing
+    const size_t n = this->slices.size();
+    this->unevenSpacing = false;
+    if (n == 1) {
+      this->sliceSpacing = (h0.spacingBetweenSlices > 0.0) ? h0.spacingBetweenSlices
+	: ((h0.sliceThickness > 0.0) ? h0.sliceThickness : 1.0);
+    } else {
+      this->sliceSpacing = (this->slices[n - 1].distance - this->slices[0].distance)
+	/ (double)(n - 1);
+      for (size_t i = 1; i < n; ++i) {
+	double d = this->slices[i].distance - this->slices[i - 1].distance;
+	if (d < 1e-3 * this->sliceSpacing || d < 1e-6) {
+	  throw std::runtime_error("Slices " + this->slices[i - 1].fileName + " and "
+				   + this->slices[i].fileName + " have the same position");
+	}
+	if (std::fabs(d - this->sliceSpacing) > 1e-2 * this->sliceSpacing) {
+	  this->unevenSpacing = true;
+	}
+      }
+    }
+  }
+
+  size_t GetNumberOfSlices() const {
+    return this->slices.size();
+  }
+
+  const DicomSliceHeader &GetSlice(size_t i) const {
+    return this->slices[i];
+  }
+
+  size_t GetRows() const {
+    return this->slices[0].rows;
+  }
+
+  size_t GetCols() const {
+    return this->slices[0].cols;
+  }
+
+  // voxel size in mm along x (columns), y (rows) and slices
+  double GetSpacing(int dim) const {
+    switch (dim) {
+    case 0:
+      return this->slices[0].pixelSpacing[1];
+    case 1:
+      return this->slices[0].pixelSpacing[0];
+    default:
+      return this->sliceSpacing;
+    }
+  }
+
+  // (3, 3) rotation matrix, row-major, that maps (x, y, slice)
+  // voxel offsets to patient coordinates as a right-multiplying
+  // matrix: X = offset * R + origin
+  const double *GetRotationMatrix() const {
+    return this->rotmat;
+  }
+
+  // centre of the first voxel in patient coordinates (mm)
+  const double *GetOrigin() const {
+    return this->slices[0].position;
+  }
+
+  // true if the distance between consecutive slices differs from the
+  // mean by more than 1%
+  bool HasUnevenSpacing() const {
+    return this->unevenSpacing;
+  }
+
+  // true if any slice has a rescale slope or intercept
+  bool NeedsRescale() const {
+    for (size_t i = 0; i < this->slices.size(); ++i) {
+      if (this->slices[i].rescaleSlope != 1.0 || this->slices[i].rescaleIntercept != 0.0) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+
+  std::vector<DicomSliceHeader> slices;
+  double rotmat[9];
+  double sliceSpacing;
+  bool unevenSpacing;
+
+};
+
+/*
+ * DicomDecodeFunctor: decode the pixel data of slices [begin, end) of
+ * a series into a preallocated volume.
+ *
+ * TIn is the stored pixel type (given by BitsAllocated and
+ * PixelRepresentation), and TOut the output type. If rescale is true,
+ * the output is slope * value + intercept of each slice.
+ *
+ * The volume is in Matlab column-major (rows, cols, slices) order,
+ * while DICOM stores pixels row by row, so each slice is decoded into
+ * a per-thread buffer and transposed into the volume. Compressed
+ * transfer syntaxes are decoded by GDCM.
+ */
+template <class TIn, class TOut>
+class DicomDecodeFunctor {
+
+ public:
+
+  DicomDecodeFunctor(const DicomSeries &_series, TOut *_out, bool _rescale,
+		     unsigned int numThreads)
+    : series(_series), out(_out), rescale(_rescale), buffers(numThreads) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t R = this->series.GetRows();
+    const size_t C = this->series.GetCols();
+    std::vector<char> &buf = this->buffers[thread];
+    for (size_t k = begin; k < end; ++k) {
+      const DicomSliceHeader &h = this->series.GetSlice(k);
+      gdcm::ImageReader reader;
+      reader.SetFileName(h.fileName.c_str());
+      if (!reader.Read()) {
+	throw std::runtime_error("Cannot read pixel data of " + h.fileName);
+      }
+      const gdcm::Image &image = reader.GetImage();
+      if (image.GetPixelFormat().GetPixelSize() != sizeof(TIn)
+	  || image.GetBufferLength() < R * C * sizeof(TIn)) {
+	throw std::runtime_error("Unexpected pixel format in " + h.fileName);
+      }
+      buf.resize(image.GetBufferLength());
+      if (!image.GetBuffer(&buf[0])) {
+	throw std::runtime_error("Cannot decode pixel data of " + h.fileName);
+      }
+
+      // transpose the slice
+      const TIn *in = (const TIn *)&buf[0];
+      TOut *o = this->out + k * R * C;
+      if (this->rescale) {
+	const double slope = h.rescaleSlope;
+	const double intercept = h.rescaleIntercept;
+	for (size_t c = 0; c < C; ++c) {
+	  for (size_t r = 0; r < R; ++r) {
+	    o[r + c * R] = (TOut)(slope * in[r * C + c] + intercept);
+	  }
+	}
+      } else {
+	for (size_t c = 0; c < C; ++c) {
+	  for (size_t r = 0; r < R; ++r) {
+	    o[r + c * R] = (TOut)in[r * C + c];
+	  }
+	}
+      }
+    }
+  }
+
+ private:
+
+  const DicomSeries &series;
+  TOut *out;
+  bool rescale;
+  std::vector<std::vector<char> > buffers;
+
+};
+
+#endif /* DICOMSERIESREADER_H */
@@ -0,0 +1,831 @@
+/*
+ * TiffReader.h
+ *
+ * Reader for TIFF and BigTIFF files, used by MEX functions
+ * tiff_read_info.cpp and tiff_read_roi.cpp.
+ *
+ * The file is memory-mapped, and the chain of Image File Directories
+ * (IFDs) is walked when the file is opened. Tag values are not
+ * copied, only their position in the file, so files with thousands
+ * of IFDs are opened quickly.
+ *
+ * Images are split into strips or tiles (segments) that are
+ * compressed independently. TiffReadFunctor decodes only the
+ * segments that intersect a region of interest, and segments can be
+ * decoded in parallel, so any block of a 100 GB file can be read
+ * without loading the rest.
+ *
+ * Supported images have 8, 16, 32 or 64 bits per sample (unsigned,
+ * signed or floating point), any number of samples per pixel, chunky
+ * or planar configuration, and no compression, LZW, Deflate or
+ * PackBits compression, with or without horizontal differencing
+ * predictor. Both byte orders are supported.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef TIFFREADER_H
+#define TIFFREADER_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Boost headers */
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/* zlib headers */
+#include <zlib.h>
+
+// TIFF field types
+enum TiffType {
+  TIFF_BYTE = 1, TIFF_ASCII = 2, TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_RATIONAL = 5,
+  TIFF_SBYTE = 6, TIFF_UNDEFINED = 7, TIFF_SSHORT = 8, TIFF_SLONG = 9,
+  TIFF_SRATIONAL = 10, TIFF_FLOAT = 11, TIFF_DOUBLE = 12, TIFF_IFD = 13,
+  TIFF_LONG8 = 16, TIFF_SLONG8 = 17, TIFF_IFD8 = 18
+};
+
+// size in bytes of one value of a TIFF field type, or 0 if the type
+// is unknown
+inline size_t tiffTypeSize(unsigned int type) {
+  switch (type) {
+  case TIFF_BYTE: case TIFF_ASCII: case TIFF_SBYTE: case TIFF_UNDEFINED:
+    return 1;
+  case TIFF_SHORT: case TIFF_SSHORT:
+    return 2;
+  case TIFF_LONG: case TIFF_SLONG: case TIFF_FLOAT: case TIFF_IFD:
+    return 4;
+  case TIFF_RATIONAL: case TIFF_SRATIONAL: case TIFF_DOUBLE:
+  case TIFF_LONG8: case TIFF_SLONG8: case TIFF_IFD8:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * TiffTag: a tag of an IFD. The values are at offset dataOffset of
+ * the file, either inside the IFD entry or elsewhere.
+ */
+class TiffTag {
+
+ public:
+
+  unsigned int code;
+  unsigned int type;
+  boost::uint64_t count;
+  boost::uint64_t dataOffset;
+
+  bool operator<(const TiffTag &other) const {
+    return this->code < other.code;
+  }
+
+};
+
+/*
+ * TiffIfd: an Image File Directory, i.e. the tags of one image of the
+ * file, sorted by code.
+ */
+class TiffIfd {
+
+ public:
+
+  boost::uint64_t offset;
+  std::vector<TiffTag> tags;
+
+  // tag with the given code, or NULL if the IFD doesn't have it
+  const TiffTag *Find(unsigned int code) const {
+    TiffTag key;
+    key.code = code;
+    std::vector<TiffTag>::const_iterator it
+      = std::lower_bound(this->tags.begin(), this->tags.end(), key);
+    return (it == this->tags.end() || it->code != code) ? NULL : &(*it);
+  }
+
+};
+
+/*
+ * TiffFile: memory-mapped TIFF or BigTIFF file, and the chain of
+ * IFDs.
+ *
+ * Only the IFD entries are read when the file is opened, so opening
+ * a file with thousands of images and hundreds of GB is fast, and
+ * pixel data are only paged in from disk when a strip or tile is
+ * decoded.
+ *
+ * The constructor throws std::runtime_error if the file cannot be
+ * read or is not valid.
+ */
+class TiffFile {
+
+ public:
+
+  TiffFile(const std::string &_fileName) : fileName(_fileName) {
+    try {
+      boost::interprocess::file_mapping mapping(this->fileName.c_str(),
+						boost::interprocess::read_only);
+      boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+      this->region.swap(region);
+    } catch (boost::interprocess::interprocess_exception &e) {
+      throw std::runtime_error("Cannot map file " + this->fileName + ": " + e.what());
+    }
+    this->data = (const unsigned char *)this->region.get_address();
+    this->size = this->region.get_size();
+
+    // header
+    if (this->size < 8 || !((this->data[0] == 'I' && this->data[1] == 'I')
+			    || (this->data[0] == 'M' && this->data[1] == 'M'))) {
+      throw std::runtime_error("File " + this->fileName + " is not a TIFF file");
+    }
+    this->bigEndian = this->data[0] == 'M';
+    unsigned int version = this->ReadU16(2);
+    boost::uint64_t ifdOffset;
+    if (version == 42) {
+      this->bigTiff = false;
+      ifdOffset = this->ReadU32(4);
+    } else if (version == 43 && this->size >= 16 && this->ReadU16(4) == 8) {
+      this->bigTiff = true;
+      ifdOffset = this->ReadU64(8);
+    } else {
+      throw std::runtime_error("File " + this->fileName + " is not a TIFF file");
+    }
+
+    // walk the IFD chain. Loops in corrupt files are detected
+    std::set<boost::uint64_t> visited;
+    while (ifdOffset != 0) {
+      if (!visited.insert(ifdOffset).second) {
+	throw std::runtime_error("File " + this->fileName + " has a loop in the IFD chain");
+      }
+      ifdOffset = this->ReadIfd(ifdOffset);
+    }
+  }
+
+  const std::string &GetFileName() const {
+    return this->fileName;
+  }
+
+  bool IsBigTiff() const {
+    return this->bigTiff;
+  }
+
+  // true if the file has a different byte order from the machine
+  bool IsByteSwapped() const {
+    const boost::uint16_t one = 1;
+    return this->bigEndian == (*(const unsigned char *)&one == 1);
+  }
+
+  size_t GetNumberOfIfds() const {
+    return this->ifds.size();
+  }
+
+  const TiffIfd &GetIfd(size_t i) const {
+    return this->ifds[i];
+  }
+
+  // pointer to n bytes of the file at offset. Throws if the bytes are
+  // outside the file
+  const unsigned char *GetData(boost::uint64_t offset, boost::uint64_t n) const {
+    if (offset > this->size || n > this->size - offset) {
+      throw std::runtime_error("File " + this->fileName
+			       + " is truncated or has an invalid offset");
+    }
+    return this->data + offset;
+  }
+
+  // numeric values of a tag, converted to double. Rationals are
+  // converted to numerator/denominator
+  std::vector<double> GetValues(const TiffTag &tag) const {
+    const size_t es = tiffTypeSize(tag.type);
+    const unsigned char *p = this->GetData(tag.dataOffset, tag.count * es);
+    std::vector<double> v(tag.count);
+    for (size_t i = 0; i < tag.count; ++i, p += es) {
+      v[i] = this->ConvertValue(p, tag.type);
+    }
+    return v;
+  }
+
+  // integer values of a tag, e.g. strip offsets
+  std::vector<boost::uint64_t> GetIntegerValues(const TiffTag &tag) const {
+    const size_t es = tiffTypeSize(tag.type);
+    const unsigned char *p = this->GetData(tag.dataOffset, tag.count * es);
+    std::vector<boost::uint64_t> v(tag.count);
+    for (size_t i = 0; i < tag.count; ++i, p += es) {
+      switch (tag.type) {
+      case TIFF_BYTE: case TIFF_UNDEFINED:
+	v[i] = p[0];
+	break;
+      case TIFF_SHORT:
+	v[i] = this->ToU16(p);
+	break;
+      case TIFF_LONG: case TIFF_IFD:
+	v[i] = this->ToU32(p);
+	break;
+      case TIFF_LONG8: case TIFF_IFD8:
+	v[i] = this->ToU64(p);
+	break;
+      default:
+	throw std::runtime_error("Tag " + ToString(tag.code) + " is not an unsigned integer");
+      }
+    }
+    return v;
+  }
+
+  // first value of tag code of an IFD, or def if the IFD doesn't have
+  // the tag
+  double GetValue(const TiffIfd &ifd, unsigned int code, double def) const {
+    const TiffTag *tag = ifd.Find(code);
+    if (tag == NULL || tag->count == 0) {
+      return def;
+    }
+    return this->ConvertValue(this->GetData(tag->dataOffset, tiffTypeSize(tag->type)),
+			      tag->type);
+  }
+
+  // file values with the byte order of the file
+  unsigned int ToU16(const unsigned char *p) const {
+    return this->bigEndian ? ((unsigned int)p[0] << 8 | p[1])
+      : ((unsigned int)p[1] << 8 | p[0]);
+  }
+
+  boost::uint32_t ToU32(const unsigned char *p) const {
+    boost::uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+      v = (v << 8) | p[this->bigEndian ? i : 3 - i];
+    }
+    return v;
+  }
+
+  boost::uint64_t ToU64(const unsigned char *p) const {
+    boost::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+      v = (v << 8) | p[this->bigEndian ? i : 7 - i];
+    }
+    return v;
+  }
+
+  static std::string ToString(boost::uint64_t v) {
+    std::ostringstream s;
+    s << v;
+    return s.str();
+  }
+
+ private:
+
+  unsigned int ReadU16(boost::uint64_t offset) const {
+    return this->ToU16(this->GetData(offset, 2));
+  }
+
+  boost::uint32_t ReadU32(boost::uint64_t offset) const {
+    return this->ToU32(this->GetData(offset, 4));
+  }
+
+  boost::uint64_t ReadU64(boost::uint64_t offset) const {
+    return this->ToU64(this->GetData(offset, 8));
+  }
+
+  // read the IFD at offset, and return the offset of the next one
+  boost::uint64_t ReadIfd(boost::uint64_t offset) {
+    const size_t countSize = this->bigTiff ? 8 : 2;
+    const size_t entrySize = this->bigTiff ? 20 : 12;
+    const size_t inlineSize = this->bigTiff ? 8 : 4;
+    boost::uint64_t n = this->bigTiff ? this->ReadU64(offset) : this->ReadU16(offset);
+    const unsigned char *p = this->GetData(offset + countSize, n * entrySize + inlineSize);
+
+    TiffIfd ifd;
+    ifd.offset = offset;
+    ifd.tags.reserve(n);
+    for (boost::uint64_t i = 0; i < n; ++i, p += entrySize) {
+      TiffTag tag;
+      tag.code = this->ToU16(p);
+      tag.type = this->ToU16(p + 2);
+      tag.count = this->bigTiff ? this->ToU64(p + 4) : this->ToU32(p + 4);
+      const unsigned char *value = p + (this->bigTiff ? 12 : 8);
+      const size_t es = tiffTypeSize(tag.type);
+      if (es == 0) {
+	// unknown types are skipped, as the TIFF specification requires
+	continue;
+      }
+      if (tag.count * es <= inlineSize) {
+	tag.dataOffset = value - this->data;
+      } else {
+	tag.dataOffset = this->bigTiff ? this->ToU64(value) : this->ToU32(value);
+	this->GetData(tag.dataOffset, tag.count * es);
+      }
+      ifd.tags.push_back(tag);
+    }
+    std::sort(ifd.tags.begin(), ifd.tags.end());
+    this->ifds.push_back(ifd);
+    return this->bigTiff ? this->ToU64(p) : this->ToU32(p);
+  }
+
+  double ConvertValue(const unsigned char *p, unsigned int type) const {
+    switch (type) {
+    case TIFF_BYTE: case TIFF_ASCII: case TIFF_UNDEFINED:
+      return p[0];
+    case TIFF_SBYTE:
+      return (signed char)p[0];
+    case TIFF_SHORT:
+      return this->ToU16(p);
+    case TIFF_SSHORT:
+      return (boost::int16_t)this->ToU16(p);
+    case TIFF_LONG: case TIFF_IFD:
+      return this->ToU32(p);
+    case TIFF_SLONG:
+      return (boost::int32_t)this->ToU32(p);
+    case TIFF_RATIONAL:
+      return (double)this->ToU32(p) / (double)this->ToU32(p + 4);
+    case TIFF_SRATIONAL:
+      return (double)(boost::int32_t)this->ToU32(p)
+	/ (double)(boost::int32_t)this->ToU32(p + 4);
+    case TIFF_FLOAT: {
+      boost::uint32_t u = this->ToU32(p);
+      float f;
+      std::memcpy(&f, &u, 4);
+      return f;
+    }
+    case TIFF_DOUBLE: {
+      boost::uint64_t u = this->ToU64(p);
+      double d;
+      std::memcpy(&d, &u, 8);
+      return d;
+    }
+    case TIFF_LONG8: case TIFF_IFD8:
+      return (double)this->ToU64(p);
+    case TIFF_SLONG8:
+      return (double)(boost::int64_t)this->ToU64(p);
+    default:
+      return 0.0;
+    }
+  }
+
+  std::string fileName;
+  boost::interprocess::mapped_region region;
+  const unsigned char *data;
+  size_t size;
+  bool bigEndian;
+  bool bigTiff;
+  std::vector<TiffIfd> ifds;
+
+};
+
+/*
+ * tiffInflate(): decompress Deflate (zlib) data. Returns the number
+ * of bytes decoded.
+ */
+inline size_t tiffInflate(const unsigned char *src, size_t n, unsigned char *dst,
+			  size_t dstSize) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    throw std::runtime_error("zlib initialisation failed");
+  }
+  zs.next_in = (Bytef *)src;
+  zs.avail_in = (uInt)n;
+  zs.next_out = dst;
+  zs.avail_out = (uInt)dstSize;
+  int err = inflate(&zs, Z_FINISH);
+  size_t decoded = dstSize - zs.avail_out;
+  inflateEnd(&zs);
+  if (err != Z_STREAM_END && err != Z_OK && err != Z_BUF_ERROR) {
+    throw std::runtime_error("Invalid Deflate data");
+  }
+  return decoded;
+}
+
+/*
+ * tiffPackBits(): decompress PackBits data. Returns the number of
+ * bytes decoded.
+ */
+inline size_t tiffPackBits(const unsigned char *src, size_t n, unsigned char *dst,
+			   size_t dstSize) {
+  size_t i = 0, o = 0;
+  while (i < n && o < dstSize) {
+    int c = (signed char)src[i++];
+    if (c >= 0) {
+      size_t len = std::min((size_t)c + 1, std::min(n - i, dstSize - o));
+      std::memcpy(dst + o, src + i, len);
+      i += c + 1;
+      o += len;
+    } else if (c != -128 && i < n) {
+      size_t len = std::min((size_t)(1 - c), dstSize - o);
+      std::memset(dst + o, src[i++], len);
+      o += len;
+    }
+  }
+  return o;
+}
+
+/*
+ * tiffLzw(): decompress TIFF LZW data (MSB-first codes of 9 to 12
+ * bits, with "early change"). Returns the number of bytes decoded.
+ */
+inline size_t tiffLzw(const unsigned char *src, size_t n, unsigned char *dst,
+		      size_t dstSize) {
+  const unsigned int ClearCode = 256;
+  const unsigned int EoiCode = 257;
+
+  // code table: each entry is a previous code plus one byte
+  std::vector<unsigned int> prefix(4096);
+  std::vector<unsigned char> suffix(4096), first(4096);
+  std::vector<size_t> length(4096);
+  for (unsigned int c = 0; c < 256; ++c) {
+    prefix[c] = 4096;
+    suffix[c] = first[c] = (unsigned char)c;
+    length[c] = 1;
+  }
+
+  size_t o = 0;
+  boost::uint64_t bitPos = 0;
+  const boost::uint64_t nBits = (boost::uint64_t)n * 8;
+  unsigned int width = 9;
+  unsigned int next = 258;
+  unsigned int old = 4096;
+  while (bitPos + width <= nBits) {
+    // read the next code
+    unsigned int code = 0;
+    for (unsigned int b = 0; b < width; ++b, ++bitPos) {
+      code = (code << 1) | ((src[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+    }
+    if (code == EoiCode) {
+      break;
+    }
+    if (code == ClearCode) {
+      width = 9;
+      next = 258;
+      old = 4096;
+      continue;
+    }
+    if (code > next || (code == next && old == 4096)) {
+      throw std::runtime_error("Invalid LZW data");
+    }
+
+    // add a new entry to the table
+    if (old != 4096 && next < 4096) {
+      prefix[next] = old;
+      first[next] = first[old];
+      suffix[next] = (code == next) ? first[old] : first[code];
+      length[next] = length[old] + 1;
+      ++next;
+      if (next + 1 >= (1u << width) && width < 12) {
+	++width;
+      }
+    }
+
+    // write the string of the code, from its end
+    size_t len = length[code];
+    size_t end = std::min(o + len, dstSize);
+    unsigned int c = code;
+    for (size_t k = o + len; k > o; --k) {
+      if (k - 1 < end) {
+	dst[k - 1] = suffix[c];
+      }
+      c = prefix[c];
+    }
+    o = end;
+    old = code;
+    if (o == dstSize) {
+      break;
+    }
+  }
+  return o;
+}
+
+/*
+ * TiffImage: layout of the image of an IFD, i.e. size, pixel type,
+ * compression and the strips or tiles (segments) it is split into.
+ *
+ * Throws std::runtime_error for layouts that cannot be decoded.
+ */
+class TiffImage {
+
+ public:
+
+  size_t width, height, samples;
+  unsigned int bitsPerSample;
+  unsigned int sampleFormat;      // 1: unsigned int, 2: signed int, 3: float
+  unsigned int compression;       // 1: none, 5: LZW, 8/32946: Deflate, 32773: PackBits
+  unsigned int predictor;         // 1: none, 2: horizontal differencing
+  bool planar;                    // PlanarConfiguration == 2
+  bool tiled;
+  size_t segWidth, segHeight;     // tile size, or (width, RowsPerStrip)
+  size_t segsAcross, segsDown;    // number of segments per plane
+  std::vector<boost::uint64_t> offsets, byteCounts;
+
+  TiffImage(const TiffFile &tiff, size_t ifdIndex) {
+    const TiffIfd &ifd = tiff.GetIfd(ifdIndex);
+    const std::string where = " in IFD " + TiffFile::ToString(ifdIndex + 1);
+    this->width = (size_t)tiff.GetValue(ifd, 256, 0);
+    this->height = (size_t)tiff.GetValue(ifd, 257, 0);
+    this->samples = (size_t)tiff.GetValue(ifd, 277, 1);
+    this->bitsPerSample = (unsigned int)tiff.GetValue(ifd, 258, 1);
+    this->sampleFormat = (unsigned int)tiff.GetValue(ifd, 339, 1);
+    this->compression = (unsigned int)tiff.GetValue(ifd, 259, 1);
+    this->predictor = (unsigned int)tiff.GetValue(ifd, 317, 1);
+    this->planar = tiff.GetValue(ifd, 284, 1) == 2 && this->samples > 1;
+    if (this->width == 0 || this->height == 0 || this->samples == 0) {
+      throw std::runtime_error("Invalid image size" + where);
+    }
+    if (this->bitsPerSample != 8 && this->bitsPerSample != 16
+	&& this->bitsPerSample != 32 && this->bitsPerSample != 64) {
+      throw std::runtime_error("Only 8, 16, 32 or 64 bits per sample are supported" + where);
+    }
+    if (this->sampleFormat < 1 || this->sampleFormat > 3
+	|| (this->sampleFormat == 3 && this->bitsPerSample < 32)) {
+      throw std::runtime_error("Unsupported SampleFormat" + where);
+    }
+    if (this->compression != 1 && this->compression != 5 && this->compression != 8
+	&& this->compression != 32946 && this->compression != 32773) {
+      throw std::runtime_error("Unsupported compression " + TiffFile::ToString(this->compression)
+			       + where + " (only none, LZW, Deflate and PackBits)");
+    }
+    if (this->predictor != 1 && (this->predictor != 2 || this->sampleFormat == 3)) {
+      throw std::runtime_error("Unsupported Predictor" + where);
+    }
+
+    // strips or tiles
+    const TiffTag *offsetsTag, *countsTag;
+    this->tiled = ifd.Find(322) != NULL;
+    if (this->tiled) {
+      this->segWidth = (size_t)tiff.GetValue(ifd, 322, 0);
+      this->segHeight = (size_t)tiff.GetValue(ifd, 323, 0);
+      offsetsTag = ifd.Find(324);
+      countsTag = ifd.Find(325);
+    } else {
+      this->segWidth = this->width;
+      this->segHeight = std::min((size_t)tiff.GetValue(ifd, 278, (double)this->height),
+				 this->height);
+      offsetsTag = ifd.Find(273);
+      countsTag = ifd.Find(279);
+    }
+    if (this->segWidth == 0 || this->segHeight == 0 || offsetsTag == NULL) {
+      throw std::runtime_error("Invalid strip or tile layout" + where);
+    }
+    this->segsAcross = (this->width + this->segWidth - 1) / this->segWidth;
+    this->segsDown = (this->height + this->segHeight - 1) / this->segHeight;
+    this->offsets = tiff.GetIntegerValues(*offsetsTag);
+    if (countsTag != NULL) {
+      this->byteCounts = tiff.GetIntegerValues(*countsTag);
+    } else if (this->compression == 1 && this->offsets.size() == 1) {
+      // some writers omit the byte count of uncompressed single-strip
+      // images
+      this->byteCounts.push_back(this->GetSegmentBytes());
+    }
+    const size_t nSegs = this->segsAcross * this->segsDown * (this->planar ? this->samples : 1);
+    if (this->offsets.size() < nSegs || this->byteCounts.size() < nSegs) {
+      throw std::runtime_error("Missing strip or tile offsets" + where);
+    }
+  }
+
+  size_t GetBytesPerSample() const {
+    return this->bitsPerSample / 8;
+  }
+
+  // samples per pixel stored in each segment
+  size_t GetSegmentSamples() const {
+    return this->planar ? 1 : this->samples;
+  }
+
+  // decoded size of a full segment
+  size_t GetSegmentBytes() const {
+    return this->segWidth * this->segHeight * this->GetSegmentSamples()
+      * this->GetBytesPerSample();
+  }
+
+  // index of the segment with the given position and plane
+  size_t GetSegmentIndex(size_t segRow, size_t segCol, size_t plane) const {
+    return (plane * this->segsDown + segRow) * this->segsAcross + segCol;
+  }
+
+  // true if both images have the same size and pixel type
+  bool IsCompatible(const TiffImage &other) const {
+    return this->width == other.width && this->height == other.height
+      && this->samples == other.samples && this->bitsPerSample == other.bitsPerSample
+      && this->sampleFormat == other.sampleFormat;
+  }
+
+  // decode segment idx into buf, in native byte order. Returns a
+  // pointer to the decoded samples, row-major with
+  // GetSegmentSamples() interleaved samples per pixel
+  const unsigned char *DecodeSegment(const TiffFile &tiff, size_t idx,
+				     std::vector<unsigned char> &buf) const {
+    const size_t nBytes = this->GetSegmentBytes();
+    const unsigned char *src = tiff.GetData(this->offsets[idx], this->byteCounts[idx]);
+    const size_t srcBytes = (size_t)this->byteCounts[idx];
+    buf.resize(nBytes);
+    size_t decoded;
+    switch (this->compression) {
+    case 1:
+      decoded = std::min(srcBytes, nBytes);
+      std::memcpy(&buf[0], src, decoded);
+      break;
+    case 5:
+      decoded = tiffLzw(src, srcBytes, &buf[0], nBytes);
+      break;
+    case 32773:
+      decoded = tiffPackBits(src, srcBytes, &buf[0], nBytes);
+      break;
+    default:
+      decoded = tiffInflate(src, srcBytes, &buf[0], nBytes);
+      break;
+    }
+
+    // the last strip can be shorter than RowsPerStrip
+    if (decoded < nBytes) {
+      std::memset(&buf[decoded], 0, nBytes - decoded);
+    }
+
+    const size_t bps = this->GetBytesPerSample();
+    if (tiff.IsByteSwapped() && bps > 1) {
+      for (size_t i = 0; i < nBytes; i += bps) {
+	std::reverse(&buf[i], &buf[i] + bps);
+      }
+    }
+    if (this->predictor == 2) {
+      switch (bps) {
+      case 1:
+	this->UndoPredictor((boost::uint8_t *)&buf[0]);
+	break;
+      case 2:
+	this->UndoPredictor((boost::uint16_t *)&buf[0]);
+	break;
+      case 4:
+	this->UndoPredictor((boost::uint32_t *)&buf[0]);
+	break;
+      default:
+	this->UndoPredictor((boost::uint64_t *)&buf[0]);
+	break;
+      }
+    }
+    return &buf[0];
+  }
+
+ private:
+
+  // horizontal differencing: each sample is stored as the difference
+  // with the same sample of the previous pixel in the row
+  template <class T>
+  void UndoPredictor(T *p) const {
+    const size_t spp = this->GetSegmentSamples();
+    const size_t rowLength = this->segWidth * spp;
+    for (size_t r = 0; r < this->segHeight; ++r, p += rowLength) {
+      for (size_t i = spp; i < rowLength; ++i) {
+	p[i] = (T)(p[i] + p[i - spp]);
+      }
+    }
+  }
+
+};
+
+/*
+ * TiffReadFunctor: decode the strips or tiles of a region of interest
+ * (ROI) of a stack of TIFF images.
+ *
+ * The ROI is rows [row0, row0 + nRows) and columns [col0, col0 +
+ * nCols) of images ifdIndices (all with the same size and pixel
+ * type). The output is in Matlab column-major order (row, col,
+ * sample, image).
+ *
+ * The functor runs over the list of segments that intersect the
+ * ROI. Each segment is decompressed into a per-thread buffer and its
+ * intersection with the ROI copied to the output, so segments of the
+ * same or different images are decoded in parallel.
+ */
+template <class T>
+class TiffReadFunctor {
+
+ public:
+
+  TiffReadFunctor(const TiffFile &_tiff, const std::vector<size_t> &ifdIndices,
+		  size_t _row0, size_t _nRows, size_t _col0, size_t _nCols, T *_out,
+		  unsigned int numThreads)
+    : tiff(_tiff), row0(_row0), nRows(_nRows), col0(_col0), nCols(_nCols),
+      out(_out), buffers(numThreads) {
+    for (size_t z = 0; z < ifdIndices.size(); ++z) {
+      this->images.push_back(TiffImage(this->tiff, ifdIndices[z]));
+      const TiffImage &im = this->images.back();
+      if (!im.IsCompatible(this->images[0])) {
+	throw std::runtime_error("All images must have the same size and pixel type");
+      }
+      if (im.GetBytesPerSample() != sizeof(T)) {
+	throw std::runtime_error("Output type doesn't match the pixel type");
+      }
+      if (this->nRows == 0 || this->nCols == 0) {
+	continue;
+      }
+      if (this->row0 + this->nRows > im.height || this->col0 + this->nCols > im.width) {
+	throw std::runtime_error("ROI is outside the image");
+      }
+
+      // segments that intersect the ROI
+      const size_t sr0 = this->row0 / im.segHeight;
+      const size_t sr1 = (this->row0 + this->nRows - 1) / im.segHeight;
+      const size_t sc0 = this->col0 / im.segWidth;
+      const size_t sc1 = (this->col0 + this->nCols - 1) / im.segWidth;
+      const size_t nPlanes = im.planar ? im.samples : 1;
+      for (size_t plane = 0; plane < nPlanes; ++plane) {
+	for (size_t sr = sr0; sr <= sr1; ++sr) {
+	  for (size_t sc = sc0; sc <= sc1; ++sc) {
+	    Segment seg;
+	    seg.image = z;
+	    seg.row = sr;
+	    seg.col = sc;
+	    seg.plane = plane;
+	    this->segments.push_back(seg);
+	  }
+	}
+      }
+    }
+  }
+
+  size_t GetNumberOfSegments() const {
+    return this->segments.size();
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    std::vector<unsigned char> &buf = this->buffers[thread];
+    for (size_t i = begin; i < end; ++i) {
+      const Segment &seg = this->segments[i];
+      const TiffImage &im = this->images[seg.image];
+      const T *in = (const T *)im.DecodeSegment(
+	this->tiff, im.GetSegmentIndex(seg.row, seg.col, seg.plane), buf);
+
+      // intersection of the segment with the ROI
+      const size_t y0 = seg.row * im.segHeight;
+      const size_t x0 = seg.col * im.segWidth;
+      const size_t r0 = std::max(y0, this->row0);
+      const size_t r1 = std::min(y0 + im.segHeight, this->row0 + this->nRows);
+      const size_t c0 = std::max(x0, this->col0);
+      const size_t c1 = std::min(x0 + im.segWidth, this->col0 + this->nCols);
+
+      // copy to the output, transposing from row-major
+      const size_t spp = im.GetSegmentSamples();
+      const size_t planeSize = this->nRows * this->nCols;
+      T *o = this->out + seg.image * planeSize * im.samples;
+      for (size_t s = 0; s < spp; ++s) {
+	const size_t sample = im.planar ? seg.plane : s;
+	T *os = o + sample * planeSize;
+	for (size_t r = r0; r < r1; ++r) {
+	  const T *pin = in + ((r - y0) * im.segWidth + (c0 - x0)) * spp + s;
+	  T *pout = os + (r - this->row0) + (c0 - this->col0) * this->nRows;
+	  for (size_t c = c0; c < c1; ++c, pin += spp, pout += this->nRows) {
+	    *pout = *pin;
+	  }
+	}
+      }
+    }
+  }
+
+ private:
+
+  struct Segment {
+    size_t image, row, col, plane;
+  };
+
+  const TiffFile &tiff;
+  size_t row0, nRows, col0, nCols;
+  T *out;
+  std::vector<TiffImage> images;
+  std::vector<Segment> segments;
+  std::vector<std::vector<unsigned char> > buffers;
+
+};
+
+#endif /* TIFFREADER_H */
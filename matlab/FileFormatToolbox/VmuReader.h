@@ -0,0 +1,315 @@
+/*
+ * VmuReader.h
+ *
+ * Reader for Hamamatsu Uncompressed Virtual Microscope Specimen files
+ * (.vmu), used by MEX function vmu_read.cpp and command line program
+ * vmu2png.
+ *
+ * A .vmu file is a small text header with "Key=Value" lines, e.g.
+ *
+ *   [Uncompressed Virtual Microscope Specimen]
+ *   ImageFile=slide.ngr
+ *   PixelWidth=51200
+ *   PixelHeight=38144
+ *   PhysicalWidth=23552000
+ *   PhysicalHeight=17546240
+ *   ...
+ *
+ * Physical sizes are in nm, so the pixel size is
+ * PhysicalWidth/PixelWidth nm.
+ *
+ * The pixels are in the file given by ImageFile (.ngr), that has a
+ * binary header with little-endian int32 values
+ *
+ *   offset  0: magic "GN"
+ *   offset  4: image width
+ *   offset  8: image height
+ *   offset 12: column width
+ *   offset 24: offset of the first pixel
+ *
+ * The image is split into vertical strips of "column width"
+ * pixels. Strips are stored one after the other, and each strip
+ * row by row. Each pixel has 3 little-endian 16-bit words in order
+ * R, G, B, with 12 significant bits (values 0 to 4095), as decoded
+ * by the NGR reader of OpenSlide (openslide-vendor-hamamatsu.c).
+ *
+ * The .ngr file is memory-mapped, so only the pages that are decoded
+ * are read from disk, and no intermediate buffer is needed.
+ *
+ * VmuDecodeFunctor converts tiles of the image to RGB with 8 or 16
+ * bits per channel, and arbitrary strides, so that it can write both
+ * Matlab's (row, col, channel) column-major layout and the
+ * interleaved row-major layout of ITK and image files. Tiles are
+ * independent and can be decoded in parallel.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef VMUREADER_H
+#define VMUREADER_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/* Boost headers */
+#include <boost/cstdint.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+/*
+ * VmuFile: header and memory-mapped pixel data of a .vmu file.
+ *
+ * The constructor throws std::runtime_error if the file cannot be
+ * read or is not valid.
+ */
+class VmuFile {
+
+ public:
+
+  // number of bytes per pixel in the .ngr file
+  static const size_t BytesPerPixel = 6;
+
+  VmuFile(const std::string &vmuFileName) {
+    this->ReadHeader(vmuFileName);
+
+    // the image file is relative to the directory of the .vmu file
+    std::string ngrFileName = this->GetHeaderValue("ImageFile");
+    size_t sep = vmuFileName.find_last_of("/\\");
+    if (sep != std::string::npos && !ngrFileName.empty()
+	&& ngrFileName[0] != '/' && ngrFileName[0] != '\\'
+	&& ngrFileName.find(':') == std::string::npos) {
+      ngrFileName = vmuFileName.substr(0, sep + 1) + ngrFileName;
+    }
+    this->MapImageFile(ngrFileName);
+  }
+
+  size_t GetWidth() const {
+    return this->width;
+  }
+
+  size_t GetHeight() const {
+    return this->height;
+  }
+
+  size_t GetColumnWidth() const {
+    return this->columnWidth;
+  }
+
+  // all "Key=Value" pairs of the .vmu header
+  const std::map<std::string, std::string> &GetHeader() const {
+    return this->header;
+  }
+
+  // value of a header key, or "" if the key is not present
+  std::string GetHeaderValue(const std::string &key) const {
+    std::map<std::string, std::string>::const_iterator it = this->header.find(key);
+    return (it == this->header.end()) ? std::string() : it->second;
+  }
+
+  // numeric value of a header key, or def if the key is not present
+  double GetHeaderNumber(const std::string &key, double def) const {
+    std::istringstream s(this->GetHeaderValue(key));
+    double v;
+    return (s >> v) ? v : def;
+  }
+
+  // pixel size in nm along x (dim=0) or y (dim=1), or 0.0 if the
+  // header doesn't have the physical size
+  double GetPixelSize(int dim) const {
+    double physical = this->GetHeaderNumber(dim == 0 ? "PhysicalWidth"
+					    : "PhysicalHeight", 0.0);
+    double pixels = this->GetHeaderNumber(dim == 0 ? "PixelWidth" : "PixelHeight",
+					  (double)(dim == 0 ? this->width : this->height));
+    return (pixels > 0.0) ? physical / pixels : 0.0;
+  }
+
+  // pointer to the first byte of pixel (x, y) in the mapped file
+  const unsigned char *GetPixel(size_t x, size_t y) const {
+    const size_t strip = x / this->columnWidth;
+    const size_t xs = x % this->columnWidth;
+    return this->pixels
+      + ((strip * this->height + y) * this->columnWidth + xs) * BytesPerPixel;
+  }
+
+ private:
+
+  // parse the "Key=Value" lines of the .vmu text header
+  void ReadHeader(const std::string &fileName) {
+    std::ifstream f(fileName.c_str());
+    if (!f) {
+      throw std::runtime_error("Cannot open file " + fileName);
+    }
+    std::string line;
+    while (std::getline(f, line)) {
+      // remove Windows end of line and surrounding spaces
+      size_t last = line.find_last_not_of(" \t\r");
+      size_t first = line.find_first_not_of(" \t");
+      if (last == std::string::npos || line[first] == '[' || line[first] == ';') {
+	continue;
+      }
+      line = line.substr(first, last - first + 1);
+      size_t eq = line.find('=');
+      if (eq == std::string::npos) {
+	continue;
+      }
+      std::string key = line.substr(0, eq);
+      key = key.substr(0, key.find_last_not_of(" \t") + 1);
+      std::string value = line.substr(eq + 1);
+      value = value.substr(std::min(value.size(), value.find_first_not_of(" \t")));
+      this->header[key] = value;
+    }
+    if (this->GetHeaderValue("ImageFile").empty()) {
+      throw std::runtime_error("File " + fileName
+			       + " is not a VMU header (no ImageFile key)");
+    }
+  }
+
+  // little-endian int32 from the mapped file
+  static boost::int32_t ReadInt32(const unsigned char *p) {
+    return (boost::int32_t)((boost::uint32_t)p[0] | ((boost::uint32_t)p[1] << 8)
+			    | ((boost::uint32_t)p[2] << 16) | ((boost::uint32_t)p[3] << 24));
+  }
+
+  // map the .ngr file into memory, and check its header
+  void MapImageFile(const std::string &fileName) {
+    try {
+      boost::interprocess::file_mapping mapping(fileName.c_str(),
+						boost::interprocess::read_only);
+      boost::interprocess::mapped_region region(mapping, boost::interprocess::read_only);
+      this->region.swap(region);
+    } catch (boost::interprocess::interprocess_exception &e) {
+      throw std::runtime_error("Cannot map image file " + fileName + ": " + e.what());
+    }
+    const unsigned char *p = (const unsigned char *)this->region.get_address();
+    const size_t size = this->region.get_size();
+    if (size < 28 || p[0] != 'G' || p[1] != 'N') {
+      throw std::runtime_error("File " + fileName + " is not an NGR image file");
+    }
+    boost::int32_t w = ReadInt32(p + 4);
+    boost::int32_t h = ReadInt32(p + 8);
+    boost::int32_t cw = ReadInt32(p + 12);
+    boost::int32_t start = ReadInt32(p + 24);
+    if (w <= 0 || h <= 0 || cw <= 0 || start < 28 || w % cw != 0) {
+      throw std::runtime_error("File " + fileName + " has an invalid NGR header");
+    }
+    this->width = (size_t)w;
+    this->height = (size_t)h;
+    this->columnWidth = (size_t)cw;
+    if ((size_t)start + this->width * this->height * BytesPerPixel > size) {
+      throw std::runtime_error("File " + fileName + " is truncated");
+    }
+    this->pixels = p + start;
+  }
+
+  std::map<std::string, std::string> header;
+  boost::interprocess::mapped_region region;
+  const unsigned char *pixels;
+  size_t width, height, columnWidth;
+
+};
+
+/*
+ * VmuDecodeFunctor: decode tiles [begin, end) of a VMU image to RGB.
+ *
+ * Tiles are TileHeight rows of one strip of the .ngr file, numbered
+ * strip by strip. Within a tile the file is read sequentially.
+ *
+ * Channel ch of pixel (x, y) is written to
+ *
+ *   out[y*rowStride + x*colStride + ch*chanStride]
+ *
+ * TOut is an 8-bit (the 8 most significant of the 12 bits of each
+ * value are kept) or 16-bit (raw 12-bit values) unsigned type.
+ */
+template <class TOut>
+class VmuDecodeFunctor {
+
+ public:
+
+  static const size_t TileHeight = 64;
+
+  VmuDecodeFunctor(const VmuFile &_vmu, TOut *_out, size_t _rowStride,
+		   size_t _colStride, size_t _chanStride)
+    : vmu(_vmu), out(_out), rowStride(_rowStride), colStride(_colStride),
+      chanStride(_chanStride) {
+    this->tilesPerStrip = (this->vmu.GetHeight() + TileHeight - 1) / TileHeight;
+  }
+
+  // total number of tiles
+  size_t GetNumberOfTiles() const {
+    return this->tilesPerStrip * (this->vmu.GetWidth() / this->vmu.GetColumnWidth());
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const size_t cw = this->vmu.GetColumnWidth();
+    for (size_t tile = begin; tile < end; ++tile) {
+      const size_t x0 = (tile / this->tilesPerStrip) * cw;
+      const size_t y0 = (tile % this->tilesPerStrip) * TileHeight;
+      const size_t y1 = std::min(y0 + TileHeight, this->vmu.GetHeight());
+      for (size_t y = y0; y < y1; ++y) {
+	const unsigned char *p = this->vmu.GetPixel(x0, y);
+	TOut *o = this->out + y * this->rowStride + x0 * this->colStride;
+	for (size_t x = 0; x < cw; ++x, p += VmuFile::BytesPerPixel, o += this->colStride) {
+	  // file order is R, G, B
+	  o[0] = Convert(p[0] | (p[1] << 8));
+	  o[this->chanStride] = Convert(p[2] | (p[3] << 8));
+	  o[2 * this->chanStride] = Convert(p[4] | (p[5] << 8));
+	}
+      }
+    }
+  }
+
+ private:
+
+  // 12-bit value to the output type
+  static TOut Convert(unsigned int v) {
+    if (sizeof(TOut) == 1) {
+      return (TOut)std::min(v >> 4, 255u);
+    }
+    return (TOut)v;
+  }
+
+  const VmuFile &vmu;
+  TOut *out;
+  size_t rowStride, colStride, chanStride;
+  size_t tilesPerStrip;
+
+};
+
+#endif /* VMUREADER_H */
@@ -0,0 +1,278 @@
+/*
+ * scimat_load_chunked.cpp
+ *
+ * SCIMAT_LOAD_CHUNKED  Load a SCIMAT volume, or a region of interest,
+ * from a chunked compressed directory
+ *
+ * SCIMAT = scimat_load_chunked(DIR)
+ *
+ *   DIR is a string with the path to a directory saved with
+ *   scimat_save_chunked().
+ *
+ *   SCIMAT is a struct with the volume (see "help scimat" for
+ *   details). SCIMAT.data has the class of the saved data.
+ *
+ * SCIMAT = scimat_load_chunked(DIR, FROM, TO)
+ *
+ *   FROM, TO are vectors with the index coordinates that define a
+ *   region of interest, as in scimat_crop(). If FROM or TO don't have
+ *   all the dimensions, those dimensions are not cropped. FROM=[] and
+ *   TO=[] read the whole volume.
+ *
+ *   Only the chunks that intersect the region of interest are read
+ *   and decompressed. SCIMAT.axis.size is the size of the region, and
+ *   SCIMAT.axis.min is moved to the first voxel of the region, so
+ *
+ *     scimat_load_chunked(DIR, FROM, TO)
+ *
+ *   gives the same result as
+ *
+ *     scimat_crop(scimat_load_chunked(DIR), FROM, TO)
+ *
+ *   for volumes without rotation, but needs a fraction of the memory
+ *   and time for small regions.
+ *
+ *   Chunk files that are missing are read as zeros.
+ *
+ * SCIMAT = scimat_load_chunked(DIR, FROM, TO, NUMTHREADS)
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * See also: scimat_save_chunked, scimat_crop.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "ChunkedVolume.h"
+
+// Matlab class of a data type name
+mxClassID dataType2ClassID(const std::string &dataType) {
+  if (dataType == "double") {
+    return mxDOUBLE_CLASS;
+  } else if (dataType == "single") {
+    return mxSINGLE_CLASS;
+  } else if (dataType == "logical") {
+    return mxLOGICAL_CLASS;
+  } else if (dataType == "int8") {
+    return mxINT8_CLASS;
+  } else if (dataType == "uint8") {
+    return mxUINT8_CLASS;
+  } else if (dataType == "int16") {
+    return mxINT16_CLASS;
+  } else if (dataType == "uint16") {
+    return mxUINT16_CLASS;
+  } else if (dataType == "int32") {
+    return mxINT32_CLASS;
+  } else if (dataType == "uint32") {
+    return mxUINT32_CLASS;
+  } else if (dataType == "int64") {
+    return mxINT64_CLASS;
+  } else if (dataType == "uint64") {
+    return mxUINT64_CLASS;
+  }
+  return mxUNKNOWN_CLASS;
+}
+
+// read index vector pm (FROM or TO) into v. Missing dimensions are
+// set to def
+void readIndexVector(const mxArray *pm, const ChunkedVolumeInfo &info,
+		     const size_t *def, size_t *v, const char *name) {
+  for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+    v[d] = def[d];
+  }
+  if (pm == NULL || mxIsEmpty(pm)) {
+    return;
+  }
+  size_t n = mxGetNumberOfElements(pm);
+  if (!mxIsDouble(pm) || n > info.ndims) {
+    mexErrMsgTxt((std::string(name)
+		  + " must be a vector of type double with at most one element per dimension").c_str());
+  }
+  const double *p = mxGetPr(pm);
+  for (size_t d = 0; d < n; ++d) {
+    if (!(p[d] >= 1.0 && p[d] <= (double)info.size[d])) {
+      mexErrMsgTxt((std::string(name) + " is outside the volume").c_str());
+    }
+    v[d] = (size_t)p[d];
+  }
+}
+
+// create the SCIMAT struct, with the data of the region of interest
+// from, sz (0-based). The data array is allocated, but not read
+mxArray *createScimat(const ChunkedVolumeInfo &info, const size_t *from,
+		      const size_t *sz) {
+  mwSize dims[CHUNKED_MAX_DIMS];
+  for (unsigned int d = 0; d < info.ndims; ++d) {
+    dims[d] = sz[d];
+  }
+  mwSize ndim = info.ndims;
+  if (ndim == 1) {
+    dims[1] = 1;
+    ndim = 2;
+  }
+  mxArray *data;
+  if (info.dataType == "logical") {
+    data = mxCreateLogicalArray(ndim, dims);
+  } else {
+    data = mxCreateNumericArray(ndim, dims, dataType2ClassID(info.dataType), mxREAL);
+  }
+  if (data == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+
+  // axis metadata. The first voxel of the ROI is moved along each
+  // axis by (FROM-1) voxels
+  const char *axisFields[] = {"size", "spacing", "min"};
+  mxArray *axis = mxCreateStructMatrix(info.ndims, 1, 3, axisFields);
+  for (unsigned int d = 0; d < info.ndims; ++d) {
+    mxSetField(axis, d, "size", mxCreateDoubleScalar((double)sz[d]));
+    if (!info.spacing.empty()) {
+      mxSetField(axis, d, "spacing", mxCreateDoubleScalar(info.spacing[d]));
+    }
+    if (!info.min.empty()) {
+      double spacing = info.spacing.empty() ? 1.0 : info.spacing[d];
+      mxSetField(axis, d, "min",
+		 mxCreateDoubleScalar(info.min[d] + (double)from[d] * spacing));
+    }
+  }
+
+  const char *scimatFields[] = {"data", "axis", "rotmat"};
+  mxArray *scimat = mxCreateStructMatrix(1, 1, info.rotmat.empty() ? 2 : 3,
+					 scimatFields);
+  mxSetField(scimat, 0, "data", data);
+  mxSetField(scimat, 0, "axis", axis);
+  if (!info.rotmat.empty()) {
+    // rotation matrices are square
+    size_t n = 1;
+    while ((n + 1) * (n + 1) <= info.rotmat.size()) {
+      ++n;
+    }
+    mxArray *rotmat = mxCreateDoubleMatrix(n, info.rotmat.size() / n, mxREAL);
+    std::copy(info.rotmat.begin(), info.rotmat.end(), mxGetPr(rotmat));
+    mxSetField(scimat, 0, "rotmat", rotmat);
+  }
+  return scimat;
+}
+
+// read the metadata. Errors are returned as a message instead of
+// calling mexErrMsgTxt()
+std::string readInfo(const std::string &dirName, ChunkedVolumeInfo &info) {
+  try {
+    info.Read(dirName);
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+// read the chunks that intersect the region of interest into data
+std::string readVolume(const std::string &dirName, const ChunkedVolumeInfo &info,
+		       const size_t *from, const size_t *sz, void *data,
+		       unsigned int numThreads) {
+  try {
+    numThreads = getNumberOfThreads(numThreads);
+    ChunkedReadFunctor f(info, dirName, from, sz, data, numThreads);
+    parallelForDynamic(0, f.GetNumberOfChunks(), 1, f, numThreads);
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 4) {
+    mexErrMsgTxt("Between one and four input arguments required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("DIR must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string dirName(buf);
+  mxFree(buf);
+
+  ChunkedVolumeInfo info;
+  std::string msg = readInfo(dirName, info);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+  // region of interest, converted to 0-based first voxel and size
+  size_t ones[CHUNKED_MAX_DIMS] = {1, 1, 1, 1};
+  size_t from[CHUNKED_MAX_DIMS], to[CHUNKED_MAX_DIMS], sz[CHUNKED_MAX_DIMS];
+  readIndexVector((nrhs > 1) ? prhs[1] : NULL, info, ones, from, "FROM");
+  readIndexVector((nrhs > 2) ? prhs[2] : NULL, info, info.size, to, "TO");
+  for (unsigned int d = 0; d < CHUNKED_MAX_DIMS; ++d) {
+    if (info.size[d] == 0) {
+      from[d] = 0;
+      sz[d] = 0;
+      continue;
+    }
+    if (to[d] < from[d]) {
+      mexErrMsgTxt("TO must be >= FROM");
+    }
+    sz[d] = to[d] - from[d] + 1;
+    --from[d];
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[3]);
+  }
+
+  plhs[0] = createScimat(info, from, sz);
+  msg = readVolume(dirName, info, from, sz,
+		   mxGetData(mxGetField(plhs[0], 0, "data")), numThreads);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+}
@@ -0,0 +1,72 @@
+function scimat = scimat_load_chunked(dirname, from, to, numthreads)
+% SCIMAT_LOAD_CHUNKED  Load a SCIMAT volume, or a region of interest,
+% from a chunked compressed directory
+%
+% SCIMAT = scimat_load_chunked(DIR)
+%
+%   DIR is a string with the path to a directory saved with
+%   scimat_save_chunked().
+%
+%   SCIMAT is a struct with the volume (see "help scimat" for
+%   details). SCIMAT.data has the class of the saved data.
+%
+% SCIMAT = scimat_load_chunked(DIR, FROM, TO)
+%
+%   FROM, TO are vectors with the index coordinates that define a
+%   region of interest, as in scimat_crop(). If FROM or TO don't have
+%   all the dimensions, those dimensions are not cropped. FROM=[] and
+%   TO=[] read the whole volume.
+%
+%   Only the chunks that intersect the region of interest are read
+%   and decompressed. SCIMAT.axis.size is the size of the region, and
+%   SCIMAT.axis.min is moved to the first voxel of the region, so
+%
+%     scimat_load_chunked(DIR, FROM, TO)
+%
+%   gives the same result as
+%
+%     scimat_crop(scimat_load_chunked(DIR), FROM, TO)
+%
+%   for volumes without rotation, but needs a fraction of the memory
+%   and time for small regions.
+%
+%   Chunk files that are missing are read as zeros.
+%
+% SCIMAT = scimat_load_chunked(DIR, FROM, TO, NUMTHREADS)
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% See also: scimat_save_chunked, scimat_crop.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -0,0 +1,316 @@
+/*
+ * scimat_load_dicom.cpp
+ *
+ * SCIMAT_LOAD_DICOM  Load a DICOM series from a directory as a SCIMAT
+ * volume
+ *
+ * SCIMAT = scimat_load_dicom(DIR)
+ *
+ *   DIR is a string with the path to a directory with DICOM files. The
+ *   directory and its subdirectories are scanned, and files that are
+ *   not DICOM images (e.g. DICOMDIR) are ignored. The headers are
+ *   parsed in parallel, without reading the pixel data.
+ *
+ *   If the directory contains several series, the one with the most
+ *   slices is read.
+ *
+ *   SCIMAT is a struct with the volume (see "help scimat" for
+ *   details). Slices are sorted by ImagePositionPatient along the
+ *   slice normal, and the volume is allocated before the slices are
+ *   decoded in parallel. SCIMAT.axis gives the voxel size and
+ *   position, and SCIMAT.rotmat the orientation, from
+ *   ImageOrientationPatient. Units are m (DICOM files use mm).
+ *
+ *   SCIMAT.data has the class of the stored pixels (e.g. int16 or
+ *   uint16). If the slices have a RescaleSlope or RescaleIntercept,
+ *   they are applied, and SCIMAT.data is of class single.
+ *
+ *   A warning is given if the slices are not evenly spaced. In that
+ *   case, SCIMAT.axis(3).spacing is the mean distance between slices.
+ *
+ * SCIMAT = scimat_load_dicom(DIR, SERIES, NUMTHREADS)
+ *
+ *   SERIES is a string with the SeriesInstanceUID of the series to
+ *   read. By default, SERIES='', and the series with the most slices
+ *   is read.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * [SCIMAT, INFO] = scimat_load_dicom(...)
+ *
+ *   INFO is a struct with the series metadata:
+ *
+ *     INFO.SeriesInstanceUID: UID of the series that was read.
+ *     INFO.Series: (N, 2) cell array with the UID and number of slices
+ *       of every series found in DIR.
+ *     INFO.FileName: cell vector with the file of each slice.
+ *     INFO.ImagePositionPatient: (S, 3) matrix with the position of
+ *       each slice (mm).
+ *     INFO.RescaleSlope, INFO.RescaleIntercept: vectors with the
+ *       rescale values of each slice.
+ *
+ * See also: scimat, loaddcmdir.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "DicomSeriesReader.h"
+
+// decode the slices with the stored type TIn. The output is TIn, or
+// float if the slices have to be rescaled
+template <class TIn>
+void decodeSeries(const DicomSeries &series, mxArray *data, bool rescale,
+		  unsigned int numThreads) {
+  if (rescale) {
+    DicomDecodeFunctor<TIn, float> f(series, (float *)mxGetData(data), true, numThreads);
+    parallelForDynamic(0, series.GetNumberOfSlices(), 1, f, numThreads);
+  } else {
+    DicomDecodeFunctor<TIn, TIn> f(series, (TIn *)mxGetData(data), false, numThreads);
+    parallelForDynamic(0, series.GetNumberOfSlices(), 1, f, numThreads);
+  }
+}
+
+// Matlab class of the stored pixel type
+mxClassID storedClassID(const DicomSliceHeader &h) {
+  bool isSigned = h.pixelRepresentation == 1;
+  switch (h.bitsAllocated) {
+  case 8:
+    return isSigned ? mxINT8_CLASS : mxUINT8_CLASS;
+  case 16:
+    return isSigned ? mxINT16_CLASS : mxUINT16_CLASS;
+  default:
+    return isSigned ? mxINT32_CLASS : mxUINT32_CLASS;
+  }
+}
+
+// SCIMAT struct with the volume geometry. DICOM units are mm, and
+// SCIMAT units are m
+mxArray *createScimat(const DicomSeries &series, mxArray *data) {
+  const double *origin = series.GetOrigin();
+  const double *R = series.GetRotationMatrix();
+
+  // axis(1) is rows (y), axis(2) columns (x)
+  const int xyz[3] = {1, 0, 2};
+  const mwSize sz[3] = {series.GetRows(), series.GetCols(), series.GetNumberOfSlices()};
+  const char *axisFields[] = {"size", "spacing", "min"};
+  mxArray *axis = mxCreateStructMatrix(3, 1, 3, axisFields);
+  for (int d = 0; d < 3; ++d) {
+    double spacing = series.GetSpacing(xyz[d]) * 1e-3;
+    mxSetField(axis, d, "size", mxCreateDoubleScalar((double)sz[d]));
+    mxSetField(axis, d, "spacing", mxCreateDoubleScalar(spacing));
+    mxSetField(axis, d, "min",
+	       mxCreateDoubleScalar(origin[xyz[d]] * 1e-3 - spacing / 2));
+  }
+
+  // X = s.*(IDX-1)*rotmat + t
+  mxArray *rotmat = mxCreateDoubleMatrix(3, 3, mxREAL);
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      mxGetPr(rotmat)[i + 3 * j] = R[3 * i + j];
+    }
+  }
+
+  const char *scimatFields[] = {"data", "axis", "rotmat"};
+  mxArray *scimat = mxCreateStructMatrix(1, 1, 3, scimatFields);
+  mxSetField(scimat, 0, "data", data);
+  mxSetField(scimat, 0, "axis", axis);
+  mxSetField(scimat, 0, "rotmat", rotmat);
+  return scimat;
+}
+
+// metadata struct
+mxArray *createInfo(const DicomSeries &series, const std::string &seriesUID,
+		    const std::map<std::string, size_t> &count) {
+  const char *fieldNames[] = {"SeriesInstanceUID", "Series", "FileName",
+			      "ImagePositionPatient", "RescaleSlope", "RescaleIntercept"};
+  mxArray *info = mxCreateStructMatrix(1, 1, 6, fieldNames);
+  mxSetField(info, 0, "SeriesInstanceUID", mxCreateString(seriesUID.c_str()));
+
+  mxArray *list = mxCreateCellMatrix(count.size(), 2);
+  size_t i = 0;
+  for (std::map<std::string, size_t>::const_iterator it = count.begin();
+       it != count.end(); ++it, ++i) {
+    mxSetCell(list, i, mxCreateString(it->first.c_str()));
+    mxSetCell(list, i + count.size(), mxCreateDoubleScalar((double)it->second));
+  }
+  mxSetField(info, 0, "Series", list);
+
+  const size_t n = series.GetNumberOfSlices();
+  mxArray *fileName = mxCreateCellMatrix(n, 1);
+  mxArray *position = mxCreateDoubleMatrix(n, 3, mxREAL);
+  mxArray *slope = mxCreateDoubleMatrix(n, 1, mxREAL);
+  mxArray *intercept = mxCreateDoubleMatrix(n, 1, mxREAL);
+  for (size_t k = 0; k < n; ++k) {
+    const DicomSliceHeader &h = series.GetSlice(k);
+    mxSetCell(fileName, k, mxCreateString(h.fileName.c_str()));
+    for (int d = 0; d < 3; ++d) {
+      mxGetPr(position)[k + d * n] = h.position[d];
+    }
+    mxGetPr(slope)[k] = h.rescaleSlope;
+    mxGetPr(intercept)[k] = h.rescaleIntercept;
+  }
+  mxSetField(info, 0, "FileName", fileName);
+  mxSetField(info, 0, "ImagePositionPatient", position);
+  mxSetField(info, 0, "RescaleSlope", slope);
+  mxSetField(info, 0, "RescaleIntercept", intercept);
+  return info;
+}
+
+// scan the directory, and read the selected series into plhs. Errors
+// are returned as a message instead of calling mexErrMsgTxt(), so
+// that the headers are freed first
+std::string readSeries(const std::string &dirName, std::string seriesUID,
+		       unsigned int numThreads, int nlhs, mxArray *plhs[],
+		       bool &unevenSpacing) {
+  try {
+    numThreads = getNumberOfThreads(numThreads);
+
+    // parse the headers of all files in parallel
+    std::vector<std::string> fileNames = dicomListFiles(dirName);
+    std::vector<DicomSliceHeader> headers;
+    DicomHeaderFunctor fHeader(fileNames, headers);
+    parallelForDynamic(0, fileNames.size(), 8, fHeader, numThreads);
+
+    // by default, read the series with most slices
+    std::map<std::string, size_t> count = dicomCountSeries(headers);
+    if (count.empty()) {
+      return "No DICOM images found in " + dirName;
+    }
+    if (seriesUID.empty()) {
+      size_t best = 0;
+      for (std::map<std::string, size_t>::const_iterator it = count.begin();
+	   it != count.end(); ++it) {
+	if (it->second > best) {
+	  best = it->second;
+	  seriesUID = it->first;
+	}
+      }
+    }
+
+    // sort the slices and check that they form a volume
+    DicomSeries series(headers, seriesUID);
+    headers.clear();
+    unevenSpacing = series.HasUnevenSpacing();
+
+    // preallocate the volume and decode the slices into it in parallel
+    bool rescale = series.NeedsRescale();
+    mxClassID classID = rescale ? mxSINGLE_CLASS : storedClassID(series.GetSlice(0));
+    mwSize dims[3] = {series.GetRows(), series.GetCols(), series.GetNumberOfSlices()};
+    mxArray *data = mxCreateNumericArray(3, dims, classID, mxREAL);
+    if (data == NULL) {
+      return "Not enough memory for output";
+    }
+    switch (storedClassID(series.GetSlice(0))) {
+    case mxINT8_CLASS:
+      decodeSeries<int8_T>(series, data, rescale, numThreads);
+      break;
+    case mxUINT8_CLASS:
+      decodeSeries<uint8_T>(series, data, rescale, numThreads);
+      break;
+    case mxINT16_CLASS:
+      decodeSeries<int16_T>(series, data, rescale, numThreads);
+      break;
+    case mxUINT16_CLASS:
+      decodeSeries<uint16_T>(series, data, rescale, numThreads);
+      break;
+    case mxINT32_CLASS:
+      decodeSeries<int32_T>(series, data, rescale, numThreads);
+      break;
+    default:
+      decodeSeries<uint32_T>(series, data, rescale, numThreads);
+      break;
+    }
+
+    plhs[0] = createScimat(series, data);
+    if (nlhs > 1) {
+      plhs[1] = createInfo(series, seriesUID, count);
+    }
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 3) {
+    mexErrMsgTxt("Between one and three input arguments required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("DIR must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string dirName(buf);
+  mxFree(buf);
+  std::string seriesUID;
+  if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+    if (!mxIsChar(prhs[1])) {
+      mexErrMsgTxt("SERIES must be a string");
+    }
+    buf = mxArrayToString(prhs[1]);
+    seriesUID = buf;
+    mxFree(buf);
+  }
+  unsigned int numThreads = 0;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[2]);
+  }
+
+  bool unevenSpacing = false;
+  std::string msg = readSeries(dirName, seriesUID, numThreads, nlhs, plhs,
+			       unevenSpacing);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+  if (unevenSpacing) {
+    mexWarnMsgTxt("Slices are not evenly spaced. SCIMAT.axis(3).spacing is the mean spacing");
+  }
+
+}
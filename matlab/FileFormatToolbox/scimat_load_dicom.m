@@ -0,0 +1,83 @@
+function [scimat, info] = scimat_load_dicom(dirname, series, numthreads)
+% SCIMAT_LOAD_DICOM  Load a DICOM series from a directory as a SCIMAT
+% volume
+%
+% SCIMAT = scimat_load_dicom(DIR)
+%
+%   DIR is a string with the path to a directory with DICOM files. The
+%   directory and its subdirectories are scanned, and files that are
+%   not DICOM images (e.g. DICOMDIR) are ignored. The headers are
+%   parsed in parallel, without reading the pixel data.
+%
+%   If the directory contains several series, the one with the most
+%   slices is read.
+%
+%   SCIMAT is a struct with the volume (see "help scimat" for
+%   details). Slices are sorted by ImagePositionPatient along the
+%   slice normal, and the volume is allocated before the slices are
+%   decoded in parallel. SCIMAT.axis gives the voxel size and
+%   position, and SCIMAT.rotmat the orientation, from
+%   ImageOrientationPatient. Units are m (DICOM files use mm).
+%
+%   SCIMAT.data has the class of the stored pixels (e.g. int16 or
+%   uint16). If the slices have a RescaleSlope or RescaleIntercept,
+%   they are applied, and SCIMAT.data is of class single.
+%
+%   A warning is given if the slices are not evenly spaced. In that
+%   case, SCIMAT.axis(3).spacing is the mean distance between slices.
+%
+% SCIMAT = scimat_load_dicom(DIR, SERIES, NUMTHREADS)
+%
+%   SERIES is a string with the SeriesInstanceUID of the series to
+%   read. By default, SERIES='', and the series with the most slices
+%   is read.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% [SCIMAT, INFO] = scimat_load_dicom(...)
+%
+%   INFO is a struct with the series metadata:
+%
+%     INFO.SeriesInstanceUID: UID of the series that was read.
+%     INFO.Series: (N, 2) cell array with the UID and number of slices
+%       of every series found in DIR.
+%     INFO.FileName: cell vector with the file of each slice.
+%     INFO.ImagePositionPatient: (S, 3) matrix with the position of
+%       each slice (mm).
+%     INFO.RescaleSlope, INFO.RescaleIntercept: vectors with the
+%       rescale values of each slice.
+%
+% See also: scimat, loaddcmdir.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -0,0 +1,273 @@
+/*
+ * scimat_save_chunked.cpp
+ *
+ * SCIMAT_SAVE_CHUNKED  Save a SCIMAT volume to a chunked compressed
+ * directory
+ *
+ * scimat_save_chunked(DIR, SCIMAT)
+ *
+ *   DIR is a string with the path to the output directory. The
+ *   directory is created if it doesn't exist.
+ *
+ *   SCIMAT is a struct with a metainfo-enriched image or segmentation
+ *   (see "help scimat" for details) with up to 4 dimensions. The data
+ *   can be of class double, single, logical or (u)int8/16/32/64.
+ *
+ *   The volume is split into chunks of 64x64x64 voxels, and each chunk
+ *   is byte-shuffled, compressed with zlib and saved to its own file
+ *   in DIR. The size, class, SCIMAT.axis spacing and min, and
+ *   SCIMAT.rotmat are saved to DIR/attributes.json. Chunks where all
+ *   voxels are zero are not saved. See ChunkedVolume.h for a
+ *   description of the format.
+ *
+ *   Chunks are compressed in parallel, and any region of interest can
+ *   be read back decompressing only the chunks it touches, with
+ *   scimat_load_chunked().
+ *
+ * scimat_save_chunked(DIR, SCIMAT, CHUNKSIZE, LEVEL, NUMTHREADS)
+ *
+ *   CHUNKSIZE is a scalar or a vector with the chunk size along each
+ *   dimension. By default, CHUNKSIZE=[64 64 64 1].
+ *
+ *   LEVEL is the zlib compression level, from 1 (fastest) to 9
+ *   (smallest). LEVEL=0 saves the chunks without compression. By
+ *   default, LEVEL=1.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * See also: scimat_load_chunked, scimat_crop.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "ChunkedVolume.h"
+
+// data type name of a Matlab class, or empty string if the class is
+// not supported
+std::string className2DataType(const mxArray *pm) {
+  switch (mxGetClassID(pm)) {
+  case mxDOUBLE_CLASS:
+    return "double";
+  case mxSINGLE_CLASS:
+    return "single";
+  case mxLOGICAL_CLASS:
+    return "logical";
+  case mxINT8_CLASS:
+    return "int8";
+  case mxUINT8_CLASS:
+    return "uint8";
+  case mxINT16_CLASS:
+    return "int16";
+  case mxUINT16_CLASS:
+    return "uint16";
+  case mxINT32_CLASS:
+    return "int32";
+  case mxUINT32_CLASS:
+    return "uint32";
+  case mxINT64_CLASS:
+    return "int64";
+  case mxUINT64_CLASS:
+    return "uint64";
+  default:
+    return "";
+  }
+}
+
+// read numeric field name of element i of struct array axis into v,
+// or leave v empty if the field doesn't exist or is empty
+void readAxisField(const mxArray *axis, size_t i, const char *name,
+		   std::vector<double> &v) {
+  const mxArray *field = mxGetField(axis, i, name);
+  if (field == NULL || mxIsEmpty(field)) {
+    v.clear();
+    return;
+  }
+  if (!mxIsDouble(field) || mxGetNumberOfElements(field) != 1) {
+    mexErrMsgTxt((std::string("SCIMAT.axis.") + name + " must be a scalar of type double").c_str());
+  }
+  v.push_back(mxGetScalar(field));
+}
+
+// write the chunks and the metadata. Errors are returned as a message
+// instead of calling mexErrMsgTxt(), so that buffers are freed first
+std::string writeVolume(const std::string &dirName, const ChunkedVolumeInfo &info,
+			const void *data, unsigned int numThreads) {
+  try {
+    info.Validate();
+    chunkedMakeDirectory(dirName);
+    numThreads = getNumberOfThreads(numThreads);
+    ChunkedWriteFunctor f(info, dirName, data, numThreads);
+    parallelForDynamic(0, f.GetNumberOfChunks(), 1, f, numThreads);
+
+    // the metadata are written last, so that the directory is not a
+    // valid volume if writing the chunks failed
+    info.Write(dirName);
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 2 || nrhs > 5) {
+    mexErrMsgTxt("Between two and five input arguments required");
+  }
+  if (nlhs > 0) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("DIR must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string dirName(buf);
+  mxFree(buf);
+
+  // image data
+  if (!mxIsStruct(prhs[1])) {
+    mexErrMsgTxt("SCIMAT must be a struct");
+  }
+  const mxArray *data = mxGetField(prhs[1], 0, "data");
+  if (data == NULL) {
+    mexErrMsgTxt("SCIMAT must have a data field");
+  }
+  if (mxIsComplex(data) || mxIsSparse(data)) {
+    mexErrMsgTxt("SCIMAT.data must be a real full array");
+  }
+  ChunkedVolumeInfo info;
+  info.dataType = className2DataType(data);
+  if (info.dataType.empty()) {
+    mexErrMsgTxt("SCIMAT.data has an unsupported class");
+  }
+
+  // the number of dimensions is given by SCIMAT.axis, if present, as
+  // Matlab drops trailing singleton dimensions
+  const mxArray *axis = mxGetField(prhs[1], 0, "axis");
+  mwSize ndim = mxGetNumberOfDimensions(data);
+  const mwSize *dims = mxGetDimensions(data);
+  size_t naxis = (axis == NULL) ? 0 : mxGetNumberOfElements(axis);
+  info.ndims = (unsigned int)std::max((size_t)ndim, naxis);
+  if (info.ndims > CHUNKED_MAX_DIMS) {
+    mexErrMsgTxt("SCIMAT.data can have at most 4 dimensions");
+  }
+  for (unsigned int d = 0; d < info.ndims; ++d) {
+    info.size[d] = (d < ndim) ? dims[d] : 1;
+  }
+
+  // axis metadata
+  if (naxis > 0) {
+    if (!mxIsStruct(axis) || naxis != info.ndims) {
+      mexErrMsgTxt("SCIMAT.axis must be a struct array with one element per dimension");
+    }
+    std::vector<double> spacing, min;
+    for (size_t i = 0; i < naxis; ++i) {
+      readAxisField(axis, i, "spacing", spacing);
+      readAxisField(axis, i, "min", min);
+    }
+    info.spacing = (spacing.size() == naxis) ? spacing : std::vector<double>();
+    info.min = (min.size() == naxis) ? min : std::vector<double>();
+  }
+  const mxArray *rotmat = mxGetField(prhs[1], 0, "rotmat");
+  if (rotmat != NULL && !mxIsEmpty(rotmat)) {
+    if (!mxIsDouble(rotmat)) {
+      mexErrMsgTxt("SCIMAT.rotmat must be of type double");
+    }
+    const double *p = mxGetPr(rotmat);
+    info.rotmat.assign(p, p + mxGetNumberOfElements(rotmat));
+  }
+
+  // chunk size
+  for (unsigned int d = 0; d < info.ndims; ++d) {
+    info.chunkSize[d] = (d < 3) ? 64 : 1;
+  }
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    size_t n = mxGetNumberOfElements(prhs[2]);
+    if (!mxIsDouble(prhs[2]) || (n != 1 && n != info.ndims)) {
+      mexErrMsgTxt("CHUNKSIZE must be a scalar or a vector with one element per dimension");
+    }
+    const double *p = mxGetPr(prhs[2]);
+    for (unsigned int d = 0; d < info.ndims; ++d) {
+      double v = (n == 1) ? p[0] : p[d];
+      if (!(v >= 1.0) || mxIsInf(v)) {
+	mexErrMsgTxt("CHUNKSIZE must be >= 1 and finite");
+      }
+      info.chunkSize[d] = (size_t)v;
+    }
+  }
+  for (unsigned int d = 0; d < info.ndims; ++d) {
+    info.chunkSize[d] = std::min(info.chunkSize[d], std::max(info.size[d], (size_t)1));
+  }
+
+  // compression level
+  if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+    if (!mxIsNumeric(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1) {
+      mexErrMsgTxt("LEVEL must be a scalar");
+    }
+    double level = mxGetScalar(prhs[3]);
+    if (!(level >= 0.0 && level <= 9.0)) {
+      mexErrMsgTxt("LEVEL must be between 0 and 9");
+    }
+    if (level < 1.0) {
+      info.compression = "raw";
+      info.shuffle = false;
+    } else {
+      info.level = (int)level;
+    }
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[4]);
+  }
+
+  std::string msg = writeVolume(dirName, info, mxGetData(data), numThreads);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+}
@@ -0,0 +1,69 @@
+function scimat_save_chunked(dirname, scimat, chunksize, level, numthreads)
+% SCIMAT_SAVE_CHUNKED  Save a SCIMAT volume to a chunked compressed
+% directory
+%
+% scimat_save_chunked(DIR, SCIMAT)
+%
+%   DIR is a string with the path to the output directory. The
+%   directory is created if it doesn't exist.
+%
+%   SCIMAT is a struct with a metainfo-enriched image or segmentation
+%   (see "help scimat" for details) with up to 4 dimensions. The data
+%   can be of class double, single, logical or (u)int8/16/32/64.
+%
+%   The volume is split into chunks of 64x64x64 voxels, and each chunk
+%   is byte-shuffled, compressed with zlib and saved to its own file
+%   in DIR. The size, class, SCIMAT.axis spacing and min, and
+%   SCIMAT.rotmat are saved to DIR/attributes.json. Chunks where all
+%   voxels are zero are not saved. See ChunkedVolume.h for a
+%   description of the format.
+%
+%   Chunks are compressed in parallel, and any region of interest can
+%   be read back decompressing only the chunks it touches, with
+%   scimat_load_chunked().
+%
+% scimat_save_chunked(DIR, SCIMAT, CHUNKSIZE, LEVEL, NUMTHREADS)
+%
+%   CHUNKSIZE is a scalar or a vector with the chunk size along each
+%   dimension. By default, CHUNKSIZE=[64 64 64 1].
+%
+%   LEVEL is the zlib compression level, from 1 (fastest) to 9
+%   (smallest). LEVEL=0 saves the chunks without compression. By
+%   default, LEVEL=1.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% See also: scimat_load_chunked, scimat_crop.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
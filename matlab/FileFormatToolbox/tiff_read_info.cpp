@@ -0,0 +1,262 @@
+/*
+ * tiff_read_info.cpp
+ *
+ * TIFF_READ_INFO  Read the tags of all the images of a TIFF or BigTIFF
+ * file
+ *
+ * INFO = tiff_read_info(FILE)
+ *
+ *   FILE is a string with the path to a TIFF or BigTIFF file.
+ *
+ *   INFO is a struct array with one element per image (Image File
+ *   Directory, IFD) in the file, in the order of the IFD chain. Each
+ *   tag is a field, with the name given in the TIFF 6.0
+ *   specification (e.g. ImageWidth, StripOffsets), or private_<code>
+ *   for tags without a known name. Fields for tags that an image
+ *   doesn't have are empty. INFO.Offset is the position of the IFD in
+ *   the file.
+ *
+ *   Values are column vectors of the class of the TIFF type (e.g.
+ *   uint16 for SHORT, uint32 for LONG, uint64 for BigTIFF LONG8),
+ *   except rationals, that are converted to double, and ASCII tags,
+ *   that are strings.
+ *
+ *   The file is memory-mapped, and only the IFDs are read, so this
+ *   function is much faster than tiff_read_header() for files with
+ *   thousands of images.
+ *
+ * [INFO, ISBIGTIFF] = tiff_read_info(FILE)
+ *
+ *   ISBIGTIFF is true if the file is a BigTIFF file.
+ *
+ * See also: tiff_read_roi, tiff_read_header, imfinfo.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cstring>
+#include <exception>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Gerardus headers */
+#include "TiffReader.h"
+
+// names of the TIFF tags, as in the TIFF 6.0 specification. Tags not
+// in this list are returned as private_<code>
+static const struct {
+  unsigned int code;
+  const char *name;
+} tagNames[] = {
+  {254, "NewSubfileType"}, {255, "SubfileType"}, {256, "ImageWidth"},
+  {257, "ImageHeight"}, {258, "BitsPerSample"}, {259, "Compression"},
+  {262, "PhotometricInterpretation"}, {263, "Threshholding"}, {264, "CellWidth"},
+  {265, "CellLength"}, {266, "FillOrder"}, {269, "DocumentName"},
+  {270, "ImageDescription"}, {271, "Make"}, {272, "Model"}, {273, "StripOffsets"},
+  {274, "Orientation"}, {277, "SamplesPerPixel"}, {278, "RowsPerStrip"},
+  {279, "StripByteCounts"}, {280, "MinSampleValue"}, {281, "MaxSampleValue"},
+  {282, "XResolution"}, {283, "YResolution"}, {284, "PlanarConfiguration"},
+  {285, "PageName"}, {286, "XPosition"}, {287, "YPosition"}, {288, "FreeOffsets"},
+  {289, "FreeByteCounts"}, {290, "GrayResponseUnit"}, {291, "GrayResponseCurve"},
+  {292, "T4Options"}, {293, "T6Options"}, {296, "ResolutionUnit"},
+  {297, "PageNumber"}, {301, "TransferFunction"}, {305, "Software"},
+  {306, "DateTime"}, {315, "Artist"}, {316, "HostComputer"}, {317, "Predictor"},
+  {318, "WhitePoint"}, {319, "PrimaryChromaticities"}, {320, "ColorMap"},
+  {321, "HalftoneHints"}, {322, "TileWidth"}, {323, "TileLength"},
+  {324, "TileOffsets"}, {325, "TileByteCounts"}, {326, "BadFaxLines"},
+  {330, "SubIFDs"}, {332, "InkSet"}, {333, "InkNames"}, {334, "NumberOfInks"},
+  {336, "DotRange"}, {337, "TargetPrinter"}, {338, "ExtraSamples"},
+  {339, "SampleFormat"}, {340, "SMinSampleValue"}, {341, "SMaxSampleValue"},
+  {342, "TransferRange"}, {343, "ClipPath"}, {347, "JPEGTables"},
+  {530, "YCbCrSubSampling"}, {532, "ReferenceBlackWhite"}, {700, "XMP"},
+  {33432, "Copyright"}, {34665, "ExifIFD"}, {34675, "ICCProfile"},
+  {50838, "ImageJMetaDataByteCounts"}, {50839, "ImageJMetaData"}
+};
+
+// field name of a tag
+std::string tagName(unsigned int code) {
+  for (size_t i = 0; i < sizeof(tagNames) / sizeof(tagNames[0]); ++i) {
+    if (tagNames[i].code == code) {
+      return tagNames[i].name;
+    }
+  }
+  return "private_" + TiffFile::ToString(code);
+}
+
+// Matlab class of a TIFF field type
+mxClassID tagClassID(unsigned int type) {
+  switch (type) {
+  case TIFF_BYTE: case TIFF_UNDEFINED:
+    return mxUINT8_CLASS;
+  case TIFF_SBYTE:
+    return mxINT8_CLASS;
+  case TIFF_SHORT:
+    return mxUINT16_CLASS;
+  case TIFF_SSHORT:
+    return mxINT16_CLASS;
+  case TIFF_LONG: case TIFF_IFD:
+    return mxUINT32_CLASS;
+  case TIFF_SLONG:
+    return mxINT32_CLASS;
+  case TIFF_FLOAT:
+    return mxSINGLE_CLASS;
+  case TIFF_LONG8: case TIFF_IFD8:
+    return mxUINT64_CLASS;
+  case TIFF_SLONG8:
+    return mxINT64_CLASS;
+  default:
+    // rationals are converted to double
+    return mxDOUBLE_CLASS;
+  }
+}
+
+// values of a tag as a column vector, or a string for ASCII tags
+mxArray *tagValue(const TiffFile &tiff, const TiffTag &tag) {
+  const size_t es = tiffTypeSize(tag.type);
+  const unsigned char *p = tiff.GetData(tag.dataOffset, tag.count * es);
+  if (tag.type == TIFF_ASCII) {
+    std::string s((const char *)p, (size_t)tag.count);
+    s = s.substr(0, s.find('\0'));
+    return mxCreateString(s.c_str());
+  }
+  if (tag.type == TIFF_RATIONAL || tag.type == TIFF_SRATIONAL) {
+    std::vector<double> v = tiff.GetValues(tag);
+    mxArray *pm = mxCreateDoubleMatrix(v.size(), 1, mxREAL);
+    std::copy(v.begin(), v.end(), mxGetPr(pm));
+    return pm;
+  }
+
+  // other types are copied, converting from the byte order of the
+  // file
+  mxArray *pm = mxCreateNumericMatrix((mwSize)tag.count, 1, tagClassID(tag.type), mxREAL);
+  unsigned char *out = (unsigned char *)mxGetData(pm);
+  for (size_t i = 0; i < tag.count; ++i, p += es, out += es) {
+    switch (es) {
+    case 1:
+      out[0] = p[0];
+      break;
+    case 2: {
+      boost::uint16_t v = (boost::uint16_t)tiff.ToU16(p);
+      std::memcpy(out, &v, 2);
+      break;
+    }
+    case 4: {
+      boost::uint32_t v = tiff.ToU32(p);
+      std::memcpy(out, &v, 4);
+      break;
+    }
+    default: {
+      boost::uint64_t v = tiff.ToU64(p);
+      std::memcpy(out, &v, 8);
+      break;
+    }
+    }
+  }
+  return pm;
+}
+
+// create the struct array with one element per IFD and one field per
+// tag found in any IFD
+mxArray *createInfo(const TiffFile &tiff) {
+  // union of the tags of all IFDs
+  std::map<unsigned int, std::string> names;
+  for (size_t i = 0; i < tiff.GetNumberOfIfds(); ++i) {
+    const TiffIfd &ifd = tiff.GetIfd(i);
+    for (size_t j = 0; j < ifd.tags.size(); ++j) {
+      if (names.find(ifd.tags[j].code) == names.end()) {
+	names[ifd.tags[j].code] = tagName(ifd.tags[j].code);
+      }
+    }
+  }
+  std::vector<const char *> fieldNames;
+  fieldNames.push_back("Offset");
+  for (std::map<unsigned int, std::string>::const_iterator it = names.begin();
+       it != names.end(); ++it) {
+    fieldNames.push_back(it->second.c_str());
+  }
+
+  mxArray *info = mxCreateStructMatrix(tiff.GetNumberOfIfds(), 1,
+				       (int)fieldNames.size(), &fieldNames[0]);
+  for (size_t i = 0; i < tiff.GetNumberOfIfds(); ++i) {
+    const TiffIfd &ifd = tiff.GetIfd(i);
+    mxSetField(info, i, "Offset", mxCreateDoubleScalar((double)ifd.offset));
+    for (size_t j = 0; j < ifd.tags.size(); ++j) {
+      mxSetField(info, i, names[ifd.tags[j].code].c_str(), tagValue(tiff, ifd.tags[j]));
+    }
+  }
+  return info;
+}
+
+// read the file into plhs. Errors are returned as a message instead
+// of calling mexErrMsgTxt(), so that the file is unmapped first
+std::string readInfo(const std::string &fileName, int nlhs, mxArray *plhs[]) {
+  try {
+    TiffFile tiff(fileName);
+    plhs[0] = createInfo(tiff);
+    if (nlhs > 1) {
+      plhs[1] = mxCreateLogicalScalar(tiff.IsBigTiff());
+    }
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs != 1) {
+    mexErrMsgTxt("One input argument required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("FILE must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string fileName(buf);
+  mxFree(buf);
+
+  std::string msg = readInfo(fileName, nlhs, plhs);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+}
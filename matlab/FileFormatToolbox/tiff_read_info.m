@@ -0,0 +1,62 @@
+function [info, isbigtiff] = tiff_read_info(file)
+% TIFF_READ_INFO  Read the tags of all the images of a TIFF or BigTIFF
+% file
+%
+% INFO = tiff_read_info(FILE)
+%
+%   FILE is a string with the path to a TIFF or BigTIFF file.
+%
+%   INFO is a struct array with one element per image (Image File
+%   Directory, IFD) in the file, in the order of the IFD chain. Each
+%   tag is a field, with the name given in the TIFF 6.0
+%   specification (e.g. ImageWidth, StripOffsets), or private_<code>
+%   for tags without a known name. Fields for tags that an image
+%   doesn't have are empty. INFO.Offset is the position of the IFD in
+%   the file.
+%
+%   Values are column vectors of the class of the TIFF type (e.g.
+%   uint16 for SHORT, uint32 for LONG, uint64 for BigTIFF LONG8),
+%   except rationals, that are converted to double, and ASCII tags,
+%   that are strings.
+%
+%   The file is memory-mapped, and only the IFDs are read, so this
+%   function is much faster than tiff_read_header() for files with
+%   thousands of images.
+%
+% [INFO, ISBIGTIFF] = tiff_read_info(FILE)
+%
+%   ISBIGTIFF is true if the file is a BigTIFF file.
+%
+% See also: tiff_read_roi, tiff_read_header, imfinfo.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -0,0 +1,225 @@
+/*
+ * tiff_read_roi.cpp
+ *
+ * TIFF_READ_ROI  Read a region of interest of one or more images of a
+ * TIFF or BigTIFF file
+ *
+ * IM = tiff_read_roi(FILE)
+ *
+ *   FILE is a string with the path to a TIFF or BigTIFF file.
+ *
+ *   IM is the first image in the file, with the class given by
+ *   BitsPerSample and SampleFormat (e.g. uint8, int16, single).
+ *
+ * IM = tiff_read_roi(FILE, IFD, ROWS, COLS, NUMTHREADS)
+ *
+ *   IFD is a vector with the indices of the images (Image File
+ *   Directories) to read, starting from 1. All images must have the
+ *   same size and pixel type. By default, IFD=1.
+ *
+ *   ROWS, COLS are 2-vectors [FIRST LAST] with the rows and columns of
+ *   the region of interest. By default, ROWS=[] and COLS=[], and the
+ *   whole image is read.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ *   IM has size (R, C, N) for images with one sample per pixel, where
+ *   R, C are the size of the region of interest and N the number of
+ *   images, and (R, C, S, N) for images with S samples per pixel
+ *   (e.g. RGB).
+ *
+ *   The file is memory-mapped, and only the strips or tiles that
+ *   intersect the region of interest are read and decompressed, in
+ *   parallel. Supported compressions are none, LZW, Deflate and
+ *   PackBits, with or without horizontal predictor.
+ *
+ * See also: tiff_read_info, tiff_read_header, imread.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "TiffReader.h"
+
+// Matlab class of the pixel type of an image
+mxClassID imageClassID(const TiffImage &im) {
+  switch (im.bitsPerSample) {
+  case 8:
+    return (im.sampleFormat == 2) ? mxINT8_CLASS : mxUINT8_CLASS;
+  case 16:
+    return (im.sampleFormat == 2) ? mxINT16_CLASS : mxUINT16_CLASS;
+  case 32:
+    return (im.sampleFormat == 3) ? mxSINGLE_CLASS
+      : ((im.sampleFormat == 2) ? mxINT32_CLASS : mxUINT32_CLASS);
+  default:
+    return (im.sampleFormat == 3) ? mxDOUBLE_CLASS
+      : ((im.sampleFormat == 2) ? mxINT64_CLASS : mxUINT64_CLASS);
+  }
+}
+
+// decode the segments that intersect the ROI into im
+template <class T>
+void decodeRoi(const TiffFile &tiff, const std::vector<size_t> &ifds,
+	       const size_t *roi, mxArray *im, unsigned int numThreads) {
+  numThreads = getNumberOfThreads(numThreads);
+  TiffReadFunctor<T> f(tiff, ifds, roi[0], roi[1], roi[2], roi[3],
+		       (T *)mxGetData(im), numThreads);
+  parallelForDynamic(0, f.GetNumberOfSegments(), 1, f, numThreads);
+}
+
+// read a [FIRST LAST] range into first, n. An empty range is the
+// whole image. Throws std::runtime_error if the range is not valid
+void readRange(const mxArray *pm, size_t size, size_t &first, size_t &n,
+	       const char *name) {
+  first = 0;
+  n = size;
+  if (pm == NULL || mxIsEmpty(pm)) {
+    return;
+  }
+  if (!mxIsDouble(pm) || mxGetNumberOfElements(pm) != 2) {
+    throw std::runtime_error(std::string(name) + " must be a vector [FIRST LAST]");
+  }
+  const double *p = mxGetPr(pm);
+  if (!(p[0] >= 1.0 && p[0] <= p[1] && p[1] <= (double)size)) {
+    throw std::runtime_error(std::string(name) + " is outside the image");
+  }
+  first = (size_t)p[0] - 1;
+  n = (size_t)p[1] - first;
+}
+
+// read the ROI into plhs. Errors are returned as a message instead
+// of calling mexErrMsgTxt(), so that the file is unmapped first
+std::string readRoi(const std::string &fileName, const mxArray *ifdArg,
+		    const mxArray *rowsArg, const mxArray *colsArg,
+		    unsigned int numThreads, mxArray *plhs[]) {
+  try {
+    TiffFile tiff(fileName);
+
+    // images to read
+    std::vector<size_t> ifds;
+    if (ifdArg == NULL || mxIsEmpty(ifdArg)) {
+      ifds.push_back(0);
+    } else {
+      if (!mxIsDouble(ifdArg)) {
+	return "IFD must be a vector of type double";
+      }
+      const double *p = mxGetPr(ifdArg);
+      for (size_t i = 0; i < mxGetNumberOfElements(ifdArg); ++i) {
+	if (!(p[i] >= 1.0 && p[i] <= (double)tiff.GetNumberOfIfds())) {
+	  return "IFD must be between 1 and the number of images in the file";
+	}
+	ifds.push_back((size_t)p[i] - 1);
+      }
+    }
+    TiffImage im0(tiff, ifds[0]);
+
+    // region of interest
+    size_t roi[4];
+    readRange(rowsArg, im0.height, roi[0], roi[1], "ROWS");
+    readRange(colsArg, im0.width, roi[2], roi[3], "COLS");
+
+    // (rows, cols, images) for one sample per pixel, and (rows, cols,
+    // samples, images) otherwise
+    std::vector<mwSize> dims;
+    dims.push_back(roi[1]);
+    dims.push_back(roi[3]);
+    if (im0.samples > 1) {
+      dims.push_back(im0.samples);
+    }
+    dims.push_back(ifds.size());
+    mxClassID classID = imageClassID(im0);
+    plhs[0] = mxCreateNumericArray(dims.size(), &dims[0], classID, mxREAL);
+    if (plhs[0] == NULL) {
+      return "Not enough memory for output";
+    }
+
+    switch (classID) {
+    case mxUINT8_CLASS: case mxINT8_CLASS:
+      decodeRoi<boost::uint8_t>(tiff, ifds, roi, plhs[0], numThreads);
+      break;
+    case mxUINT16_CLASS: case mxINT16_CLASS:
+      decodeRoi<boost::uint16_t>(tiff, ifds, roi, plhs[0], numThreads);
+      break;
+    case mxUINT32_CLASS: case mxINT32_CLASS: case mxSINGLE_CLASS:
+      decodeRoi<boost::uint32_t>(tiff, ifds, roi, plhs[0], numThreads);
+      break;
+    default:
+      decodeRoi<boost::uint64_t>(tiff, ifds, roi, plhs[0], numThreads);
+      break;
+    }
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 5) {
+    mexErrMsgTxt("Between one and five input arguments required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("FILE must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string fileName(buf);
+  mxFree(buf);
+  unsigned int numThreads = 0;
+  if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[4]);
+  }
+
+  std::string msg = readRoi(fileName, (nrhs > 1) ? prhs[1] : NULL,
+			    (nrhs > 2) ? prhs[2] : NULL, (nrhs > 3) ? prhs[3] : NULL,
+			    numThreads, plhs);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+}
@@ -0,0 +1,67 @@
+function im = tiff_read_roi(file, ifd, rows, cols, numthreads)
+% TIFF_READ_ROI  Read a region of interest of one or more images of a
+% TIFF or BigTIFF file
+%
+% IM = tiff_read_roi(FILE)
+%
+%   FILE is a string with the path to a TIFF or BigTIFF file.
+%
+%   IM is the first image in the file, with the class given by
+%   BitsPerSample and SampleFormat (e.g. uint8, int16, single).
+%
+% IM = tiff_read_roi(FILE, IFD, ROWS, COLS, NUMTHREADS)
+%
+%   IFD is a vector with the indices of the images (Image File
+%   Directories) to read, starting from 1. All images must have the
+%   same size and pixel type. By default, IFD=1.
+%
+%   ROWS, COLS are 2-vectors [FIRST LAST] with the rows and columns of
+%   the region of interest. By default, ROWS=[] and COLS=[], and the
+%   whole image is read.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+%   IM has size (R, C, N) for images with one sample per pixel, where
+%   R, C are the size of the region of interest and N the number of
+%   images, and (R, C, S, N) for images with S samples per pixel
+%   (e.g. RGB).
+%
+%   The file is memory-mapped, and only the strips or tiles that
+%   intersect the region of interest are read and decompressed, in
+%   parallel. Supported compressions are none, LZW, Deflate and
+%   PackBits, with or without horizontal predictor.
+%
+% See also: tiff_read_info, tiff_read_header, imread.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
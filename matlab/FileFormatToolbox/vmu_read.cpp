@@ -0,0 +1,191 @@
+/*
+ * vmu_read.cpp
+ *
+ * VMU_READ  Read a Hamamatsu Uncompressed Virtual Microscope Specimen
+ * (.vmu) file
+ *
+ * IM = vmu_read(FILE)
+ *
+ *   FILE is a string with the path to the .vmu header file. The pixel
+ *   data are read from the .ngr file given by key ImageFile in the
+ *   header, relative to the directory of FILE.
+ *
+ *   IM is an RGB image of class uint8 and size (Height, Width, 3).
+ *   The microscope stores 12 bits per channel, and only the 8 most
+ *   significant bits are kept.
+ *
+ * IM = vmu_read(FILE, NBITS, NUMTHREADS)
+ *
+ *   NBITS is 8 (default) or 16. With NBITS=16, IM is of class uint16,
+ *   and has the raw 12-bit values of the microscope (0 to 4095).
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * [IM, INFO] = vmu_read(...)
+ *
+ *   INFO is a struct with the image metadata:
+ *
+ *     INFO.Width, INFO.Height: image size in pixels.
+ *     INFO.ColumnWidth: width of the strips in the .ngr file.
+ *     INFO.PixelSize: [dy dx] pixel size in m, computed as
+ *       PhysicalHeight/PixelHeight and PhysicalWidth/PixelWidth (the
+ *       header gives physical sizes in nm).
+ *     INFO.Header: (N, 2) cell array with all the "Key=Value" pairs
+ *       in the .vmu header, as strings.
+ *
+ *   The .ngr file is memory-mapped, and the image is decoded in
+ *   parallel by tiles, without intermediate copies.
+ *
+ *   To convert many files to PNG, TIFF or MHA without starting Matlab,
+ *   see command line program vmu2png.
+ *
+ * See also: imread.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <exception>
+#include <map>
+#include <string>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "VmuReader.h"
+
+// decode the whole image into Matlab's column-major (row, col, channel)
+// layout
+template <class T>
+void decodeImage(const VmuFile &vmu, mxArray *im, unsigned int numThreads) {
+  const size_t h = vmu.GetHeight();
+  const size_t w = vmu.GetWidth();
+  VmuDecodeFunctor<T> f(vmu, (T *)mxGetData(im), 1, h, h * w);
+  parallelForDynamic(0, f.GetNumberOfTiles(), 1, f, numThreads);
+}
+
+// metadata struct
+mxArray *createInfo(const VmuFile &vmu) {
+  const char *fieldNames[] = {"Width", "Height", "ColumnWidth", "PixelSize", "Header"};
+  mxArray *info = mxCreateStructMatrix(1, 1, 5, fieldNames);
+  mxSetField(info, 0, "Width", mxCreateDoubleScalar((double)vmu.GetWidth()));
+  mxSetField(info, 0, "Height", mxCreateDoubleScalar((double)vmu.GetHeight()));
+  mxSetField(info, 0, "ColumnWidth", mxCreateDoubleScalar((double)vmu.GetColumnWidth()));
+  mxArray *pixelSize = mxCreateDoubleMatrix(1, 2, mxREAL);
+  mxGetPr(pixelSize)[0] = vmu.GetPixelSize(1) * 1e-9;
+  mxGetPr(pixelSize)[1] = vmu.GetPixelSize(0) * 1e-9;
+  mxSetField(info, 0, "PixelSize", pixelSize);
+
+  const std::map<std::string, std::string> &header = vmu.GetHeader();
+  mxArray *cell = mxCreateCellMatrix(header.size(), 2);
+  size_t i = 0;
+  for (std::map<std::string, std::string>::const_iterator it = header.begin();
+       it != header.end(); ++it, ++i) {
+    mxSetCell(cell, i, mxCreateString(it->first.c_str()));
+    mxSetCell(cell, i + header.size(), mxCreateString(it->second.c_str()));
+  }
+  mxSetField(info, 0, "Header", cell);
+  return info;
+}
+
+// read the file into plhs. Errors are returned as a message instead
+// of calling mexErrMsgTxt(), so that the file is unmapped first
+std::string readVmu(const std::string &fileName, unsigned int nbits,
+		    unsigned int numThreads, int nlhs, mxArray *plhs[]) {
+  try {
+    VmuFile vmu(fileName);
+
+    mwSize dims[3];
+    dims[0] = vmu.GetHeight();
+    dims[1] = vmu.GetWidth();
+    dims[2] = 3;
+    plhs[0] = mxCreateNumericArray(3, dims, (nbits == 8) ? mxUINT8_CLASS : mxUINT16_CLASS,
+				   mxREAL);
+    if (plhs[0] == NULL) {
+      return "Not enough memory for output";
+    }
+    if (nbits == 8) {
+      decodeImage<uint8_T>(vmu, plhs[0], numThreads);
+    } else {
+      decodeImage<uint16_T>(vmu, plhs[0], numThreads);
+    }
+
+    if (nlhs > 1) {
+      plhs[1] = createInfo(vmu);
+    }
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  return "";
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 3) {
+    mexErrMsgTxt("Between one and three input arguments required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("FILE must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string fileName(buf);
+  mxFree(buf);
+  unsigned int nbits = 8;
+  if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+    if (!mxIsNumeric(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+      mexErrMsgTxt("NBITS must be a scalar");
+    }
+    nbits = (unsigned int)mxGetScalar(prhs[1]);
+    if (nbits != 8 && nbits != 16) {
+      mexErrMsgTxt("NBITS must be 8 or 16");
+    }
+  }
+  unsigned int numThreads = 0;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[2]);
+  }
+
+  std::string msg = readVmu(fileName, nbits, numThreads, nlhs, plhs);
+  if (!msg.empty()) {
+    mexErrMsgTxt(msg.c_str());
+  }
+
+}
@@ -0,0 +1,73 @@
+function [im, info] = vmu_read(file, nbits, numthreads)
+% VMU_READ  Read a Hamamatsu Uncompressed Virtual Microscope Specimen
+% (.vmu) file
+%
+% IM = vmu_read(FILE)
+%
+%   FILE is a string with the path to the .vmu header file. The pixel
+%   data are read from the .ngr file given by key ImageFile in the
+%   header, relative to the directory of FILE.
+%
+%   IM is an RGB image of class uint8 and size (Height, Width, 3).
+%   The microscope stores 12 bits per channel, and only the 8 most
+%   significant bits are kept.
+%
+% IM = vmu_read(FILE, NBITS, NUMTHREADS)
+%
+%   NBITS is 8 (default) or 16. With NBITS=16, IM is of class uint16,
+%   and has the raw 12-bit values of the microscope (0 to 4095).
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% [IM, INFO] = vmu_read(...)
+%
+%   INFO is a struct with the image metadata:
+%
+%     INFO.Width, INFO.Height: image size in pixels.
+%     INFO.ColumnWidth: width of the strips in the .ngr file.
+%     INFO.PixelSize: [dy dx] pixel size in m, computed as
+%       PhysicalHeight/PixelHeight and PhysicalWidth/PixelWidth (the
+%       header gives physical sizes in nm).
+%     INFO.Header: (N, 2) cell array with all the "Key=Value" pairs
+%       in the .vmu header, as strings.
+%
+%   The .ngr file is memory-mapped, and the image is decoded in
+%   parallel by tiles, without intermediate copies.
+%
+%   To convert many files to PNG, TIFF or MHA without starting Matlab,
+%   see command line program vmu2png.
+%
+% See also: imread.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.1
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -0,0 +1,644 @@
+/*
+ * BlockProcessingEngine.h
+ *
+ * Native block processing of 2D and 3D images, used by
+ * blockproc3_mex.cpp.
+ *
+ * The image is tiled into blocks. Each block is grown by a border
+ * (halo), copied to a buffer of the worker thread, and processed by
+ * a BlockKernel. The border is trimmed from the result, and the
+ * block is written straight into the preallocated output image.
+ *
+ * Blocks are pulled from a shared queue by the worker threads
+ * (parallelForDynamic()), so that blocks that take longer to process
+ * don't hold back the other threads. Only one block per thread is in
+ * memory at any time.
+ *
+ * Kernels see the block with its border as if it was a whole image,
+ * i.e. with the same boundary conditions that blockproc3() gives to
+ * the Matlab function handle. Thus, a kernel produces the same result
+ * as on the full image in the voxels that are further than its
+ * radius from the border.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef BLOCKPROCESSINGENGINE_H
+#define BLOCKPROCESSINGENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * BlockGrid: tiling of an image of size sz=(R, C, S) into blocks of
+ * size blk, each one grown by border voxels on each side, clipped to
+ * the image. Blocks are numbered in Matlab order (rows first).
+ */
+class BlockGrid {
+
+ public:
+
+  BlockGrid(const size_t *_sz, const size_t *_blk, const size_t *_border) {
+    for (int d = 0; d < 3; ++d) {
+      this->sz[d] = _sz[d];
+      this->blk[d] = std::max(_blk[d], (size_t)1);
+      this->border[d] = _border[d];
+      this->nblk[d] = (this->sz[d] + this->blk[d] - 1) / this->blk[d];
+    }
+  }
+
+  size_t NumberOfBlocks() const {
+    return this->nblk[0] * this->nblk[1] * this->nblk[2];
+  }
+
+  // core (without border) and halo (with border) limits of block b,
+  // as half-open intervals [lo, hi)
+  void GetBlock(size_t b, size_t *coreLo, size_t *coreHi,
+		size_t *haloLo, size_t *haloHi) const {
+    size_t idx[3];
+    idx[0] = b % this->nblk[0];
+    idx[1] = (b / this->nblk[0]) % this->nblk[1];
+    idx[2] = b / (this->nblk[0] * this->nblk[1]);
+    for (int d = 0; d < 3; ++d) {
+      coreLo[d] = idx[d] * this->blk[d];
+      coreHi[d] = std::min(coreLo[d] + this->blk[d], this->sz[d]);
+      haloLo[d] = (coreLo[d] > this->border[d]) ? coreLo[d] - this->border[d] : 0;
+      haloHi[d] = std::min(coreHi[d] + this->border[d], this->sz[d]);
+    }
+  }
+
+  size_t sz[3];
+  size_t blk[3];
+  size_t border[3];
+  size_t nblk[3];
+
+};
+
+/*
+ * BlockKernel: native filter applied to each block.
+ *
+ * Run() gets the block with its border in column-major order, with
+ * size sz=(R, C, S), and writes the result, with the same size, to
+ * out. scratch is a buffer owned by the worker thread, that the
+ * kernel can resize and use freely.
+ *
+ * Kernels are shared by all the worker threads, so Run() must not
+ * modify the kernel.
+ */
+class BlockKernel {
+
+ public:
+
+  virtual ~BlockKernel() {}
+
+  virtual void Run(const double *in, const size_t *sz, double *out,
+		   std::vector<double> &scratch) const = 0;
+
+};
+
+/*
+ * Helpers to process an image line by line along dimension d. The
+ * line is copied to a contiguous buffer, processed, and copied back.
+ */
+template <class TLineFunctor>
+void processLines(double *im, const size_t *sz, int d, const TLineFunctor &f,
+		  std::vector<double> &line, std::vector<double> &aux) {
+  size_t n = sz[d];
+  if (n < 2) {
+    return;
+  }
+  size_t stride = (d == 0) ? 1 : ((d == 1) ? sz[0] : sz[0] * sz[1]);
+  size_t nlines = sz[0] * sz[1] * sz[2] / n;
+  line.resize(n);
+  for (size_t l = 0; l < nlines; ++l) {
+    // index of the first voxel of the line
+    size_t first;
+    if (d == 0) {
+      first = l * sz[0];
+    } else if (d == 1) {
+      first = (l % sz[0]) + (l / sz[0]) * sz[0] * sz[1];
+    } else {
+      first = l;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      line[i] = im[first + i * stride];
+    }
+    f(line, aux);
+    for (size_t i = 0; i < n; ++i) {
+      im[first + i * stride] = line[i];
+    }
+  }
+}
+
+/*
+ * Line filters. Voxels outside the line are replicated from the
+ * nearest end (zero-flux Neumann boundary condition, as in ITK).
+ */
+
+// mean of a box of radius r
+class LineBoxMean {
+
+ public:
+
+  LineBoxMean(size_t _r) : r(_r) {}
+
+  void operator()(std::vector<double> &line, std::vector<double> &aux) const {
+    long n = (long)line.size();
+    long r = (long)this->r;
+    aux.resize(n + 2 * r + 1);
+    // cumulative sum of the padded line
+    aux[0] = 0.0;
+    for (long i = -r; i < n + r; ++i) {
+      aux[i + r + 1] = aux[i + r] + line[std::min(std::max(i, 0L), n - 1)];
+    }
+    double norm = 1.0 / (double)(2 * r + 1);
+    for (long i = 0; i < n; ++i) {
+      line[i] = (aux[i + 2 * r + 1] - aux[i]) * norm;
+    }
+  }
+
+ private:
+
+  size_t r;
+
+};
+
+// minimum or maximum of a box of radius r (monotone queue)
+class LineBoxMinMax {
+
+ public:
+
+  LineBoxMinMax(size_t _r, bool _isMax) : r(_r), isMax(_isMax) {}
+
+  void operator()(std::vector<double> &line, std::vector<double> &aux) const {
+    long n = (long)line.size();
+    long r = (long)this->r;
+    aux.assign(line.begin(), line.end());
+    std::deque<long> q;
+    long next = 0; // next voxel to push into the queue
+    for (long i = 0; i < n; ++i) {
+      long hi = std::min(i + r, n - 1);
+      for (; next <= hi; ++next) {
+	while (!q.empty() && this->Dominates(aux[next], aux[q.back()])) {
+	  q.pop_back();
+	}
+	q.push_back(next);
+      }
+      while (q.front() < i - r) {
+	q.pop_front();
+      }
+      line[i] = aux[q.front()];
+    }
+  }
+
+ private:
+
+  bool Dominates(double a, double b) const {
+    return this->isMax ? (a >= b) : (a <= b);
+  }
+
+  size_t r;
+  bool isMax;
+
+};
+
+// convolution with a normalised symmetric kernel w[0..r]
+class LineConvolution {
+
+ public:
+
+  LineConvolution(const std::vector<double> &_w) : w(_w) {}
+
+  void operator()(std::vector<double> &line, std::vector<double> &aux) const {
+    long n = (long)line.size();
+    long r = (long)this->w.size() - 1;
+    aux.assign(line.begin(), line.end());
+    for (long i = 0; i < n; ++i) {
+      double acc = this->w[0] * aux[i];
+      for (long k = 1; k <= r; ++k) {
+	acc += this->w[k] * (aux[std::max(i - k, 0L)]
+			     + aux[std::min(i + k, n - 1)]);
+      }
+      line[i] = acc;
+    }
+  }
+
+ private:
+
+  std::vector<double> w;
+
+};
+
+/*
+ * Separable kernels: box mean, grayscale dilation/erosion with a box,
+ * and Gaussian smoothing, applied one dimension at a time.
+ */
+class BoxMeanKernel : public BlockKernel {
+
+ public:
+
+  BoxMeanKernel(const size_t *_radius) {
+    std::copy(_radius, _radius + 3, this->radius);
+  }
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &scratch) const {
+    std::copy(in, in + sz[0] * sz[1] * sz[2], out);
+    std::vector<double> line;
+    for (int d = 0; d < 3; ++d) {
+      if (this->radius[d] > 0) {
+	processLines(out, sz, d, LineBoxMean(this->radius[d]), line, scratch);
+      }
+    }
+  }
+
+ private:
+
+  size_t radius[3];
+
+};
+
+class BoxMinMaxKernel : public BlockKernel {
+
+ public:
+
+  BoxMinMaxKernel(const size_t *_radius, bool _isMax) : isMax(_isMax) {
+    std::copy(_radius, _radius + 3, this->radius);
+  }
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &scratch) const {
+    std::copy(in, in + sz[0] * sz[1] * sz[2], out);
+    std::vector<double> line;
+    for (int d = 0; d < 3; ++d) {
+      if (this->radius[d] > 0) {
+	processLines(out, sz, d, LineBoxMinMax(this->radius[d], this->isMax),
+		     line, scratch);
+      }
+    }
+  }
+
+ private:
+
+  size_t radius[3];
+  bool isMax;
+
+};
+
+class GaussianKernel : public BlockKernel {
+
+ public:
+
+  // sigma in voxels. The Gaussian is truncated at 3*sigma
+  GaussianKernel(const double *sigma) {
+    for (int d = 0; d < 3; ++d) {
+      if (sigma[d] <= 0.0) {
+	continue;
+      }
+      size_t r = (size_t)std::ceil(3.0 * sigma[d]);
+      std::vector<double> &w = this->weights[d];
+      w.resize(r + 1);
+      double norm = 0.0;
+      for (size_t k = 0; k <= r; ++k) {
+	w[k] = std::exp(-0.5 * (double)(k * k) / (sigma[d] * sigma[d]));
+	norm += (k == 0) ? w[k] : 2.0 * w[k];
+      }
+      for (size_t k = 0; k <= r; ++k) {
+	w[k] /= norm;
+      }
+    }
+  }
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &scratch) const {
+    std::copy(in, in + sz[0] * sz[1] * sz[2], out);
+    std::vector<double> line;
+    for (int d = 0; d < 3; ++d) {
+      if (this->weights[d].size() > 1) {
+	processLines(out, sz, d, LineConvolution(this->weights[d]), line, scratch);
+      }
+    }
+  }
+
+ private:
+
+  std::vector<double> weights[3];
+
+};
+
+/*
+ * MedianKernel: median of a box of radius r, with replicated
+ * boundaries, as itk::MedianImageFilter.
+ */
+class MedianKernel : public BlockKernel {
+
+ public:
+
+  MedianKernel(const size_t *_radius) {
+    std::copy(_radius, _radius + 3, this->radius);
+  }
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &scratch) const {
+    long R = (long)sz[0], C = (long)sz[1], S = (long)sz[2];
+    long rr = (long)this->radius[0], rc = (long)this->radius[1],
+      rs = (long)this->radius[2];
+    scratch.resize((2 * rr + 1) * (2 * rc + 1) * (2 * rs + 1));
+    size_t mid = scratch.size() / 2;
+    size_t idx = 0;
+    for (long s = 0; s < S; ++s) {
+      for (long c = 0; c < C; ++c) {
+	for (long r = 0; r < R; ++r, ++idx) {
+	  size_t k = 0;
+	  for (long ks = s - rs; ks <= s + rs; ++ks) {
+	    long ss = std::min(std::max(ks, 0L), S - 1);
+	    for (long kc = c - rc; kc <= c + rc; ++kc) {
+	      const double *col = in + (ss * C + std::min(std::max(kc, 0L), C - 1)) * R;
+	      for (long kr = r - rr; kr <= r + rr; ++kr) {
+		scratch[k++] = col[std::min(std::max(kr, 0L), R - 1)];
+	      }
+	    }
+	  }
+	  std::nth_element(scratch.begin(), scratch.begin() + mid, scratch.end());
+	  out[idx] = scratch[mid];
+	}
+      }
+    }
+  }
+
+ private:
+
+  size_t radius[3];
+
+};
+
+/*
+ * TotalVariationKernel: local total variation |Dx|+|Dy|+|Dz|, with
+ * forward finite differences that are zero on the last row, column
+ * and slice, as in forward_TV(). The sum of the output is the total
+ * variation of the image. Needs a border of 1 voxel.
+ */
+class TotalVariationKernel : public BlockKernel {
+
+ public:
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &) const {
+    size_t R = sz[0], C = sz[1], S = sz[2];
+    size_t RC = R * C;
+    size_t idx = 0;
+    for (size_t s = 0; s < S; ++s) {
+      for (size_t c = 0; c < C; ++c) {
+	for (size_t r = 0; r < R; ++r, ++idx) {
+	  double v = 0.0;
+	  if (r + 1 < R) {
+	    v += std::fabs(in[idx + 1] - in[idx]);
+	  }
+	  if (c + 1 < C) {
+	    v += std::fabs(in[idx + R] - in[idx]);
+	  }
+	  if (s + 1 < S) {
+	    v += std::fabs(in[idx + RC] - in[idx]);
+	  }
+	  out[idx] = v;
+	}
+      }
+    }
+  }
+
+};
+
+/*
+ * SignedDistanceKernel: signed Euclidean distance, in voxel units,
+ * to the boundary of the foreground (non-zero voxels), with the same
+ * convention as itk::SignedMaurerDistanceMapImageFilter: foreground
+ * voxels with a 6-connected background neighbour are the boundary
+ * (distance 0), other foreground voxels are negative, background
+ * voxels are positive.
+ *
+ * The exact squared distance transform is computed with the
+ * separable lower envelope algorithm by Felzenszwalb and
+ * Huttenlocher, "Distance Transforms of Sampled Functions", 2012.
+ *
+ * Distances are exact if they are smaller than the border of the
+ * block. Blocks without boundary voxels are set to +/-Inf.
+ */
+class LineSquaredDistance {
+
+ public:
+
+  void operator()(std::vector<double> &line, std::vector<double> &aux) const {
+    long n = (long)line.size();
+    const double inf = std::numeric_limits<double>::infinity();
+    // aux = [f(0..n-1) | v(0..n-1) | z(0..n)]
+    aux.resize(3 * n + 1);
+    double *f = &aux[0];
+    double *v = &aux[n];
+    double *z = &aux[2 * n];
+    std::copy(line.begin(), line.end(), f);
+    long k = -1;
+    for (long q = 0; q < n; ++q) {
+      if (f[q] == inf) {
+	continue;
+      }
+      double s = -inf;
+      while (k >= 0) {
+	long p = (long)v[k];
+	s = ((f[q] + (double)(q * q)) - (f[p] + (double)(p * p)))
+	  / (2.0 * (double)(q - p));
+	if (s > z[k]) {
+	  break;
+	}
+	--k;
+      }
+      ++k;
+      v[k] = (double)q;
+      z[k] = (k == 0) ? -inf : s;
+      z[k + 1] = inf;
+    }
+    if (k < 0) {
+      return; // the whole line is at infinite distance
+    }
+    k = 0;
+    for (long q = 0; q < n; ++q) {
+      while (z[k + 1] < (double)q) {
+	++k;
+      }
+      long p = (long)v[k];
+      line[q] = (double)((q - p) * (q - p)) + f[p];
+    }
+  }
+
+};
+
+class SignedDistanceKernel : public BlockKernel {
+
+ public:
+
+  void Run(const double *in, const size_t *sz, double *out,
+	   std::vector<double> &scratch) const {
+    size_t R = sz[0], C = sz[1], S = sz[2];
+    size_t RC = R * C;
+    const double inf = std::numeric_limits<double>::infinity();
+
+    // boundary voxels are the seeds of the distance transform
+    size_t idx = 0;
+    for (size_t s = 0; s < S; ++s) {
+      for (size_t c = 0; c < C; ++c) {
+	for (size_t r = 0; r < R; ++r, ++idx) {
+	  bool boundary = false;
+	  if (in[idx] != 0.0) {
+	    boundary = (r > 0 && in[idx - 1] == 0.0)
+	      || (r + 1 < R && in[idx + 1] == 0.0)
+	      || (c > 0 && in[idx - R] == 0.0)
+	      || (c + 1 < C && in[idx + R] == 0.0)
+	      || (s > 0 && in[idx - RC] == 0.0)
+	      || (s + 1 < S && in[idx + RC] == 0.0);
+	  }
+	  out[idx] = boundary ? 0.0 : inf;
+	}
+      }
+    }
+
+    std::vector<double> line;
+    for (int d = 0; d < 3; ++d) {
+      processLines(out, sz, d, LineSquaredDistance(), line, scratch);
+    }
+
+    for (idx = 0; idx < R * C * S; ++idx) {
+      out[idx] = std::sqrt(out[idx]);
+      if (in[idx] != 0.0) {
+	out[idx] = -out[idx];
+      }
+    }
+  }
+
+};
+
+/*
+ * BlockProcessor: functor run by the worker threads. Each call
+ * processes a range of blocks: copy the block with its border to the
+ * thread's buffer, run the kernel, and write the trimmed result to
+ * the output image.
+ */
+template <class TIn, class TOut>
+class BlockProcessor {
+
+ public:
+
+  BlockProcessor(const TIn *_im, TOut *_im2, const BlockGrid &_grid,
+		 const BlockKernel &_kernel, unsigned int numThreads)
+    : im(_im), im2(_im2), grid(_grid), kernel(_kernel),
+      tileIn(numThreads), tileOut(numThreads), scratch(numThreads) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    std::vector<double> &bin = this->tileIn[thread];
+    std::vector<double> &bout = this->tileOut[thread];
+    const size_t R = this->grid.sz[0];
+    const size_t RC = this->grid.sz[0] * this->grid.sz[1];
+
+    for (size_t b = begin; b < end; ++b) {
+
+      size_t coreLo[3], coreHi[3], haloLo[3], haloHi[3], bsz[3];
+      this->grid.GetBlock(b, coreLo, coreHi, haloLo, haloHi);
+      for (int d = 0; d < 3; ++d) {
+	bsz[d] = haloHi[d] - haloLo[d];
+      }
+      bin.resize(bsz[0] * bsz[1] * bsz[2]);
+      bout.resize(bin.size());
+
+      // copy block with border
+      size_t k = 0;
+      for (size_t s = haloLo[2]; s < haloHi[2]; ++s) {
+	for (size_t c = haloLo[1]; c < haloHi[1]; ++c) {
+	  const TIn *col = this->im + s * RC + c * R;
+	  for (size_t r = haloLo[0]; r < haloHi[0]; ++r) {
+	    bin[k++] = (double)col[r];
+	  }
+	}
+      }
+
+      this->kernel.Run(&bin[0], bsz, &bout[0], this->scratch[thread]);
+
+      // write the block without border to the output
+      for (size_t s = coreLo[2]; s < coreHi[2]; ++s) {
+	for (size_t c = coreLo[1]; c < coreHi[1]; ++c) {
+	  TOut *col = this->im2 + s * RC + c * R;
+	  const double *bcol = &bout[0]
+	    + ((s - haloLo[2]) * bsz[1] + (c - haloLo[1])) * bsz[0]
+	    - haloLo[0];
+	  for (size_t r = coreLo[0]; r < coreHi[0]; ++r) {
+	    col[r] = (TOut)bcol[r];
+	  }
+	}
+      }
+
+    }
+  }
+
+ private:
+
+  const TIn *im;
+  TOut *im2;
+  const BlockGrid &grid;
+  const BlockKernel &kernel;
+  std::vector<std::vector<double> > tileIn;
+  std::vector<std::vector<double> > tileOut;
+  std::vector<std::vector<double> > scratch;
+
+};
+
+/*
+ * blockProcess(): process image im block by block with kernel, and
+ * write the result to im2, that must be preallocated with the same
+ * size as im.
+ *
+ * numThreads: number of threads (0 = number of hardware threads).
+ */
+template <class TIn, class TOut>
+void blockProcess(const TIn *im, TOut *im2, const BlockGrid &grid,
+		  const BlockKernel &kernel, unsigned int numThreads = 0) {
+  numThreads = getNumberOfThreads(numThreads);
+  BlockProcessor<TIn, TOut> processor(im, im2, grid, kernel, numThreads);
+  parallelForDynamic(0, grid.NumberOfBlocks(), 1, processor, numThreads);
+}
+
+#endif /* BLOCKPROCESSINGENGINE_H */
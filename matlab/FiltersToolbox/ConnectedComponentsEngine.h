@@ -0,0 +1,728 @@
+/*
+ * ConnectedComponentsEngine.h
+ *
+ * Native connected component labelling of 2D and 3D masks, with
+ * per-component statistics, used by MEX function bwlabel_stats.cpp.
+ *
+ * Components are labelled with a union-find forest stored in the
+ * label image itself: while labelling, each foreground voxel holds
+ * the linear index (+1) of its parent, and the root of each component
+ * is its first voxel in linear order, so labels are numbered in the
+ * same order as bwconncomp(). No list of voxel indices is created, so
+ * the only memory needed on top of the mask is the label image and
+ * the statistics.
+ *
+ * The image is split into slabs of slices (or of columns for 2D
+ * images) that are labelled in parallel. Then the components of
+ * adjacent slabs are merged at the slab boundaries, and a last
+ * parallel pass writes the final labels and accumulates the
+ * statistics of each component: number of voxels, bounding box,
+ * centroid, second moments and, optionally, the sum of intensities
+ * of another image. Sums of indices are accumulated as 64-bit
+ * integers, so they are exact, and the results don't depend on the
+ * number of threads.
+ *
+ * Components smaller than a given number of voxels can then be
+ * deleted from the label image, and the remaining ones renumbered.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef CONNECTEDCOMPONENTSENGINE_H
+#define CONNECTEDCOMPONENTSENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <vector>
+
+/* Boost headers */
+#include <boost/cstdint.hpp>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * ComponentStats: statistics of one connected component. Indices are
+ * 0-based, in order (row, column, slice).
+ */
+struct ComponentStats {
+
+  // number of voxels
+  boost::uint64_t numVoxels;
+
+  // first and last index of the bounding box in each dimension
+  size_t boxMin[3];
+  size_t boxMax[3];
+
+  // sums of the indices, and of their products in order rr, cc, ss,
+  // rc, rs, cs
+  boost::uint64_t sum[3];
+  boost::uint64_t sum2[6];
+
+  // sum of the intensities, and of the squared intensities
+  double intensity;
+  double intensity2;
+
+  ComponentStats() : numVoxels(0), intensity(0.0), intensity2(0.0) {
+    for (int d = 0; d < 3; ++d) {
+      this->boxMin[d] = (size_t)-1;
+      this->boxMax[d] = 0;
+      this->sum[d] = 0;
+    }
+    for (int k = 0; k < 6; ++k) {
+      this->sum2[k] = 0;
+    }
+  }
+
+  void Add(size_t r, size_t c, size_t s, double v) {
+    const size_t x[3] = {r, c, s};
+    ++this->numVoxels;
+    for (int d = 0; d < 3; ++d) {
+      this->boxMin[d] = std::min(this->boxMin[d], x[d]);
+      this->boxMax[d] = std::max(this->boxMax[d], x[d]);
+      this->sum[d] += x[d];
+    }
+    this->sum2[0] += (boost::uint64_t)r * r;
+    this->sum2[1] += (boost::uint64_t)c * c;
+    this->sum2[2] += (boost::uint64_t)s * s;
+    this->sum2[3] += (boost::uint64_t)r * c;
+    this->sum2[4] += (boost::uint64_t)r * s;
+    this->sum2[5] += (boost::uint64_t)c * s;
+    this->intensity += v;
+    this->intensity2 += v * v;
+  }
+
+  void Merge(const ComponentStats &o) {
+    this->numVoxels += o.numVoxels;
+    for (int d = 0; d < 3; ++d) {
+      this->boxMin[d] = std::min(this->boxMin[d], o.boxMin[d]);
+      this->boxMax[d] = std::max(this->boxMax[d], o.boxMax[d]);
+      this->sum[d] += o.sum[d];
+    }
+    for (int k = 0; k < 6; ++k) {
+      this->sum2[k] += o.sum2[k];
+    }
+    this->intensity += o.intensity;
+    this->intensity2 += o.intensity2;
+  }
+
+  // mean index in dimension d
+  double GetCentroid(int d) const {
+    return (double)this->sum[d] / (double)this->numVoxels;
+  }
+
+  // second central moment of dimensions d0 and d1, normalised by the
+  // number of voxels
+  double GetCovariance(int d0, int d1) const {
+    static const int k[3][3] = {{0, 3, 4}, {3, 1, 5}, {4, 5, 2}};
+    const double n = (double)this->numVoxels;
+    return ((double)this->sum2[k[d0][d1]]
+	    - (double)this->sum[d0] * (double)this->sum[d1] / n) / n;
+  }
+
+};
+
+/*
+ * ComponentOffset: relative position of a neighbour voxel.
+ */
+struct ComponentOffset {
+  int dr, dc, ds;
+  std::ptrdiff_t step;
+};
+
+template <class T, class TLab> class ComponentScanFunctor;
+template <class TLab> class ComponentRootFunctor;
+template <class TLab, class TIm> class ComponentResolveFunctor;
+template <class TLab> class ComponentRemapFunctor;
+
+/*
+ * ConnectedComponents: labelling and statistics of the connected
+ * components of a mask.
+ *
+ * sz:           image size (R, C, S). S=1 for 2D images.
+ * connectivity: 6, 18 or 26 for 3D images. For 2D images, 4 or 6
+ *               mean 4-connectivity, and 8, 18 or 26 mean
+ *               8-connectivity.
+ * numThreads:   number of threads (0 = number of hardware threads).
+ *
+ * TLab is the unsigned integer type of the label image. It must be
+ * able to hold the number of voxels + 1 without using its most
+ * significant bit, that is used internally as a flag.
+ *
+ * Usage:
+ *
+ *   ConnectedComponents<boost::uint32_t> cc(sz, 26);
+ *   cc.FindComponents(mask, lab);
+ *   cc.ResolveLabels(im);          // im can be NULL
+ *   cc.RemoveSmallComponents(10);  // optional
+ */
+template <class TLab>
+class ConnectedComponents {
+
+  template <class T, class TLab2> friend class ComponentScanFunctor;
+  template <class TLab2> friend class ComponentRootFunctor;
+  template <class TLab2, class TIm> friend class ComponentResolveFunctor;
+  template <class TLab2> friend class ComponentRemapFunctor;
+
+ public:
+
+  ConnectedComponents(const size_t *sz, unsigned int connectivity,
+		      unsigned int _numThreads = 0) : lab(NULL) {
+    this->R = sz[0];
+    this->C = sz[1];
+    this->S = sz[2];
+    this->numThreads = getNumberOfThreads(_numThreads);
+
+    // maximum number of non-zero displacements of a neighbour: 1 for
+    // face neighbours, 2 for edges and 3 for corners
+    int maxNonZero = 3;
+    if (connectivity == 4 || connectivity == 6) {
+      maxNonZero = 1;
+    } else if (connectivity == 18) {
+      maxNonZero = 2;
+    }
+
+    // neighbours that precede the voxel in linear order. They are
+    // visited before the voxel in a raster scan
+    for (int ds = -1; ds <= 0; ++ds) {
+      for (int dc = -1; dc <= 1; ++dc) {
+	for (int dr = -1; dr <= 1; ++dr) {
+	  if (ds == 0 && (dc > 0 || (dc == 0 && dr >= 0))) {
+	    continue;
+	  }
+	  if ((this->S == 1 && ds != 0)
+	      || (dr != 0) + (dc != 0) + (ds != 0) > maxNonZero) {
+	    continue;
+	  }
+	  ComponentOffset o;
+	  o.dr = dr;
+	  o.dc = dc;
+	  o.ds = ds;
+	  o.step = (std::ptrdiff_t)dr + (std::ptrdiff_t)dc * (std::ptrdiff_t)this->R
+	    + (std::ptrdiff_t)ds * (std::ptrdiff_t)(this->R * this->C);
+	  this->offsets.push_back(o);
+
+	  // if the previous voxel in the column is foreground, the
+	  // neighbours adjacent to it are already in its component, so
+	  // only the others need to be visited
+	  const bool isPrevious = (dr == -1 && dc == 0 && ds == 0);
+	  const bool adjacentToPrevious = (dr <= 0)
+	    && (dr + 1 != 0) + (dc != 0) + (ds != 0) <= maxNonZero;
+	  if (!isPrevious && !adjacentToPrevious) {
+	    this->offsetsAfterPrevious.push_back(o);
+	  }
+	}
+      }
+    }
+
+    // the image is split into slabs of layers, that are slices, or
+    // columns for 2D images. There are more slabs than threads, to
+    // balance the load when the mask is not uniform
+    this->layerSize = (this->S > 1) ? this->R * this->C : this->R;
+    this->numLayers = (this->S > 1) ? this->S : this->C;
+    if (this->R * this->C * this->S == 0) {
+      this->numLayers = 0;
+    }
+    const size_t numSlabs = std::min(this->numLayers, (size_t)this->numThreads * 4);
+    this->slabFirst.assign(numSlabs + 1, 0);
+    for (size_t k = 1; k <= numSlabs; ++k) {
+      this->slabFirst[k] = k * this->numLayers / numSlabs;
+    }
+  }
+
+  // label the connected components of the non-zero voxels of mask,
+  // with size sz and stored column-major. lab must be preallocated
+  // with the same size. Returns the number of components. The labels
+  // are only written to lab by ResolveLabels()
+  template <class T>
+  size_t FindComponents(const T *mask, TLab *_lab) {
+    this->lab = _lab;
+    const size_t numSlabs = this->GetNumberOfSlabs();
+    this->roots.assign(numSlabs, std::vector<size_t>());
+    this->linked.clear();
+    this->labelFirst.assign(numSlabs + 1, 1);
+    this->stats.clear();
+    if (numSlabs == 0) {
+      return 0;
+    }
+
+    // components within each slab
+    ComponentScanFunctor<T, TLab> scan(*this, mask);
+    parallelForDynamic(0, numSlabs, 1, scan, this->numThreads);
+
+    // merge components that touch across slab boundaries
+    for (size_t k = 1; k < numSlabs; ++k) {
+      this->MergeSlab(k);
+    }
+
+    // roots of the forest, i.e. components. The roots of each slab
+    // are numbered consecutively, and get a flag so that they can be
+    // told from pointers
+    ComponentRootFunctor<TLab> root(*this);
+    parallelForDynamic(0, numSlabs, 1, root, this->numThreads);
+    for (size_t k = 0; k < numSlabs; ++k) {
+      this->labelFirst[k + 1] = this->labelFirst[k] + this->roots[k].size();
+      for (size_t m = 0; m < this->roots[k].size(); ++m) {
+	this->lab[this->roots[k][m]] = (TLab)(this->labelFirst[k] + m) | Flag;
+      }
+    }
+
+    // roots linked to another component point directly to the final
+    // label
+    std::sort(this->linked.begin(), this->linked.end());
+    for (size_t m = 0; m < this->linked.size(); ++m) {
+      const size_t i = this->linked[m];
+      this->lab[i] = this->lab[this->lab[i] - 1];
+    }
+    return this->labelFirst[numSlabs] - 1;
+  }
+
+  // write the final labels to the label image, and compute the
+  // statistics of each component. im is an intensity image with the
+  // size of the mask, or NULL
+  template <class TIm>
+  void ResolveLabels(const TIm *im) {
+    const size_t numSlabs = this->GetNumberOfSlabs();
+    this->stats.assign(this->labelFirst[numSlabs] - 1, ComponentStats());
+    this->foreign.assign(numSlabs, std::map<size_t, ComponentStats>());
+    if (numSlabs == 0) {
+      return;
+    }
+    ComponentResolveFunctor<TLab, TIm> resolve(*this, im);
+    parallelForDynamic(0, numSlabs, 1, resolve, this->numThreads);
+
+    // the roots still have the flag
+    for (size_t k = 0; k < numSlabs; ++k) {
+      for (size_t m = 0; m < this->roots[k].size(); ++m) {
+	this->lab[this->roots[k][m]] &= LabelMask;
+      }
+      std::vector<size_t>().swap(this->roots[k]);
+    }
+    for (size_t m = 0; m < this->linked.size(); ++m) {
+      this->lab[this->linked[m]] &= LabelMask;
+    }
+    std::vector<size_t>().swap(this->linked);
+
+    // statistics of components that started in a previous slab
+    for (size_t k = 0; k < numSlabs; ++k) {
+      std::map<size_t, ComponentStats>::const_iterator it;
+      for (it = this->foreign[k].begin(); it != this->foreign[k].end(); ++it) {
+	this->stats[it->first - 1].Merge(it->second);
+      }
+    }
+    this->foreign.clear();
+  }
+
+  // delete the components with fewer than minSize voxels from the
+  // label image and the statistics, and renumber the rest
+  // consecutively. Returns the number of components left
+  size_t RemoveSmallComponents(boost::uint64_t minSize) {
+    const size_t N = this->stats.size();
+    std::vector<TLab> lut(N + 1, 0);
+    std::vector<ComponentStats> keep;
+    for (size_t l = 0; l < N; ++l) {
+      if (this->stats[l].numVoxels >= minSize) {
+	keep.push_back(this->stats[l]);
+	lut[l + 1] = (TLab)keep.size();
+      }
+    }
+    if (keep.size() < N) {
+      ComponentRemapFunctor<TLab> remap(*this, lut);
+      parallelForDynamic(0, this->GetNumberOfSlabs(), 1, remap, this->numThreads);
+      this->stats.swap(keep);
+    }
+    return this->stats.size();
+  }
+
+  // number of components
+  size_t GetNumberOfComponents() const {
+    return this->stats.size();
+  }
+
+  // statistics of each component, valid after ResolveLabels(). The
+  // statistics of label l are in element l-1
+  const std::vector<ComponentStats> &GetStats() const {
+    return this->stats;
+  }
+
+ private:
+
+  // flag of the roots, and mask to remove it
+  static const TLab Flag = (TLab)((TLab)1 << (8 * sizeof(TLab) - 1));
+  static const TLab LabelMask = (TLab)(Flag - 1);
+
+  size_t GetNumberOfSlabs() const {
+    return this->slabFirst.size() - 1;
+  }
+
+  // first and one past the last voxel of slab k
+  size_t GetSlabBegin(size_t k) const {
+    return this->slabFirst[k] * this->layerSize;
+  }
+  size_t GetSlabEnd(size_t k) const {
+    return this->slabFirst[k + 1] * this->layerSize;
+  }
+
+  // root of the tree of voxel i. While labelling, lab[i] is the index
+  // of the parent of i + 1, and roots are their own parent. Paths are
+  // halved on the way
+  size_t Find(size_t i) {
+    for (;;) {
+      const size_t p = this->lab[i] - 1;
+      if (p == i) {
+	return i;
+      }
+      const size_t gp = this->lab[p] - 1;
+      this->lab[i] = (TLab)(gp + 1);
+      i = gp;
+    }
+  }
+
+  // index of "no voxel"
+  static const size_t None = (size_t)-1;
+
+  // link the component of the current voxel, with root root (or None
+  // if it has no foreground neighbours yet), to the component of
+  // neighbour j. Neighbours often have the same parent as the previous
+  // one, prev, and then the root doesn't need to be found again
+  void LinkNeighbour(size_t j, size_t &root, TLab &prev) {
+    const TLab v = this->lab[j];
+    if (v == 0 || v == prev) {
+      return;
+    }
+    prev = v;
+    const size_t rj = this->Find(j);
+    if (root == None) {
+      root = rj;
+    } else if (rj < root) {
+      this->lab[root] = (TLab)(rj + 1);
+      root = rj;
+    } else if (rj > root) {
+      this->lab[rj] = (TLab)(root + 1);
+    }
+  }
+
+  // label slab k with a raster scan, linking each voxel to the
+  // components of its preceding neighbours in the slab. The root of
+  // each tree is its first voxel. Then every voxel is pointed
+  // directly at its root
+  template <class T>
+  void ScanSlab(size_t k, const T *mask) {
+    TLab *lab = this->lab;
+    const size_t first = this->GetSlabBegin(k);
+    const size_t last = this->GetSlabEnd(k);
+    const std::ptrdiff_t R = (std::ptrdiff_t)this->R;
+    const std::ptrdiff_t C = (std::ptrdiff_t)this->C;
+    const std::ptrdiff_t cLo = (this->S > 1) ? 0 : (std::ptrdiff_t)this->slabFirst[k];
+    const std::ptrdiff_t sLo = (this->S > 1) ? (std::ptrdiff_t)this->slabFirst[k] : 0;
+    std::ptrdiff_t r = 0;
+    std::ptrdiff_t c = (std::ptrdiff_t)((first / this->R) % this->C);
+    std::ptrdiff_t s = (std::ptrdiff_t)(first / (this->R * this->C));
+    for (size_t i = first; i < last; ++i) {
+      if (mask[i] == 0) {
+	lab[i] = 0;
+      } else {
+	size_t root = None;
+	TLab prev = 0;
+	const std::vector<ComponentOffset> *neigh = &this->offsets;
+	if (r > 0 && lab[i - 1] != 0) {
+	  this->LinkNeighbour(i - 1, root, prev);
+	  neigh = &this->offsetsAfterPrevious;
+	}
+	if (r > 0 && r + 1 < R && c > cLo && c + 1 < C && (this->S == 1 || s > sLo)) {
+	  // all the neighbours are inside the slab
+	  for (size_t n = 0; n < neigh->size(); ++n) {
+	    this->LinkNeighbour(i + (*neigh)[n].step, root, prev);
+	  }
+	} else {
+	  for (size_t n = 0; n < neigh->size(); ++n) {
+	    const ComponentOffset &o = (*neigh)[n];
+	    const std::ptrdiff_t rn = r + o.dr;
+	    const std::ptrdiff_t cn = c + o.dc;
+	    if (rn >= 0 && rn < R && cn >= cLo && cn < C && s + o.ds >= sLo) {
+	      this->LinkNeighbour(i + o.step, root, prev);
+	    }
+	  }
+	}
+	lab[i] = (TLab)(((root == None) ? i : root) + 1);
+      }
+      if (++r == R) {
+	r = 0;
+	if (++c == C) {
+	  c = 0;
+	  ++s;
+	}
+      }
+    }
+
+    // parents precede their children, so one pass is enough
+    for (size_t i = first; i < last; ++i) {
+      if (lab[i] != 0) {
+	lab[i] = lab[lab[i] - 1];
+      }
+    }
+  }
+
+  // merge the components in the first layer of slab k with those in
+  // the last layer of slab k-1. Roots are linked to the smaller root,
+  // so the root of each component is still its first voxel
+  void MergeSlab(size_t k) {
+    TLab *lab = this->lab;
+    const size_t first = this->GetSlabBegin(k);
+    const std::ptrdiff_t R = (std::ptrdiff_t)this->R;
+    const std::ptrdiff_t C = (std::ptrdiff_t)this->C;
+    std::ptrdiff_t r = 0;
+    std::ptrdiff_t c = (std::ptrdiff_t)((first / this->R) % this->C);
+    for (size_t i = first; i < first + this->layerSize; ++i) {
+      if (lab[i] != 0) {
+	for (size_t n = 0; n < this->offsets.size(); ++n) {
+	  const ComponentOffset &o = this->offsets[n];
+	  const std::ptrdiff_t rn = r + o.dr;
+	  const std::ptrdiff_t cn = c + o.dc;
+	  if (((this->S > 1) ? o.ds : o.dc) != -1
+	      || rn < 0 || rn >= R || cn < 0 || cn >= C) {
+	    continue;
+	  }
+	  const size_t j = i + o.step;
+	  if (lab[j] == 0) {
+	    continue;
+	  }
+	  size_t ri = this->Find(i);
+	  size_t rj = this->Find(j);
+	  if (ri == rj) {
+	    continue;
+	  }
+	  if (ri < rj) {
+	    std::swap(ri, rj);
+	  }
+	  lab[ri] = (TLab)(rj + 1);
+	  this->linked.push_back(ri);
+	}
+      }
+      if (++r == R) {
+	r = 0;
+	++c;
+      }
+    }
+  }
+
+  // roots of the components whose first voxel is in slab k. After
+  // merging, every voxel points to a root or to a linked root
+  void CollectRoots(size_t k) {
+    const size_t last = this->GetSlabEnd(k);
+    for (size_t i = this->GetSlabBegin(k); i < last; ++i) {
+      if (this->lab[i] != 0 && this->lab[i] - 1 == i) {
+	this->roots[k].push_back(i);
+      }
+    }
+  }
+
+  // replace the pointers of slab k with the labels of the roots, and
+  // accumulate the statistics. Components that started in a previous
+  // slab go to the slab's own map, merged afterwards, so that threads
+  // don't write to the same statistics
+  template <class TIm>
+  void ResolveSlab(size_t k, const TIm *im) {
+    TLab *lab = this->lab;
+    const size_t first = this->GetSlabBegin(k);
+    const size_t last = this->GetSlabEnd(k);
+    const size_t labelLo = this->labelFirst[k];
+    std::map<size_t, ComponentStats> &foreign = this->foreign[k];
+    size_t cachedLabel = 0;
+    ComponentStats *cached = NULL;
+    size_t r = 0;
+    size_t c = (first / this->R) % this->C;
+    size_t s = first / (this->R * this->C);
+    for (size_t i = first; i < last; ++i) {
+      const TLab v = lab[i];
+      if (v != 0) {
+	size_t l;
+	if (v & Flag) {
+	  l = (size_t)(v & LabelMask);
+	} else {
+	  l = (size_t)(lab[v - 1] & LabelMask);
+	  lab[i] = (TLab)l;
+	}
+	ComponentStats *st;
+	if (l >= labelLo) {
+	  st = &this->stats[l - 1];
+	} else if (l == cachedLabel) {
+	  st = cached;
+	} else {
+	  st = &foreign[l];
+	  cachedLabel = l;
+	  cached = st;
+	}
+	st->Add(r, c, s, (im == NULL) ? 0.0 : (double)im[i]);
+      }
+      if (++r == this->R) {
+	r = 0;
+	if (++c == this->C) {
+	  c = 0;
+	  ++s;
+	}
+      }
+    }
+  }
+
+  // relabel slab k with a look-up table
+  void RemapSlab(size_t k, const std::vector<TLab> &lut) {
+    TLab *lab = this->lab;
+    const size_t last = this->GetSlabEnd(k);
+    for (size_t i = this->GetSlabBegin(k); i < last; ++i) {
+      lab[i] = lut[lab[i]];
+    }
+  }
+
+  size_t R, C, S;
+  unsigned int numThreads;
+  std::vector<ComponentOffset> offsets;
+  std::vector<ComponentOffset> offsetsAfterPrevious;
+
+  // slabs of layers (slices, or columns for 2D images)
+  size_t layerSize;
+  size_t numLayers;
+  std::vector<size_t> slabFirst;
+
+  TLab *lab;
+
+  // roots of each slab, and roots linked to another component
+  std::vector<std::vector<size_t> > roots;
+  std::vector<size_t> linked;
+
+  // first label of each slab
+  std::vector<size_t> labelFirst;
+
+  std::vector<ComponentStats> stats;
+  std::vector<std::map<size_t, ComponentStats> > foreign;
+
+};
+
+/*
+ * ComponentScanFunctor: label slabs [begin, end) independently.
+ */
+template <class T, class TLab>
+class ComponentScanFunctor {
+
+ public:
+
+  ComponentScanFunctor(ConnectedComponents<TLab> &_cc, const T *_mask)
+    : cc(_cc), mask(_mask) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t k = begin; k < end; ++k) {
+      this->cc.ScanSlab(k, this->mask);
+    }
+  }
+
+ private:
+
+  ConnectedComponents<TLab> &cc;
+  const T *mask;
+
+};
+
+/*
+ * ComponentRootFunctor: find the roots of slabs [begin, end).
+ */
+template <class TLab>
+class ComponentRootFunctor {
+
+ public:
+
+  ComponentRootFunctor(ConnectedComponents<TLab> &_cc) : cc(_cc) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t k = begin; k < end; ++k) {
+      this->cc.CollectRoots(k);
+    }
+  }
+
+ private:
+
+  ConnectedComponents<TLab> &cc;
+
+};
+
+/*
+ * ComponentResolveFunctor: final labels and statistics of slabs
+ * [begin, end).
+ */
+template <class TLab, class TIm>
+class ComponentResolveFunctor {
+
+ public:
+
+  ComponentResolveFunctor(ConnectedComponents<TLab> &_cc, const TIm *_im)
+    : cc(_cc), im(_im) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t k = begin; k < end; ++k) {
+      this->cc.ResolveSlab(k, this->im);
+    }
+  }
+
+ private:
+
+  ConnectedComponents<TLab> &cc;
+  const TIm *im;
+
+};
+
+/*
+ * ComponentRemapFunctor: relabel slabs [begin, end).
+ */
+template <class TLab>
+class ComponentRemapFunctor {
+
+ public:
+
+  ComponentRemapFunctor(ConnectedComponents<TLab> &_cc, const std::vector<TLab> &_lut)
+    : cc(_cc), lut(_lut) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t k = begin; k < end; ++k) {
+      this->cc.RemapSlab(k, this->lut);
+    }
+  }
+
+ private:
+
+  ConnectedComponents<TLab> &cc;
+  const std::vector<TLab> &lut;
+
+};
+
+#endif /* CONNECTEDCOMPONENTSENGINE_H */
@@ -0,0 +1,182 @@
+/*
+ * DistanceTransformEngine.h
+ *
+ * Exact squared Euclidean distance transform of 1D, 2D and 3D images,
+ * used by LabelMorphologyEngine.h and ShapeBasedInterpolationEngine.h.
+ *
+ * The transform is separable: a 1D transform is applied along the
+ * rows, then the columns and then the slices, each time computing the
+ * lower envelope of the parabolas rooted at the samples
+ *
+ *   P. F. Felzenszwalb and D. P. Huttenlocher, "Distance Transforms of
+ *   Sampled Functions", Theory of Computing 8:415-428, 2012.
+ *
+ * so the cost is linear in the number of voxels, independently of the
+ * distances. Voxel size can be anisotropic.
+ *
+ * The class is not thread-safe, because it keeps its work buffers
+ * between calls, but each thread can use its own object to transform
+ * a different image.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef DISTANCETRANSFORMENGINE_H
+#define DISTANCETRANSFORMENGINE_H
+
+/* C++ headers */
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+/*
+ * SquaredDistanceTransform: exact squared Euclidean distance
+ * transform.
+ */
+class SquaredDistanceTransform {
+
+ public:
+
+  // value of the voxels that are not features
+  static double Infinity() {
+    return std::numeric_limits<double>::infinity();
+  }
+
+  // transform in place image f with size sz=(R, C, S), stored
+  // column-major. On input, f is 0 at the feature voxels and
+  // Infinity() elsewhere (more generally, any sampled function >= 0).
+  // On output, f is the squared distance to the nearest feature voxel,
+  // or Infinity() if there are no features.
+  //
+  // spacing: voxel size (row, column, slice), or NULL for 1.
+  void Compute(double *f, const size_t *sz, const double *spacing = NULL) {
+    const size_t R = sz[0];
+    const size_t C = sz[1];
+    const size_t S = sz[2];
+    double w2[3] = {1.0, 1.0, 1.0};
+    if (spacing != NULL) {
+      for (int d = 0; d < 3; ++d) {
+	w2[d] = spacing[d] * spacing[d];
+      }
+    }
+
+    // columns of voxels along each dimension
+    for (size_t s = 0; s < S; ++s) {
+      for (size_t c = 0; c < C; ++c) {
+	this->Transform1D(f + (s * C + c) * R, R, 1, w2[0]);
+      }
+    }
+    if (C > 1) {
+      for (size_t s = 0; s < S; ++s) {
+	for (size_t r = 0; r < R; ++r) {
+	  this->Transform1D(f + s * C * R + r, C, R, w2[1]);
+	}
+      }
+    }
+    if (S > 1) {
+      for (size_t c = 0; c < C; ++c) {
+	for (size_t r = 0; r < R; ++r) {
+	  this->Transform1D(f + c * R + r, S, R * C, w2[2]);
+	}
+      }
+    }
+  }
+
+ private:
+
+  // 1D transform of the n samples f[0], f[stride], ... with squared
+  // sample spacing w2
+  void Transform1D(double *f, size_t n, size_t stride, double w2) {
+    if (n < 2) {
+      return;
+    }
+    this->line.resize(n);
+    this->vertex.resize(n);
+    this->boundary.resize(n + 1);
+    for (size_t q = 0; q < n; ++q) {
+      this->line[q] = f[q * stride];
+    }
+    const double *g = &this->line[0];
+
+    // lower envelope of the parabolas of the finite samples. Parabola
+    // k is the minimum in (boundary[k], boundary[k+1])
+    size_t k = 0;
+    bool empty = true;
+    for (size_t q = 0; q < n; ++q) {
+      if (g[q] == Infinity()) {
+	continue;
+      }
+      if (empty) {
+	this->vertex[0] = q;
+	this->boundary[0] = -Infinity();
+	this->boundary[1] = Infinity();
+	empty = false;
+	continue;
+      }
+      double s;
+      for (;;) {
+	const double v = (double)this->vertex[k];
+	s = ((g[q] + w2 * q * q) - (g[this->vertex[k]] + w2 * v * v))
+	  / (2.0 * w2 * (q - v));
+	if (s > this->boundary[k]) {
+	  break;
+	}
+	--k;
+      }
+      ++k;
+      this->vertex[k] = q;
+      this->boundary[k] = s;
+      this->boundary[k + 1] = Infinity();
+    }
+    if (empty) {
+      return;
+    }
+
+    // sample the envelope
+    k = 0;
+    for (size_t p = 0; p < n; ++p) {
+      while (this->boundary[k + 1] < (double)p) {
+	++k;
+      }
+      const double d = (double)p - (double)this->vertex[k];
+      f[p * stride] = w2 * d * d + g[this->vertex[k]];
+    }
+  }
+
+  std::vector<double> line;
+  std::vector<size_t> vertex;
+  std::vector<double> boundary;
+
+};
+
+#endif /* DISTANCETRANSFORMENGINE_H */
@@ -0,0 +1,481 @@
+/*
+ * LabelMorphologyEngine.h
+ *
+ * Native binary morphology (dilation, erosion, opening and closing)
+ * of each label of a segmentation independently, used by MEX function
+ * labmathmorph_mex.cpp.
+ *
+ * The structuring element is a ball of radius N voxels, the same as
+ * itk::BinaryBallStructuringElement, i.e. all offsets x with
+ * |x|^2 <= (N+1/2)^2. Dilation and erosion are computed by
+ * thresholding the exact squared distance transform of the label, or
+ * of its complement (DistanceTransformEngine.h). Voxels outside the
+ * image are treated as foreground by erosion, as
+ * itk::BinaryErodeImageFilter does by default.
+ *
+ * Each label is processed only within its bounding box, grown by the
+ * dilation radius, with a local scratch buffer. A first pass over the
+ * image finds the bounding boxes, and then labels are distributed
+ * over the threads, largest boxes first. So the whole operation costs
+ * one pass over the image plus the total volume of the boxes, instead
+ * of one pass over the image per label.
+ *
+ * When labels are dilated, they can compete for the same voxel. The
+ * voxel goes to the label at the smallest distance (before the
+ * operation), and in case of a tie, to the smallest label value. In
+ * particular, the voxels of a label are never taken by another label
+ * if the operation keeps them. Thus, the result doesn't depend on the
+ * order in which labels are processed or the number of threads.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef LABELMORPHOLOGYENGINE_H
+#define LABELMORPHOLOGYENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+/* Boost headers */
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+#include "DistanceTransformEngine.h"
+
+/*
+ * LabelBox: bounding box of a label, first and last index in each
+ * dimension.
+ */
+struct LabelBox {
+
+  size_t lo[3];
+  size_t hi[3];
+
+  LabelBox() {
+    for (int d = 0; d < 3; ++d) {
+      this->lo[d] = (size_t)-1;
+      this->hi[d] = 0;
+    }
+  }
+
+  void Add(size_t r, size_t c, size_t s) {
+    const size_t x[3] = {r, c, s};
+    for (int d = 0; d < 3; ++d) {
+      this->lo[d] = std::min(this->lo[d], x[d]);
+      this->hi[d] = std::max(this->hi[d], x[d]);
+    }
+  }
+
+  void Merge(const LabelBox &o) {
+    for (int d = 0; d < 3; ++d) {
+      this->lo[d] = std::min(this->lo[d], o.lo[d]);
+      this->hi[d] = std::max(this->hi[d], o.hi[d]);
+    }
+  }
+
+};
+
+template <class T> class LabelBoxFunctor;
+template <class T> class LabelMorphologyFunctor;
+
+/*
+ * LabelMorphology: morphological operator applied to each label of a
+ * segmentation with voxel type T.
+ *
+ * sz: image size (R, C, S). S=1 for 2D images.
+ *
+ * numThreads: number of threads (0 = number of hardware threads).
+ */
+template <class T>
+class LabelMorphology {
+
+  friend class LabelBoxFunctor<T>;
+  friend class LabelMorphologyFunctor<T>;
+
+ public:
+
+  enum Operation {Dilate, Erode, Open, Close};
+
+  LabelMorphology(const size_t *sz, unsigned int _numThreads = 0) {
+    this->R = sz[0];
+    this->C = sz[1];
+    this->S = sz[2];
+    this->numThreads = getNumberOfThreads(_numThreads);
+  }
+
+  // apply operation op to each label of segmentation im, and write
+  // the result to out, that must be preallocated with the size of im
+  // and can't be im. Voxels with value 0 are background.
+  //
+  // radius0, radius1: radius of the first and second operator, in
+  // voxels. For Dilate and Erode, radius1 is not used.
+  void Run(const T *im, T *out, Operation op, unsigned int radius0,
+	   unsigned int radius1 = 0) {
+    this->im = im;
+    this->out = out;
+    this->op = op;
+    this->radius[0] = radius0;
+    this->radius[1] = radius1;
+
+    // output and distance of each voxel to the label that has it
+    const size_t N = this->R * this->C * this->S;
+    std::fill(out, out + N, (T)0);
+    if (N == 0) {
+      return;
+    }
+    if (this->MayOverlap()) {
+      this->dist.assign(N, (boost::uint32_t)NoDistance);
+    }
+
+    // bounding box of each label. Each thread finds the boxes of the
+    // layers (slices, or columns for 2D images) it's given, and then
+    // they are merged
+    const size_t numLayers = (this->S > 1) ? this->S : this->C;
+    this->threadBoxes.assign(this->numThreads, std::map<T, LabelBox>());
+    LabelBoxFunctor<T> boxFunctor(*this);
+    parallelFor(0, numLayers, boxFunctor, this->numThreads);
+    std::map<T, LabelBox> boxes;
+    for (size_t t = 0; t < this->threadBoxes.size(); ++t) {
+      typename std::map<T, LabelBox>::const_iterator it;
+      for (it = this->threadBoxes[t].begin(); it != this->threadBoxes[t].end(); ++it) {
+	boxes[it->first].Merge(it->second);
+      }
+    }
+    this->threadBoxes.clear();
+
+    // grow the boxes so that the result of the operator fits inside,
+    // with a margin of background voxels for erosion
+    const size_t margin = this->GetDilationRadius() + 1;
+    this->labels.clear();
+    this->boxes.clear();
+    std::vector<std::pair<size_t, size_t> > order;
+    typename std::map<T, LabelBox>::const_iterator it;
+    for (it = boxes.begin(); it != boxes.end(); ++it) {
+      LabelBox box = it->second;
+      const size_t sz[3] = {this->R, this->C, this->S};
+      size_t volume = 1;
+      for (int d = 0; d < 3; ++d) {
+	box.lo[d] = (box.lo[d] > margin) ? box.lo[d] - margin : 0;
+	box.hi[d] = std::min(box.hi[d] + margin, sz[d] - 1);
+	volume *= box.hi[d] - box.lo[d] + 1;
+      }
+      order.push_back(std::make_pair(volume, this->labels.size()));
+      this->labels.push_back(it->first);
+      this->boxes.push_back(box);
+    }
+
+    // largest boxes first, to balance the load of the threads
+    std::sort(order.begin(), order.end());
+    std::reverse(order.begin(), order.end());
+    this->schedule.resize(order.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+      this->schedule[k] = order[k].second;
+    }
+
+    // one lock per layer of the output, used when labels compete for
+    // voxels
+    this->layerMutex.reset(new boost::mutex[numLayers]);
+
+    LabelMorphologyFunctor<T> morph(*this);
+    parallelForDynamic(0, this->schedule.size(), 1, morph, this->numThreads);
+
+    this->layerMutex.reset();
+    std::vector<boost::uint32_t>().swap(this->dist);
+  }
+
+ private:
+
+  // distance of voxels that no label has taken
+  static const boost::uint32_t NoDistance = 0xffffffff;
+
+  // bounding boxes of the labels in layers [begin, end)
+  void FindBoxes(size_t begin, size_t end, unsigned int thread) {
+    std::map<T, LabelBox> &boxes = this->threadBoxes[thread];
+    const size_t layerSize = (this->S > 1) ? this->R * this->C : this->R;
+    size_t r = 0;
+    size_t c = (this->S > 1) ? 0 : begin;
+    size_t s = (this->S > 1) ? begin : 0;
+    T cachedLabel = 0;
+    LabelBox *cached = NULL;
+    for (size_t i = begin * layerSize; i < end * layerSize; ++i) {
+      const T v = this->im[i];
+      // NaN voxels (v != v) are skipped
+      if (v != 0 && v == v) {
+	if (cached == NULL || v != cachedLabel) {
+	  cached = &boxes[v];
+	  cachedLabel = v;
+	}
+	cached->Add(r, c, s);
+      }
+      if (++r == this->R) {
+	r = 0;
+	if (++c == this->C) {
+	  c = 0;
+	  ++s;
+	}
+      }
+    }
+  }
+
+  // squared distance threshold of the ball with radius n
+  static double BallThreshold(unsigned int n) {
+    return (double)n * n + n;
+  }
+
+  // squared distance of each voxel of mask, with size sz, to the
+  // nearest mask voxel, or if complement=true, to the nearest
+  // background voxel
+  void MaskDistance(const std::vector<unsigned char> &mask, std::vector<double> &f,
+		    const size_t *sz, bool complement, SquaredDistanceTransform &dt) {
+    f.resize(mask.size());
+    for (size_t i = 0; i < mask.size(); ++i) {
+      f[i] = ((mask[i] != 0) == complement) ? SquaredDistanceTransform::Infinity() : 0.0;
+    }
+    dt.Compute(&f[0], sz);
+  }
+
+  // dilation of mask by a ball of radius n, given the squared
+  // distance to the mask
+  void DilateMask(std::vector<unsigned char> &mask, const std::vector<double> &f,
+		  unsigned int n) {
+    const double threshold = BallThreshold(n);
+    for (size_t i = 0; i < mask.size(); ++i) {
+      mask[i] = (f[i] <= threshold);
+    }
+  }
+
+  // erosion of mask by a ball of radius n, given the squared distance
+  // to the background
+  void ErodeMask(std::vector<unsigned char> &mask, const std::vector<double> &f,
+		 unsigned int n) {
+    const double threshold = BallThreshold(n);
+    for (size_t i = 0; i < mask.size(); ++i) {
+      mask[i] = mask[i] && (f[i] > threshold);
+    }
+  }
+
+  // radius of the dilation of the operator, if any
+  unsigned int GetDilationRadius() const {
+    switch (this->op) {
+    case Dilate:
+    case Close:
+      return this->radius[0];
+    case Open:
+      return this->radius[1];
+    default:
+      return 0;
+    }
+  }
+
+  // whether the result of a label can go beyond the label, and
+  // overlap other labels. Opening is contained in the label if the
+  // dilation is not larger than the erosion
+  bool MayOverlap() const {
+    return this->op == Dilate || this->op == Close
+      || (this->op == Open && this->radius[1] > this->radius[0]);
+  }
+
+  // apply the operator to label k within its box, and write the
+  // result to the output. mask, f and g are scratch buffers
+  void ProcessLabel(size_t k, std::vector<unsigned char> &mask,
+		    std::vector<double> &f, std::vector<double> &g,
+		    SquaredDistanceTransform &dt) {
+    const T label = this->labels[k];
+    const LabelBox &box = this->boxes[k];
+    const size_t sz[3] = {box.hi[0] - box.lo[0] + 1, box.hi[1] - box.lo[1] + 1,
+			  box.hi[2] - box.lo[2] + 1};
+    mask.resize(sz[0] * sz[1] * sz[2]);
+
+    // crop the label
+    size_t j = 0;
+    for (size_t s = box.lo[2]; s <= box.hi[2]; ++s) {
+      for (size_t c = box.lo[1]; c <= box.hi[1]; ++c) {
+	const T *p = this->im + (s * this->C + c) * this->R;
+	for (size_t r = box.lo[0]; r <= box.hi[0]; ++r, ++j) {
+	  mask[j] = (p[r] == label);
+	}
+      }
+    }
+
+    // g is the squared distance to the label before the operator,
+    // that decides which label gets a voxel when labels compete for
+    // it
+    const bool overlap = this->MayOverlap();
+    if (overlap) {
+      this->MaskDistance(mask, g, sz, false, dt);
+    }
+
+    switch (this->op) {
+    case Dilate:
+      this->DilateMask(mask, g, this->radius[0]);
+      break;
+    case Erode:
+      this->MaskDistance(mask, f, sz, true, dt);
+      this->ErodeMask(mask, f, this->radius[0]);
+      break;
+    case Open:
+      this->MaskDistance(mask, f, sz, true, dt);
+      this->ErodeMask(mask, f, this->radius[0]);
+      this->MaskDistance(mask, f, sz, false, dt);
+      this->DilateMask(mask, f, this->radius[1]);
+      break;
+    case Close:
+      this->DilateMask(mask, g, this->radius[0]);
+      this->MaskDistance(mask, f, sz, true, dt);
+      this->ErodeMask(mask, f, this->radius[1]);
+      break;
+    }
+
+    // if the result is contained in the label, labels don't overlap
+    // and can write directly to the output
+    if (!overlap) {
+      j = 0;
+      for (size_t s = box.lo[2]; s <= box.hi[2]; ++s) {
+	for (size_t c = box.lo[1]; c <= box.hi[1]; ++c) {
+	  T *p = this->out + (s * this->C + c) * this->R;
+	  for (size_t r = box.lo[0]; r <= box.hi[0]; ++r, ++j) {
+	    if (mask[j]) {
+	      p[r] = label;
+	    }
+	  }
+	}
+      }
+      return;
+    }
+
+    // otherwise, the closest label gets the voxel
+    j = 0;
+    for (size_t s = box.lo[2]; s <= box.hi[2]; ++s) {
+      for (size_t c = box.lo[1]; c <= box.hi[1]; ++c) {
+	const size_t layer = (this->S > 1) ? s : c;
+	if (this->S == 1 || c == box.lo[1]) {
+	  this->layerMutex[layer].lock();
+	}
+	const size_t first = (s * this->C + c) * this->R;
+	T *p = this->out + first;
+	boost::uint32_t *d = &this->dist[first];
+	for (size_t r = box.lo[0]; r <= box.hi[0]; ++r, ++j) {
+	  if (!mask[j]) {
+	    continue;
+	  }
+	  const boost::uint32_t dj = (boost::uint32_t)g[j];
+	  if (dj < d[r] || (dj == d[r] && label < p[r])) {
+	    d[r] = dj;
+	    p[r] = label;
+	  }
+	}
+	if (this->S == 1 || c == box.hi[1]) {
+	  this->layerMutex[layer].unlock();
+	}
+      }
+    }
+  }
+
+  size_t R, C, S;
+  unsigned int numThreads;
+
+  const T *im;
+  T *out;
+  Operation op;
+  unsigned int radius[2];
+
+  // labels, their boxes, and order in which they are processed
+  std::vector<T> labels;
+  std::vector<LabelBox> boxes;
+  std::vector<size_t> schedule;
+
+  std::vector<std::map<T, LabelBox> > threadBoxes;
+  std::vector<boost::uint32_t> dist;
+  boost::scoped_array<boost::mutex> layerMutex;
+
+};
+
+/*
+ * LabelBoxFunctor: bounding boxes of the labels in layers [begin,
+ * end).
+ */
+template <class T>
+class LabelBoxFunctor {
+
+ public:
+
+  LabelBoxFunctor(LabelMorphology<T> &_morph) : morph(_morph) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    this->morph.FindBoxes(begin, end, thread);
+  }
+
+ private:
+
+  LabelMorphology<T> &morph;
+
+};
+
+/*
+ * LabelMorphologyFunctor: apply the operator to labels [begin, end)
+ * of the schedule. Each thread has its own scratch buffers.
+ */
+template <class T>
+class LabelMorphologyFunctor {
+
+ public:
+
+  LabelMorphologyFunctor(LabelMorphology<T> &_morph)
+    : morph(_morph), mask(_morph.numThreads), f(_morph.numThreads),
+      g(_morph.numThreads), dt(_morph.numThreads) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    for (size_t k = begin; k < end; ++k) {
+      this->morph.ProcessLabel(this->morph.schedule[k], this->mask[thread],
+			       this->f[thread], this->g[thread], this->dt[thread]);
+    }
+  }
+
+ private:
+
+  LabelMorphology<T> &morph;
+  std::vector<std::vector<unsigned char> > mask;
+  std::vector<std::vector<double> > f;
+  std::vector<std::vector<double> > g;
+  std::vector<SquaredDistanceTransform> dt;
+
+};
+
+#endif /* LABELMORPHOLOGYENGINE_H */
@@ -0,0 +1,1033 @@
+/*
+ * SkeletonGraphEngine.h
+ *
+ * Native extraction and pruning of the branch graph of a skeleton,
+ * used by skeleton_label_mex.cpp and skeleton_prune_mex.cpp. It
+ * computes the same decomposition as the Matlab code of
+ * skeleton_label() without merging, but in one pass over the
+ * skeleton instead of a sparse distance matrix and several calls to
+ * bwconncomp().
+ *
+ * The skeleton is a 2D or 3D binary mask of 1-voxel thick branches,
+ * e.g. the output of itk_imfilter('skel', ...). Voxels are connected
+ * to their 26 neighbours (8 in 2D), and the distance between
+ * neighbours is the Euclidean distance between voxel centres with
+ * voxel size RES.
+ *
+ *   1. The skeleton voxels are listed in linear index order, and the
+ *      degree of each voxel is counted with precomputed neighbour
+ *      offsets. The neighbours are kept in a compressed adjacency
+ *      list (CSR).
+ *
+ *   2. Voxels with degree >= 3 are bifurcation voxels. The connected
+ *      components of the other voxels are the branches, and the
+ *      connected components of the bifurcation voxels are the
+ *      bifurcation clumps.
+ *
+ *   3. The voxels of each branch are sorted from one end to the
+ *      other with two Dijkstra sweeps (to the furthest voxel from an
+ *      arbitrary voxel, and from there to the other end), and
+ *      parameterised with the accumulated chord length. Voxels off
+ *      the shortest path (small cycles) are dropped from the branch,
+ *      as in skeleton_label(). Branches are sorted in parallel.
+ *
+ *   4. A branch is connected to a clump if any of their voxels are
+ *      neighbours. Branches with at most InterLength voxels that
+ *      connect two or more clumps are converted to bifurcation
+ *      voxels, and clumps and connections are recomputed.
+ *
+ *   5. Bifurcation voxels get the label of the nearest branch
+ *      (geodesic distance through the clump).
+ *
+ * Once the graph exists, SkeletonGraph::Prune() removes short leaves
+ * and bifurcation clumps that don't connect branches, iteratively,
+ * as scimat_skeleton_prune() does, without labelling the skeleton
+ * again. Removing a voxel decrements the degree of its neighbours,
+ * and only the branches and clumps around the removed voxels are
+ * decomposed and sorted again. Thus, when a clump is left with two
+ * branches and its voxels are no longer bifurcation voxels, both
+ * branches are merged through the clump. The removed voxels are
+ * listed so that they can be cleared from the mask.
+ *
+ * Indices are size_t, so images with more than 2^31 voxels are
+ * supported. Memory is proportional to the number of skeleton
+ * voxels, not to the image size.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.2.2
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef SKELETONGRAPHENGINE_H
+#define SKELETONGRAPHENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/* mex headers */
+#include <mex.h>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * SkeletonBranch: a branch of the skeleton, i.e. a chain of voxels
+ * with degree < 3 between bifurcation clumps or free ends.
+ */
+struct SkeletonBranch {
+
+  // image linear indices (0-based) of the voxels, sorted from one end
+  // of the branch to the other
+  std::vector<size_t> voxels;
+
+  // accumulated chord length of each voxel, starting at 0
+  std::vector<double> param;
+
+  // bifurcation clumps the branch is connected to, in increasing order
+  std::vector<size_t> clumps;
+
+  // a leaf has a free end, i.e. it's connected to at most one clump
+  bool IsLeaf() const {
+    return this->clumps.size() < 2;
+  }
+
+  double GetLength() const {
+    return this->param.empty() ? 0.0 : this->param.back();
+  }
+
+};
+
+/*
+ * SkeletonClump: a connected component of bifurcation voxels.
+ */
+struct SkeletonClump {
+
+  // image linear indices (0-based) of the voxels, in increasing order
+  std::vector<size_t> voxels;
+
+  // branches connected to the clump, in increasing order
+  std::vector<size_t> branches;
+
+};
+
+// neighbour of a voxel, as an offset in each dimension, in the
+// linear index, and the distance to the neighbour
+struct SkeletonOffset {
+  int dr, dc, ds;
+  std::ptrdiff_t step;
+  double dist;
+};
+
+template <class T> class SkeletonAdjacencyFunctor;
+class SkeletonSortFunctor;
+
+/*
+ * SkeletonGraph: branches, bifurcation clumps and connections of a
+ * skeleton.
+ *
+ * sz:  image size (R, C, S). S=1 for 2D images.
+ * res: voxel size (row, column, slice).
+ *
+ * numThreads: number of threads (0 = number of hardware threads).
+ */
+class SkeletonGraph {
+
+  template <class T> friend class SkeletonAdjacencyFunctor;
+  friend class SkeletonSortFunctor;
+
+ public:
+
+  // index of "no node" or "no branch"
+  static const size_t None = (size_t)-1;
+
+  // intermediate (i.e. non-leaf) branches up to this number of voxels
+  // are converted to bifurcation voxels
+  static const size_t InterLength = 4;
+
+  SkeletonGraph(const size_t *sz, const double *res, unsigned int _numThreads = 0) {
+    this->R = sz[0];
+    this->C = sz[1];
+    this->S = sz[2];
+    this->numThreads = getNumberOfThreads(_numThreads);
+
+    // the 26 neighbours in 3D, or 8 in 2D
+    for (int ds = -1; ds <= 1; ++ds) {
+      for (int dc = -1; dc <= 1; ++dc) {
+	for (int dr = -1; dr <= 1; ++dr) {
+	  if ((dr == 0 && dc == 0 && ds == 0) || (this->S == 1 && ds != 0)) {
+	    continue;
+	  }
+	  SkeletonOffset o;
+	  o.dr = dr;
+	  o.dc = dc;
+	  o.ds = ds;
+	  o.step = (std::ptrdiff_t)dr + (std::ptrdiff_t)dc * (std::ptrdiff_t)this->R
+	    + (std::ptrdiff_t)ds * (std::ptrdiff_t)(this->R * this->C);
+	  o.dist = std::sqrt(dr * dr * res[0] * res[0] + dc * dc * res[1] * res[1]
+			     + ds * ds * res[2] * res[2]);
+	  this->offsets.push_back(o);
+	}
+      }
+    }
+  }
+
+  // extract the graph of the skeleton given by the non-zero voxels of
+  // mask, an array with size sz stored column-major
+  template <class T>
+  void Build(const T *mask) {
+
+    // list of skeleton voxels. Node i of the graph is voxel
+    // this->voxels[i]
+    const size_t nvox = this->R * this->C * this->S;
+    this->voxels.clear();
+    for (size_t idx = 0; idx < nvox; ++idx) {
+      if (mask[idx] != 0) {
+	this->voxels.push_back(idx);
+      }
+    }
+    const size_t M = this->voxels.size();
+
+    // count neighbours of each voxel, and then list them
+    this->adjStart.assign(M + 1, 0);
+    SkeletonAdjacencyFunctor<T> count(*this, mask, false);
+    parallelFor(0, M, count, this->numThreads);
+    for (size_t i = 0; i < M; ++i) {
+      this->adjStart[i + 1] += this->adjStart[i];
+    }
+    this->adj.resize(this->adjStart[M]);
+    this->adjDist.resize(this->adjStart[M]);
+    SkeletonAdjacencyFunctor<T> fill(*this, mask, true);
+    parallelFor(0, M, fill, this->numThreads);
+
+    // bifurcation voxels
+    this->degree.resize(M);
+    this->isBif.resize(M);
+    for (size_t i = 0; i < M; ++i) {
+      this->degree[i] = (unsigned char)(this->adjStart[i + 1] - this->adjStart[i]);
+      this->isBif[i] = (this->degree[i] >= 3);
+    }
+    this->removed.assign(M, 0);
+    this->removedVoxels.clear();
+
+    // branches are the connected components of the other voxels
+    std::vector<char> member(M);
+    for (size_t i = 0; i < M; ++i) {
+      member[i] = !this->isBif[i];
+    }
+    std::vector<std::vector<size_t> > comps;
+    this->FindComponents(member, comps);
+    this->branches.clear();
+    this->branches.resize(comps.size());
+    SkeletonSortFunctor sort(*this, comps, this->branches);
+    parallelForDynamic(0, comps.size(), 1, sort, this->numThreads);
+
+    this->FindClumps();
+    if (this->ConvertShortBranches()) {
+      this->FindClumps();
+    }
+    this->GrowLabels();
+  }
+
+  // prune the skeleton as step 2 of scimat_skeleton_prune(): remove
+  // leaves with fewer than minLength voxels, and then clumps
+  // connected to fewer than two branches (floating alone or
+  // terminating a branch), until no more clumps are removed. Returns
+  // the number of removed voxels
+  size_t Prune(size_t minLength) {
+    const size_t numRemoved = this->removedVoxels.size();
+    std::vector<size_t> dirty;
+    while (true) {
+
+      // short leaves
+      dirty.clear();
+      for (size_t b = 0; b < this->branches.size(); ++b) {
+	const SkeletonBranch &br = this->branches[b];
+	if (br.IsLeaf() && br.voxels.size() < minLength) {
+	  this->RemoveVoxels(br.voxels, dirty);
+	}
+      }
+      this->Update(dirty);
+
+      // clumps that don't connect branches
+      dirty.clear();
+      for (size_t c = 0; c < this->clumps.size(); ++c) {
+	if (this->clumps[c].branches.size() < 2) {
+	  this->RemoveVoxels(this->clumps[c].voxels, dirty);
+	}
+      }
+      if (dirty.empty()) {
+	break;
+      }
+      this->Update(dirty);
+    }
+    this->GrowLabels();
+    return this->removedVoxels.size() - numRemoved;
+  }
+
+  // number of skeleton voxels
+  size_t GetNumberOfVoxels() const {
+    return this->voxels.size();
+  }
+
+  const std::vector<SkeletonBranch> &GetBranches() const {
+    return this->branches;
+  }
+
+  const std::vector<SkeletonClump> &GetClumps() const {
+    return this->clumps;
+  }
+
+  // number of skeleton neighbours of voxel idx (linear index), or 0
+  // if idx is not a skeleton voxel
+  unsigned int GetDegree(size_t idx) const {
+    size_t i = this->FindNode(idx);
+    return (i == None || this->removed[i]) ? 0 : this->degree[i];
+  }
+
+  // linear indices of the voxels removed by Prune()
+  const std::vector<size_t> &GetRemovedVoxels() const {
+    return this->removedVoxels;
+  }
+
+  // write the label of each skeleton voxel, i.e. 1 + the index of
+  // its branch, to the array lab with size sz. Voxels without a label
+  // are not written
+  template <class TLab>
+  void GetLabels(TLab *lab) const {
+    for (size_t i = 0; i < this->voxels.size(); ++i) {
+      if (this->nodeLabel[i] != None) {
+	lab[this->voxels[i]] = (TLab)(this->nodeLabel[i] + 1);
+      }
+    }
+  }
+
+ private:
+
+  // node of voxel idx (linear index), or None
+  size_t FindNode(size_t idx) const {
+    std::vector<size_t>::const_iterator it
+      = std::lower_bound(this->voxels.begin(), this->voxels.end(), idx);
+    return (it == this->voxels.end() || *it != idx) ? None
+      : (size_t)(it - this->voxels.begin());
+  }
+
+  // count (fill=false) or list (fill=true) the skeleton neighbours of
+  // node i
+  template <class T>
+  void VisitNeighbours(size_t i, const T *mask, bool fill) {
+    const size_t idx = this->voxels[i];
+    const size_t r = idx % this->R;
+    const size_t c = (idx / this->R) % this->C;
+    const size_t s = idx / (this->R * this->C);
+    size_t pos = this->adjStart[i];
+    size_t count = 0;
+    for (size_t k = 0; k < this->offsets.size(); ++k) {
+      const SkeletonOffset &o = this->offsets[k];
+      if ((o.dr < 0 && r == 0) || (o.dr > 0 && r + 1 == this->R)
+	  || (o.dc < 0 && c == 0) || (o.dc > 0 && c + 1 == this->C)
+	  || (o.ds < 0 && s == 0) || (o.ds > 0 && s + 1 == this->S)) {
+	continue;
+      }
+      const size_t nb = idx + o.step;
+      if (mask[nb] == 0) {
+	continue;
+      }
+      if (fill) {
+	this->adj[pos] = this->FindNode(nb);
+	this->adjDist[pos] = o.dist;
+	++pos;
+      } else {
+	++count;
+      }
+    }
+    if (!fill) {
+      this->adjStart[i + 1] = count;
+    }
+  }
+
+  // connected components of the nodes with member[i] != 0. Each
+  // component is a list of nodes in increasing order, and components
+  // are sorted by their first node, as in bwconncomp()
+  void FindComponents(const std::vector<char> &member,
+		      std::vector<std::vector<size_t> > &comps) const {
+    comps.clear();
+    std::vector<char> visited(member.size(), 0);
+    std::vector<size_t> stack;
+    for (size_t seed = 0; seed < member.size(); ++seed) {
+      if (!member[seed] || visited[seed]) {
+	continue;
+      }
+      comps.push_back(std::vector<size_t>());
+      std::vector<size_t> &comp = comps.back();
+      visited[seed] = 1;
+      stack.push_back(seed);
+      while (!stack.empty()) {
+	size_t i = stack.back();
+	stack.pop_back();
+	comp.push_back(i);
+	for (size_t e = this->adjStart[i]; e < this->adjStart[i + 1]; ++e) {
+	  size_t j = this->adj[e];
+	  if (member[j] && !visited[j]) {
+	    visited[j] = 1;
+	    stack.push_back(j);
+	  }
+	}
+      }
+      std::sort(comp.begin(), comp.end());
+    }
+  }
+
+  // geodesic distance from node nodes[src] to the other nodes in the
+  // list, that must be in increasing order. parent is the previous
+  // node (local index) in the shortest path, or None
+  void BranchDistances(const std::vector<size_t> &nodes, size_t src,
+		       std::vector<double> &dist, std::vector<size_t> &parent) const {
+    typedef std::pair<double, size_t> Item;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item> > queue;
+    dist.assign(nodes.size(), std::numeric_limits<double>::infinity());
+    parent.assign(nodes.size(), (size_t)None);
+    dist[src] = 0.0;
+    queue.push(Item(0.0, src));
+    while (!queue.empty()) {
+      Item top = queue.top();
+      queue.pop();
+      const size_t u = top.second;
+      if (top.first > dist[u]) {
+	continue;
+      }
+      const size_t i = nodes[u];
+      for (size_t e = this->adjStart[i]; e < this->adjStart[i + 1]; ++e) {
+	if (this->removed[this->adj[e]]) {
+	  continue;
+	}
+	std::vector<size_t>::const_iterator it
+	  = std::lower_bound(nodes.begin(), nodes.end(), this->adj[e]);
+	if (it == nodes.end() || *it != this->adj[e]) {
+	  continue;
+	}
+	const size_t v = (size_t)(it - nodes.begin());
+	const double d = top.first + this->adjDist[e];
+	if (d < dist[v]) {
+	  dist[v] = d;
+	  parent[v] = u;
+	  queue.push(Item(d, v));
+	}
+      }
+    }
+  }
+
+  // sort the voxels of a branch given as a list of nodes in increasing
+  // order, from one end to the other, and parameterise them with the
+  // accumulated chord length. dist and parent are work buffers
+  void SortBranch(const std::vector<size_t> &nodes, SkeletonBranch &br,
+		  std::vector<double> &dist, std::vector<size_t> &parent) const {
+    br.voxels.clear();
+    br.param.clear();
+    if (nodes.empty()) {
+      return;
+    }
+
+    // the furthest voxel from an arbitrary voxel is one of the ends
+    // of the branch, and the furthest voxel from there the other end
+    this->BranchDistances(nodes, 0, dist, parent);
+    size_t v0 = std::max_element(dist.begin(), dist.end()) - dist.begin();
+    this->BranchDistances(nodes, v0, dist, parent);
+    size_t v1 = std::max_element(dist.begin(), dist.end()) - dist.begin();
+
+    // backtrack the shortest path between both ends
+    for (size_t v = v1; v != None; v = parent[v]) {
+      br.voxels.push_back(this->voxels[nodes[v]]);
+      br.param.push_back(dist[v]);
+    }
+    std::reverse(br.voxels.begin(), br.voxels.end());
+    std::reverse(br.param.begin(), br.param.end());
+  }
+
+  // connected components of the bifurcation voxels, and connections
+  // between clumps and branches
+  void FindClumps() {
+    const size_t M = this->voxels.size();
+
+    // branch of each node. Voxels dropped when a branch was sorted
+    // don't belong to any branch
+    this->nodeBranch.assign(M, (size_t)None);
+    for (size_t b = 0; b < this->branches.size(); ++b) {
+      const std::vector<size_t> &v = this->branches[b].voxels;
+      for (size_t k = 0; k < v.size(); ++k) {
+	this->nodeBranch[this->FindNode(v[k])] = b;
+      }
+      this->branches[b].clumps.clear();
+    }
+
+    std::vector<std::vector<size_t> > comps;
+    this->FindComponents(this->isBif, comps);
+    this->nodeClump.assign(M, (size_t)None);
+    this->clumps.clear();
+    this->clumps.resize(comps.size());
+    for (size_t c = 0; c < comps.size(); ++c) {
+      SkeletonClump &clump = this->clumps[c];
+      std::vector<size_t> &nodes = comps[c];
+      for (size_t k = 0; k < nodes.size(); ++k) {
+	const size_t i = nodes[k];
+	this->nodeClump[i] = c;
+	clump.voxels.push_back(this->voxels[i]);
+	for (size_t e = this->adjStart[i]; e < this->adjStart[i + 1]; ++e) {
+	  const size_t b = this->nodeBranch[this->adj[e]];
+	  if (b != None) {
+	    clump.branches.push_back(b);
+	  }
+	}
+      }
+      std::sort(clump.branches.begin(), clump.branches.end());
+      clump.branches.erase(std::unique(clump.branches.begin(), clump.branches.end()),
+			   clump.branches.end());
+      for (size_t k = 0; k < clump.branches.size(); ++k) {
+	this->branches[clump.branches[k]].clumps.push_back(c);
+      }
+    }
+  }
+
+  // convert short intermediate branches to bifurcation voxels.
+  // Returns true if any branch was converted
+  bool ConvertShortBranches() {
+    // leave the branches and their clumps untouched if there is
+    // nothing to convert
+    bool converted = false;
+    for (size_t b = 0; b < this->branches.size() && !converted; ++b) {
+      const SkeletonBranch &br = this->branches[b];
+      converted = br.voxels.size() <= InterLength && !br.IsLeaf();
+    }
+    if (!converted) {
+      return false;
+    }
+    std::vector<SkeletonBranch> keep;
+    keep.reserve(this->branches.size());
+    for (size_t b = 0; b < this->branches.size(); ++b) {
+      SkeletonBranch &br = this->branches[b];
+      if (br.voxels.size() <= InterLength && !br.IsLeaf()) {
+	for (size_t v = 0; v < br.voxels.size(); ++v) {
+	  this->isBif[this->FindNode(br.voxels[v])] = true;
+	}
+      } else {
+	keep.push_back(SkeletonBranch());
+	keep.back().voxels.swap(br.voxels);
+	keep.back().param.swap(br.param);
+	keep.back().clumps.swap(br.clumps);
+      }
+    }
+    this->branches.swap(keep);
+    return true;
+  }
+
+  // remove voxels (linear indices) from the skeleton, and append them
+  // and the nodes whose degree changes to dirty
+  void RemoveVoxels(const std::vector<size_t> &v, std::vector<size_t> &dirty) {
+    for (size_t k = 0; k < v.size(); ++k) {
+      const size_t i = this->FindNode(v[k]);
+      if (this->removed[i]) {
+	continue;
+      }
+      this->removed[i] = 1;
+      this->isBif[i] = false;
+      this->removedVoxels.push_back(v[k]);
+      dirty.push_back(i);
+      for (size_t e = this->adjStart[i]; e < this->adjStart[i + 1]; ++e) {
+	const size_t j = this->adj[e];
+	if (!this->removed[j]) {
+	  --this->degree[j];
+	  dirty.push_back(j);
+	}
+      }
+    }
+  }
+
+  // decompose again the region around the dirty nodes, i.e. the
+  // clumps and branches they belong to (or belonged to, for removed
+  // nodes), and the branches connected to those clumps. Bifurcation
+  // voxels whose degree has dropped below 3 merge with the branches
+  // around them
+  void Update(const std::vector<size_t> &dirty);
+
+  // label each skeleton voxel with its branch, and each bifurcation
+  // voxel with the nearest branch. Voxels that cannot be reached from
+  // any branch are left without a label
+  void GrowLabels() {
+    typedef std::pair<double, size_t> Item;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item> > queue;
+    const size_t M = this->voxels.size();
+    std::vector<double> dist(M, std::numeric_limits<double>::infinity());
+    this->nodeLabel = this->nodeBranch;
+    for (size_t i = 0; i < M; ++i) {
+      if (this->nodeLabel[i] != None) {
+	dist[i] = 0.0;
+	queue.push(Item(0.0, i));
+      }
+    }
+    while (!queue.empty()) {
+      Item top = queue.top();
+      queue.pop();
+      const size_t i = top.second;
+      if (top.first > dist[i]) {
+	continue;
+      }
+      for (size_t e = this->adjStart[i]; e < this->adjStart[i + 1]; ++e) {
+	const size_t j = this->adj[e];
+	const double d = top.first + this->adjDist[e];
+	if (this->isBif[j] && d < dist[j]) {
+	  dist[j] = d;
+	  this->nodeLabel[j] = this->nodeLabel[i];
+	  queue.push(Item(d, j));
+	}
+      }
+    }
+  }
+
+  size_t R, C, S;
+  unsigned int numThreads;
+  std::vector<SkeletonOffset> offsets;
+
+  // skeleton voxels, in increasing order
+  std::vector<size_t> voxels;
+
+  // neighbours of node i are adj[adjStart[i]], ...,
+  // adj[adjStart[i+1]-1], at distances adjDist[...]
+  std::vector<size_t> adjStart;
+  std::vector<size_t> adj;
+  std::vector<double> adjDist;
+
+  // per node degree, flags and labels
+  std::vector<unsigned char> degree;
+  std::vector<char> isBif;
+  std::vector<char> removed;
+  std::vector<size_t> nodeBranch;
+  std::vector<size_t> nodeClump;
+  std::vector<size_t> nodeLabel;
+
+  // voxels removed by pruning
+  std::vector<size_t> removedVoxels;
+
+  std::vector<SkeletonBranch> branches;
+  std::vector<SkeletonClump> clumps;
+
+};
+
+/*
+ * SkeletonAdjacencyFunctor: count (fill=false) or list (fill=true)
+ * the neighbours of nodes [begin, end).
+ */
+template <class T>
+class SkeletonAdjacencyFunctor {
+
+ public:
+
+  SkeletonAdjacencyFunctor(SkeletonGraph &_graph, const T *_mask, bool _fill)
+    : graph(_graph), mask(_mask), fill(_fill) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t i = begin; i < end; ++i) {
+      this->graph.VisitNeighbours(i, this->mask, this->fill);
+    }
+  }
+
+ private:
+
+  SkeletonGraph &graph;
+  const T *mask;
+  bool fill;
+
+};
+
+/*
+ * SkeletonSortFunctor: sort the voxels of branches [begin, end).
+ */
+class SkeletonSortFunctor {
+
+ public:
+
+  SkeletonSortFunctor(const SkeletonGraph &_graph,
+		      const std::vector<std::vector<size_t> > &_nodes,
+		      std::vector<SkeletonBranch> &_branches)
+    : graph(_graph), nodes(_nodes), branches(_branches),
+      dist(_graph.numThreads), parent(_graph.numThreads) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    for (size_t b = begin; b < end; ++b) {
+      this->graph.SortBranch(this->nodes[b], this->branches[b],
+			     this->dist[thread], this->parent[thread]);
+    }
+  }
+
+ private:
+
+  const SkeletonGraph &graph;
+  const std::vector<std::vector<size_t> > &nodes;
+  std::vector<SkeletonBranch> &branches;
+  std::vector<std::vector<double> > dist;
+  std::vector<std::vector<size_t> > parent;
+
+};
+
+// SkeletonGraph::Update() uses SkeletonSortFunctor, so it's defined
+// after the functor
+inline
+void SkeletonGraph::Update(const std::vector<size_t> &dirty) {
+  if (dirty.empty()) {
+    return;
+  }
+  const size_t M = this->voxels.size();
+  std::vector<char> branchMark(this->branches.size(), 0);
+  std::vector<char> clumpMark(this->clumps.size(), 0);
+  std::vector<char> member(M, 0);
+  for (size_t k = 0; k < dirty.size(); ++k) {
+    const size_t i = dirty[k];
+    if (this->nodeBranch[i] != None) {
+      branchMark[this->nodeBranch[i]] = 1;
+    } else if (this->nodeClump[i] != None) {
+      clumpMark[this->nodeClump[i]] = 1;
+    } else {
+      member[i] = 1;
+    }
+  }
+  for (size_t c = 0; c < this->clumps.size(); ++c) {
+    if (!clumpMark[c]) {
+      continue;
+    }
+    const SkeletonClump &clump = this->clumps[c];
+    for (size_t k = 0; k < clump.branches.size(); ++k) {
+      branchMark[clump.branches[k]] = 1;
+    }
+    for (size_t k = 0; k < clump.voxels.size(); ++k) {
+      member[this->FindNode(clump.voxels[k])] = 1;
+    }
+  }
+
+  // nodes of the region that are not bifurcation voxels anymore, and
+  // branches that are not affected
+  std::vector<SkeletonBranch> keep;
+  keep.reserve(this->branches.size());
+  for (size_t b = 0; b < this->branches.size(); ++b) {
+    SkeletonBranch &br = this->branches[b];
+    if (branchMark[b]) {
+      for (size_t k = 0; k < br.voxels.size(); ++k) {
+	member[this->FindNode(br.voxels[k])] = 1;
+      }
+    } else {
+      keep.push_back(SkeletonBranch());
+      keep.back().voxels.swap(br.voxels);
+      keep.back().param.swap(br.param);
+    }
+  }
+  for (size_t i = 0; i < M; ++i) {
+    if (member[i]) {
+      this->isBif[i] = !this->removed[i] && (this->degree[i] >= 3);
+      member[i] = !this->isBif[i] && !this->removed[i];
+    }
+  }
+
+  // sort the new branches of the region
+  std::vector<std::vector<size_t> > comps;
+  this->FindComponents(member, comps);
+  std::vector<SkeletonBranch> added(comps.size());
+  SkeletonSortFunctor sort(*this, comps, added);
+  parallelForDynamic(0, comps.size(), 1, sort, this->numThreads);
+
+  // branches are numbered by their first voxel, as in a new
+  // labelling
+  std::vector<std::pair<size_t, size_t> > order;
+  for (size_t b = 0; b < keep.size(); ++b) {
+    order.push_back(std::make_pair(*std::min_element(keep[b].voxels.begin(),
+						     keep[b].voxels.end()), b));
+  }
+  for (size_t b = 0; b < added.size(); ++b) {
+    if (!added[b].voxels.empty()) {
+      order.push_back(std::make_pair(this->voxels[comps[b][0]], keep.size() + b));
+    }
+  }
+  std::sort(order.begin(), order.end());
+  this->branches.clear();
+  this->branches.resize(order.size());
+  for (size_t b = 0; b < order.size(); ++b) {
+    const size_t k = order[b].second;
+    SkeletonBranch &src = (k < keep.size()) ? keep[k] : added[k - keep.size()];
+    this->branches[b].voxels.swap(src.voxels);
+    this->branches[b].param.swap(src.param);
+  }
+
+  this->FindClumps();
+  if (this->ConvertShortBranches()) {
+    this->FindClumps();
+  }
+}
+
+/*
+ * Conversion between mxArrays and the graph. The outputs are those of
+ * skeleton_label(): label image, CC and BIFCC structs, and MCON and
+ * MADJ sparse matrices.
+ */
+
+// extract the graph of the skeleton in mxArray sk, with the mask cast
+// to its type
+template <class T>
+void buildSkeletonGraph(SkeletonGraph &graph, const mxArray *sk) {
+  graph.Build((const T *)mxGetData(sk));
+}
+
+inline
+void buildSkeletonGraph(SkeletonGraph &graph, const mxArray *sk) {
+  switch (mxGetClassID(sk)) {
+  case mxDOUBLE_CLASS:
+    buildSkeletonGraph<double>(graph, sk);
+    break;
+  case mxSINGLE_CLASS:
+    buildSkeletonGraph<float>(graph, sk);
+    break;
+  case mxLOGICAL_CLASS:
+    buildSkeletonGraph<mxLogical>(graph, sk);
+    break;
+  case mxINT8_CLASS:
+    buildSkeletonGraph<int8_T>(graph, sk);
+    break;
+  case mxUINT8_CLASS:
+    buildSkeletonGraph<uint8_T>(graph, sk);
+    break;
+  case mxINT16_CLASS:
+    buildSkeletonGraph<int16_T>(graph, sk);
+    break;
+  case mxUINT16_CLASS:
+    buildSkeletonGraph<uint16_T>(graph, sk);
+    break;
+  case mxINT32_CLASS:
+    buildSkeletonGraph<int32_T>(graph, sk);
+    break;
+  case mxUINT32_CLASS:
+    buildSkeletonGraph<uint32_T>(graph, sk);
+    break;
+  case mxINT64_CLASS:
+    buildSkeletonGraph<int64_T>(graph, sk);
+    break;
+  case mxUINT64_CLASS:
+    buildSkeletonGraph<uint64_T>(graph, sk);
+    break;
+  default:
+    mexErrMsgTxt("SK has an unsupported class");
+  }
+}
+
+// allocate the label image with the class that labelmatrix() would
+// use, and write the labels of the skeleton voxels
+template <class TLab>
+mxArray *createSkeletonLabels(const SkeletonGraph &graph, const mxArray *sk, mxClassID classId) {
+  mxArray *lab = mxCreateNumericArray(mxGetNumberOfDimensions(sk),
+				      mxGetDimensions(sk), classId, mxREAL);
+  if (lab == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  graph.GetLabels((TLab *)mxGetData(lab));
+  return lab;
+}
+
+inline
+mxArray *createSkeletonLabels(const SkeletonGraph &graph, const mxArray *sk) {
+  size_t n = graph.GetBranches().size();
+  if (n <= std::numeric_limits<unsigned char>::max()) {
+    return createSkeletonLabels<uint8_T>(graph, sk, mxUINT8_CLASS);
+  } else if (n <= std::numeric_limits<unsigned short>::max()) {
+    return createSkeletonLabels<uint16_T>(graph, sk, mxUINT16_CLASS);
+  } else if (n <= std::numeric_limits<unsigned int>::max()) {
+    return createSkeletonLabels<uint32_T>(graph, sk, mxUINT32_CLASS);
+  } else {
+    return createSkeletonLabels<double>(graph, sk, mxDOUBLE_CLASS);
+  }
+}
+
+// column vector with 1-based image indices
+inline
+mxArray *createSkeletonIndexVector(const std::vector<size_t> &v) {
+  mxArray *out = mxCreateDoubleMatrix(v.size(), 1, mxREAL);
+  double *p = mxGetPr(out);
+  for (size_t i = 0; i < v.size(); ++i) {
+    p[i] = (double)(v[i] + 1);
+  }
+  return out;
+}
+
+// common fields of the CC and BIFCC structs, as given by bwconncomp()
+inline
+void setSkeletonComponentFields(mxArray *cc, const size_t *sz, mwSize ndim,
+				 size_t numObjects) {
+  mxSetField(cc, 0, "Connectivity", mxCreateDoubleScalar(sz[2] > 1 ? 26.0 : 8.0));
+  mxArray *imageSize = mxCreateDoubleMatrix(1, ndim, mxREAL);
+  for (mwSize d = 0; d < ndim; ++d) {
+    mxGetPr(imageSize)[d] = (double)sz[d];
+  }
+  mxSetField(cc, 0, "ImageSize", imageSize);
+  mxSetField(cc, 0, "NumObjects", mxCreateDoubleScalar((double)numObjects));
+}
+
+inline
+mxArray *createSkeletonBranchStruct(const SkeletonGraph &graph, const size_t *sz) {
+  const char *fields[] = {"Connectivity", "ImageSize", "NumObjects", "PixelIdxList",
+			  "PixelParam", "IsLeaf", "BranchLength", "Degree"};
+  mxArray *cc = mxCreateStructMatrix(1, 1, 8, fields);
+  const std::vector<SkeletonBranch> &branches = graph.GetBranches();
+  const size_t n = branches.size();
+
+  // ImageSize always has 3 elements, as in skeleton_label()
+  setSkeletonComponentFields(cc, sz, 3, n);
+
+  mxArray *pixelIdxList = mxCreateCellMatrix(1, n);
+  mxArray *pixelParam = mxCreateCellMatrix(1, n);
+  mxArray *isLeaf = mxCreateLogicalMatrix(1, n);
+  mxArray *branchLength = mxCreateDoubleMatrix(1, n, mxREAL);
+  mxArray *degree = mxCreateCellMatrix(1, n);
+  for (size_t b = 0; b < n; ++b) {
+    const SkeletonBranch &br = branches[b];
+    mxSetCell(pixelIdxList, b, createSkeletonIndexVector(br.voxels));
+    mxArray *param = mxCreateDoubleMatrix(1, br.param.size(), mxREAL);
+    std::copy(br.param.begin(), br.param.end(), mxGetPr(param));
+    mxSetCell(pixelParam, b, param);
+    mxGetLogicals(isLeaf)[b] = br.IsLeaf();
+    mxGetPr(branchLength)[b] = br.GetLength();
+    mxArray *deg = mxCreateDoubleMatrix(br.voxels.size(), 1, mxREAL);
+    for (size_t k = 0; k < br.voxels.size(); ++k) {
+      mxGetPr(deg)[k] = (double)graph.GetDegree(br.voxels[k]);
+    }
+    mxSetCell(degree, b, deg);
+  }
+  mxSetField(cc, 0, "PixelIdxList", pixelIdxList);
+  mxSetField(cc, 0, "PixelParam", pixelParam);
+  mxSetField(cc, 0, "IsLeaf", isLeaf);
+  mxSetField(cc, 0, "BranchLength", branchLength);
+  mxSetField(cc, 0, "Degree", degree);
+  return cc;
+}
+
+inline
+mxArray *createSkeletonClumpStruct(const SkeletonGraph &graph, const size_t *sz, mwSize ndim) {
+  const char *fields[] = {"Connectivity", "ImageSize", "NumObjects", "PixelIdxList"};
+  mxArray *bifcc = mxCreateStructMatrix(1, 1, 4, fields);
+  const std::vector<SkeletonClump> &clumps = graph.GetClumps();
+  setSkeletonComponentFields(bifcc, sz, ndim, clumps.size());
+  mxArray *pixelIdxList = mxCreateCellMatrix(1, clumps.size());
+  for (size_t c = 0; c < clumps.size(); ++c) {
+    mxSetCell(pixelIdxList, c, createSkeletonIndexVector(clumps[c].voxels));
+  }
+  mxSetField(bifcc, 0, "PixelIdxList", pixelIdxList);
+  return bifcc;
+}
+
+// sparse logical connection matrix, rows = branches, columns = clumps
+inline
+mxArray *createSkeletonConnectionMatrix(const SkeletonGraph &graph) {
+  const std::vector<SkeletonClump> &clumps = graph.GetClumps();
+  size_t nnz = 0;
+  for (size_t c = 0; c < clumps.size(); ++c) {
+    nnz += clumps[c].branches.size();
+  }
+  mxArray *mcon = mxCreateSparseLogicalMatrix(graph.GetBranches().size(),
+					      clumps.size(), std::max(nnz, (size_t)1));
+  if (mcon == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  mwIndex *ir = mxGetIr(mcon);
+  mwIndex *jc = mxGetJc(mcon);
+  mxLogical *pr = mxGetLogicals(mcon);
+  size_t k = 0;
+  jc[0] = 0;
+  for (size_t c = 0; c < clumps.size(); ++c) {
+    for (size_t i = 0; i < clumps[c].branches.size(); ++i, ++k) {
+      ir[k] = clumps[c].branches[i];
+      pr[k] = true;
+    }
+    jc[c + 1] = k;
+  }
+  return mcon;
+}
+
+// sparse adjacency matrix between branches. When two branches share
+// more than one clump, the one with the largest index is kept, as in
+// skeleton_label()
+inline
+mxArray *createSkeletonAdjacencyMatrix(const SkeletonGraph &graph) {
+  const std::vector<SkeletonBranch> &branches = graph.GetBranches();
+  const std::vector<SkeletonClump> &clumps = graph.GetClumps();
+  const size_t n = branches.size();
+  std::vector<std::vector<std::pair<size_t, size_t> > > cols(n);
+  size_t nnz = 0;
+  for (size_t j = 0; j < n; ++j) {
+    std::vector<std::pair<size_t, size_t> > &col = cols[j];
+    for (size_t k = 0; k < branches[j].clumps.size(); ++k) {
+      const size_t c = branches[j].clumps[k];
+      for (size_t l = 0; l < clumps[c].branches.size(); ++l) {
+	if (clumps[c].branches[l] != j) {
+	  col.push_back(std::make_pair(clumps[c].branches[l], c));
+	}
+      }
+    }
+    std::sort(col.begin(), col.end());
+    size_t m = 0;
+    for (size_t k = 0; k < col.size(); ++k) {
+      if (m > 0 && col[m - 1].first == col[k].first) {
+	col[m - 1].second = col[k].second;
+      } else {
+	col[m++] = col[k];
+      }
+    }
+    col.resize(m);
+    nnz += m;
+  }
+  mxArray *madj = mxCreateSparse(n, n, std::max(nnz, (size_t)1), mxREAL);
+  if (madj == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  mwIndex *ir = mxGetIr(madj);
+  mwIndex *jc = mxGetJc(madj);
+  double *pr = mxGetPr(madj);
+  size_t k = 0;
+  jc[0] = 0;
+  for (size_t j = 0; j < n; ++j) {
+    for (size_t l = 0; l < cols[j].size(); ++l, ++k) {
+      ir[k] = cols[j][l].first;
+      pr[k] = (double)(cols[j][l].second + 1);
+    }
+    jc[j + 1] = k;
+  }
+  return madj;
+}
+
+#endif /* SKELETONGRAPHENGINE_H */
@@ -0,0 +1,304 @@
+/*
+ * TotalVariationEngine.h
+ *
+ * Native finite difference operators for total variation (TV)
+ * regularisation, used by forward_TV_aux.cpp, inverse_TV_aux.cpp and
+ * forward_TV_mex.cpp. The functions are templated on the pixel type
+ * (float or double).
+ *
+ * tvGradient() computes the forward differences (Dx, Dy, Dz) of an
+ * image and its total variation in one sweep, with the same
+ * convention as forward_TV(): differences are zero on the last row,
+ * column and slice. The total variation can be anisotropic,
+ * sum(|Dx|+|Dy|+|Dz|), or isotropic, sum(sqrt(Dx^2+Dy^2+Dz^2)).
+ *
+ * tvAdjoint() is the adjoint of tvGradient() (minus the divergence),
+ * that inverse_TV() computes as adjDx(Dx)+adjDy(Dy)+adjDz(Dz).
+ *
+ * Both functions split the image into slabs of columns that are
+ * processed in parallel. Within each column, the loop over rows
+ * reads and writes contiguous memory without branches, so that the
+ * compiler can vectorise it. Indices are size_t, so images with more
+ * than 2^31 voxels are supported.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.2.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef TOTALVARIATIONENGINE_H
+#define TOTALVARIATIONENGINE_H
+
+/* C++ headers */
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * TVGradientFunctor: forward differences and partial TV sum of the
+ * columns [begin, end), where column l is image(:, l % C, l / C).
+ *
+ * dz can be NULL for 2D images.
+ *
+ * isotropic: if true, the partial sum is sum(sqrt(dx^2+dy^2+dz^2))
+ * instead of sum(|dx|+|dy|+|dz|).
+ */
+template <class T>
+class TVGradientFunctor {
+
+ public:
+
+  TVGradientFunctor(const T *_im, const size_t *_sz, T *_dx, T *_dy, T *_dz,
+		    bool _isotropic, unsigned int numThreads)
+    : im(_im), dx(_dx), dy(_dy), dz(_dz), isotropic(_isotropic),
+      partial(numThreads, 0.0) {
+    this->R = _sz[0];
+    this->C = _sz[1];
+    this->S = _sz[2];
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t R = this->R;
+    const size_t RC = this->R * this->C;
+    double acc = 0.0;
+    for (size_t l = begin; l < end; ++l) {
+      const size_t c = l % this->C;
+      const size_t s = l / this->C;
+      const size_t first = l * R;
+      const T *in = this->im + first;
+      T *px = this->dx + first;
+      T *py = this->dy + first;
+      T *pz = (this->dz == NULL) ? NULL : this->dz + first;
+
+      // row differences
+      for (size_t r = 0; r + 1 < R; ++r) {
+	px[r] = in[r + 1] - in[r];
+      }
+      px[R - 1] = 0;
+
+      // column differences
+      if (c + 1 < this->C) {
+	for (size_t r = 0; r < R; ++r) {
+	  py[r] = in[r + R] - in[r];
+	}
+      } else {
+	for (size_t r = 0; r < R; ++r) {
+	  py[r] = 0;
+	}
+      }
+
+      // slice differences
+      if (pz != NULL) {
+	if (s + 1 < this->S) {
+	  for (size_t r = 0; r < R; ++r) {
+	    pz[r] = in[r + RC] - in[r];
+	  }
+	} else {
+	  for (size_t r = 0; r < R; ++r) {
+	    pz[r] = 0;
+	  }
+	}
+      }
+
+      // TV of the column, while it's still in cache
+      if (this->isotropic) {
+	for (size_t r = 0; r < R; ++r) {
+	  double n2 = (double)px[r] * px[r] + (double)py[r] * py[r];
+	  if (pz != NULL) {
+	    n2 += (double)pz[r] * pz[r];
+	  }
+	  acc += std::sqrt(n2);
+	}
+      } else {
+	for (size_t r = 0; r < R; ++r) {
+	  acc += std::fabs((double)px[r]) + std::fabs((double)py[r]);
+	}
+	if (pz != NULL) {
+	  for (size_t r = 0; r < R; ++r) {
+	    acc += std::fabs((double)pz[r]);
+	  }
+	}
+      }
+    }
+    this->partial[thread] += acc;
+  }
+
+  double GetTotalVariation() const {
+    double tv = 0.0;
+    for (size_t i = 0; i < this->partial.size(); ++i) {
+      tv += this->partial[i];
+    }
+    return tv;
+  }
+
+ private:
+
+  const T *im;
+  T *dx;
+  T *dy;
+  T *dz;
+  bool isotropic;
+  size_t R, C, S;
+  std::vector<double> partial;
+
+};
+
+/*
+ * TVAdjointFunctor: adjoint of the forward differences in the
+ * columns [begin, end)
+ *
+ *   res(r) = dx(r-1) - dx(r) + dy(c-1) - dy(c) + dz(s-1) - dz(s)
+ *
+ * where terms outside the image, and the (zero) differences on the
+ * last row, column and slice are skipped.
+ *
+ * dz can be NULL for 2D images.
+ */
+template <class T>
+class TVAdjointFunctor {
+
+ public:
+
+  TVAdjointFunctor(const T *_dx, const T *_dy, const T *_dz, const size_t *_sz,
+		   T *_res)
+    : dx(_dx), dy(_dy), dz(_dz), res(_res) {
+    this->R = _sz[0];
+    this->C = _sz[1];
+    this->S = _sz[2];
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const size_t R = this->R;
+    const size_t RC = this->R * this->C;
+    for (size_t l = begin; l < end; ++l) {
+      const size_t c = l % this->C;
+      const size_t s = l / this->C;
+      const size_t first = l * R;
+      const T *px = this->dx + first;
+      const T *py = this->dy + first;
+      T *out = this->res + first;
+
+      // rows
+      if (R == 1) {
+	out[0] = 0;
+      } else {
+	out[0] = -px[0];
+	for (size_t r = 1; r + 1 < R; ++r) {
+	  out[r] = px[r - 1] - px[r];
+	}
+	out[R - 1] = px[R - 2];
+      }
+
+      // columns
+      if (this->C > 1) {
+	if (c > 0) {
+	  const T *pyPrev = py - R;
+	  for (size_t r = 0; r < R; ++r) {
+	    out[r] += pyPrev[r];
+	  }
+	}
+	if (c + 1 < this->C) {
+	  for (size_t r = 0; r < R; ++r) {
+	    out[r] -= py[r];
+	  }
+	}
+      }
+
+      // slices
+      if (this->dz == NULL || this->S == 1) {
+	continue;
+      }
+      const T *pz = this->dz + first;
+      if (s > 0) {
+	const T *pzPrev = pz - RC;
+	for (size_t r = 0; r < R; ++r) {
+	  out[r] += pzPrev[r];
+	}
+      }
+      if (s + 1 < this->S) {
+	for (size_t r = 0; r < R; ++r) {
+	  out[r] -= pz[r];
+	}
+      }
+    }
+  }
+
+ private:
+
+  const T *dx;
+  const T *dy;
+  const T *dz;
+  T *res;
+  size_t R, C, S;
+
+};
+
+/*
+ * tvGradient(): forward differences of image im with size
+ * sz=(R, C, S). Returns the total variation, accumulated in double
+ * precision: anisotropic, sum(|dx|+|dy|+|dz|), or if isotropic=true,
+ * sum(sqrt(dx^2+dy^2+dz^2)).
+ *
+ * dx, dy, dz must be preallocated with the size of im. dz can be
+ * NULL for 2D images.
+ *
+ * numThreads: number of threads (0 = number of hardware threads).
+ */
+template <class T>
+double tvGradient(const T *im, const size_t *sz, T *dx, T *dy, T *dz,
+		  bool isotropic = false, unsigned int numThreads = 0) {
+  if (sz[0] * sz[1] * sz[2] == 0) {
+    return 0.0;
+  }
+  numThreads = getNumberOfThreads(numThreads);
+  TVGradientFunctor<T> f(im, sz, dx, dy, dz, isotropic, numThreads);
+  parallelFor(0, sz[1] * sz[2], f, numThreads);
+  return f.GetTotalVariation();
+}
+
+/*
+ * tvAdjoint(): adjoint of tvGradient(), res = D'*[dx; dy; dz]. res
+ * must be preallocated with the size of the image.
+ */
+template <class T>
+void tvAdjoint(const T *dx, const T *dy, const T *dz, const size_t *sz,
+	       T *res, unsigned int numThreads = 0) {
+  if (sz[0] * sz[1] * sz[2] == 0) {
+    return;
+  }
+  TVAdjointFunctor<T> f(dx, dy, dz, sz, res);
+  parallelFor(0, sz[1] * sz[2], f, numThreads);
+}
+
+#endif /* TOTALVARIATIONENGINE_H */
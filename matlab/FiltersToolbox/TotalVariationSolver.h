@@ -0,0 +1,562 @@
+/*
+ * TotalVariationSolver.h
+ *
+ * Primal-dual solver for total variation (TV) denoising and
+ * deconvolution of 2D and 3D images, used by chambolle_pock_TV.cpp.
+ *
+ * The solver minimises
+ *
+ *   E(u) = 1/2 ||A u - f||^2 + lambda TV(u)
+ *
+ * where f is the observed image, and A is either the identity
+ * (denoising) or the convolution with a point spread function
+ * (deconvolution). TV(u) is computed with the forward differences of
+ * forward_TV(), either anisotropic sum(|Dx|+|Dy|+|Dz|) or isotropic
+ * sum(sqrt(Dx^2+Dy^2+Dz^2)).
+ *
+ * The algorithm is the primal-dual method by Chambolle and Pock, "A
+ * first-order primal-dual algorithm for convex problems with
+ * applications to imaging", J Math Imaging Vis, 40(1):120-145, 2011.
+ * Denoising uses the accelerated version (Algorithm 2), as the data
+ * term is strongly convex. Deconvolution dualises both the data term
+ * and the TV term (Algorithm 1), so that no linear system has to be
+ * solved.
+ *
+ * All the state of the solver lives in buffers allocated once at
+ * construction. Each iteration is a dual pass, that computes the
+ * gradient of the extrapolated image and projects the dual variable
+ * in place, and a primal pass, that computes the divergence of the
+ * dual variable and updates the image in place. Both passes are run
+ * in parallel on slabs of image columns.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef TOTALVARIATIONSOLVER_H
+#define TOTALVARIATIONSOLVER_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * TVImageGeometry: size of the image and of its gradient. Column l
+ * of the image is image(:, l % C, l / C). 2D images have 2 gradient
+ * components, and 3D images have 3.
+ */
+struct TVImageGeometry {
+
+  size_t R, C, S;
+  size_t nvox;
+  unsigned int ncomp;
+
+};
+
+/*
+ * TVDualFunctor: dual step of the TV term on columns [begin, end)
+ *
+ *   p = proj(p + sigma * grad(ubar))
+ *
+ * where proj is the projection on the set |p_k| <= lambda for each
+ * component (anisotropic TV), or on the ball ||p|| <= lambda
+ * (isotropic TV). p stores the ncomp components one after the
+ * other.
+ */
+template <class T>
+class TVDualFunctor {
+
+ public:
+
+  TVDualFunctor(const TVImageGeometry &_g, const T *_ubar, T *_p,
+		double _lambda, bool _isotropic)
+    : g(_g), ubar(_ubar), p(_p), lambda(_lambda), isotropic(_isotropic),
+      sigma(0.0) {}
+
+  void SetSigma(double _sigma) {
+    this->sigma = _sigma;
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const size_t R = this->g.R;
+    const size_t RC = this->g.R * this->g.C;
+    const T sig = (T)this->sigma;
+    const T lam = (T)this->lambda;
+    for (size_t l = begin; l < end; ++l) {
+      const size_t c = l % this->g.C;
+      const size_t s = l / this->g.C;
+      const size_t first = l * R;
+      const T *in = this->ubar + first;
+      T *px = this->p + first;
+      T *py = px + this->g.nvox;
+      T *pz = (this->g.ncomp == 3) ? py + this->g.nvox : NULL;
+      const bool hasY = (c + 1 < this->g.C);
+      const bool hasZ = (pz != NULL) && (s + 1 < this->g.S);
+
+      // gradient ascent step. The differences on the last row,
+      // column and slice are zero, so p stays zero there
+      for (size_t r = 0; r + 1 < R; ++r) {
+	px[r] += sig * (in[r + 1] - in[r]);
+      }
+      if (hasY) {
+	for (size_t r = 0; r < R; ++r) {
+	  py[r] += sig * (in[r + R] - in[r]);
+	}
+      }
+      if (hasZ) {
+	for (size_t r = 0; r < R; ++r) {
+	  pz[r] += sig * (in[r + RC] - in[r]);
+	}
+      }
+
+      // projection
+      if (this->isotropic) {
+	for (size_t r = 0; r < R; ++r) {
+	  T n2 = px[r] * px[r] + py[r] * py[r];
+	  if (pz != NULL) {
+	    n2 += pz[r] * pz[r];
+	  }
+	  if (n2 > lam * lam) {
+	    T scale = lam / std::sqrt(n2);
+	    px[r] *= scale;
+	    py[r] *= scale;
+	    if (pz != NULL) {
+	      pz[r] *= scale;
+	    }
+	  }
+	}
+      } else {
+	for (size_t r = 0; r < R; ++r) {
+	  px[r] = std::max(-lam, std::min(lam, px[r]));
+	  py[r] = std::max(-lam, std::min(lam, py[r]));
+	}
+	if (pz != NULL) {
+	  for (size_t r = 0; r < R; ++r) {
+	    pz[r] = std::max(-lam, std::min(lam, pz[r]));
+	  }
+	}
+      }
+    }
+  }
+
+ private:
+
+  const TVImageGeometry &g;
+  const T *ubar;
+  T *p;
+  double lambda;
+  bool isotropic;
+  double sigma;
+
+};
+
+/*
+ * TVConvolutionFunctor: convolution of the image with the point
+ * spread function h (zero boundary conditions, output with the size
+ * of the input, centre of h at floor(size(h)/2)), or its adjoint
+ * (correlation).
+ *
+ * With isDual=true, the result is used for the dual step of the data
+ * term of the deconvolution,
+ *
+ *   q = (q + sigma * (A ubar - f)) / (1 + sigma)
+ *
+ * With isDual=false, the result is written to out = A' q.
+ */
+template <class T>
+class TVConvolutionFunctor {
+
+ public:
+
+  TVConvolutionFunctor(const TVImageGeometry &_g, const std::vector<double> &_h,
+		       const size_t *_hsz, const T *_f)
+    : g(_g), h(_h), f(_f), in(NULL), out(NULL), isDual(false), sigma(0.0) {
+    for (int d = 0; d < 3; ++d) {
+      this->hsz[d] = (long)_hsz[d];
+      this->hc[d] = (long)(_hsz[d] / 2);
+    }
+  }
+
+  // forward convolution for the dual step of the data term
+  void SetDual(const T *ubar, T *q, double _sigma) {
+    this->in = ubar;
+    this->out = q;
+    this->isDual = true;
+    this->sigma = _sigma;
+  }
+
+  // adjoint convolution
+  void SetAdjoint(const T *q, T *aux) {
+    this->in = q;
+    this->out = aux;
+    this->isDual = false;
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const long R = (long)this->g.R, C = (long)this->g.C, S = (long)this->g.S;
+    // the adjoint flips the kernel
+    const long sgn = this->isDual ? -1 : 1;
+    for (size_t l = begin; l < end; ++l) {
+      const long c = (long)(l % this->g.C);
+      const long s = (long)(l / this->g.C);
+      for (long r = 0; r < R; ++r) {
+	double acc = 0.0;
+	size_t k = 0;
+	for (long ks = 0; ks < this->hsz[2]; ++ks) {
+	  long ss = s + sgn * (ks - this->hc[2]);
+	  if (ss < 0 || ss >= S) {
+	    k += this->hsz[0] * this->hsz[1];
+	    continue;
+	  }
+	  for (long kc = 0; kc < this->hsz[1]; ++kc) {
+	    long cc = c + sgn * (kc - this->hc[1]);
+	    if (cc < 0 || cc >= C) {
+	      k += this->hsz[0];
+	      continue;
+	    }
+	    const T *col = this->in + (ss * C + cc) * R;
+	    for (long kr = 0; kr < this->hsz[0]; ++kr, ++k) {
+	      long rr = r + sgn * (kr - this->hc[0]);
+	      if (rr >= 0 && rr < R) {
+		acc += this->h[k] * (double)col[rr];
+	      }
+	    }
+	  }
+	}
+	size_t idx = l * this->g.R + r;
+	if (this->isDual) {
+	  this->out[idx] = (T)((this->out[idx] + this->sigma * (acc - (double)this->f[idx]))
+			       / (1.0 + this->sigma));
+	} else {
+	  this->out[idx] = (T)acc;
+	}
+      }
+    }
+  }
+
+ private:
+
+  const TVImageGeometry &g;
+  const std::vector<double> &h;
+  long hsz[3];
+  long hc[3];
+  const T *f;
+  const T *in;
+  T *out;
+  bool isDual;
+  double sigma;
+
+};
+
+/*
+ * TVPrimalFunctor: primal step on columns [begin, end)
+ *
+ *   v = u - tau * (div'(p) + aux)
+ *   u_new = (v + tau * f) / (1 + tau)    (denoising)
+ *   u_new = v                            (deconvolution, aux = A' q)
+ *   ubar = u_new + theta * (u_new - u)
+ *
+ * where div'(p) is the adjoint of the forward differences. If
+ * requested, the functor also accumulates ||u_new - u||^2 and
+ * ||u_new||^2 for the convergence check.
+ */
+template <class T>
+class TVPrimalFunctor {
+
+ public:
+
+  TVPrimalFunctor(const TVImageGeometry &_g, const T *_f, const T *_p,
+		  const T *_aux, T *_u, T *_ubar, unsigned int numThreads)
+    : g(_g), f(_f), p(_p), aux(_aux), u(_u), ubar(_ubar),
+      tau(0.0), theta(1.0), checkChange(false),
+      diff2(numThreads, 0.0), norm2(numThreads, 0.0), div(numThreads) {}
+
+  void SetStep(double _tau, double _theta, bool _checkChange) {
+    this->tau = _tau;
+    this->theta = _theta;
+    this->checkChange = _checkChange;
+    std::fill(this->diff2.begin(), this->diff2.end(), 0.0);
+    std::fill(this->norm2.begin(), this->norm2.end(), 0.0);
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t R = this->g.R;
+    const size_t RC = this->g.R * this->g.C;
+    const T t = (T)this->tau;
+    const T th = (T)this->theta;
+    std::vector<T> &d = this->div[thread];
+    d.resize(R);
+    double acc2 = 0.0, accn = 0.0;
+    for (size_t l = begin; l < end; ++l) {
+      const size_t c = l % this->g.C;
+      const size_t s = l / this->g.C;
+      const size_t first = l * R;
+      const T *px = this->p + first;
+      const T *py = px + this->g.nvox;
+      const T *pz = (this->g.ncomp == 3) ? py + this->g.nvox : NULL;
+
+      // adjoint of the forward differences (see TVAdjointFunctor)
+      if (R == 1) {
+	d[0] = 0;
+      } else {
+	d[0] = -px[0];
+	for (size_t r = 1; r + 1 < R; ++r) {
+	  d[r] = px[r - 1] - px[r];
+	}
+	d[R - 1] = px[R - 2];
+      }
+      if (c > 0) {
+	const T *pyPrev = py - R;
+	for (size_t r = 0; r < R; ++r) {
+	  d[r] += pyPrev[r];
+	}
+      }
+      if (c + 1 < this->g.C) {
+	for (size_t r = 0; r < R; ++r) {
+	  d[r] -= py[r];
+	}
+      }
+      if (pz != NULL) {
+	if (s > 0) {
+	  const T *pzPrev = pz - RC;
+	  for (size_t r = 0; r < R; ++r) {
+	    d[r] += pzPrev[r];
+	  }
+	}
+	if (s + 1 < this->g.S) {
+	  for (size_t r = 0; r < R; ++r) {
+	    d[r] -= pz[r];
+	  }
+	}
+      }
+
+      // primal update and extrapolation
+      T *pu = this->u + first;
+      T *pubar = this->ubar + first;
+      const T *pf = this->f + first;
+      if (this->aux == NULL) {
+	const T inv = (T)(1.0 / (1.0 + this->tau));
+	for (size_t r = 0; r < R; ++r) {
+	  d[r] = (pu[r] - t * d[r] + t * pf[r]) * inv;
+	}
+      } else {
+	const T *pa = this->aux + first;
+	for (size_t r = 0; r < R; ++r) {
+	  d[r] = pu[r] - t * (d[r] + pa[r]);
+	}
+      }
+      if (this->checkChange) {
+	for (size_t r = 0; r < R; ++r) {
+	  double delta = (double)d[r] - (double)pu[r];
+	  acc2 += delta * delta;
+	  accn += (double)d[r] * (double)d[r];
+	}
+      }
+      for (size_t r = 0; r < R; ++r) {
+	pubar[r] = d[r] + th * (d[r] - pu[r]);
+	pu[r] = d[r];
+      }
+    }
+    this->diff2[thread] += acc2;
+    this->norm2[thread] += accn;
+  }
+
+  // ||u_new - u|| / ||u_new|| of the last step
+  double GetRelativeChange() const {
+    double diff = 0.0, norm = 0.0;
+    for (size_t i = 0; i < this->diff2.size(); ++i) {
+      diff += this->diff2[i];
+      norm += this->norm2[i];
+    }
+    return (norm > 0.0) ? std::sqrt(diff / norm) : std::sqrt(diff);
+  }
+
+ private:
+
+  const TVImageGeometry &g;
+  const T *f;
+  const T *p;
+  const T *aux;
+  T *u;
+  T *ubar;
+  double tau;
+  double theta;
+  bool checkChange;
+  std::vector<double> diff2;
+  std::vector<double> norm2;
+  std::vector<std::vector<T> > div;
+
+};
+
+/*
+ * ChambollePockTV: TV denoising or deconvolution solver.
+ *
+ * f: observed image, column-major, with size sz=(R, C, S). S=1 for
+ *    2D images.
+ *
+ * lambda: weight of the TV term.
+ *
+ * isotropic: true for isotropic TV, false for anisotropic TV (as in
+ *    forward_TV()).
+ *
+ * numThreads: number of threads (0 = number of hardware threads).
+ */
+template <class T>
+class ChambollePockTV {
+
+ public:
+
+  ChambollePockTV(const T *_f, const size_t *sz, double _lambda, bool _isotropic,
+		  unsigned int _numThreads = 0)
+    : f(_f), lambda(_lambda), isotropic(_isotropic), hnorm(0.0),
+      numIterations(0), relativeChange(0.0) {
+    this->numThreads = getNumberOfThreads(_numThreads);
+    this->g.R = sz[0];
+    this->g.C = sz[1];
+    this->g.S = sz[2];
+    this->g.nvox = sz[0] * sz[1] * sz[2];
+    this->g.ncomp = (sz[2] > 1) ? 3 : 2;
+    this->hsz[0] = this->hsz[1] = this->hsz[2] = 0;
+    this->ubar.resize(this->g.nvox);
+    this->p.assign(this->g.ncomp * this->g.nvox, (T)0);
+  }
+
+  // set the point spread function for deconvolution. h has size
+  // hsz=(R, C, S), and is stored column-major
+  void SetPointSpreadFunction(const double *h, const size_t *hsz) {
+    size_t n = hsz[0] * hsz[1] * hsz[2];
+    this->h.assign(h, h + n);
+    std::copy(hsz, hsz + 3, this->hsz);
+    // ||A|| <= sum(|h|)
+    this->hnorm = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+      this->hnorm += std::fabs(h[i]);
+    }
+    this->q.assign(this->g.nvox, (T)0);
+    this->aux.resize(this->g.nvox);
+  }
+
+  // run up to maxIter iterations on u, that on input has the initial
+  // guess (e.g. f), and on output the solution. Every checkEvery
+  // iterations, the relative change of u is computed, and the solver
+  // stops if it is below tol
+  void Run(T *u, unsigned int maxIter, double tol, unsigned int checkEvery) {
+    const bool deconvolve = !this->h.empty();
+    checkEvery = std::max(checkEvery, 1U);
+    std::copy(u, u + this->g.nvox, this->ubar.begin());
+
+    // step sizes, with tau * sigma * ||K||^2 <= 1, ||grad||^2 <= 4*ncomp
+    double L2 = 4.0 * this->g.ncomp;
+    if (deconvolve) {
+      L2 += this->hnorm * this->hnorm;
+    }
+    double tau = 1.0 / std::sqrt(L2);
+    double sigma = 1.0 / std::sqrt(L2);
+
+    TVDualFunctor<T> dual(this->g, &this->ubar[0], &this->p[0], this->lambda,
+			  this->isotropic);
+    TVPrimalFunctor<T> primal(this->g, this->f, &this->p[0],
+			      deconvolve ? &this->aux[0] : NULL,
+			      u, &this->ubar[0], this->numThreads);
+    TVConvolutionFunctor<T> conv(this->g, this->h, this->hsz, this->f);
+
+    const size_t ncol = this->g.C * this->g.S;
+    this->relativeChange = 0.0;
+    this->numIterations = 0;
+    while (this->numIterations < maxIter) {
+
+      // dual steps
+      dual.SetSigma(sigma);
+      parallelFor(0, ncol, dual, this->numThreads);
+      if (deconvolve) {
+	conv.SetDual(&this->ubar[0], &this->q[0], sigma);
+	parallelFor(0, ncol, conv, this->numThreads);
+	conv.SetAdjoint(&this->q[0], &this->aux[0]);
+	parallelFor(0, ncol, conv, this->numThreads);
+      }
+
+      // primal step. Denoising is accelerated, because the data term
+      // is 1-strongly convex
+      double theta = deconvolve ? 1.0 : 1.0 / std::sqrt(1.0 + 2.0 * tau);
+      ++this->numIterations;
+      bool check = (this->numIterations % checkEvery == 0)
+	|| (this->numIterations == maxIter);
+      primal.SetStep(tau, theta, check);
+      parallelFor(0, ncol, primal, this->numThreads);
+      if (!deconvolve) {
+	tau *= theta;
+	sigma /= theta;
+      }
+
+      if (check) {
+	this->relativeChange = primal.GetRelativeChange();
+	if (this->relativeChange < tol) {
+	  break;
+	}
+      }
+    }
+  }
+
+  unsigned int GetNumberOfIterations() const {
+    return this->numIterations;
+  }
+
+  // relative change of the image in the last convergence check
+  double GetRelativeChange() const {
+    return this->relativeChange;
+  }
+
+ private:
+
+  const T *f;
+  double lambda;
+  bool isotropic;
+  unsigned int numThreads;
+  TVImageGeometry g;
+  std::vector<double> h;
+  size_t hsz[3];
+  double hnorm;
+  std::vector<T> ubar;
+  std::vector<T> p;
+  std::vector<T> q;
+  std::vector<T> aux;
+  unsigned int numIterations;
+  double relativeChange;
+
+};
+
+#endif /* TOTALVARIATIONSOLVER_H */
@@ -18,6 +18,48 @@ function im2 = blockproc3(im, blksz, fun, border, numworkers)
 %   FUN is a function handle. This is the processing applied to every
 %   block.
 %
+%   Alternatively, FUN can be the name of a native C++ kernel, or a cell
+%   array {KERNEL, PARAM} with the name of the kernel and its parameter.
+%   Native kernels are run by MEX function blockproc3_mex(), that
+%   processes the blocks in parallel with a pool of threads. Blocks are
+%   read from IM and written to IM2 directly in memory, without creating
+%   jobs, and the Parallel Computing Toolbox is not needed.
+%
+%   Available kernels:
+%
+%     'median':   Median of a box, as itk_imfilter('median'). PARAM is
+%                 the radius of the box, e.g. PARAM=[2 3 4] is a box of
+%                 [5 7 9] voxels.
+%
+%     'mean':     Mean of a box of radius PARAM.
+%
+%     'dilate':   Grayscale dilation (maximum) with a box of radius PARAM.
+%
+%     'erode':    Grayscale erosion (minimum) with a box of radius PARAM.
+%
+%     'gaussian': Gaussian smoothing. PARAM is the standard deviation in
+%                 voxel units. The Gaussian is truncated at 3*PARAM.
+%
+%     'tv':       Local total variation |Dx|+|Dy|+|Dz|, with the forward
+%                 differences of forward_TV(). sum(IM2(:)) is the total
+%                 variation of IM. No PARAM.
+%
+%     'maudist':  Signed distance to the boundary of the foreground
+%                 (non-zero voxels), in voxel units, as
+%                 itk_imfilter('maudist'). No PARAM.
+%
+%   PARAM is a scalar or a vector with one element per dimension.
+%
+%   As with function handles, each kernel only sees its block and
+%   border. Results are the same as processing the whole image if
+%   BORDER >= PARAM (box kernels), BORDER >= ceil(3*PARAM) ('gaussian'),
+%   BORDER >= 1 ('tv'). 'maudist' distances are exact if they are
+%   smaller than BORDER.
+%
+%   'median', 'dilate' and 'erode' return an image of the same class as
+%   IM. 'mean', 'gaussian' and 'tv' return class single if IM is single,
+%   and double otherwise. 'maudist' returns class single.
+%
 % IM2 = blockproc3(IM, BLKSZ, FUN, BORDER)
 %
 %  BORDER is a 2- or 3-vector with the size of the border around each
@@ -30,6 +72,9 @@ function im2 = blockproc3(im, blksz, fun, border, numworkers)
 %       fun = @(x) deconvblind(x, ones(20, 20, 10));
 %       im2 = blockproc3d(im, [256 256 128], fun, [30 30 10]);
 %
+%       % median filter with a native kernel
+%       im2 = blockproc3(im, [128 128 64], {'median', [9 9 9]}, [9 9 9]);
+%
 % IM2 = blockproc3(..., NUMWORKERS)
 %
 %   NUMWORKERS is an integer to activate parallel processing. If the
@@ -38,6 +83,9 @@ function im2 = blockproc3(im, blksz, fun, border, numworkers)
 %   at the same time. By default, NUMWORKERS=1, and parallel processing is
 %   disabled.
 %
+%   If FUN is a native kernel, NUMWORKERS is the number of threads. By
+%   default, one thread per processor is used.
+%
 %   Note that in parallel model, FUN gets wrapped in parallel jobs. Thus,
 %   execution can be interrupted by pressing CTRL+C even when FUN is a C++
 %   MEX file.
@@ -72,8 +120,8 @@ function im2 = blockproc3(im, blksz, fun, border, numworkers)
 % See also: blockproc, scimat_blockproc3.
 
 % Author: Ramon Casero <rcasero@gmail.com>
-% Copyright © 2011 University of Oxford
-% Version: 0.4.0
+% Copyright © 2011-2015 University of Oxford
+% Version: 0.5.0
 % $Rev$
 % $Date$
 % 
@@ -104,6 +152,25 @@ function im2 = blockproc3(im, blksz, fun, border, numworkers)
 narginchk(3, 5);
 nargoutchk(0, 1);
 
+% native C++ kernels
+if (ischar(fun) || iscell(fun))
+    if ischar(fun)
+        fun = {fun};
+    end
+    if (length(fun) < 2)
+        fun{2} = [];
+    end
+    if (nargin < 4)
+        border = [];
+    end
+    if (nargin < 5) || isempty(numworkers)
+        numworkers = 0;
+    end
+    im2 = blockproc3_mex(im, double(blksz), double(border), ...
+        fun{1}, double(fun{2}), double(numworkers));
+    return
+end
+
 % defaults
 if isempty(blksz)
     blksz = size(im);
@@ -0,0 +1,275 @@
+/*
+ * blockproc3_mex.cpp
+ *
+ * BLOCKPROC3_MEX  Native block processing of a 2D or 3D image with
+ * multithreading. Auxiliary function for blockproc3.m
+ *
+ * IM2 = blockproc3_mex(IM, BLKSZ, BORDER, KERNEL, PARAM, NUMTHREADS)
+ *
+ *   This function should only be called by blockproc3.m. The image is
+ *   processed as in blockproc3(), but the function applied to each
+ *   block is a native kernel, and blocks are processed in parallel by
+ *   a pool of threads, without copying them to Matlab.
+ *
+ *   IM is a 2D or 3D array of class double, single, logical or
+ *   (u)int8/16/32.
+ *
+ *   BLKSZ, BORDER are 3-vectors with the block size and the border
+ *   around each block.
+ *
+ *   KERNEL is a string with the kernel name, and PARAM its numeric
+ *   parameter (scalar or 3-vector, see blockproc3.m):
+ *
+ *     'median':   median of a box of radius PARAM
+ *     'mean':     mean of a box of radius PARAM
+ *     'dilate':   maximum of a box of radius PARAM
+ *     'erode':    minimum of a box of radius PARAM
+ *     'gaussian': Gaussian smoothing with standard deviation PARAM
+ *                 (voxels)
+ *     'tv':       local total variation |Dx|+|Dy|+|Dz| (no PARAM)
+ *     'maudist':  signed distance to the foreground boundary (no PARAM)
+ *
+ *   NUMTHREADS is the number of threads. 0 means one thread per
+ *   processor.
+ *
+ *   IM2 has the same size as IM. 'median', 'dilate' and 'erode'
+ *   return the class of IM. 'mean', 'gaussian' and 'tv' return class
+ *   single if IM is single, and double otherwise. 'maudist' returns
+ *   class single.
+ *
+ * See also: blockproc3.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+#include <string>
+
+/* Gerardus headers */
+#include "BlockProcessingEngine.h"
+
+// read a scalar or vector with up to 3 elements into v[3]. A scalar
+// is replicated to the 3 dimensions, and missing elements of a
+// shorter vector are set to def
+static void readVector3(const mxArray *pm, double *v, double def,
+			const char *name) {
+  v[0] = v[1] = v[2] = def;
+  if (pm == NULL || mxIsEmpty(pm)) {
+    return;
+  }
+  if (!mxIsDouble(pm) || mxIsComplex(pm) || mxGetNumberOfElements(pm) > 3) {
+    mexErrMsgTxt((std::string(name)
+		  + " must be a scalar or vector of type double with up to 3 elements").c_str());
+  }
+  const double *p = mxGetPr(pm);
+  size_t n = mxGetNumberOfElements(pm);
+  if (n == 1) {
+    v[0] = v[1] = v[2] = p[0];
+  } else {
+    for (size_t i = 0; i < n; ++i) {
+      v[i] = p[i];
+    }
+  }
+  for (int d = 0; d < 3; ++d) {
+    if (!(v[d] >= 0.0) || mxIsInf(v[d])) {
+      mexErrMsgTxt((std::string(name) + " must be non-negative and finite").c_str());
+    }
+  }
+}
+
+// run the block processor with the input and output pointers cast to
+// their types
+template <class TIn, class TOut>
+void runBlockProcess(const mxArray *im, mxArray *im2, const BlockGrid &grid,
+		     const BlockKernel &kernel, unsigned int numThreads) {
+  blockProcess((const TIn *)mxGetData(im), (TOut *)mxGetData(im2),
+	       grid, kernel, numThreads);
+}
+
+template <class TIn>
+void runBlockProcess(const mxArray *im, mxArray *im2, const BlockGrid &grid,
+		     const BlockKernel &kernel, unsigned int numThreads) {
+  switch (mxGetClassID(im2)) {
+  case mxDOUBLE_CLASS:
+    runBlockProcess<TIn, double>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxSINGLE_CLASS:
+    runBlockProcess<TIn, float>(im, im2, grid, kernel, numThreads);
+    break;
+  default:
+    // order statistics kernels: output has the same class as input
+    runBlockProcess<TIn, TIn>(im, im2, grid, kernel, numThreads);
+    break;
+  }
+}
+
+// allocate the output image with class outClass, and process the
+// input image with the kernel
+mxArray *runBlockProcess(const mxArray *im, mxClassID outClass,
+			 const BlockGrid &grid, const BlockKernel &kernel,
+			 unsigned int numThreads) {
+
+  mxArray *im2 = mxCreateNumericArray(mxGetNumberOfDimensions(im),
+				      mxGetDimensions(im), outClass, mxREAL);
+  if (im2 == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  if (mxIsEmpty(im)) {
+    return im2;
+  }
+
+  switch (mxGetClassID(im)) {
+  case mxDOUBLE_CLASS:
+    runBlockProcess<double>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxSINGLE_CLASS:
+    runBlockProcess<float>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxLOGICAL_CLASS:
+    runBlockProcess<mxLogical>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxINT8_CLASS:
+    runBlockProcess<int8_T>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxUINT8_CLASS:
+    runBlockProcess<uint8_T>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxINT16_CLASS:
+    runBlockProcess<int16_T>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxUINT16_CLASS:
+    runBlockProcess<uint16_T>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxINT32_CLASS:
+    runBlockProcess<int32_T>(im, im2, grid, kernel, numThreads);
+    break;
+  case mxUINT32_CLASS:
+    runBlockProcess<uint32_T>(im, im2, grid, kernel, numThreads);
+    break;
+  default:
+    mexErrMsgTxt("IM has an unsupported class");
+  }
+
+  return im2;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check number of input and output arguments
+  if (nrhs != 6) {
+    mexErrMsgTxt("Six input arguments required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+
+  // input image
+  const mxArray *im = prhs[0];
+  mwSize ndim = mxGetNumberOfDimensions(im);
+  if (ndim > 3) {
+    mexErrMsgTxt("IM must be a 2D or 3D array");
+  }
+  if (mxIsComplex(im)) {
+    mexErrMsgTxt("IM must be real");
+  }
+  const mwSize *dims = mxGetDimensions(im);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // block size and border
+  double v[3];
+  size_t blksz[3], border[3];
+  readVector3(prhs[1], v, 0.0, "BLKSZ");
+  for (int d = 0; d < 3; ++d) {
+    blksz[d] = (v[d] < 1.0) ? sz[d] : (size_t)v[d];
+  }
+  readVector3(prhs[2], v, 0.0, "BORDER");
+  for (int d = 0; d < 3; ++d) {
+    border[d] = (size_t)std::ceil(v[d]);
+  }
+
+  // kernel and its parameter
+  if (!mxIsChar(prhs[3])) {
+    mexErrMsgTxt("KERNEL must be a string");
+  }
+  char *buf = mxArrayToString(prhs[3]);
+  std::string kernelName(buf);
+  mxFree(buf);
+  readVector3(prhs[4], v, 0.0, "PARAM");
+  size_t radius[3];
+  for (int d = 0; d < 3; ++d) {
+    radius[d] = (size_t)std::ceil(v[d]);
+  }
+
+  // number of threads
+  if (!mxIsDouble(prhs[5]) || mxGetNumberOfElements(prhs[5]) > 1) {
+    mexErrMsgTxt("NUMTHREADS must be a scalar");
+  }
+  unsigned int numThreads = mxIsEmpty(prhs[5]) ? 0 : (unsigned int)mxGetScalar(prhs[5]);
+
+  BlockGrid grid(sz, blksz, border);
+
+  // run the kernel. The output class is double or single for
+  // kernels that compute new values, and the input class for order
+  // statistics kernels
+  mxClassID inClass = mxGetClassID(im);
+  mxClassID realClass = (inClass == mxSINGLE_CLASS) ? mxSINGLE_CLASS : mxDOUBLE_CLASS;
+  if (kernelName == "median") {
+    plhs[0] = runBlockProcess(im, inClass, grid, MedianKernel(radius), numThreads);
+  } else if (kernelName == "mean") {
+    plhs[0] = runBlockProcess(im, realClass, grid, BoxMeanKernel(radius), numThreads);
+  } else if (kernelName == "dilate") {
+    plhs[0] = runBlockProcess(im, inClass, grid, BoxMinMaxKernel(radius, true),
+			      numThreads);
+  } else if (kernelName == "erode") {
+    plhs[0] = runBlockProcess(im, inClass, grid, BoxMinMaxKernel(radius, false),
+			      numThreads);
+  } else if (kernelName == "gaussian") {
+    plhs[0] = runBlockProcess(im, realClass, grid, GaussianKernel(v), numThreads);
+  } else if (kernelName == "tv") {
+    plhs[0] = runBlockProcess(im, realClass, grid, TotalVariationKernel(), numThreads);
+  } else if (kernelName == "maudist") {
+    plhs[0] = runBlockProcess(im, mxSINGLE_CLASS, grid, SignedDistanceKernel(),
+			      numThreads);
+  } else {
+    mexErrMsgTxt(("Unknown KERNEL: " + kernelName).c_str());
+  }
+
+}
@@ -0,0 +1,70 @@
+function im2 = blockproc3_mex(im, blksz, border, kernel, param, numthreads)
+% BLOCKPROC3_MEX  Native block processing of a 2D or 3D image with
+% multithreading. Auxiliary function for blockproc3.m
+%
+% IM2 = blockproc3_mex(IM, BLKSZ, BORDER, KERNEL, PARAM, NUMTHREADS)
+%
+%   This function should only be called by blockproc3.m. The image is
+%   processed as in blockproc3(), but the function applied to each
+%   block is a native kernel, and blocks are processed in parallel by
+%   a pool of threads, without copying them to Matlab.
+%
+%   IM is a 2D or 3D array of class double, single, logical or
+%   (u)int8/16/32.
+%
+%   BLKSZ, BORDER are 3-vectors with the block size and the border
+%   around each block.
+%
+%   KERNEL is a string with the kernel name, and PARAM its numeric
+%   parameter (scalar or 3-vector, see blockproc3.m):
+%
+%     'median':   median of a box of radius PARAM
+%     'mean':     mean of a box of radius PARAM
+%     'dilate':   maximum of a box of radius PARAM
+%     'erode':    minimum of a box of radius PARAM
+%     'gaussian': Gaussian smoothing with standard deviation PARAM
+%                 (voxels)
+%     'tv':       local total variation |Dx|+|Dy|+|Dz| (no PARAM)
+%     'maudist':  signed distance to the foreground boundary (no PARAM)
+%
+%   NUMTHREADS is the number of threads. 0 means one thread per
+%   processor.
+%
+%   IM2 has the same size as IM. 'median', 'dilate' and 'erode'
+%   return the class of IM. 'mean', 'gaussian' and 'tv' return class
+%   single if IM is single, and double otherwise. 'maudist' returns
+%   class single.
+%
+% See also: blockproc3.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
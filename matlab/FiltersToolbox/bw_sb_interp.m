@@ -14,15 +14,26 @@ function thres_img=bw_sb_interp(data_SBintrp, inter_slice_no)
 %
 %   THRES_IMG is the 3D binary image obtained from applying shape based
 %   interpolation Herman et al. (1992) to DATA_SBINTRP. THRES_IMG has the
-%   same number of rows and columns as DATA_SBINTRP, and more slices due to
-%   the interpolation.
+%   same number of rows and columns as DATA_SBINTRP, and
+%   size(DATA_SBINTRP, 3) + (size(DATA_SBINTRP, 3)-1)*INTER_SLICE_NO
+%   slices. Slice K of DATA_SBINTRP is slice (K-1)*(INTER_SLICE_NO+1)+1 of
+%   THRES_IMG.
+%
+%   If MEX function bw_sb_interp_mex() is available, it is used instead of
+%   the Matlab code. Slices are then converted to exact Euclidean signed
+%   distance maps instead of chamfer distance maps, slice pairs are
+%   processed in parallel, and the interpolated slices are thresholded
+%   straight into the output, so that only two distance maps per thread
+%   are kept in memory.
 %
 % Herman et al. (1992) Shape-based interpolation. IEEE Computer Graphics &
 % Applications, 12(3):69--79.
+%
+% See also: bw_sb_interp_mex.
 
 % Author: Valentina Carapella <vcarapella@gmail.com>
 % Copyright © 2013 University of Oxford
-% Version: 0.1.0
+% Version: 0.2.0
 % $Rev$
 % $Date$
 % 
@@ -58,6 +69,12 @@ if (nargin < 2) || isempty(inter_slice_no)
     inter_slice_no = 5;
 end
 
+% use the MEX function if available
+if (exist('bw_sb_interp_mex', 'file') == 3)
+    thres_img = bw_sb_interp_mex(data_SBintrp, inter_slice_no);
+    return
+end
+
 % First distance map
 
 %Rules
@@ -186,13 +203,13 @@ toc
 
 
 
-inter_slice_sp=zeros(size_x,size_y,1);
+inter_slice_sp=chamfer_matrix2(:,:,1);
 
 %linear inbetween interpolation
 x0=(1:size_x)';
 y0=(1:size_y)';
-z0= linspace(1,2,inter_slice_no)';
-[xf,yf,zf]=meshgrid(x0,y0,z0);
+z0= linspace(1,2,inter_slice_no+2)';
+[xf,yf,zf]=meshgrid(y0,x0,z0);
 
 
 display('Two-slices-per-time cubic interpolation step')
@@ -205,11 +222,9 @@ inter_slice_sp=cat(3,inter_slice_sp,tmp_inter_slice_sp(:,:,2:end));
 toc
 end
 
-% GET THE BINARY
+% GET THE BINARY, without the padding
 
-thres_img=inter_slice_sp;
-thres_img(thres_img<=5)=0;
-thres_img(thres_img>5)=1;
+thres_img=inter_slice_sp(2:end-1,2:end-1,:)>5;
 
 end
 
@@ -0,0 +1,167 @@
+/*
+ * bw_sb_interp_mex.cpp
+ *
+ * BW_SB_INTERP_MEX  Auxiliary function for bw_sb_interp(). Native
+ * shape-based interpolation of the slices of a binary image
+ *
+ * BW2 = bw_sb_interp_mex(BW, NINTER, NUMTHREADS)
+ *
+ *   BW is a 2D or 3D binary image (logical or any numeric class, with
+ *   voxels ~= 0 being the object).
+ *
+ *   NINTER is a non-negative integer with the number of slices to
+ *   interpolate between each pair of consecutive slices of BW.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+ *   the number of processing cores.
+ *
+ *   BW2 is a logical image with the same number of rows and columns as
+ *   BW, and size(BW, 3) + (size(BW, 3)-1)*NINTER slices. Slice K of BW
+ *   is slice (K-1)*(NINTER+1)+1 of BW2.
+ *
+ *   Each slice is converted to a signed distance map with an exact
+ *   Euclidean distance transform, the maps of each pair of slices are
+ *   interpolated linearly and the result is thresholded at 0. Only two
+ *   distance maps per thread are kept in memory.
+ *
+ * See also: bw_sb_interp.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+
+/* Gerardus headers */
+#include "ShapeBasedInterpolationEngine.h"
+
+// interpolate the slices of bw, with the voxels cast to their type
+template <class T>
+void runShapeBasedInterpolation(const mxArray *bw, mxArray *bw2, const size_t *sz,
+				size_t numInter, unsigned int numThreads) {
+  ShapeBasedInterpolation<T> interp(sz, numInter, numThreads);
+  interp.Run((const T *)mxGetData(bw), (bool *)mxGetLogicals(bw2));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 2 || nrhs > 3) {
+    mexErrMsgTxt("Two or three input arguments required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+
+  const mxArray *bw = prhs[0];
+  const mwSize ndim = mxGetNumberOfDimensions(bw);
+  if (ndim > 3) {
+    mexErrMsgTxt("BW must be a 2D or 3D array");
+  }
+  if (mxIsComplex(bw) || mxIsSparse(bw)) {
+    mexErrMsgTxt("BW must be a real full array");
+  }
+  const mwSize *dims = mxGetDimensions(bw);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // number of interpolated slices
+  if (!mxIsDouble(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+    mexErrMsgTxt("NINTER must be a scalar");
+  }
+  const double ninter = mxGetScalar(prhs[1]);
+  if (!(ninter >= 0.0) || ninter != std::floor(ninter) || mxIsInf(ninter)) {
+    mexErrMsgTxt("NINTER must be a non-negative integer");
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    if (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1) {
+      mexErrMsgTxt("NUMTHREADS must be a scalar");
+    }
+    numThreads = (unsigned int)mxGetScalar(prhs[2]);
+  }
+
+  const size_t numInter = (size_t)ninter;
+  mwSize dims2[3] = {dims[0], dims[1], 0};
+  dims2[2] = (sz[2] == 0) ? 0 : sz[2] + (sz[2] - 1) * numInter;
+  plhs[0] = mxCreateLogicalArray(3, dims2);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  switch (mxGetClassID(bw)) {
+  case mxDOUBLE_CLASS:
+    runShapeBasedInterpolation<double>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxSINGLE_CLASS:
+    runShapeBasedInterpolation<float>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxLOGICAL_CLASS:
+    runShapeBasedInterpolation<mxLogical>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxINT8_CLASS:
+    runShapeBasedInterpolation<int8_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxUINT8_CLASS:
+    runShapeBasedInterpolation<uint8_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxINT16_CLASS:
+    runShapeBasedInterpolation<int16_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxUINT16_CLASS:
+    runShapeBasedInterpolation<uint16_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxINT32_CLASS:
+    runShapeBasedInterpolation<int32_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxUINT32_CLASS:
+    runShapeBasedInterpolation<uint32_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxINT64_CLASS:
+    runShapeBasedInterpolation<int64_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  case mxUINT64_CLASS:
+    runShapeBasedInterpolation<uint64_T>(bw, plhs[0], sz, numInter, numThreads);
+    break;
+  default:
+    mexErrMsgTxt("BW has an unsupported class");
+  }
+
+}
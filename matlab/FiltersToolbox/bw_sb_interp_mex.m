@@ -0,0 +1,57 @@
+function bw2 = bw_sb_interp_mex(bw, ninter, numthreads)
+% BW_SB_INTERP_MEX  Auxiliary function for bw_sb_interp(). Native
+% shape-based interpolation of the slices of a binary image
+%
+% BW2 = bw_sb_interp_mex(BW, NINTER, NUMTHREADS)
+%
+%   BW is a 2D or 3D binary image (logical or any numeric class, with
+%   voxels ~= 0 being the object).
+%
+%   NINTER is a non-negative integer with the number of slices to
+%   interpolate between each pair of consecutive slices of BW.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+%   the number of processing cores.
+%
+%   BW2 is a logical image with the same number of rows and columns as
+%   BW, and size(BW, 3) + (size(BW, 3)-1)*NINTER slices. Slice K of BW
+%   is slice (K-1)*(NINTER+1)+1 of BW2.
+%
+%   Each slice is converted to a signed distance map with an exact
+%   Euclidean distance transform, the maps of each pair of slices are
+%   interpolated linearly and the result is thresholded at 0. Only two
+%   distance maps per thread are kept in memory.
+%
+% See also: bw_sb_interp.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -0,0 +1,373 @@
+/*
+ * bwlabel_stats.cpp
+ *
+ * BWLABEL_STATS  Connected components of a 2D or 3D mask, with
+ * per-component statistics
+ *
+ * [LAB, STATS] = bwlabel_stats(BW)
+ *
+ *   BW is a 2D or 3D segmentation mask of any numeric class or
+ *   logical. Non-zero voxels are foreground.
+ *
+ *   LAB is an array with the size of BW, where the voxels of each
+ *   connected component have value 1, 2, ..., and the background has
+ *   value 0. Components are numbered in the same order as by
+ *   bwconncomp(), i.e. by their first voxel. LAB is of class uint32,
+ *   or uint64 if BW has 2^31 or more voxels.
+ *
+ *   STATS is a struct with the statistics of each component, computed
+ *   while labelling, instead of from the lists of voxel indices given
+ *   by bwconncomp(). Indices are 1-based (row, column, slice), and
+ *   only row and column are given for 2D masks. N is the number of
+ *   components and D=2 or D=3 the number of dimensions:
+ *
+ *     Connectivity: connectivity used for labelling
+ *     ImageSize:    size of BW
+ *     NumObjects:   number of components, N
+ *     NVox:         (1, N)-vector with the number of voxels
+ *     BoxMin:       (D, N)-matrix with the first index of the
+ *                   bounding box
+ *     BoxMax:       (D, N)-matrix with the last index of the
+ *                   bounding box
+ *     Centroid:     (D, N)-matrix with the mean index
+ *     Cov:          (D, D, N)-array with the covariance matrices
+ *                   (second central moments, normalised by NVox) of
+ *                   the indices
+ *
+ * [LAB, STATS] = bwlabel_stats(BW, CONN, IM, MINSIZE, NUMTHREADS)
+ *
+ *   CONN is the connectivity, 6, 18 or 26 for 3D masks, and 4 or 8
+ *   for 2D masks (6 means 4, and 18 or 26 mean 8). By default,
+ *   CONN=26 in 3D and CONN=8 in 2D.
+ *
+ *   IM is an intensity image with the size of BW, of any numeric
+ *   class or logical. If it's given, STATS has two more fields:
+ *
+ *     IntensitySum:   (1, N)-vector with the sum of IM
+ *     IntensitySumSq: (1, N)-vector with the sum of IM.^2
+ *
+ *   so that e.g. the mean intensity is STATS.IntensitySum./STATS.NVox.
+ *   By default, IM=[].
+ *
+ *   MINSIZE is a scalar. Components with fewer than MINSIZE voxels are
+ *   deleted from LAB and STATS, and the remaining ones renumbered
+ *   consecutively. By default, MINSIZE=0.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+ *   the number of processing cores.
+ *
+ * See also: bwrmsmallcomp, bwconncomp, regionprops.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+#include <vector>
+
+/* Boost headers */
+#include <boost/cstdint.hpp>
+
+/* Gerardus headers */
+#include "ConnectedComponentsEngine.h"
+
+// label the mask bw, with its voxels cast to their type
+template <class TLab, class T>
+void findComponents(ConnectedComponents<TLab> &cc, const mxArray *bw, TLab *lab) {
+  cc.FindComponents((const T *)mxGetData(bw), lab);
+}
+
+template <class TLab>
+void findComponents(ConnectedComponents<TLab> &cc, const mxArray *bw, TLab *lab) {
+  switch (mxGetClassID(bw)) {
+  case mxDOUBLE_CLASS:
+    findComponents<TLab, double>(cc, bw, lab);
+    break;
+  case mxSINGLE_CLASS:
+    findComponents<TLab, float>(cc, bw, lab);
+    break;
+  case mxLOGICAL_CLASS:
+    findComponents<TLab, mxLogical>(cc, bw, lab);
+    break;
+  case mxINT8_CLASS:
+    findComponents<TLab, int8_T>(cc, bw, lab);
+    break;
+  case mxUINT8_CLASS:
+    findComponents<TLab, uint8_T>(cc, bw, lab);
+    break;
+  case mxINT16_CLASS:
+    findComponents<TLab, int16_T>(cc, bw, lab);
+    break;
+  case mxUINT16_CLASS:
+    findComponents<TLab, uint16_T>(cc, bw, lab);
+    break;
+  case mxINT32_CLASS:
+    findComponents<TLab, int32_T>(cc, bw, lab);
+    break;
+  case mxUINT32_CLASS:
+    findComponents<TLab, uint32_T>(cc, bw, lab);
+    break;
+  case mxINT64_CLASS:
+    findComponents<TLab, int64_T>(cc, bw, lab);
+    break;
+  case mxUINT64_CLASS:
+    findComponents<TLab, uint64_T>(cc, bw, lab);
+    break;
+  default:
+    mexErrMsgTxt("BW has an unsupported class");
+  }
+}
+
+// final labels and statistics, with the intensities of im (or none
+// if im is NULL) cast to their type
+template <class TLab, class TIm>
+void resolveLabels(ConnectedComponents<TLab> &cc, const mxArray *im) {
+  cc.ResolveLabels((im == NULL) ? (const TIm *)NULL : (const TIm *)mxGetData(im));
+}
+
+template <class TLab>
+void resolveLabels(ConnectedComponents<TLab> &cc, const mxArray *im) {
+  if (im == NULL) {
+    resolveLabels<TLab, double>(cc, im);
+    return;
+  }
+  switch (mxGetClassID(im)) {
+  case mxDOUBLE_CLASS:
+    resolveLabels<TLab, double>(cc, im);
+    break;
+  case mxSINGLE_CLASS:
+    resolveLabels<TLab, float>(cc, im);
+    break;
+  case mxLOGICAL_CLASS:
+    resolveLabels<TLab, mxLogical>(cc, im);
+    break;
+  case mxINT8_CLASS:
+    resolveLabels<TLab, int8_T>(cc, im);
+    break;
+  case mxUINT8_CLASS:
+    resolveLabels<TLab, uint8_T>(cc, im);
+    break;
+  case mxINT16_CLASS:
+    resolveLabels<TLab, int16_T>(cc, im);
+    break;
+  case mxUINT16_CLASS:
+    resolveLabels<TLab, uint16_T>(cc, im);
+    break;
+  case mxINT32_CLASS:
+    resolveLabels<TLab, int32_T>(cc, im);
+    break;
+  case mxUINT32_CLASS:
+    resolveLabels<TLab, uint32_T>(cc, im);
+    break;
+  case mxINT64_CLASS:
+    resolveLabels<TLab, int64_T>(cc, im);
+    break;
+  case mxUINT64_CLASS:
+    resolveLabels<TLab, uint64_T>(cc, im);
+    break;
+  default:
+    mexErrMsgTxt("IM has an unsupported class");
+  }
+}
+
+// STATS output struct
+mxArray *createStatsStruct(const std::vector<ComponentStats> &stats,
+			   const mxArray *bw, unsigned int connectivity, bool hasIntensity) {
+  const char *fieldNames[] = {"Connectivity", "ImageSize", "NumObjects", "NVox",
+			      "BoxMin", "BoxMax", "Centroid", "Cov",
+			      "IntensitySum", "IntensitySumSq"};
+  mxArray *out = mxCreateStructMatrix(1, 1, hasIntensity ? 10 : 8, fieldNames);
+  const size_t N = stats.size();
+  const mwSize ndim = mxGetNumberOfDimensions(bw);
+
+  mxSetField(out, 0, "Connectivity", mxCreateDoubleScalar((double)connectivity));
+  mxArray *imageSize = mxCreateDoubleMatrix(1, ndim, mxREAL);
+  for (mwSize d = 0; d < ndim; ++d) {
+    mxGetPr(imageSize)[d] = (double)mxGetDimensions(bw)[d];
+  }
+  mxSetField(out, 0, "ImageSize", imageSize);
+  mxSetField(out, 0, "NumObjects", mxCreateDoubleScalar((double)N));
+
+  mxArray *nvox = mxCreateDoubleMatrix(1, N, mxREAL);
+  mxArray *boxMin = mxCreateDoubleMatrix(ndim, N, mxREAL);
+  mxArray *boxMax = mxCreateDoubleMatrix(ndim, N, mxREAL);
+  mxArray *centroid = mxCreateDoubleMatrix(ndim, N, mxREAL);
+  mwSize covDims[3] = {ndim, ndim, N};
+  mxArray *cov = mxCreateNumericArray(3, covDims, mxDOUBLE_CLASS, mxREAL);
+  for (size_t l = 0; l < N; ++l) {
+    const ComponentStats &st = stats[l];
+    mxGetPr(nvox)[l] = (double)st.numVoxels;
+    for (mwSize d = 0; d < ndim; ++d) {
+      mxGetPr(boxMin)[l * ndim + d] = (double)(st.boxMin[d] + 1);
+      mxGetPr(boxMax)[l * ndim + d] = (double)(st.boxMax[d] + 1);
+      mxGetPr(centroid)[l * ndim + d] = st.GetCentroid(d) + 1.0;
+      for (mwSize d1 = 0; d1 < ndim; ++d1) {
+	mxGetPr(cov)[(l * ndim + d1) * ndim + d] = st.GetCovariance(d, d1);
+      }
+    }
+  }
+  mxSetField(out, 0, "NVox", nvox);
+  mxSetField(out, 0, "BoxMin", boxMin);
+  mxSetField(out, 0, "BoxMax", boxMax);
+  mxSetField(out, 0, "Centroid", centroid);
+  mxSetField(out, 0, "Cov", cov);
+
+  if (hasIntensity) {
+    mxArray *sum = mxCreateDoubleMatrix(1, N, mxREAL);
+    mxArray *sum2 = mxCreateDoubleMatrix(1, N, mxREAL);
+    for (size_t l = 0; l < N; ++l) {
+      mxGetPr(sum)[l] = stats[l].intensity;
+      mxGetPr(sum2)[l] = stats[l].intensity2;
+    }
+    mxSetField(out, 0, "IntensitySum", sum);
+    mxSetField(out, 0, "IntensitySumSq", sum2);
+  }
+  return out;
+}
+
+// label the mask with label type TLab, and create the outputs
+template <class TLab>
+void labelComponents(int nlhs, mxArray *plhs[], const mxArray *bw, const mxArray *im,
+		     const size_t *sz, unsigned int connectivity, double minSize,
+		     unsigned int numThreads, mxClassID labClassId) {
+  plhs[0] = mxCreateNumericArray(mxGetNumberOfDimensions(bw), mxGetDimensions(bw),
+				 labClassId, mxREAL);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  ConnectedComponents<TLab> cc(sz, connectivity, numThreads);
+  findComponents(cc, bw, (TLab *)mxGetData(plhs[0]));
+  resolveLabels(cc, im);
+  if (minSize > 1.0) {
+    cc.RemoveSmallComponents((boost::uint64_t)std::ceil(minSize));
+  }
+  if (nlhs > 1) {
+    plhs[1] = createStatsStruct(cc.GetStats(), bw, connectivity, im != NULL);
+  }
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 5) {
+    mexErrMsgTxt("One to five input arguments required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  const mxArray *bw = prhs[0];
+  const mwSize ndim = mxGetNumberOfDimensions(bw);
+  if (ndim > 3) {
+    mexErrMsgTxt("BW must be a 2D or 3D array");
+  }
+  if (mxIsComplex(bw) || mxIsSparse(bw)) {
+    mexErrMsgTxt("BW must be a real full array");
+  }
+  const mwSize *dims = mxGetDimensions(bw);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // connectivity
+  unsigned int connectivity = (ndim == 3) ? 26 : 8;
+  if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+    if (!mxIsNumeric(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1) {
+      mexErrMsgTxt("CONN must be a scalar");
+    }
+    connectivity = (unsigned int)mxGetScalar(prhs[1]);
+    if (ndim == 3 && connectivity != 6 && connectivity != 18 && connectivity != 26) {
+      mexErrMsgTxt("CONN must be 6, 18 or 26 for a 3D mask");
+    }
+    if (ndim == 2) {
+      if (connectivity == 6) {
+	connectivity = 4;
+      } else if (connectivity == 18 || connectivity == 26) {
+	connectivity = 8;
+      } else if (connectivity != 4 && connectivity != 8) {
+	mexErrMsgTxt("CONN must be 4 or 8 for a 2D mask");
+      }
+    }
+  }
+
+  // intensity image
+  const mxArray *im = NULL;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    im = prhs[2];
+    if (mxIsComplex(im) || mxIsSparse(im)) {
+      mexErrMsgTxt("IM must be a real full array");
+    }
+    if (mxGetNumberOfDimensions(im) != ndim) {
+      mexErrMsgTxt("IM must have the same size as BW");
+    }
+    for (mwSize d = 0; d < ndim; ++d) {
+      if (mxGetDimensions(im)[d] != dims[d]) {
+	mexErrMsgTxt("IM must have the same size as BW");
+      }
+    }
+  }
+
+  // minimum component size
+  double minSize = 0.0;
+  if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+    if (!mxIsDouble(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1
+	|| !(mxGetScalar(prhs[3]) >= 0.0)) {
+      mexErrMsgTxt("MINSIZE must be a non-negative scalar");
+    }
+    minSize = mxGetScalar(prhs[3]);
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+    if (!mxIsDouble(prhs[4]) || mxGetNumberOfElements(prhs[4]) != 1) {
+      mexErrMsgTxt("NUMTHREADS must be a scalar");
+    }
+    numThreads = (unsigned int)mxGetScalar(prhs[4]);
+  }
+
+  // while labelling, each voxel holds the index of another voxel + 1,
+  // and the most significant bit is used as a flag
+  if (mxGetNumberOfElements(bw) < ((size_t)1 << 31)) {
+    labelComponents<boost::uint32_t>(nlhs, plhs, bw, im, sz, connectivity, minSize,
+				     numThreads, mxUINT32_CLASS);
+  } else {
+    labelComponents<boost::uint64_t>(nlhs, plhs, bw, im, sz, connectivity, minSize,
+				     numThreads, mxUINT64_CLASS);
+  }
+
+}
@@ -0,0 +1,89 @@
+function [lab, stats] = bwlabel_stats(bw, conn, im, minsize, numthreads)
+% BWLABEL_STATS  Connected components of a 2D or 3D mask, with
+% per-component statistics
+%
+% [LAB, STATS] = bwlabel_stats(BW)
+%
+%   BW is a 2D or 3D segmentation mask of any numeric class or
+%   logical. Non-zero voxels are foreground.
+%
+%   LAB is an array with the size of BW, where the voxels of each
+%   connected component have value 1, 2, ..., and the background has
+%   value 0. Components are numbered in the same order as by
+%   bwconncomp(), i.e. by their first voxel. LAB is of class uint32,
+%   or uint64 if BW has 2^31 or more voxels.
+%
+%   STATS is a struct with the statistics of each component, computed
+%   while labelling, instead of from the lists of voxel indices given
+%   by bwconncomp(). Indices are 1-based (row, column, slice), and
+%   only row and column are given for 2D masks. N is the number of
+%   components and D=2 or D=3 the number of dimensions:
+%
+%     Connectivity: connectivity used for labelling
+%     ImageSize:    size of BW
+%     NumObjects:   number of components, N
+%     NVox:         (1, N)-vector with the number of voxels
+%     BoxMin:       (D, N)-matrix with the first index of the
+%                   bounding box
+%     BoxMax:       (D, N)-matrix with the last index of the
+%                   bounding box
+%     Centroid:     (D, N)-matrix with the mean index
+%     Cov:          (D, D, N)-array with the covariance matrices
+%                   (second central moments, normalised by NVox) of
+%                   the indices
+%
+% [LAB, STATS] = bwlabel_stats(BW, CONN, IM, MINSIZE, NUMTHREADS)
+%
+%   CONN is the connectivity, 6, 18 or 26 for 3D masks, and 4 or 8
+%   for 2D masks (6 means 4, and 18 or 26 mean 8). By default,
+%   CONN=26 in 3D and CONN=8 in 2D.
+%
+%   IM is an intensity image with the size of BW, of any numeric
+%   class or logical. If it's given, STATS has two more fields:
+%
+%     IntensitySum:   (1, N)-vector with the sum of IM
+%     IntensitySumSq: (1, N)-vector with the sum of IM.^2
+%
+%   so that e.g. the mean intensity is STATS.IntensitySum./STATS.NVox.
+%   By default, IM=[].
+%
+%   MINSIZE is a scalar. Components with fewer than MINSIZE voxels are
+%   deleted from LAB and STATS, and the remaining ones renumbered
+%   consecutively. By default, MINSIZE=0.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+%   the number of processing cores.
+%
+% See also: bwrmsmallcomp, bwconncomp, regionprops.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
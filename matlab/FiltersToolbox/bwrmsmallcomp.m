@@ -14,10 +14,12 @@ function bw = bwrmsmallcomp(bw, nobj)
 %   BW2 is a binary segmentation with the same size as BW, but where all
 %   connected components except for the NOBJ largest ones have been
 %   removed.
+%
+% See also: bwlabel_stats.
 
 % Author: Ramon Casero <rcasero@gmail.com>
 % Copyright © 2012 University of Oxford
-% Version: 0.1.3
+% Version: 0.2.0
 % $Rev$
 % $Date$
 % 
@@ -53,6 +55,23 @@ if (nargin < 2 || isempty(nobj))
     nobj = 1;
 end
 
+% if the MEX function is available, label the components without
+% creating the lists of voxel indices of bwconncomp(), that need a lot
+% of memory for large images
+if (exist('bwlabel_stats', 'file') == 3)
+    
+    [lab, stats] = bwlabel_stats(bw);
+    
+    % keep the NOBJ largest components
+    [~, idx] = sort(stats.NVox, 2, 'descend');
+    keep = false(1, stats.NumObjects + 1);
+    keep(idx(1:min(nobj, end)) + 1) = true;
+    bw(:) = keep(lab + 1);
+    
+    return
+    
+end
+
 % get connected components
 cc = bwconncomp(bw);
 
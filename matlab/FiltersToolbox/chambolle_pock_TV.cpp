@@ -0,0 +1,231 @@
+/*
+ * chambolle_pock_TV.cpp
+ *
+ * CHAMBOLLE_POCK_TV  Total variation denoising or deconvolution of a 2D
+ * or 3D image with the primal-dual algorithm of Chambolle and Pock
+ *
+ * U = chambolle_pock_TV(F, LAMBDA)
+ *
+ *   F is a 2D or 3D image of class double or single.
+ *
+ *   LAMBDA is a scalar with the weight of the total variation term.
+ *
+ *   U is the solution of the TV denoising problem
+ *
+ *     min_U 1/2 ||U - F||^2 + LAMBDA * TV(U)
+ *
+ *   with the same size and class as F. TV(U) is computed with the
+ *   finite differences of forward_TV() (3D images) or forward_TV_2D()
+ *   (2D images).
+ *
+ * U = chambolle_pock_TV(F, LAMBDA, PSF, MAXITER, TOL, NCHECK, TVTYPE, NUMTHREADS)
+ *
+ *   PSF is a 2D or 3D array with the point spread function of the
+ *   blur. If provided, U is the solution of the TV deconvolution
+ *   problem
+ *
+ *     min_U 1/2 ||conv(U, PSF) - F||^2 + LAMBDA * TV(U)
+ *
+ *   where conv() is the convolution with zero boundary conditions,
+ *   and output of the same size as the input (convn(U, PSF, 'same')).
+ *   By default, PSF=[] and the problem is TV denoising.
+ *
+ *   MAXITER is the maximum number of iterations. By default,
+ *   MAXITER=100.
+ *
+ *   TOL is the stopping tolerance. The solver stops when the relative
+ *   change ||U_new - U|| / ||U_new|| in one iteration is smaller than
+ *   TOL. By default, TOL=1e-4.
+ *
+ *   NCHECK is the number of iterations between convergence checks. By
+ *   default, NCHECK=10.
+ *
+ *   TVTYPE is a string with the type of total variation:
+ *
+ *     'aniso' (default): sum(|Dx|+|Dy|+|Dz|), as in forward_TV().
+ *
+ *     'iso': sum(sqrt(Dx.^2+Dy.^2+Dz.^2)).
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * [U, NITER, CHANGE] = chambolle_pock_TV(...)
+ *
+ *   NITER is the number of iterations run.
+ *
+ *   CHANGE is the relative change of U in the last convergence check.
+ *
+ * See also: forward_TV, inverse_TV, forward_TV_2D, inverse_TV_2D.
+ */
+
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <string>
+
+/* Gerardus headers */
+#include "TotalVariationSolver.h"
+
+// read a non-negative scalar from a Matlab input, or return its
+// default value if the input is empty or not provided
+static double readScalar(int nrhs, const mxArray *prhs[], int pos,
+			 double def, const char *name) {
+  if (nrhs <= pos || mxIsEmpty(prhs[pos])) {
+    return def;
+  }
+  if (!mxIsNumeric(prhs[pos]) || mxGetNumberOfElements(prhs[pos]) != 1) {
+    mexErrMsgTxt((std::string(name) + " must be a scalar").c_str());
+  }
+  double v = mxGetScalar(prhs[pos]);
+  if (!(v >= 0.0)) {
+    mexErrMsgTxt((std::string(name) + " must be non-negative").c_str());
+  }
+  return v;
+}
+
+template <class T>
+void runSolver(const mxArray *f, const size_t *sz, double lambda, bool isotropic,
+	       const mxArray *psf, unsigned int maxIter, double tol,
+	       unsigned int nCheck, unsigned int numThreads, mxArray *u,
+	       unsigned int &nIter, double &change) {
+
+  ChambollePockTV<T> solver((const T *)mxGetData(f), sz, lambda, isotropic,
+			    numThreads);
+  if (psf != NULL) {
+    mwSize ndim = mxGetNumberOfDimensions(psf);
+    const mwSize *dims = mxGetDimensions(psf);
+    size_t hsz[3];
+    hsz[0] = dims[0];
+    hsz[1] = dims[1];
+    hsz[2] = (ndim == 3) ? dims[2] : 1;
+    solver.SetPointSpreadFunction(mxGetPr(psf), hsz);
+  }
+
+  // the initial guess is the observed image
+  T *pu = (T *)mxGetData(u);
+  const T *pf = (const T *)mxGetData(f);
+  std::copy(pf, pf + sz[0] * sz[1] * sz[2], pu);
+
+  solver.Run(pu, maxIter, tol, nCheck);
+  nIter = solver.GetNumberOfIterations();
+  change = solver.GetRelativeChange();
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check number of arguments
+  if (nrhs < 2 || nrhs > 8) {
+    mexErrMsgTxt("Between two and eight input arguments required");
+  }
+  if (nlhs > 3) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+
+  // observed image
+  const mxArray *f = prhs[0];
+  if ((!mxIsDouble(f) && !mxIsSingle(f)) || mxIsComplex(f)) {
+    mexErrMsgTxt("F must be real, of class double or single");
+  }
+  mwSize ndim = mxGetNumberOfDimensions(f);
+  if (ndim > 3) {
+    mexErrMsgTxt("F must be a 2D or 3D image");
+  }
+  const mwSize *dims = mxGetDimensions(f);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // parameters
+  double lambda = readScalar(nrhs, prhs, 1, 0.0, "LAMBDA");
+  const mxArray *psf = NULL;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    psf = prhs[2];
+    if (!mxIsDouble(psf) || mxIsComplex(psf)
+	|| mxGetNumberOfDimensions(psf) > 3) {
+      mexErrMsgTxt("PSF must be a real 2D or 3D array of class double");
+    }
+    if (ndim < 3 && mxGetNumberOfDimensions(psf) == 3) {
+      mexErrMsgTxt("PSF must be 2D for 2D images");
+    }
+  }
+  unsigned int maxIter = (unsigned int)readScalar(nrhs, prhs, 3, 100.0, "MAXITER");
+  double tol = readScalar(nrhs, prhs, 4, 1e-4, "TOL");
+  unsigned int nCheck = (unsigned int)readScalar(nrhs, prhs, 5, 10.0, "NCHECK");
+  bool isotropic = false;
+  if (nrhs > 6 && !mxIsEmpty(prhs[6])) {
+    if (!mxIsChar(prhs[6])) {
+      mexErrMsgTxt("TVTYPE must be a string");
+    }
+    char *buf = mxArrayToString(prhs[6]);
+    std::string tvType(buf);
+    mxFree(buf);
+    if (tvType == "iso") {
+      isotropic = true;
+    } else if (tvType != "aniso") {
+      mexErrMsgTxt("TVTYPE must be 'aniso' or 'iso'");
+    }
+  }
+  unsigned int numThreads = (unsigned int)readScalar(nrhs, prhs, 7, 0.0, "NUMTHREADS");
+
+  // output
+  plhs[0] = mxCreateNumericArray(ndim, dims, mxGetClassID(f), mxREAL);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+
+  unsigned int nIter = 0;
+  double change = 0.0;
+  if (!mxIsEmpty(f)) {
+    if (mxIsDouble(f)) {
+      runSolver<double>(f, sz, lambda, isotropic, psf, maxIter, tol, nCheck,
+			numThreads, plhs[0], nIter, change);
+    } else {
+      runSolver<float>(f, sz, lambda, isotropic, psf, maxIter, tol, nCheck,
+		       numThreads, plhs[0], nIter, change);
+    }
+  }
+
+  if (nlhs > 1) {
+    plhs[1] = mxCreateDoubleScalar((double)nIter);
+  }
+  if (nlhs > 2) {
+    plhs[2] = mxCreateDoubleScalar(change);
+  }
+
+}
@@ -0,0 +1,88 @@
+function [u, niter, change] = chambolle_pock_TV(f, lambda, psf, maxiter, tol, ncheck, tvtype, numthreads)
+% CHAMBOLLE_POCK_TV  Total variation denoising or deconvolution of a 2D
+% or 3D image with the primal-dual algorithm of Chambolle and Pock
+%
+% U = chambolle_pock_TV(F, LAMBDA)
+%
+%   F is a 2D or 3D image of class double or single.
+%
+%   LAMBDA is a scalar with the weight of the total variation term.
+%
+%   U is the solution of the TV denoising problem
+%
+%     min_U 1/2 ||U - F||^2 + LAMBDA * TV(U)
+%
+%   with the same size and class as F. TV(U) is computed with the
+%   finite differences of forward_TV() (3D images) or forward_TV_2D()
+%   (2D images).
+%
+% U = chambolle_pock_TV(F, LAMBDA, PSF, MAXITER, TOL, NCHECK, TVTYPE, NUMTHREADS)
+%
+%   PSF is a 2D or 3D array with the point spread function of the
+%   blur. If provided, U is the solution of the TV deconvolution
+%   problem
+%
+%     min_U 1/2 ||conv(U, PSF) - F||^2 + LAMBDA * TV(U)
+%
+%   where conv() is the convolution with zero boundary conditions,
+%   and output of the same size as the input (convn(U, PSF, 'same')).
+%   By default, PSF=[] and the problem is TV denoising.
+%
+%   MAXITER is the maximum number of iterations. By default,
+%   MAXITER=100.
+%
+%   TOL is the stopping tolerance. The solver stops when the relative
+%   change ||U_new - U|| / ||U_new|| in one iteration is smaller than
+%   TOL. By default, TOL=1e-4.
+%
+%   NCHECK is the number of iterations between convergence checks. By
+%   default, NCHECK=10.
+%
+%   TVTYPE is a string with the type of total variation:
+%
+%     'aniso' (default): sum(|Dx|+|Dy|+|Dz|), as in forward_TV().
+%
+%     'iso': sum(sqrt(Dx.^2+Dy.^2+Dz.^2)).
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% [U, NITER, CHANGE] = chambolle_pock_TV(...)
+%
+%   NITER is the number of iterations run.
+%
+%   CHANGE is the relative change of U in the last convergence check.
+%
+% See also: forward_TV, inverse_TV, forward_TV_2D, inverse_TV_2D.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -15,8 +15,8 @@ function [ TV, TV_grad ] = forward_TV( I )
 
 
 % Author: Darryl McClymont <darryl.mcclymont@gmail.com>
-% Copyright  2014 University of Oxford
-% Version: 0.1.2
+% Copyright  2014-2015 University of Oxford
+% Version: 0.1.5
 % $Rev$
 % $Date$
 % 
@@ -49,13 +49,27 @@ nargoutchk(0, 2);
 
 
 % Let mex do the work for you
-if exist('forward_TV_aux', 'file')
-    [Dx, Dy, Dz, TV] = forward_TV_aux(double(I), 1);  
+if ((exist('forward_TV_mex', 'file') == 3) && (ndims(I) == 3))
+    
+    % single precision images are processed without conversion, and the
+    % derivatives are returned already concatenated
+    if ~isa(I, 'single')
+        I = double(I);
+    end
+    [TV, TV_grad] = forward_TV_mex(I);
+    return
+    
+elseif exist('forward_TV_aux', 'file')
+    % single precision images are processed without conversion
+    if ~isa(I, 'single')
+        I = double(I);
+    end
+    [Dx, Dy, Dz, TV] = forward_TV_aux(I, 1);  
 else
     
     disp('Please compile the forward total variation transform for increased speed.')
-    disp('Just find the file forward_TV_aux.cpp and type:')
-    disp('mex forward_TV_aux.cpp')
+    disp('forward_TV_aux.cpp is built with the rest of the Gerardus MEX files')
+    disp('(it needs the Boost thread library)')
     
     
     % This is the equivalent to the above mex function in Matlab, but the
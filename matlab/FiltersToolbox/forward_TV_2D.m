@@ -9,8 +9,8 @@ function [ TV, TV_grad ] = forward_TV_2D( I )
 
 
 % Author: Darryl McClymont <darryl.mcclymont@gmail.com>
-% Copyright  2014 University of Oxford
-% Version: 0.1.1
+% Copyright  2014-2015 University of Oxford
+% Version: 0.1.3
 % $Rev$
 % $Date$
 % 
@@ -41,6 +41,13 @@ function [ TV, TV_grad ] = forward_TV_2D( I )
 narginchk(1,1);
 nargoutchk(0, 2);
 
+% Let mex do the work for you. The MEX function returns the same class
+% as the input, so other classes use the Matlab code
+if ((exist('forward_TV_mex', 'file') == 3) && isfloat(I) && isreal(I))
+    [TV, TV_grad] = forward_TV_mex(I);
+    return
+end
+
 Dx = I([2:end,end],:) - I;
 Dy = I(:,[2:end,end]) - I;
 
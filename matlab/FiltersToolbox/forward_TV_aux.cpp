@@ -3,11 +3,28 @@
  *
  * FORWARD_TV_aux Total variation of a 3D image
  *   This function should only be called by forward_TV.m
+ *
+ * [DX, DY, DZ, TV] = forward_TV_aux(I, ~)
+ *
+ *   I is a 2D or 3D real image, of class double or single.
+ *
+ *   DX, DY, DZ are the forward finite differences in the row, column
+ *   and slice directions, with the same size and class as I. They
+ *   are zero in the last row, column and slice, respectively.
+ *
+ *   TV is the total variation sum(|DX|+|DY|+|DZ|), a scalar of class
+ *   double.
+ *
+ *   The second input argument is ignored, and kept for backwards
+ *   compatibility.
+ *
+ *   The differences and the TV sum are computed in one multithreaded
+ *   pass over the image (see TotalVariationEngine.h).
  
  
  * Author: Darryl McClymont <darryl.mcclymont@gmail.com>
- * Copyright  2014 University of Oxford
- * Version: 0.1.1
+ * Copyright  2014-2015 University of Oxford
+ * Version: 0.2.0
  * $Rev$
  * $Date$
  * 
@@ -35,106 +52,61 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <cmath> 
-//#include <vector> 
-#include <mex.h> 
-#include <math.h> 
-using namespace std; 
+/* mex headers */
+#include <mex.h>
 
+/* Gerardus headers */
+#include "TotalVariationEngine.h"
+
+template <class T>
+double runForwardTV(const mxArray *im, const size_t *sz, mxArray *plhs[])
+{
+    return tvGradient((const T *)mxGetData(im), sz,
+                      (T *)mxGetData(plhs[0]), (T *)mxGetData(plhs[1]),
+                      (T *)mxGetData(plhs[2]));
+}
 
-  
 // Main function 
 void mexFunction( int nlhs, mxArray *plhs[], 
                   int nrhs, const mxArray *prhs[] ) 
 { 
-    double *INPUT, *DX, *DY, *DZ, *TV; 
-    mwSize     ndim, ndim_zero; 
-    const mwSize *dims, *dims_zero; 
-  
-  
-    /* The input must be a noncomplex scalar double.*/
-    ndim = mxGetNumberOfDimensions(prhs[0]);   
-    dims = mxGetDimensions(prhs[0]); 
-  
-    
-    // I couldn't work out how to get a single value output, so I'm just using the second input argument!
-    ndim_zero = mxGetNumberOfDimensions(prhs[1]);   
-    dims_zero = mxGetDimensions(prhs[1]); 
-    
-    /* Create matrices for the return arguments. */
-    plhs[0] = mxCreateNumericArray(ndim, dims, mxDOUBLE_CLASS, mxREAL); 
-    plhs[1] = mxCreateNumericArray(ndim, dims, mxDOUBLE_CLASS, mxREAL); 
-    plhs[2] = mxCreateNumericArray(ndim, dims, mxDOUBLE_CLASS, mxREAL); 
-    plhs[3] = mxCreateNumericArray(ndim_zero, dims_zero, mxDOUBLE_CLASS, mxREAL); 
-  
-    /* Assign pointers to each input and output. */
-    DX = mxGetPr(plhs[0]); 
-    DY = mxGetPr(plhs[1]); 
-    DZ = mxGetPr(plhs[2]); 
-    TV = mxGetPr(plhs[3]);
-    INPUT = mxGetPr(prhs[0]); 
-  
-    
-    int dim0 = (int)dims[0];
-    int dim1 = (int)dims[1];
-    int dim2 = (int)dims[2];
-    
-
-    
-    int numel = dim0*dim1*dim2;
-    
-    
-    // I had an implementation with lots of calls to sub2ind, but it was far too slow
-    
-    
-    // Finite differences in the row dimension
-    for (int i = 0; i < numel - 1; i++) 
-    {  
-        DX[i] = INPUT[i+1] - INPUT[i];
+    // check arguments
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgTxt("One or two input arguments required");
     }
-
-    // Column dimension
-    for (int i = 0; i < numel - dim0; i++) 
-    {  
-        DY[i] = INPUT[i + dim0] - INPUT[i];
+    if (nlhs > 4) {
+        mexErrMsgTxt("Too many output arguments");
     }
-    
-    // Slice dimension
-    for (int i = 0; i < numel - dim0*dim1; i++) 
-    {  
-        DZ[i] = INPUT[i + dim0*dim1] - INPUT[i];
+    if ((!mxIsDouble(prhs[0]) && !mxIsSingle(prhs[0])) || mxIsComplex(prhs[0])) {
+        mexErrMsgTxt("Input image must be real, of class double or single");
     }
-    
-    // Due to the indexing, the last row and column have values, but they should be zeros
-    // DZ is fine though - the last slice is already zeros
-
-    // fill the last row with zeros
-    for (int i = dim0-1; i < numel; i+= dim0) 
-    {  
-        DX[i] = 0;
+    mwSize ndim = mxGetNumberOfDimensions(prhs[0]);
+    if (ndim > 3) {
+        mexErrMsgTxt("Input image must be 2D or 3D");
     }
-    
-    // do the same with the last column - this one is a bit trickier with the indexing
-    int base_i = dim0 * (dim1-1);
-    int k_index = 0;
-    for (int k = 0; k < dim2; k++) 
-    {  
-        k_index = k * dim0 * dim1;
-        for (int i = 0; i < dims[0]; i++)
-        {
-            // k index gets the slice, base_i gets us to the first row of the final column, and i gets us the rest of the way
-            DY[k_index + base_i + i] = 0;
-        }
+    const mwSize *dims = mxGetDimensions(prhs[0]);
+    mxClassID classId = mxGetClassID(prhs[0]);
+
+    // image size, with 64-bit indices
+    size_t sz[3];
+    sz[0] = dims[0];
+    sz[1] = dims[1];
+    sz[2] = (ndim == 3) ? dims[2] : 1;
+
+    /* Create matrices for the return arguments. */
+    plhs[0] = mxCreateNumericArray(ndim, dims, classId, mxREAL); 
+    plhs[1] = mxCreateNumericArray(ndim, dims, classId, mxREAL); 
+    plhs[2] = mxCreateNumericArray(ndim, dims, classId, mxREAL); 
+    if (plhs[0] == NULL || plhs[1] == NULL || plhs[2] == NULL) {
+        mexErrMsgTxt("Not enough memory for output");
     }
-   
-    
-     // add them up to get the total variation
-    double TV_adder = 0;
-    
-    for (int i = 0; i < numel; i++) 
-    {  
-       TV_adder+= abs(DX[i])+abs(DY[i])+abs(DZ[i]);
+
+    // finite differences and total variation in a single pass
+    double tv;
+    if (classId == mxDOUBLE_CLASS) {
+        tv = runForwardTV<double>(prhs[0], sz, plhs);
+    } else {
+        tv = runForwardTV<float>(prhs[0], sz, plhs);
     }
-        
-    TV[0] = TV_adder;
-}
\ No newline at end of file
+    plhs[3] = mxCreateDoubleScalar(tv);
+}
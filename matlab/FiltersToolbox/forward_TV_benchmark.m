@@ -0,0 +1,187 @@
+function t = forward_TV_benchmark(sz, nrep)
+% FORWARD_TV_BENCHMARK  Micro-benchmark of the total variation operators
+%
+% T = forward_TV_benchmark
+%
+%   Time the Matlab implementation of forward_TV() and inverse_TV()
+%   against MEX functions forward_TV_mex() and inverse_TV_aux(), in
+%   double and single precision, on a random image. Results are printed
+%   on the screen.
+%
+%   T is a struct with the mean time in seconds of each implementation:
+%
+%     T.matlab:         forward differences and TV in Matlab code
+%     T.forward_TV:     forward_TV(), using whichever MEX file is available
+%     T.mex_double:     forward_TV_mex(), double image
+%     T.mex_single:     forward_TV_mex(), single image
+%     T.adj_matlab:     adjoint in Matlab code (as inverse_TV())
+%     T.adj_mex_double: inverse_TV_aux(), double
+%     T.adj_mex_single: inverse_TV_aux(), single
+%
+%   The function also checks that the MEX and Matlab results agree.
+%
+% T = forward_TV_benchmark(SZ, NREP)
+%
+%   SZ is the image size. By default, SZ=[256 256 256].
+%
+%   NREP is the number of repetitions of each operator. By default,
+%   NREP=10.
+%
+% See also: forward_TV, inverse_TV, forward_TV_mex, inverse_TV_aux.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.1
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+% check arguments
+narginchk(0, 2);
+nargoutchk(0, 1);
+
+% defaults
+if (nargin < 1 || isempty(sz))
+    sz = [256 256 256];
+end
+if (nargin < 2 || isempty(nrep))
+    nrep = 10;
+end
+if (length(sz) ~= 3)
+    error('SZ must be a 3-vector')
+end
+if (exist('forward_TV_mex', 'file') ~= 3)
+    error('MEX function forward_TV_mex not found')
+end
+if (exist('inverse_TV_aux', 'file') ~= 3)
+    error('MEX function inverse_TV_aux not found')
+end
+
+% random test image
+im = rand(sz);
+ims = single(im);
+
+% forward operator, Matlab code
+tic
+for I = 1:nrep
+    [tv0, g0] = matlab_forward(im);
+end
+t.matlab = toc / nrep;
+
+% forward_TV()
+tic
+for I = 1:nrep
+    [~, ~] = forward_TV(im);
+end
+t.forward_TV = toc / nrep;
+
+% forward operator, MEX
+tic
+for I = 1:nrep
+    [tv1, g1] = forward_TV_mex(im);
+end
+t.mex_double = toc / nrep;
+tic
+for I = 1:nrep
+    [tv2, g2] = forward_TV_mex(ims);
+end
+t.mex_single = toc / nrep;
+
+% adjoint operator
+tic
+for I = 1:nrep
+    r0 = matlab_adjoint(g0);
+end
+t.adj_matlab = toc / nrep;
+tic
+for I = 1:nrep
+    r1 = inverse_TV_aux(g1);
+end
+t.adj_mex_double = toc / nrep;
+tic
+for I = 1:nrep
+    r2 = inverse_TV_aux(g2);
+end
+t.adj_mex_single = toc / nrep;
+
+% check results
+if (abs(tv1 - tv0) > 1e-9 * tv0 || max(abs(g1(:) - g0(:))) > 1e-12 ...
+        || max(abs(r1(:) - r0(:))) > 1e-12)
+    warning('MEX results in double precision differ from Matlab')
+end
+if (abs(double(tv2) - tv0) > 1e-4 * tv0 || max(abs(double(r2(:)) - r0(:))) > 1e-5)
+    warning('MEX results in single precision differ from Matlab')
+end
+
+% print results
+fprintf('Image size: [%d %d %d], %d repetitions\n', sz, nrep)
+fprintf('Forward operator:\n')
+fprintf('  Matlab code:            %8.4f s\n', t.matlab)
+fprintf('  forward_TV():           %8.4f s\n', t.forward_TV)
+fprintf('  forward_TV_mex, double: %8.4f s (%.1fx)\n', ...
+    t.mex_double, t.matlab / t.mex_double)
+fprintf('  forward_TV_mex, single: %8.4f s (%.1fx)\n', ...
+    t.mex_single, t.matlab / t.mex_single)
+fprintf('Adjoint operator:\n')
+fprintf('  Matlab code:            %8.4f s\n', t.adj_matlab)
+fprintf('  inverse_TV_aux, double: %8.4f s (%.1fx)\n', ...
+    t.adj_mex_double, t.adj_matlab / t.adj_mex_double)
+fprintf('  inverse_TV_aux, single: %8.4f s (%.1fx)\n', ...
+    t.adj_mex_single, t.adj_matlab / t.adj_mex_single)
+
+end
+
+% matlab_forward(): Matlab implementation of forward_TV()
+function [TV, TV_grad] = matlab_forward(I)
+
+Dx = I([2:end,end],:,:) - I;
+Dy = I(:,[2:end,end],:) - I;
+Dz = I(:,:,[2:end,end]) - I;
+TV = sum(abs(Dx(:)) + abs(Dy(:)) + abs(Dz(:)));
+TV_grad = cat(4,Dx,Dy,Dz);
+
+end
+
+% matlab_adjoint(): Matlab implementation of inverse_TV()
+function res = matlab_adjoint(y)
+
+x = y(:,:,:,1);
+res = x([1,1:end-1],:,:) - x;
+res(1,:,:) = -x(1,:,:);
+res(end,:,:) = x(end-1,:,:);
+
+x = y(:,:,:,2);
+aux = x(:,[1,1:end-1],:) - x;
+aux(:,1,:) = -x(:,1,:);
+aux(:,end,:) = x(:,end-1,:);
+res = res + aux;
+
+x = y(:,:,:,3);
+aux = x(:,:,[1,1:end-1]) - x;
+aux(:,:,1) = -x(:,:,1);
+aux(:,:,end) = x(:,:,end-1);
+res = res + aux;
+
+end
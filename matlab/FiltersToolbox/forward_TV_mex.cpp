@@ -0,0 +1,146 @@
+/*
+ * forward_TV_mex.cpp
+ *
+ * FORWARD_TV_MEX  Total variation operator of a 2D or 3D image
+ *
+ * [TV, G] = forward_TV_mex(I)
+ * [TV, G] = forward_TV_mex(I, TVTYPE)
+ *
+ *   I is a 2D or 3D real image, of class double or single.
+ *
+ *   TVTYPE is a string with the type of total variation:
+ *
+ *     'aniso' (default): TV = sum(|Dx|+|Dy|+|Dz|), as in forward_TV().
+ *
+ *     'iso': TV = sum(sqrt(Dx.^2+Dy.^2+Dz.^2)).
+ *
+ *   TV is a scalar with the total variation of I. It is accumulated
+ *   in double precision, and returned with the same class as I.
+ *
+ *   G has the forward differences Dx, Dy (and Dz for 3D images)
+ *   concatenated as in forward_TV(), i.e. G has size (R,C,S,3) for a
+ *   3D image, and (R,C,2) for a 2D image. The differences are zero on
+ *   the last row, column and slice. G has the same class as I, so
+ *   single precision images need half the memory and bandwidth.
+ *
+ * The operator runs in one multithreaded pass over the image, with
+ * 64-bit indices (see TotalVariationEngine.h). The adjoint is
+ * computed by inverse_TV_aux(), with the same engine.
+ *
+ * See also: forward_TV, inverse_TV, forward_TV_2D, inverse_TV_2D,
+ * forward_TV_benchmark.
+ */
+
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.2.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <string>
+
+/* Gerardus headers */
+#include "TotalVariationEngine.h"
+
+template <class T>
+double runForward(const mxArray *im, const size_t *sz, unsigned int ncomp,
+		  bool isotropic, mxArray *g) {
+  T *dx = (T *)mxGetData(g);
+  size_t nvox = sz[0] * sz[1] * sz[2];
+  return tvGradient((const T *)mxGetData(im), sz, dx, dx + nvox,
+		    (ncomp == 3) ? dx + 2 * nvox : (T *)NULL, isotropic);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 2) {
+    mexErrMsgTxt("One or two input arguments required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+
+  const mxArray *in = prhs[0];
+  if ((!mxIsDouble(in) && !mxIsSingle(in)) || mxIsComplex(in)) {
+    mexErrMsgTxt("Input array must be real, of class double or single");
+  }
+  mwSize ndim = mxGetNumberOfDimensions(in);
+  const mwSize *dims = mxGetDimensions(in);
+  mxClassID classId = mxGetClassID(in);
+
+  bool isotropic = false;
+  if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+    if (!mxIsChar(prhs[1])) {
+      mexErrMsgTxt("TVTYPE must be a string");
+    }
+    char *buf = mxArrayToString(prhs[1]);
+    std::string tvType(buf);
+    mxFree(buf);
+    if (tvType == "iso") {
+      isotropic = true;
+    } else if (tvType != "aniso") {
+      mexErrMsgTxt("TVTYPE must be 'aniso' or 'iso'");
+    }
+  }
+
+  // image size, and size of the concatenated differences
+  if (ndim > 3) {
+    mexErrMsgTxt("I must be a 2D or 3D image");
+  }
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+  unsigned int ncomp = (ndim == 3) ? 3 : 2;
+  mwSize gdims[4];
+  gdims[0] = sz[0];
+  gdims[1] = sz[1];
+  gdims[2] = (ncomp == 3) ? sz[2] : 2;
+  gdims[3] = 3;
+
+  plhs[1] = mxCreateNumericArray((ncomp == 3) ? 4 : 3, gdims, classId, mxREAL);
+  plhs[0] = mxCreateNumericMatrix(1, 1, classId, mxREAL);
+  if (plhs[0] == NULL || plhs[1] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  if (classId == mxDOUBLE_CLASS) {
+    *mxGetPr(plhs[0]) = runForward<double>(in, sz, ncomp, isotropic, plhs[1]);
+  } else {
+    *(float *)mxGetData(plhs[0])
+      = (float)runForward<float>(in, sz, ncomp, isotropic, plhs[1]);
+  }
+
+}
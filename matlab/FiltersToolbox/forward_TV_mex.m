@@ -0,0 +1,61 @@
+function [tv, g] = forward_TV_mex(im, tvtype)
+% FORWARD_TV_MEX  Total variation operator of a 2D or 3D image
+%
+% [TV, G] = forward_TV_mex(I)
+% [TV, G] = forward_TV_mex(I, TVTYPE)
+%
+%   I is a 2D or 3D real image, of class double or single.
+%
+%   TVTYPE is a string with the type of total variation:
+%
+%     'aniso' (default): TV = sum(|Dx|+|Dy|+|Dz|), as in forward_TV().
+%
+%     'iso': TV = sum(sqrt(Dx.^2+Dy.^2+Dz.^2)).
+%
+%   TV is a scalar with the total variation of I. It is accumulated
+%   in double precision, and returned with the same class as I.
+%
+%   G has the forward differences Dx, Dy (and Dz for 3D images)
+%   concatenated as in forward_TV(), i.e. G has size (R,C,S,3) for a
+%   3D image, and (R,C,2) for a 2D image. The differences are zero on
+%   the last row, column and slice. G has the same class as I, so
+%   single precision images need half the memory and bandwidth.
+%
+% The operator runs in one multithreaded pass over the image, with
+% 64-bit indices (see TotalVariationEngine.h). The adjoint is
+% computed by inverse_TV_aux(), with the same engine.
+%
+% See also: forward_TV, inverse_TV, forward_TV_2D, inverse_TV_2D,
+% forward_TV_benchmark.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.2.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -16,8 +16,8 @@ function [ res ] = inverse_TV_2D( y )
 %   them.
 
 % Author: Darryl McClymont <darryl.mcclymont@gmail.com>
-% Copyright  2014 University of Oxford
-% Version: 0.1.1
+% Copyright  2014-2015 University of Oxford
+% Version: 0.1.3
 % $Rev$
 % $Date$
 % 
@@ -48,7 +48,12 @@ function [ res ] = inverse_TV_2D( y )
 narginchk(1,1);
 nargoutchk(0, 1);
 
-res = adjDx(y(:,:,1)) + adjDy(y(:,:,2));
+% Let mex do the work for you
+if (exist('inverse_TV_aux', 'file') == 3)
+    res = inverse_TV_aux(y);
+else
+    res = adjDx(y(:,:,1)) + adjDy(y(:,:,2));
+end
 
 
 end
@@ -0,0 +1,112 @@
+/*
+ * inverse_TV_aux.cpp
+ *
+ * INVERSE_TV_aux Adjoint of the finite differences of forward_TV
+ *   This function should only be called by inverse_TV.m and
+ *   inverse_TV_2D.m
+ *
+ * RES = inverse_TV_aux(Y)
+ *
+ *   Y is an array of class double or single with the concatenated
+ *   partial derivatives, as returned by forward_TV() (size (R,C,S,3))
+ *   or forward_TV_2D() (size (R,C,2)).
+ *
+ *   RES has size (R,C,S) or (R,C), and the same class as Y. RES is
+ *   the adjoint of the forward differences applied to Y, i.e.
+ *   adjDx(Dx)+adjDy(Dy)+adjDz(Dz) in inverse_TV.m, computed in one
+ *   multithreaded pass (see TotalVariationEngine.h).
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* Gerardus headers */
+#include "TotalVariationEngine.h"
+
+template <class T>
+void runInverseTV(const mxArray *y, const size_t *sz, size_t ncomp, mxArray *res) {
+  const T *dx = (const T *)mxGetData(y);
+  size_t nvox = sz[0] * sz[1] * sz[2];
+  tvAdjoint(dx, dx + nvox, (ncomp == 3) ? dx + 2 * nvox : (const T *)NULL,
+	    sz, (T *)mxGetData(res));
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs != 1) {
+    mexErrMsgTxt("One input argument required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  const mxArray *y = prhs[0];
+  if ((!mxIsDouble(y) && !mxIsSingle(y)) || mxIsComplex(y)) {
+    mexErrMsgTxt("Y must be real, of class double or single");
+  }
+
+  // Y is (R,C,S,3) for 3D images, and (R,C,2) for 2D images
+  mwSize ndim = mxGetNumberOfDimensions(y);
+  const mwSize *dims = mxGetDimensions(y);
+  size_t sz[3];
+  size_t ncomp = 0;
+  mwSize outDims[3];
+  if (ndim == 4 && dims[3] == 3) {
+    ncomp = 3;
+    sz[2] = dims[2];
+  } else if (ndim == 3 && dims[2] == 2) {
+    ncomp = 2;
+    sz[2] = 1;
+  } else {
+    mexErrMsgTxt("Y must have size (R,C,S,3) or (R,C,2)");
+  }
+  sz[0] = outDims[0] = dims[0];
+  sz[1] = outDims[1] = dims[1];
+  outDims[2] = sz[2];
+
+  plhs[0] = mxCreateNumericArray((ncomp == 3) ? 3 : 2, outDims,
+				 mxGetClassID(y), mxREAL);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+
+  if (mxIsDouble(y)) {
+    runInverseTV<double>(y, sz, ncomp, plhs[0]);
+  } else {
+    runInverseTV<float>(y, sz, ncomp, plhs[0]);
+  }
+
+}
@@ -36,11 +36,21 @@ function im = labmathmorph(type, im, param)
 % where NDIL, NERO are the radii to dilate and erode, respectively, in
 % voxel units.
 %
-% See also bwregiongrow
+% If MEX function labmathmorph_mex() is available, it is used instead of
+% the Matlab code. Each label is then processed only within its bounding
+% box, with the labels distributed over all processing cores, and the
+% structuring element is the same ball as in itk_imfilter(). When dilated
+% labels compete for a voxel, the voxel goes to the label that was
+% closest to it, or in case of a tie, to the label with the smallest
+% value. Thus, the result doesn't depend on the order in which labels are
+% processed, whereas with the Matlab code, labels processed first
+% prevail.
+%
+% See also bwregiongrow, labmathmorph_mex
 
 % Author: Ramon Casero <rcasero@gmail.com>
 % Copyright © 2011 University of Oxford
-% Version: 0.1.0
+% Version: 0.2.0
 % $Rev$
 % $Date$
 % 
@@ -116,6 +126,12 @@ switch type
         error('Operator type not implemented')
 end
 
+% use the MEX function if available
+if (exist('labmathmorph_mex', 'file') == 3)
+    im = labmathmorph_mex(type, im, param);
+    return
+end
+
 % get indices and labels of the segmented voxels
 idxlab = find(im);
 lab = nonzeros(im);
@@ -0,0 +1,205 @@
+/*
+ * labmathmorph_mex.cpp
+ *
+ * LABMATHMORPH_MEX  Auxiliary function for labmathmorph(). Native
+ * mathematical morphology operators on a labelled segmentation, one
+ * label at a time
+ *
+ * IM2 = labmathmorph_mex(TYPE, IM, PARAM, NUMTHREADS)
+ *
+ *   TYPE is a string with the operator name: 'dilate', 'erode',
+ *   'open' or 'close'.
+ *
+ *   IM is a 2D or 3D labelled segmentation of any numeric class or
+ *   logical. Voxels with value 0 are background.
+ *
+ *   PARAM is NDIL for 'dilate', NERO for 'erode', [NDIL NERO] for
+ *   'close' and [NERO NDIL] for 'open', where NDIL and NERO are the
+ *   radii of the dilation and erosion in voxels. Non-integer radii
+ *   are rounded down.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+ *   the number of processing cores.
+ *
+ *   IM2 has the same size and class as IM. The operator is applied to
+ *   each label independently, with a ball structuring element (the
+ *   same as itk_imfilter('bwdilate', ...)). Each label is processed
+ *   only within its bounding box, in parallel.
+ *
+ *   When dilated labels compete for a voxel, the voxel goes to the
+ *   label that was closest to it, or in case of a tie, to the label
+ *   with the smallest value. So voxels of a label are only taken by
+ *   another label if the operator removes them from their label.
+ *
+ * See also: labmathmorph, itk_imfilter.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+#include <string>
+
+/* Gerardus headers */
+#include "LabelMorphologyEngine.h"
+
+// apply the operator to the labels of im, with the voxels cast to
+// their type
+template <class T>
+void runLabelMorphology(const mxArray *im, mxArray *im2, const size_t *sz,
+			const std::string &type, const unsigned int *param,
+			unsigned int numThreads) {
+  typedef LabelMorphology<T> MorphologyType;
+  typename MorphologyType::Operation op = MorphologyType::Dilate;
+  if (type == "erode") {
+    op = MorphologyType::Erode;
+  } else if (type == "open") {
+    op = MorphologyType::Open;
+  } else if (type == "close") {
+    op = MorphologyType::Close;
+  }
+  MorphologyType morph(sz, numThreads);
+  morph.Run((const T *)mxGetData(im), (T *)mxGetData(im2), op, param[0], param[1]);
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 3 || nrhs > 4) {
+    mexErrMsgTxt("Three or four input arguments required");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  if (!mxIsChar(prhs[0])) {
+    mexErrMsgTxt("TYPE must be a string");
+  }
+  char *buf = mxArrayToString(prhs[0]);
+  std::string type(buf);
+  mxFree(buf);
+
+  // number of radii expected for each operator
+  size_t numParam;
+  if (type == "dilate" || type == "erode") {
+    numParam = 1;
+  } else if (type == "open" || type == "close") {
+    numParam = 2;
+  } else {
+    mexErrMsgTxt("Operator type not implemented");
+  }
+
+  const mxArray *im = prhs[1];
+  const mwSize ndim = mxGetNumberOfDimensions(im);
+  if (ndim > 3) {
+    mexErrMsgTxt("IM must be a 2D or 3D array");
+  }
+  if (mxIsComplex(im) || mxIsSparse(im)) {
+    mexErrMsgTxt("IM must be a real full array");
+  }
+  const mwSize *dims = mxGetDimensions(im);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // radii
+  if (!mxIsDouble(prhs[2]) || mxIsComplex(prhs[2])
+      || mxGetNumberOfElements(prhs[2]) != numParam) {
+    mexErrMsgTxt(numParam == 1 ? "PARAM must be a scalar for this operator"
+		 : "PARAM must be a 2-vector for this operator");
+  }
+  unsigned int param[2] = {0, 0};
+  for (size_t k = 0; k < numParam; ++k) {
+    const double v = mxGetPr(prhs[2])[k];
+    if (!(v >= 0.0) || mxIsInf(v)) {
+      mexErrMsgTxt("PARAM must be non-negative and finite");
+    }
+    param[k] = (unsigned int)std::floor(v);
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+    if (!mxIsDouble(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1) {
+      mexErrMsgTxt("NUMTHREADS must be a scalar");
+    }
+    numThreads = (unsigned int)mxGetScalar(prhs[3]);
+  }
+
+  plhs[0] = mxCreateNumericArray(ndim, dims, mxGetClassID(im), mxREAL);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  switch (mxGetClassID(im)) {
+  case mxDOUBLE_CLASS:
+    runLabelMorphology<double>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxSINGLE_CLASS:
+    runLabelMorphology<float>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxLOGICAL_CLASS:
+    runLabelMorphology<mxLogical>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxINT8_CLASS:
+    runLabelMorphology<int8_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxUINT8_CLASS:
+    runLabelMorphology<uint8_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxINT16_CLASS:
+    runLabelMorphology<int16_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxUINT16_CLASS:
+    runLabelMorphology<uint16_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxINT32_CLASS:
+    runLabelMorphology<int32_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxUINT32_CLASS:
+    runLabelMorphology<uint32_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxINT64_CLASS:
+    runLabelMorphology<int64_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  case mxUINT64_CLASS:
+    runLabelMorphology<uint64_T>(im, plhs[0], sz, type, param, numThreads);
+    break;
+  default:
+    mexErrMsgTxt("IM has an unsupported class");
+  }
+
+}
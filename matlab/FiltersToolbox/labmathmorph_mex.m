@@ -0,0 +1,64 @@
+function im2 = labmathmorph_mex(type, im, param, numthreads)
+% LABMATHMORPH_MEX  Auxiliary function for labmathmorph(). Native
+% mathematical morphology operators on a labelled segmentation, one
+% label at a time
+%
+% IM2 = labmathmorph_mex(TYPE, IM, PARAM, NUMTHREADS)
+%
+%   TYPE is a string with the operator name: 'dilate', 'erode',
+%   'open' or 'close'.
+%
+%   IM is a 2D or 3D labelled segmentation of any numeric class or
+%   logical. Voxels with value 0 are background.
+%
+%   PARAM is NDIL for 'dilate', NERO for 'erode', [NDIL NERO] for
+%   'close' and [NERO NDIL] for 'open', where NDIL and NERO are the
+%   radii of the dilation and erosion in voxels. Non-integer radii
+%   are rounded down.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+%   the number of processing cores.
+%
+%   IM2 has the same size and class as IM. The operator is applied to
+%   each label independently, with a ball structuring element (the
+%   same as itk_imfilter('bwdilate', ...)). Each label is processed
+%   only within its bounding box, in parallel.
+%
+%   When dilated labels compete for a voxel, the voxel goes to the
+%   label that was closest to it, or in case of a tie, to the label
+%   with the smallest value. So voxels of a label are only taken by
+%   another label if the operator removes them from their label.
+%
+% See also: labmathmorph, itk_imfilter.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
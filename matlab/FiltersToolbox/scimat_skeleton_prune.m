@@ -47,7 +47,7 @@ function scimatsk = scimat_skeleton_prune(scimatsk, scimat, minlen, lratio, alph
 
 % Author: Ramon Casero <rcasero@gmail.com>
 % Copyright © 2011, 2014 University of Oxford
-% Version: 0.5.1
+% Version: 0.6.0
 % $Rev$
 % $Date$
 % 
@@ -246,38 +246,48 @@ scimatsk.data = uint8(scimatsk.data ~= 0);
 scimatsk.data(cat(1, bifcc.PixelIdxList{:})) = 1;
 
 %% Step 2: pruning of very short leaf branches
-while (1)
+
+% if the MEX function is available, prune the graph of the skeleton
+% in place, instead of recomputing the labelling twice per iteration
+if (exist('skeleton_prune_mex', 'file') == 3)
+    scimatsk.data = skeleton_prune_mex(scimatsk.data, ...
+        [scimatsk.axis.spacing], minlen);
+else
+    
+    while (1)
     
-    % compute skeleton labelling
-    [~, cc] = skeleton_label(scimatsk.data, [], [scimatsk.axis.spacing]);
+        % compute skeleton labelling
+        [~, cc] = skeleton_label(scimatsk.data, [], [scimatsk.axis.spacing]);
    
-    % get number of voxels in each branch
-    n = cellfun(@(x) length(x), cc.PixelIdxList);
+        % get number of voxels in each branch
+        n = cellfun(@(x) length(x), cc.PixelIdxList);
     
-    % find leaf-branches that are shorter than the minimum length
-    idx1 = find(n < minlen & cc.IsLeaf);
+        % find leaf-branches that are shorter than the minimum length
+        idx1 = find(n < minlen & cc.IsLeaf);
     
-    % remove short branches from the segmentation
-    scimatsk.data(cat(1, cc.PixelIdxList{idx1})) = 0;
+        % remove short branches from the segmentation
+        scimatsk.data(cat(1, cc.PixelIdxList{idx1})) = 0;
     
-    % recompute the skeleton labelling
-    [~, ~, bifcc, mcon] = skeleton_label(scimatsk.data, [], [scimatsk.axis.spacing]);
+        % recompute the skeleton labelling
+        [~, ~, bifcc, mcon] = skeleton_label(scimatsk.data, [], [scimatsk.axis.spacing]);
    
-    % find bifurcation clusters that are connected to 0 or 1 branches
-    idx2 = find(sum(mcon, 1) < 2);
+        % find bifurcation clusters that are connected to 0 or 1 branches
+        idx2 = find(sum(mcon, 1) < 2);
     
-    % remove those bifurcation clumps, because they are not connecting
-    % branches, they are either floating alone in space, or terminating a
-    % branch
-    scimatsk.data(cat(1, bifcc.PixelIdxList{idx2})) = 0;
+        % remove those bifurcation clumps, because they are not connecting
+        % branches, they are either floating alone in space, or terminating a
+        % branch
+        scimatsk.data(cat(1, bifcc.PixelIdxList{idx2})) = 0;
     
-    % if no bifurcation clumps were found to be removed, stop the
-    % algorithm, because that means that no new short leaf-braches can be
-    % found either
-    if (isempty(idx2))
-        break;
-    end
+        % if no bifurcation clumps were found to be removed, stop the
+        % algorithm, because that means that no new short leaf-braches can be
+        % found either
+        if (isempty(idx2))
+            break;
+        end
     
+    end
+
 end
 
 
@@ -59,6 +59,10 @@ function [sk, cc, bifcc, mcon, madj, cc2, mmerge] = skeleton_label(sk, im, res,
 %   MADJ is a square sparse matrix where MADJ(7, 3)==10 means that branches
 %   7 and 3 and connected through the bifurcation clump 10.
 %
+%   If MEX function skeleton_label_mex() is available, this syntax is
+%   computed by the MEX function, that is much faster for large
+%   skeletons.
+%
 %
 % [LAB, ...] = skeleton_label(SK, IM, RES)
 %
@@ -119,11 +123,11 @@ function [sk, cc, bifcc, mcon, madj, cc2, mmerge] = skeleton_label(sk, im, res,
 %                      to create branch i
 %
 %
-% See also: skeleton_plot, scimat_skeleton_prune.
+% See also: skeleton_plot, scimat_skeleton_prune, skeleton_label_mex.
 
 % Author: Ramon Casero <rcasero@gmail.com>
 % Copyright © 2011, 2014 University of Oxford
-% Version: 0.15.6
+% Version: 0.16.0
 % $Rev$
 % $Date$
 % 
@@ -195,6 +199,14 @@ if (nnz(sk) == 0)
     return
 end
 
+% without merging or a full segmentation, the MEX function computes
+% the same labelling in one pass over the skeleton
+if (alphamax < 0 && isempty(im) && nargout <= 5 ...
+        && exist('skeleton_label_mex', 'file') == 3)
+    [sk, cc, bifcc, mcon, madj] = skeleton_label_mex(sk, res);
+    return
+end
+
 % get sparse matrix of distances between voxels. To label the skeleton we
 % don't care about the actual distances, just need to know which voxels are
 % connected to others. Actual distances are needed to parameterize the
@@ -371,6 +383,10 @@ end
 %% we need to compute this so that we can identify leaf branches
 %%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+% tag each branch with its label, so that we can tell which branches
+% touch each bifurcation clump
+sk = labelmatrix(cc);
+
 % create empty image volume and add only bifurcation voxels
 sk2 = zeros(size(sk), 'uint8');
 sk2(bifidx) = 1;
@@ -0,0 +1,80 @@
+function [lab, cc, bifcc, mcon, madj] = skeleton_label_mex(sk, res, numthreads)
+% SKELETON_LABEL_MEX  Auxiliary function for skeleton_label(). Native
+% labelling of the branches and bifurcation clumps of a skeleton
+%
+% [LAB, CC, BIFCC, MCON, MADJ] = skeleton_label_mex(SK, RES, NUMTHREADS)
+%
+%   SK is a 2D or 3D segmentation mask with a skeleton, i.e. 1 voxel
+%   thick branches connected between them. SK can be of any numeric
+%   class or logical.
+%
+%   RES is a 3-vector with the voxel size as [row, column, slice]. By
+%   default, RES=[1 1 1].
+%
+%   NUMTHREADS is the number of threads used to compute the voxel
+%   neighbourhoods and to sort the branches. By default, NUMTHREADS is
+%   the number of processing cores.
+%
+%   The outputs are the same as those of skeleton_label(SK, [], RES)
+%   without merging:
+%
+%   LAB is an image of the same size as SK with the label of the
+%   branch each skeleton voxel belongs to. Bifurcation voxels get the
+%   label of the nearest branch. LAB has the smallest of classes
+%   uint8, uint16, uint32 or double that can hold all the labels, as
+%   labelmatrix().
+%
+%   CC is a struct with fields Connectivity, ImageSize, NumObjects,
+%   PixelIdxList, PixelParam, IsLeaf, BranchLength and Degree. The
+%   voxels in each CC.PixelIdxList{i} are sorted from one end of the
+%   branch to the other, and CC.PixelParam{i} is their accumulated
+%   chord length.
+%
+%   BIFCC is a struct with fields Connectivity, ImageSize, NumObjects
+%   and PixelIdxList with the bifurcation clumps.
+%
+%   MCON is a sparse logical matrix, MCON(i, j)==true if branch i is
+%   connected to bifurcation clump j.
+%
+%   MADJ is a sparse matrix, MADJ(i, k)==j if branches i and k are
+%   connected through bifurcation clump j.
+%
+%   The skeleton is scanned once, so this function takes seconds
+%   where the Matlab code takes minutes for large skeletons (e.g. a
+%   whole coronary tree). A branch is a leaf if it's connected to at
+%   most one bifurcation clump. Ties between voxels at the same
+%   distance may be broken differently than in the Matlab code.
+%
+% See also: skeleton_label, scimat_skeleton_prune, seg2dmat.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
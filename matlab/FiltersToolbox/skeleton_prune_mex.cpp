@@ -0,0 +1,181 @@
+/*
+ * skeleton_prune_mex.cpp
+ *
+ * SKELETON_PRUNE_MEX  Auxiliary function for scimat_skeleton_prune().
+ * Native pruning of short leaves of a skeleton on its branch graph
+ *
+ * SK2 = skeleton_prune_mex(SK, RES, MINLEN, NUMTHREADS)
+ *
+ *   SK is a 2D or 3D segmentation mask with a skeleton, of any
+ *   numeric class or logical. See skeleton_label_mex() for details.
+ *
+ *   RES is a 3-vector with the voxel size as [row, column, slice]. By
+ *   default, RES=[1 1 1].
+ *
+ *   MINLEN is a scalar with the minimum number of voxels of a leaf.
+ *   By default, MINLEN=5.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+ *   the number of processing cores.
+ *
+ *   SK2 is SK with the pruned voxels set to 0. As in step 2 of
+ *   scimat_skeleton_prune(), leaves with fewer than MINLEN voxels are
+ *   removed, followed by the bifurcation clumps connected to fewer
+ *   than two branches, until no more clumps are removed.
+ *
+ *   The skeleton is labelled only once. Then, pruning works on the
+ *   branch graph: removing voxels updates the degree of their
+ *   neighbours, and only the branches and clumps around them are
+ *   decomposed again. Branches that meet at a clump that is no longer
+ *   a bifurcation are merged.
+ *
+ * [SK2, LAB, CC, BIFCC, MCON, MADJ] = skeleton_prune_mex(...)
+ *
+ *   The other outputs are the labelling of the pruned skeleton, with
+ *   the same format as the outputs of skeleton_label_mex().
+ *
+ * See also: scimat_skeleton_prune, skeleton_label_mex, skeleton_label.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+/* Gerardus headers */
+#include "SkeletonGraphEngine.h"
+
+// copy of the skeleton with the pruned voxels set to 0. Zero is a
+// zero bit pattern in all numeric classes, so only the element size
+// is needed
+mxArray *createPrunedSkeleton(const SkeletonGraph &graph, const mxArray *sk) {
+  mxArray *sk2 = mxDuplicateArray(sk);
+  if (sk2 == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  const size_t es = mxGetElementSize(sk2);
+  char *p = (char *)mxGetData(sk2);
+  const std::vector<size_t> &v = graph.GetRemovedVoxels();
+  for (size_t k = 0; k < v.size(); ++k) {
+    std::memset(p + v[k] * es, 0, es);
+  }
+  return sk2;
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // check arguments
+  if (nrhs < 1 || nrhs > 4) {
+    mexErrMsgTxt("One to four input arguments required");
+  }
+  if (nlhs > 6) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  const mxArray *sk = prhs[0];
+  const mwSize ndim = mxGetNumberOfDimensions(sk);
+  if (ndim > 3) {
+    mexErrMsgTxt("SK must be a 2D or 3D array");
+  }
+  if (mxIsComplex(sk) || mxIsSparse(sk)) {
+    mexErrMsgTxt("SK must be a real full array");
+  }
+  const mwSize *dims = mxGetDimensions(sk);
+  size_t sz[3];
+  sz[0] = dims[0];
+  sz[1] = dims[1];
+  sz[2] = (ndim == 3) ? dims[2] : 1;
+
+  // voxel size
+  double res[3] = {1.0, 1.0, 1.0};
+  if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+    if (!mxIsDouble(prhs[1]) || mxIsComplex(prhs[1])
+	|| mxGetNumberOfElements(prhs[1]) < 2 || mxGetNumberOfElements(prhs[1]) > 3) {
+      mexErrMsgTxt("RES must be a vector of type double with 2 or 3 elements");
+    }
+    for (size_t d = 0; d < mxGetNumberOfElements(prhs[1]); ++d) {
+      res[d] = mxGetPr(prhs[1])[d];
+      if (!(res[d] > 0.0) || mxIsInf(res[d])) {
+	mexErrMsgTxt("RES must be positive and finite");
+      }
+    }
+  }
+
+  // minimum leaf length
+  size_t minLength = 5;
+  if (nrhs > 2 && !mxIsEmpty(prhs[2])) {
+    if (!mxIsDouble(prhs[2]) || mxGetNumberOfElements(prhs[2]) != 1
+	|| !(mxGetScalar(prhs[2]) >= 0.0)) {
+      mexErrMsgTxt("MINLEN must be a non-negative scalar");
+    }
+    minLength = (size_t)std::ceil(mxGetScalar(prhs[2]));
+  }
+
+  // number of threads
+  unsigned int numThreads = 0;
+  if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+    if (!mxIsDouble(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1) {
+      mexErrMsgTxt("NUMTHREADS must be a scalar");
+    }
+    numThreads = (unsigned int)mxGetScalar(prhs[3]);
+  }
+
+  // extract the skeleton graph, and prune it
+  SkeletonGraph graph(sz, res, numThreads);
+  buildSkeletonGraph(graph, sk);
+  graph.Prune(minLength);
+
+  // outputs
+  plhs[0] = createPrunedSkeleton(graph, sk);
+  if (nlhs > 1) {
+    plhs[1] = createSkeletonLabels(graph, sk);
+  }
+  if (nlhs > 2) {
+    plhs[2] = createSkeletonBranchStruct(graph, sz);
+  }
+  if (nlhs > 3) {
+    plhs[3] = createSkeletonClumpStruct(graph, sz, ndim);
+  }
+  if (nlhs > 4) {
+    plhs[4] = createSkeletonConnectionMatrix(graph);
+  }
+  if (nlhs > 5) {
+    plhs[5] = createSkeletonAdjacencyMatrix(graph);
+  }
+
+}
@@ -0,0 +1,67 @@
+function [sk2, lab, cc, bifcc, mcon, madj] = skeleton_prune_mex(sk, res, minlen, numthreads)
+% SKELETON_PRUNE_MEX  Auxiliary function for scimat_skeleton_prune().
+% Native pruning of short leaves of a skeleton on its branch graph
+%
+% SK2 = skeleton_prune_mex(SK, RES, MINLEN, NUMTHREADS)
+%
+%   SK is a 2D or 3D segmentation mask with a skeleton, of any
+%   numeric class or logical. See skeleton_label_mex() for details.
+%
+%   RES is a 3-vector with the voxel size as [row, column, slice]. By
+%   default, RES=[1 1 1].
+%
+%   MINLEN is a scalar with the minimum number of voxels of a leaf.
+%   By default, MINLEN=5.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS is
+%   the number of processing cores.
+%
+%   SK2 is SK with the pruned voxels set to 0. As in step 2 of
+%   scimat_skeleton_prune(), leaves with fewer than MINLEN voxels are
+%   removed, followed by the bifurcation clumps connected to fewer
+%   than two branches, until no more clumps are removed.
+%
+%   The skeleton is labelled only once. Then, pruning works on the
+%   branch graph: removing voxels updates the degree of their
+%   neighbours, and only the branches and clumps around them are
+%   decomposed again. Branches that meet at a clump that is no longer
+%   a bifurcation are merged.
+%
+% [SK2, LAB, CC, BIFCC, MCON, MADJ] = skeleton_prune_mex(...)
+%
+%   The other outputs are the labelling of the pruned skeleton, with
+%   the same format as the outputs of skeleton_label_mex().
+%
+% See also: scimat_skeleton_prune, skeleton_label_mex, skeleton_label.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
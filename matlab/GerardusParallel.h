@@ -0,0 +1,302 @@
+/*
+ * GerardusParallel.h
+ *
+ * Minimal multithreading helpers shared by the MEX functions that run
+ * native (non-ITK, non-CGAL) loops over large arrays.
+ *
+ * The helpers are built on Boost.Thread, because Matlab already ships
+ * with the Boost libraries, and Gerardus links to them (see the Boost
+ * section in gerardus/CMakeLists.txt).
+ *
+ * Important: the MEX API is not thread-safe. Functors run by the
+ * functions in this file must not call any mx*() or mex*() function,
+ * including mexErrMsgTxt(). Instead, they can throw a
+ * std::exception. The exception is caught in the worker thread, and
+ * after all threads have been joined, the main thread terminates the
+ * MEX function with mexErrMsgTxt() and the message of the exception.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef GERARDUSPARALLEL_H
+#define GERARDUSPARALLEL_H
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <string>
+
+/* Boost headers */
+#include <boost/thread.hpp>
+
+/*
+ * getNumberOfThreads(): number of worker threads to use.
+ *
+ * requested: number of threads requested by the user. If 0, the
+ *            number of hardware threads is returned. The result is
+ *            always >= 1.
+ */
+inline
+unsigned int getNumberOfThreads(unsigned int requested = 0) {
+  if (requested > 0) {
+    return requested;
+  }
+  unsigned int n = boost::thread::hardware_concurrency();
+  return (n > 0) ? n : 1;
+}
+
+/*
+ * ParallelErrorState: error message reported by the first worker
+ * thread that throws an exception. Only used internally by the
+ * functions below.
+ */
+class ParallelErrorState {
+
+ public:
+
+  ParallelErrorState() : failed(false) {}
+
+  void Set(const std::string &msg) {
+    boost::mutex::scoped_lock lock(this->mutex);
+    if (!this->failed) {
+      this->failed = true;
+      this->message = msg;
+    }
+  }
+
+  bool HasFailed() {
+    boost::mutex::scoped_lock lock(this->mutex);
+    return this->failed;
+  }
+
+  // terminate the MEX function if any of the workers failed. This
+  // must be called from the main thread, after joining the workers
+  void ThrowIfFailed() {
+    if (this->failed) {
+      mexErrMsgTxt(this->message.c_str());
+    }
+  }
+
+ private:
+
+  boost::mutex mutex;
+  bool failed;
+  std::string message;
+
+};
+
+/*
+ * Worker that processes one fixed chunk of the range. Used by
+ * parallelFor().
+ */
+template <class TFunctor>
+class ParallelForStaticWorker {
+
+ public:
+
+  ParallelForStaticWorker(TFunctor &_f, size_t _begin, size_t _end,
+			  unsigned int _thread, ParallelErrorState &_error)
+    : f(_f), begin(_begin), end(_end), thread(_thread), error(_error) {}
+
+  void operator()() {
+    try {
+      this->f(this->begin, this->end, this->thread);
+    } catch (std::exception &e) {
+      this->error.Set(e.what());
+    } catch (...) {
+      this->error.Set("Unknown exception in worker thread");
+    }
+  }
+
+ private:
+
+  TFunctor &f;
+  size_t begin;
+  size_t end;
+  unsigned int thread;
+  ParallelErrorState &error;
+
+};
+
+/*
+ * Worker that keeps pulling chunks of the range from a shared counter
+ * until the range is exhausted. Used by parallelForDynamic().
+ */
+template <class TFunctor>
+class ParallelForDynamicWorker {
+
+ public:
+
+  ParallelForDynamicWorker(TFunctor &_f, size_t &_next, size_t _last, size_t _grain,
+			   boost::mutex &_mutex, unsigned int _thread,
+			   ParallelErrorState &_error)
+    : f(_f), next(_next), last(_last), grain(_grain), mutex(_mutex),
+      thread(_thread), error(_error) {}
+
+  void operator()() {
+    try {
+      for (;;) {
+	size_t begin, end;
+	{
+	  boost::mutex::scoped_lock lock(this->mutex);
+	  if (this->next >= this->last) {
+	    return;
+	  }
+	  begin = this->next;
+	  end = std::min(this->last, begin + this->grain);
+	  this->next = end;
+	}
+	if (this->error.HasFailed()) {
+	  return;
+	}
+	this->f(begin, end, this->thread);
+      }
+    } catch (std::exception &e) {
+      this->error.Set(e.what());
+    } catch (...) {
+      this->error.Set("Unknown exception in worker thread");
+    }
+  }
+
+ private:
+
+  TFunctor &f;
+  size_t &next;
+  size_t last;
+  size_t grain;
+  boost::mutex &mutex;
+  unsigned int thread;
+  ParallelErrorState &error;
+
+};
+
+/*
+ * parallelFor(): split the range [first, last) into numThreads
+ * contiguous chunks of (almost) the same size, and run each chunk in
+ * a separate thread as
+ *
+ *   f(begin, end, thread)
+ *
+ * where thread is the index of the worker, in [0, numThreads). The
+ * index can be used to give each worker its own scratch buffer.
+ *
+ * The functor is shared by all threads (it is passed by reference),
+ * so it must be safe to run on disjoint ranges concurrently.
+ *
+ * numThreads: number of threads (0 = number of hardware threads). If
+ *             only one thread is used, f is run in the calling
+ *             thread.
+ */
+template <class TFunctor>
+void parallelFor(size_t first, size_t last, TFunctor &f,
+		 unsigned int numThreads = 0) {
+
+  if (last <= first) {
+    return;
+  }
+  numThreads = getNumberOfThreads(numThreads);
+  numThreads = (unsigned int)std::min((size_t)numThreads, last - first);
+
+  ParallelErrorState error;
+
+  // single thread: avoid the overhead of creating a thread
+  if (numThreads == 1) {
+    ParallelForStaticWorker<TFunctor> worker(f, first, last, 0, error);
+    worker();
+    error.ThrowIfFailed();
+    return;
+  }
+
+  // split the range into chunks, the first ones one element longer
+  // if the range is not divisible by the number of threads
+  size_t len = (last - first) / numThreads;
+  size_t rem = (last - first) % numThreads;
+  boost::thread_group threads;
+  size_t begin = first;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    size_t end = begin + len + (i < rem ? 1 : 0);
+    threads.create_thread(ParallelForStaticWorker<TFunctor>(f, begin, end, i, error));
+    begin = end;
+  }
+  threads.join_all();
+  error.ThrowIfFailed();
+
+}
+
+/*
+ * parallelForDynamic(): like parallelFor(), but the range is split
+ * into chunks of grain elements, and each thread keeps pulling the
+ * next available chunk until the range is exhausted. This balances
+ * the load when the cost per element is very uneven (e.g. blocks of
+ * an image with very different amounts of foreground).
+ */
+template <class TFunctor>
+void parallelForDynamic(size_t first, size_t last, size_t grain, TFunctor &f,
+			unsigned int numThreads = 0) {
+
+  if (last <= first) {
+    return;
+  }
+  if (grain == 0) {
+    grain = 1;
+  }
+  numThreads = getNumberOfThreads(numThreads);
+  numThreads = (unsigned int)std::min((size_t)numThreads,
+				      (last - first + grain - 1) / grain);
+
+  ParallelErrorState error;
+  boost::mutex mutex;
+  size_t next = first;
+
+  if (numThreads == 1) {
+    ParallelForDynamicWorker<TFunctor> worker(f, next, last, grain, mutex, 0, error);
+    worker();
+    error.ThrowIfFailed();
+    return;
+  }
+
+  boost::thread_group threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.create_thread(ParallelForDynamicWorker<TFunctor>(f, next, last, grain,
+							     mutex, i, error));
+  }
+  threads.join_all();
+  error.ThrowIfFailed();
+
+}
+
+#endif /* GERARDUSPARALLEL_H */
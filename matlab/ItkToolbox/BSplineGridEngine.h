@@ -0,0 +1,274 @@
+/*
+ * BSplineGridEngine.h
+ *
+ * Separable evaluation of the B-spline lattice fitted by
+ * itk::BSplineScatteredDataPointSetToImageFilter on a rectangular grid
+ * of points (itk_pstransform('bspline', X, Y, {XI, YI, ZI})).
+ *
+ * Evaluating the lattice point by point with
+ * itk::BSplineControlPointImageFunction costs (ORDER+1)^D lattice reads
+ * per point, plus a lot of overhead per call. On a rectangular grid,
+ * the tensor-product structure of the B-spline allows to contract one
+ * axis at a time: each slice of the grid first collapses the lattice
+ * along z to a plane, each row of the slice collapses the plane along
+ * y to a line, and each point of the row only needs ORDER+1 reads
+ * from the line. The B-spline weights of each grid coordinate are
+ * computed only once per axis.
+ *
+ * Slices (3D) or rows (2D) of the grid are independent, and are
+ * processed in parallel.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef BSPLINEGRIDENGINE_H
+#define BSPLINEGRIDENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/*
+ * bsplineSpanWeights(): uniform B-spline weights of the ORDER+1
+ * control points that have support on a span, at the local parametric
+ * coordinate t in [0, 1]. This is de Boor's recursion on uniform
+ * knots, and gives the same weights as the centred kernel used by
+ * ITK, B(t - k + (ORDER-1)/2), k = 0, ..., ORDER.
+ */
+inline
+void bsplineSpanWeights(double t, unsigned int order, double *b) {
+  b[0] = 1.0;
+  for (unsigned int k = 1; k <= order; ++k) {
+    b[k] = t * b[k-1] / k;
+    for (unsigned int j = k - 1; j > 0; --j) {
+      b[j] = ((t + k - j) * b[j-1] + (j + 1 - t) * b[j]) / k;
+    }
+    b[0] = (1.0 - t) * b[0] / k;
+  }
+}
+
+/*
+ * BSplineGridAxis: span index and B-spline weights of each coordinate
+ * of one axis of the grid.
+ *
+ * u:     parametric coordinates of the grid points along this axis,
+ *        in [0, 1] (the lattice domain)
+ * len:   number of control points of the lattice along this axis
+ * order: B-spline order
+ */
+class BSplineGridAxis {
+
+ public:
+
+  std::vector<size_t> start;  // first control point of each grid point
+  std::vector<double> weight; // weight[i * (order + 1) + k]
+
+  BSplineGridAxis() {}
+
+  void Compute(const std::vector<double> &u, size_t len, unsigned int order) {
+    size_t nspans = len - order;
+    this->start.resize(u.size());
+    this->weight.resize(u.size() * (order + 1));
+    for (size_t i = 0; i < u.size(); ++i) {
+      double p = u[i] * nspans;
+      double f = std::floor(p);
+      // points on the upper boundary of the domain belong to the last
+      // span, and rounding errors can put points slightly outside
+      if (f > (double)(nspans - 1)) {
+	f = (double)(nspans - 1);
+      }
+      if (f < 0.0) {
+	f = 0.0;
+      }
+      this->start[i] = (size_t)f;
+      bsplineSpanWeights(p - f, order, &this->weight[i * (order + 1)]);
+    }
+  }
+
+};
+
+/*
+ * BSplineGridEvaluator: warp a rectangular grid of points with the
+ * displacement field given by a B-spline control point lattice.
+ *
+ * The grid is given by one vector of coordinates per axis,
+ * axis[0] = XI (columns), axis[1] = YI (rows), axis[2] = ZI
+ * (slices). The output yi is an array of size
+ * (rows, columns[, slices], Dimension), where yi(r, c, s, :) is the
+ * warped point (XI(c), YI(r), ZI(s)).
+ *
+ * phi:     lattice, phi[((k * Ly + j) * Lx + i) * Dimension + d]
+ *          (same layout as an ITK image of vectors)
+ * latSize: lattice size, {Lx, Ly[, Lz]}
+ * orig:    origin of the parametric domain, in real coordinates
+ * scale:   length of the side of the parametric domain, in real
+ *          coordinates. The displacements in phi are scaled by the
+ *          same factor
+ *
+ * Run with parallelFor(0, number of slices) in 3D, or
+ * parallelFor(0, number of rows) in 2D.
+ */
+template <class T, unsigned int Dimension>
+class BSplineGridEvaluator {
+
+ public:
+
+  BSplineGridEvaluator(const std::vector<double> &_phi,
+		       const size_t *_latSize,
+		       unsigned int _order,
+		       const T * const *_axis,
+		       const size_t *_axisLen,
+		       const double *orig,
+		       double _scale,
+		       T *_yi)
+    : phi(_phi), order(_order), scale(_scale), yi(_yi) {
+
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      this->latSize[d] = _latSize[d];
+      this->axis[d] = _axis[d];
+      this->axisLen[d] = _axisLen[d];
+
+      // parametric coordinates of the grid along this axis
+      std::vector<double> u(_axisLen[d]);
+      for (size_t i = 0; i < _axisLen[d]; ++i) {
+	u[i] = ((double)_axis[d][i] - orig[d]) / _scale;
+      }
+      this->weights[d].Compute(u, _latSize[d], _order);
+    }
+
+    this->numPoints = 1;
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      this->numPoints *= _axisLen[d];
+    }
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+
+    const size_t Lx = this->latSize[0];
+    const size_t Ly = this->latSize[1];
+
+    // scratch buffers for the lattice collapsed along z (plane) and
+    // along y (line)
+    std::vector<double> plane;
+    std::vector<double> line(Lx * Dimension);
+
+    if (Dimension == 3) {
+      plane.resize(Lx * Ly * Dimension);
+      for (size_t s = begin; s < end; ++s) {
+	this->CollapseAxis(&this->phi[0], Lx * Ly, this->weights[2], s, &plane[0]);
+	for (size_t r = 0; r < this->axisLen[1]; ++r) {
+	  this->EvaluateRow(&plane[0], r, s, &line[0]);
+	}
+      }
+    } else {
+      for (size_t r = begin; r < end; ++r) {
+	this->EvaluateRow(&this->phi[0], r, 0, &line[0]);
+      }
+    }
+
+  }
+
+ private:
+
+  const std::vector<double> &phi;
+  size_t latSize[Dimension];
+  unsigned int order;
+  const T *axis[Dimension];
+  size_t axisLen[Dimension];
+  BSplineGridAxis weights[Dimension];
+  double scale;
+  size_t numPoints;
+  T *yi;
+
+  // collapse the slowest varying axis of the array src, made of
+  // blocks of "stride" nodes, with the B-spline weights of grid point
+  // i along that axis
+  void CollapseAxis(const double *src, size_t stride,
+		    const BSplineGridAxis &w, size_t i, double *dst) const {
+    const size_t n = stride * Dimension;
+    const double *wi = &w.weight[i * (this->order + 1)];
+    const double *block = src + w.start[i] * n;
+    std::fill(dst, dst + n, 0.0);
+    for (unsigned int k = 0; k <= this->order; ++k) {
+      const double wk = wi[k];
+      const double *p = block + k * n;
+      for (size_t m = 0; m < n; ++m) {
+	dst[m] += wk * p[m];
+      }
+    }
+  }
+
+  // warp row r of slice s of the grid, using the lattice collapsed
+  // along z
+  void EvaluateRow(const double *plane, size_t r, size_t s, double *line) const {
+
+    const size_t Lx = this->latSize[0];
+    const size_t nx = this->axisLen[0];
+    const size_t ny = this->axisLen[1];
+    const unsigned int K = this->order + 1;
+
+    // collapse plane along y
+    this->CollapseAxis(plane, Lx, this->weights[1], r, line);
+
+    // coordinates of the row that are common to all points
+    double yr = (double)this->axis[1][r];
+    double zs = (Dimension == 3) ? (double)this->axis[Dimension - 1][s] : 0.0;
+
+    for (size_t c = 0; c < nx; ++c) {
+
+      // displacement at this point
+      double v[Dimension];
+      std::fill(v, v + Dimension, 0.0);
+      const double *wc = &this->weights[0].weight[c * K];
+      const double *p = line + this->weights[0].start[c] * Dimension;
+      for (unsigned int k = 0; k < K; ++k) {
+	for (unsigned int d = 0; d < Dimension; ++d) {
+	  v[d] += wc[k] * p[k * Dimension + d];
+	}
+      }
+
+      // warped point
+      size_t idx = r + ny * (c + nx * s);
+      double xc[3] = {(double)this->axis[0][c], yr, zs};
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	this->yi[idx + this->numPoints * d] = (T)(xc[d] + v[d] * this->scale);
+      }
+    }
+
+  }
+
+};
+
+#endif /* BSPLINEGRIDENGINE_H */
@@ -0,0 +1,1023 @@
+/*
+ * ICPEngine.h
+ *
+ * Native Iterative Closest Point (ICP) engine used by
+ * itk_icp_registration for the 'rigid', 'similarity' and 'affine'
+ * transforms.
+ *
+ * itk::EuclideanDistancePointMetric finds the closest fixed point of
+ * each moving point by brute force (unless a distance map is
+ * provided), so each evaluation of the metric is O(N*M). Here
+ *
+ *   - the fixed points are stored in a k-d tree, built once,
+ *   - at each iteration, the closest fixed point of each (sampled)
+ *     moving point is found in parallel,
+ *   - the transform update is computed in closed form (point-to-point
+ *     error, Horn's quaternion method or linear least squares), or by
+ *     solving the linearised normal equations (point-to-plane error),
+ *     accumulated in parallel,
+ *   - optionally, only a random or normal-space subsample of the moving
+ *     points is used to compute the transform.
+ *
+ * Points are read directly from the Matlab (N x 3) column-major
+ * arrays, x[i + N * d]. All computations are in double precision.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef ICPENGINE_H
+#define ICPENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/* Gerardus headers */
+#include "GerardusParallel.h"
+
+// transforms and metrics supported by the native ICP engine
+enum ICPTransformType {ICP_RIGID, ICP_SIMILARITY, ICP_AFFINE};
+enum ICPMetricType {ICP_POINT_TO_POINT, ICP_POINT_TO_PLANE};
+enum ICPSamplingType {ICP_SAMPLING_ALL, ICP_SAMPLING_RANDOM, ICP_SAMPLING_NORMAL};
+
+/*
+ * ICPRandom: small linear congruential generator, so that the
+ * subsampling is reproducible and does not depend on the global state
+ * of std::rand().
+ */
+class ICPRandom {
+
+ public:
+
+  ICPRandom(unsigned long seed = 5489UL) : state(seed) {}
+
+  // random integer in [0, n)
+  size_t operator()(size_t n) {
+    this->state = this->state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (size_t)((this->state >> 33) % n);
+  }
+
+ private:
+
+  unsigned long long state;
+
+};
+
+/*
+ * PointKdTree: k-d tree of 3D points for nearest neighbour queries.
+ *
+ * The points are copied and reordered so that the points of each leaf
+ * are contiguous in memory. Each node splits its points at the median
+ * of the coordinate with the largest extent.
+ */
+class PointKdTree {
+
+ public:
+
+  PointKdTree() {}
+
+  // build the tree from a Matlab (n x 3) column-major array
+  void Build(const double *x, size_t n) {
+    this->index.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      this->index[i] = i;
+    }
+    this->pts.resize(3 * n);
+    for (size_t i = 0; i < n; ++i) {
+      for (unsigned int d = 0; d < 3; ++d) {
+	this->pts[3 * i + d] = x[i + n * d];
+      }
+    }
+    this->nodes.clear();
+    if (n == 0) {
+      return;
+    }
+    this->nodes.reserve(2 * (n / LEAF_SIZE + 1));
+    this->BuildNode(0, n);
+
+    // reorder the coordinates to follow the leaves
+    std::vector<double> sorted(3 * n);
+    for (size_t i = 0; i < n; ++i) {
+      for (unsigned int d = 0; d < 3; ++d) {
+	sorted[3 * i + d] = x[this->index[i] + n * d];
+      }
+    }
+    this->pts.swap(sorted);
+  }
+
+  size_t GetNumberOfPoints() const {
+    return this->index.size();
+  }
+
+  // index (in the input array) of the point closest to q, and squared
+  // distance to it
+  size_t Nearest(const double *q, double &dist2) const {
+    size_t best = 0;
+    dist2 = std::numeric_limits<double>::max();
+    if (!this->nodes.empty()) {
+      this->NearestNode(0, q, best, dist2);
+    }
+    return this->index[best];
+  }
+
+  // indices (in the input array) of the k points closest to q, sorted
+  // by increasing distance
+  void KNearest(const double *q, size_t k, std::vector<size_t> &idx) const {
+    std::priority_queue<std::pair<double, size_t> > heap;
+    if (!this->nodes.empty() && k > 0) {
+      this->KNearestNode(0, q, k, heap);
+    }
+    idx.resize(heap.size());
+    for (size_t i = idx.size(); i > 0; --i) {
+      idx[i - 1] = this->index[heap.top().second];
+      heap.pop();
+    }
+  }
+
+ private:
+
+  static const size_t LEAF_SIZE = 16;
+
+  struct Node {
+    size_t begin, end;   // range of points in this node
+    size_t left, right;  // children (0 if leaf)
+    unsigned int dim;    // split dimension
+    double split;        // split value
+  };
+
+  // compare two points by one coordinate, for std::nth_element
+  class CompareCoordinate {
+  public:
+    CompareCoordinate(const std::vector<double> &_pts, unsigned int _dim)
+      : pts(_pts), dim(_dim) {}
+    bool operator()(size_t a, size_t b) const {
+      return this->pts[3 * a + this->dim] < this->pts[3 * b + this->dim];
+    }
+  private:
+    const std::vector<double> &pts;
+    unsigned int dim;
+  };
+
+  std::vector<double> pts;   // coordinates, pts[3 * i + d]
+  std::vector<size_t> index; // input index of each point
+  std::vector<Node> nodes;
+
+  size_t BuildNode(size_t begin, size_t end) {
+
+    size_t id = this->nodes.size();
+    this->nodes.push_back(Node());
+    this->nodes[id].begin = begin;
+    this->nodes[id].end = end;
+    this->nodes[id].left = 0;
+    this->nodes[id].right = 0;
+    this->nodes[id].dim = 0;
+    this->nodes[id].split = 0.0;
+    if (end - begin <= LEAF_SIZE) {
+      return id;
+    }
+
+    // split along the dimension with the largest extent (coordinates
+    // are still in input order, so we go through the index)
+    double lo[3], hi[3];
+    for (unsigned int d = 0; d < 3; ++d) {
+      lo[d] = std::numeric_limits<double>::max();
+      hi[d] = -std::numeric_limits<double>::max();
+    }
+    for (size_t i = begin; i < end; ++i) {
+      const double *p = &this->pts[3 * this->index[i]];
+      for (unsigned int d = 0; d < 3; ++d) {
+	lo[d] = std::min(lo[d], p[d]);
+	hi[d] = std::max(hi[d], p[d]);
+      }
+    }
+    unsigned int dim = 0;
+    for (unsigned int d = 1; d < 3; ++d) {
+      if (hi[d] - lo[d] > hi[dim] - lo[dim]) {
+	dim = d;
+      }
+    }
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(this->index.begin() + begin, this->index.begin() + mid,
+		     this->index.begin() + end, CompareCoordinate(this->pts, dim));
+    double split = this->pts[3 * this->index[mid] + dim];
+
+    size_t left = this->BuildNode(begin, mid);
+    size_t right = this->BuildNode(mid, end);
+    this->nodes[id].left = left;
+    this->nodes[id].right = right;
+    this->nodes[id].dim = dim;
+    this->nodes[id].split = split;
+    return id;
+  }
+
+  void NearestNode(size_t id, const double *q, size_t &best, double &dist2) const {
+    const Node &node = this->nodes[id];
+    if (node.left == 0) {
+      for (size_t i = node.begin; i < node.end; ++i) {
+	const double *p = &this->pts[3 * i];
+	double dx = p[0] - q[0];
+	double dy = p[1] - q[1];
+	double dz = p[2] - q[2];
+	double d2 = dx * dx + dy * dy + dz * dz;
+	if (d2 < dist2) {
+	  dist2 = d2;
+	  best = i;
+	}
+      }
+      return;
+    }
+    double diff = q[node.dim] - node.split;
+    size_t nearChild = (diff < 0.0) ? node.left : node.right;
+    size_t farChild = (diff < 0.0) ? node.right : node.left;
+    this->NearestNode(nearChild, q, best, dist2);
+    if (diff * diff < dist2) {
+      this->NearestNode(farChild, q, best, dist2);
+    }
+  }
+
+  void KNearestNode(size_t id, const double *q, size_t k,
+		    std::priority_queue<std::pair<double, size_t> > &heap) const {
+    const Node &node = this->nodes[id];
+    if (node.left == 0) {
+      for (size_t i = node.begin; i < node.end; ++i) {
+	const double *p = &this->pts[3 * i];
+	double dx = p[0] - q[0];
+	double dy = p[1] - q[1];
+	double dz = p[2] - q[2];
+	double d2 = dx * dx + dy * dy + dz * dz;
+	if (heap.size() < k) {
+	  heap.push(std::make_pair(d2, i));
+	} else if (d2 < heap.top().first) {
+	  heap.pop();
+	  heap.push(std::make_pair(d2, i));
+	}
+      }
+      return;
+    }
+    double diff = q[node.dim] - node.split;
+    size_t nearChild = (diff < 0.0) ? node.left : node.right;
+    size_t farChild = (diff < 0.0) ? node.right : node.left;
+    this->KNearestNode(nearChild, q, k, heap);
+    if (heap.size() < k || diff * diff < heap.top().first) {
+      this->KNearestNode(farChild, q, k, heap);
+    }
+  }
+
+};
+
+/*
+ * symmetricEigen(): eigenvalues and eigenvectors of a small symmetric
+ * matrix (n <= 4) by cyclic Jacobi rotations.
+ *
+ * a:    (n x n) row-major matrix. It is overwritten
+ * eval: n eigenvalues, unsorted
+ * evec: (n x n) row-major matrix, evec[i * n + k] is the i-th
+ *       component of the k-th eigenvector
+ */
+inline
+void symmetricEigen(double *a, unsigned int n, double *eval, double *evec) {
+  for (unsigned int i = 0; i < n; ++i) {
+    for (unsigned int j = 0; j < n; ++j) {
+      evec[i * n + j] = (i == j) ? 1.0 : 0.0;
+    }
+  }
+  for (unsigned int sweep = 0; sweep < 50; ++sweep) {
+    double off = 0.0;
+    for (unsigned int i = 0; i < n; ++i) {
+      for (unsigned int j = i + 1; j < n; ++j) {
+	off += a[i * n + j] * a[i * n + j];
+      }
+    }
+    if (off < 1e-30) {
+      break;
+    }
+    for (unsigned int p = 0; p < n; ++p) {
+      for (unsigned int q = p + 1; q < n; ++q) {
+	double apq = a[p * n + q];
+	if (std::fabs(apq) < 1e-300) {
+	  continue;
+	}
+	double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+	double t = ((theta >= 0.0) ? 1.0 : -1.0)
+	  / (std::fabs(theta) + std::sqrt(theta * theta + 1.0));
+	double c = 1.0 / std::sqrt(t * t + 1.0);
+	double s = t * c;
+	for (unsigned int k = 0; k < n; ++k) {
+	  double akp = a[k * n + p];
+	  double akq = a[k * n + q];
+	  a[k * n + p] = c * akp - s * akq;
+	  a[k * n + q] = s * akp + c * akq;
+	}
+	for (unsigned int k = 0; k < n; ++k) {
+	  double apk = a[p * n + k];
+	  double aqk = a[q * n + k];
+	  a[p * n + k] = c * apk - s * aqk;
+	  a[q * n + k] = s * apk + c * aqk;
+	}
+	for (unsigned int k = 0; k < n; ++k) {
+	  double vkp = evec[k * n + p];
+	  double vkq = evec[k * n + q];
+	  evec[k * n + p] = c * vkp - s * vkq;
+	  evec[k * n + q] = s * vkp + c * vkq;
+	}
+      }
+    }
+  }
+  for (unsigned int i = 0; i < n; ++i) {
+    eval[i] = a[i * n + i];
+  }
+}
+
+/*
+ * solveLinearSystem(): solve the (n x n) system a * x = b by Gaussian
+ * elimination with partial pivoting. a is row-major and overwritten;
+ * b is overwritten with the solution. Returns false if the matrix is
+ * (numerically) singular.
+ */
+inline
+bool solveLinearSystem(double *a, double *b, unsigned int n) {
+  double amax = 0.0;
+  for (unsigned int i = 0; i < n * n; ++i) {
+    amax = std::max(amax, std::fabs(a[i]));
+  }
+  for (unsigned int k = 0; k < n; ++k) {
+    unsigned int piv = k;
+    for (unsigned int i = k + 1; i < n; ++i) {
+      if (std::fabs(a[i * n + k]) > std::fabs(a[piv * n + k])) {
+	piv = i;
+      }
+    }
+    if (std::fabs(a[piv * n + k]) <= 1e-12 * amax) {
+      return false;
+    }
+    if (piv != k) {
+      for (unsigned int j = 0; j < n; ++j) {
+	std::swap(a[k * n + j], a[piv * n + j]);
+      }
+      std::swap(b[k], b[piv]);
+    }
+    for (unsigned int i = k + 1; i < n; ++i) {
+      double f = a[i * n + k] / a[k * n + k];
+      for (unsigned int j = k; j < n; ++j) {
+	a[i * n + j] -= f * a[k * n + j];
+      }
+      b[i] -= f * b[k];
+    }
+  }
+  for (unsigned int k = n; k > 0; --k) {
+    double acc = b[k - 1];
+    for (unsigned int j = k; j < n; ++j) {
+      acc -= a[(k - 1) * n + j] * b[j];
+    }
+    b[k - 1] = acc / a[(k - 1) * n + (k - 1)];
+  }
+  return true;
+}
+
+/*
+ * PointNormalEstimator: unit normal of each point, estimated as the
+ * direction of least variance of its K nearest neighbours. The sign
+ * of the normal is arbitrary. Run with parallelFor(0, n).
+ */
+class PointNormalEstimator {
+
+ public:
+
+  PointNormalEstimator(const PointKdTree &_tree, const double *_x, size_t _n,
+		       size_t _k, double *_normals)
+    : tree(_tree), x(_x), n(_n), k(_k), normals(_normals) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    std::vector<size_t> idx;
+    for (size_t i = begin; i < end; ++i) {
+      double q[3] = {this->x[i], this->x[i + this->n], this->x[i + 2 * this->n]};
+      this->tree.KNearest(q, this->k, idx);
+
+      // covariance of the neighbourhood
+      double mu[3] = {0.0, 0.0, 0.0};
+      for (size_t j = 0; j < idx.size(); ++j) {
+	for (unsigned int d = 0; d < 3; ++d) {
+	  mu[d] += this->x[idx[j] + this->n * d];
+	}
+      }
+      for (unsigned int d = 0; d < 3; ++d) {
+	mu[d] /= idx.size();
+      }
+      double cov[9] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+      for (size_t j = 0; j < idx.size(); ++j) {
+	double v[3];
+	for (unsigned int d = 0; d < 3; ++d) {
+	  v[d] = this->x[idx[j] + this->n * d] - mu[d];
+	}
+	for (unsigned int r = 0; r < 3; ++r) {
+	  for (unsigned int c = 0; c < 3; ++c) {
+	    cov[r * 3 + c] += v[r] * v[c];
+	  }
+	}
+      }
+
+      // eigenvector of the smallest eigenvalue
+      double eval[3], evec[9];
+      symmetricEigen(cov, 3, eval, evec);
+      unsigned int kmin = 0;
+      for (unsigned int c = 1; c < 3; ++c) {
+	if (eval[c] < eval[kmin]) {
+	  kmin = c;
+	}
+      }
+      for (unsigned int d = 0; d < 3; ++d) {
+	this->normals[3 * i + d] = evec[d * 3 + kmin];
+      }
+    }
+  }
+
+ private:
+
+  const PointKdTree &tree;
+  const double *x;
+  size_t n;
+  size_t k;
+  double *normals;
+
+};
+
+/*
+ * ICPAccumulator: one ICP iteration. For each sampled moving point,
+ * apply the current transform, find the closest fixed point, and add
+ * the pair to the sums needed to compute the transform update. Each
+ * thread accumulates in its own buffer. Run with
+ * parallelFor(0, number of samples, *this, numThreads).
+ *
+ * Points are centred on the centroid of the fixed points, to avoid
+ * loss of precision in the sums.
+ *
+ * Point-to-point: sums of p, q, p*q^T, |p|^2 (rigid, similarity) or
+ * of h*h^T, h*q^T with h = [p; 1] (affine).
+ *
+ * Point-to-plane: normal equations J^T*J, J^T*r of the linearised
+ * residual r = n^T * (p - q), with parameters
+ *
+ *   rigid:      [w; t], J = [p x n; n]
+ *   similarity: [w; t; s], J = [p x n; n; n^T * p]
+ *   affine:     [M(:); t], J = [n * p^T (row-major); n]
+ */
+class ICPAccumulator {
+
+ public:
+
+  // size of the accumulation buffer of each thread
+  static const unsigned int BUFFER_SIZE = 12 * 12 + 12 + 2;
+
+  ICPAccumulator(const PointKdTree &_tree, const double *_x, size_t _nx,
+		 const double *_normals, const double *_y, size_t _ny,
+		 const std::vector<size_t> &_sample, const double *_c,
+		 ICPTransformType _transformType, ICPMetricType _metric,
+		 unsigned int numThreads)
+    : tree(_tree), x(_x), nx(_nx), normals(_normals), y(_y), ny(_ny),
+      sample(_sample), c(_c), transformType(_transformType), metric(_metric),
+      buffer(numThreads, std::vector<double>(BUFFER_SIZE, 0.0)) {
+    std::fill(this->A, this->A + 9, 0.0);
+    this->A[0] = this->A[4] = this->A[8] = 1.0;
+    std::fill(this->b, this->b + 3, 0.0);
+  }
+
+  // current transform, y -> A * y + b
+  double A[9];
+  double b[3];
+
+  // number of parameters of the point-to-plane normal equations
+  unsigned int GetNumberOfPlaneParameters() const {
+    switch (this->transformType) {
+    case ICP_RIGID:
+      return 6;
+    case ICP_SIMILARITY:
+      return 7;
+    default:
+      return 12;
+    }
+  }
+
+  void Reset() {
+    for (size_t t = 0; t < this->buffer.size(); ++t) {
+      std::fill(this->buffer[t].begin(), this->buffer[t].end(), 0.0);
+    }
+  }
+
+  // reduce the buffers of all threads
+  void Sum(std::vector<double> &total) const {
+    total.assign(BUFFER_SIZE, 0.0);
+    for (size_t t = 0; t < this->buffer.size(); ++t) {
+      for (unsigned int i = 0; i < BUFFER_SIZE; ++i) {
+	total[i] += this->buffer[t][i];
+      }
+    }
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+
+    double *acc = &this->buffer[thread][0];
+    const unsigned int np = this->GetNumberOfPlaneParameters();
+
+    // the last two elements of the buffer are the number of pairs and
+    // the sum of squared distances
+    double &count = acc[BUFFER_SIZE - 2];
+    double &sumDist2 = acc[BUFFER_SIZE - 1];
+
+    for (size_t k = begin; k < end; ++k) {
+      size_t i = this->sample[k];
+
+      // warp moving point
+      double yi[3] = {this->y[i], this->y[i + this->ny], this->y[i + 2 * this->ny]};
+      double p[3];
+      for (unsigned int r = 0; r < 3; ++r) {
+	p[r] = this->A[r * 3] * yi[0] + this->A[r * 3 + 1] * yi[1]
+	  + this->A[r * 3 + 2] * yi[2] + this->b[r];
+      }
+
+      // closest fixed point
+      double dist2;
+      size_t j = this->tree.Nearest(p, dist2);
+      double q[3];
+      for (unsigned int d = 0; d < 3; ++d) {
+	q[d] = this->x[j + this->nx * d] - this->c[d];
+	p[d] -= this->c[d];
+      }
+      count += 1.0;
+      sumDist2 += dist2;
+
+      if (this->metric == ICP_POINT_TO_POINT) {
+
+	if (this->transformType == ICP_AFFINE) {
+	  // acc[0..15]: h*h^T, acc[16..27]: h*q^T
+	  double h[4] = {p[0], p[1], p[2], 1.0};
+	  for (unsigned int r = 0; r < 4; ++r) {
+	    for (unsigned int s = 0; s < 4; ++s) {
+	      acc[r * 4 + s] += h[r] * h[s];
+	    }
+	    for (unsigned int s = 0; s < 3; ++s) {
+	      acc[16 + r * 3 + s] += h[r] * q[s];
+	    }
+	  }
+	} else {
+	  // acc[0..2]: p, acc[3..5]: q, acc[6..14]: p*q^T, acc[15]: |p|^2
+	  for (unsigned int r = 0; r < 3; ++r) {
+	    acc[r] += p[r];
+	    acc[3 + r] += q[r];
+	    for (unsigned int s = 0; s < 3; ++s) {
+	      acc[6 + r * 3 + s] += p[r] * q[s];
+	    }
+	    acc[15] += p[r] * p[r];
+	  }
+	}
+
+      } else {
+
+	// point-to-plane
+	const double *nrm = &this->normals[3 * j];
+	double res = nrm[0] * (p[0] - q[0]) + nrm[1] * (p[1] - q[1])
+	  + nrm[2] * (p[2] - q[2]);
+	double J[12];
+	if (this->transformType == ICP_AFFINE) {
+	  for (unsigned int r = 0; r < 3; ++r) {
+	    for (unsigned int s = 0; s < 3; ++s) {
+	      J[r * 3 + s] = nrm[r] * p[s];
+	    }
+	    J[9 + r] = nrm[r];
+	  }
+	} else {
+	  J[0] = p[1] * nrm[2] - p[2] * nrm[1];
+	  J[1] = p[2] * nrm[0] - p[0] * nrm[2];
+	  J[2] = p[0] * nrm[1] - p[1] * nrm[0];
+	  J[3] = nrm[0];
+	  J[4] = nrm[1];
+	  J[5] = nrm[2];
+	  J[6] = nrm[0] * p[0] + nrm[1] * p[1] + nrm[2] * p[2];
+	}
+	// acc[0..np*np-1]: J^T*J, acc[np*np..np*np+np-1]: J^T*r
+	for (unsigned int r = 0; r < np; ++r) {
+	  for (unsigned int s = 0; s < np; ++s) {
+	    acc[r * np + s] += J[r] * J[s];
+	  }
+	  acc[np * np + r] += J[r] * res;
+	}
+
+      }
+    }
+
+  }
+
+ private:
+
+  const PointKdTree &tree;
+  const double *x;
+  size_t nx;
+  const double *normals;
+  const double *y;
+  size_t ny;
+  const std::vector<size_t> &sample;
+  const double *c;
+  ICPTransformType transformType;
+  ICPMetricType metric;
+  std::vector<std::vector<double> > buffer;
+
+};
+
+/*
+ * rotationFromQuaternion(): (3 x 3) row-major rotation matrix of a
+ * unit quaternion (w, x, y, z).
+ */
+inline
+void rotationFromQuaternion(const double *qt, double *R) {
+  double w = qt[0], x = qt[1], y = qt[2], z = qt[3];
+  R[0] = w*w + x*x - y*y - z*z;
+  R[1] = 2.0 * (x*y - w*z);
+  R[2] = 2.0 * (x*z + w*y);
+  R[3] = 2.0 * (x*y + w*z);
+  R[4] = w*w - x*x + y*y - z*z;
+  R[5] = 2.0 * (y*z - w*x);
+  R[6] = 2.0 * (x*z - w*y);
+  R[7] = 2.0 * (y*z + w*x);
+  R[8] = w*w - x*x - y*y + z*z;
+}
+
+/*
+ * icpUpdate(): transform update dA, db (in centred coordinates) from
+ * the accumulated sums. Returns false if the update cannot be
+ * computed (degenerate configuration).
+ */
+inline
+bool icpUpdate(const std::vector<double> &acc, ICPTransformType transformType,
+	       ICPMetricType metric, unsigned int np, double *dA, double *db) {
+
+  double count = acc[ICPAccumulator::BUFFER_SIZE - 2];
+  if (count < 1.0) {
+    return false;
+  }
+
+  if (metric == ICP_POINT_TO_POINT && transformType == ICP_AFFINE) {
+
+    // least squares: (sum h*h^T) * X = sum h*q^T, X is (4 x 3)
+    for (unsigned int s = 0; s < 3; ++s) {
+      double a[16], rhs[4];
+      std::copy(acc.begin(), acc.begin() + 16, a);
+      for (unsigned int r = 0; r < 4; ++r) {
+	rhs[r] = acc[16 + r * 3 + s];
+      }
+      if (!solveLinearSystem(a, rhs, 4)) {
+	return false;
+      }
+      for (unsigned int r = 0; r < 3; ++r) {
+	dA[s * 3 + r] = rhs[r];
+      }
+      db[s] = rhs[3];
+    }
+    return true;
+
+  } else if (metric == ICP_POINT_TO_POINT) {
+
+    // Horn's quaternion method, with the cross-covariance of the
+    // centred point sets
+    double mp[3], mq[3], S[9];
+    for (unsigned int r = 0; r < 3; ++r) {
+      mp[r] = acc[r] / count;
+      mq[r] = acc[3 + r] / count;
+    }
+    for (unsigned int r = 0; r < 3; ++r) {
+      for (unsigned int s = 0; s < 3; ++s) {
+	S[r * 3 + s] = acc[6 + r * 3 + s] / count - mp[r] * mq[s];
+      }
+    }
+    double N[16] = {
+      S[0] + S[4] + S[8], S[5] - S[7],        S[6] - S[2],        S[1] - S[3],
+      S[5] - S[7],        S[0] - S[4] - S[8], S[1] + S[3],        S[6] + S[2],
+      S[6] - S[2],        S[1] + S[3],        -S[0] + S[4] - S[8], S[5] + S[7],
+      S[1] - S[3],        S[6] + S[2],        S[5] + S[7],        -S[0] - S[4] + S[8]
+    };
+    double eval[4], evec[16];
+    symmetricEigen(N, 4, eval, evec);
+    unsigned int kmax = 0;
+    for (unsigned int k = 1; k < 4; ++k) {
+      if (eval[k] > eval[kmax]) {
+	kmax = k;
+      }
+    }
+    double qt[4];
+    for (unsigned int i = 0; i < 4; ++i) {
+      qt[i] = evec[i * 4 + kmax];
+    }
+    double R[9];
+    rotationFromQuaternion(qt, R);
+
+    // scale, s = trace(R * S^T) / var(p)
+    double scale = 1.0;
+    if (transformType == ICP_SIMILARITY) {
+      double varp = acc[15] / count - (mp[0] * mp[0] + mp[1] * mp[1] + mp[2] * mp[2]);
+      double num = 0.0;
+      for (unsigned int r = 0; r < 3; ++r) {
+	for (unsigned int s = 0; s < 3; ++s) {
+	  num += R[r * 3 + s] * S[s * 3 + r];
+	}
+      }
+      if (varp <= 0.0 || num <= 0.0) {
+	return false;
+      }
+      scale = num / varp;
+    }
+    for (unsigned int i = 0; i < 9; ++i) {
+      dA[i] = scale * R[i];
+    }
+    for (unsigned int r = 0; r < 3; ++r) {
+      db[r] = mq[r] - (dA[r * 3] * mp[0] + dA[r * 3 + 1] * mp[1] + dA[r * 3 + 2] * mp[2]);
+    }
+    return true;
+
+  }
+
+  // point-to-plane: solve normal equations (J^T*J) * dx = -J^T*r
+  double a[144], rhs[12];
+  std::copy(acc.begin(), acc.begin() + np * np, a);
+  for (unsigned int r = 0; r < np; ++r) {
+    rhs[r] = -acc[np * np + r];
+  }
+  if (!solveLinearSystem(a, rhs, np)) {
+    return false;
+  }
+
+  if (transformType == ICP_AFFINE) {
+    for (unsigned int i = 0; i < 9; ++i) {
+      dA[i] = rhs[i] + ((i % 4 == 0) ? 1.0 : 0.0);
+    }
+    std::copy(rhs + 9, rhs + 12, db);
+    return true;
+  }
+
+  // rotation of angle |w| around w (Rodrigues), scaled by 1 + s
+  double w[3] = {rhs[0], rhs[1], rhs[2]};
+  double theta = std::sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+  double qt[4] = {1.0, 0.0, 0.0, 0.0};
+  if (theta > 0.0) {
+    double sh = std::sin(0.5 * theta) / theta;
+    qt[0] = std::cos(0.5 * theta);
+    qt[1] = w[0] * sh;
+    qt[2] = w[1] * sh;
+    qt[3] = w[2] * sh;
+  }
+  double R[9];
+  rotationFromQuaternion(qt, R);
+  double scale = (transformType == ICP_SIMILARITY) ? 1.0 + rhs[6] : 1.0;
+  if (scale <= 0.0) {
+    return false;
+  }
+  for (unsigned int i = 0; i < 9; ++i) {
+    dA[i] = scale * R[i];
+  }
+  std::copy(rhs + 3, rhs + 6, db);
+  return true;
+
+}
+
+/*
+ * icpSubsample(): indices of the moving points used to compute the
+ * transform.
+ *
+ * ICP_SAMPLING_ALL:    all points.
+ * ICP_SAMPLING_RANDOM: nsamples points, uniformly at random.
+ * ICP_SAMPLING_NORMAL: normal-space sampling (Rusinkiewicz and Levoy,
+ *                      2001). Points are bucketed by the direction of
+ *                      their normal, and samples are drawn in turn
+ *                      from each bucket, so that small features with
+ *                      unusual orientations are not swamped by large
+ *                      flat areas.
+ */
+inline
+void icpSubsample(const double *y, size_t ny, ICPSamplingType sampling,
+		  size_t nsamples, std::vector<size_t> &sample) {
+
+  sample.clear();
+  if (sampling == ICP_SAMPLING_ALL || nsamples >= ny) {
+    sample.resize(ny);
+    for (size_t i = 0; i < ny; ++i) {
+      sample[i] = i;
+    }
+    return;
+  }
+
+  ICPRandom random;
+  std::vector<size_t> perm(ny);
+  for (size_t i = 0; i < ny; ++i) {
+    perm[i] = i;
+  }
+
+  if (sampling == ICP_SAMPLING_RANDOM) {
+    // partial Fisher-Yates shuffle
+    for (size_t i = 0; i < nsamples; ++i) {
+      std::swap(perm[i], perm[i + random(ny - i)]);
+    }
+    sample.assign(perm.begin(), perm.begin() + nsamples);
+    std::sort(sample.begin(), sample.end());
+    return;
+  }
+
+  // normals of the moving points
+  PointKdTree tree;
+  tree.Build(y, ny);
+  std::vector<double> normals(3 * ny);
+  PointNormalEstimator estimator(tree, y, ny, 10, &normals[0]);
+  parallelFor(0, ny, estimator);
+
+  // bucket points by normal direction. Normals have arbitrary sign,
+  // so they are flipped to one hemisphere first
+  const unsigned int B = 6; // bins per axis
+  std::vector<std::vector<size_t> > buckets(B * B * B);
+  for (size_t i = 0; i < ny; ++i) {
+    size_t p = perm[i];
+    double *n = &normals[3 * p];
+    double sgn = (n[2] < 0.0 || (n[2] == 0.0 && n[1] < 0.0)) ? -1.0 : 1.0;
+    unsigned int bin[3];
+    for (unsigned int d = 0; d < 3; ++d) {
+      double v = sgn * n[d];
+      bin[d] = std::min(B - 1, (unsigned int)((v + 1.0) * 0.5 * B));
+    }
+    buckets[bin[0] + B * (bin[1] + B * bin[2])].push_back(p);
+  }
+
+  // shuffle each bucket, and draw from the buckets in turn
+  for (size_t k = 0; k < buckets.size(); ++k) {
+    std::vector<size_t> &bk = buckets[k];
+    for (size_t i = 0; i + 1 < bk.size(); ++i) {
+      std::swap(bk[i], bk[i + random(bk.size() - i)]);
+    }
+  }
+  for (size_t round = 0; sample.size() < nsamples; ++round) {
+    for (size_t k = 0; k < buckets.size() && sample.size() < nsamples; ++k) {
+      if (round < buckets[k].size()) {
+	sample.push_back(buckets[k][round]);
+      }
+    }
+  }
+  std::sort(sample.begin(), sample.end());
+
+}
+
+/*
+ * icpRegister(): ICP registration of moving points y onto fixed points
+ * x. Both are Matlab (n x 3) column-major arrays.
+ *
+ * A, b:     on input, initial transform; on output, the transform
+ *           y -> A * y + b (A is row-major)
+ * niter:    maximum number of iterations
+ * tol:      the algorithm stops when the relative change in the RMS
+ *           distance between correspondences is below tol, or the
+ *           RMS is negligible compared to the size of the fixed set
+ * nsamples: number of moving points used for random or normal-space
+ *           sampling
+ *
+ * Returns the RMS distance between the moving points (samples) and
+ * their closest fixed points, after registration. The number of
+ * iterations run is returned in iter.
+ */
+inline
+double icpRegister(const double *x, size_t nx, const double *y, size_t ny,
+		   ICPTransformType transformType, ICPMetricType metric,
+		   ICPSamplingType sampling, size_t nsamples,
+		   unsigned int niter, double tol, double *A, double *b,
+		   unsigned int &iter) {
+
+  unsigned int numThreads = getNumberOfThreads();
+
+  // k-d tree of the fixed points, built once
+  PointKdTree tree;
+  tree.Build(x, nx);
+
+  // fixed point normals, for the point-to-plane error
+  std::vector<double> normals;
+  if (metric == ICP_POINT_TO_PLANE) {
+    normals.resize(3 * nx);
+    PointNormalEstimator estimator(tree, x, nx, 10, &normals[0]);
+    parallelFor(0, nx, estimator, numThreads);
+  }
+
+  // centroid of the fixed points
+  double c[3] = {0.0, 0.0, 0.0};
+  for (unsigned int d = 0; d < 3; ++d) {
+    for (size_t i = 0; i < nx; ++i) {
+      c[d] += x[i + nx * d];
+    }
+    c[d] /= nx;
+  }
+
+  // size of the fixed point set, to detect exact matches
+  double len = 0.0;
+  for (unsigned int d = 0; d < 3; ++d) {
+    const double *xd = x + nx * d;
+    double ext = *std::max_element(xd, xd + nx) - *std::min_element(xd, xd + nx);
+    len = std::max(len, ext);
+  }
+
+  // moving points used to compute the transform
+  std::vector<size_t> sample;
+  icpSubsample(y, ny, sampling, nsamples, sample);
+
+  ICPAccumulator accumulator(tree, x, nx, normals.empty() ? NULL : &normals[0],
+			     y, ny, sample, c, transformType, metric, numThreads);
+  std::copy(A, A + 9, accumulator.A);
+  std::copy(b, b + 3, accumulator.b);
+  const unsigned int np = accumulator.GetNumberOfPlaneParameters();
+
+  std::vector<double> acc;
+  double rms = std::numeric_limits<double>::max();
+  for (iter = 0; iter < niter; ++iter) {
+
+    // correspondences and sums, in parallel
+    accumulator.Reset();
+    parallelFor(0, sample.size(), accumulator, numThreads);
+    accumulator.Sum(acc);
+    double rmsPrev = rms;
+    rms = std::sqrt(acc[ICPAccumulator::BUFFER_SIZE - 1] 
+		    / acc[ICPAccumulator::BUFFER_SIZE - 2]);
+    if (std::fabs(rmsPrev - rms) <= tol * rmsPrev || rms <= 1e-12 * len) {
+      break;
+    }
+
+    // transform update in centred coordinates, p -> dA * p + db
+    double dA[9], db[3];
+    if (!icpUpdate(acc, transformType, metric, np, dA, db)) {
+      break;
+    }
+
+    // compose with the current transform. In uncentred coordinates,
+    // the update is y -> dA * y + (db + c - dA * c)
+    double newA[9], newb[3];
+    for (unsigned int r = 0; r < 3; ++r) {
+      double t = db[r] + c[r];
+      for (unsigned int s = 0; s < 3; ++s) {
+	t -= dA[r * 3 + s] * c[s];
+	newA[r * 3 + s] = 0.0;
+	for (unsigned int k = 0; k < 3; ++k) {
+	  newA[r * 3 + s] += dA[r * 3 + k] * accumulator.A[k * 3 + s];
+	}
+      }
+      newb[r] = t;
+      for (unsigned int k = 0; k < 3; ++k) {
+	newb[r] += dA[r * 3 + k] * accumulator.b[k];
+      }
+    }
+    std::copy(newA, newA + 9, accumulator.A);
+    std::copy(newb, newb + 3, accumulator.b);
+
+  }
+
+  // RMS with the final transform, if the loop ran out of iterations
+  if (iter == niter) {
+    accumulator.Reset();
+    parallelFor(0, sample.size(), accumulator, numThreads);
+    accumulator.Sum(acc);
+    rms = std::sqrt(acc[ICPAccumulator::BUFFER_SIZE - 2] > 0.0 ?
+		    acc[ICPAccumulator::BUFFER_SIZE - 1] 
+		    / acc[ICPAccumulator::BUFFER_SIZE - 2] : 0.0);
+  }
+
+  std::copy(accumulator.A, accumulator.A + 9, A);
+  std::copy(accumulator.b, accumulator.b + 3, b);
+  return rms;
+
+}
+
+#endif /* ICPENGINE_H */
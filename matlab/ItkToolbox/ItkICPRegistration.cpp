@@ -3,15 +3,78 @@
  *
  * ITK_ICP_REGISTRATION  Iterative Closest Point registration
  *
- * This function is a derived work of IterativeClosestPoint3.cxx
- * https://github.com/Kitware/ITK/blob/master/Examples/Registration/IterativeClosestPoint3.cxx
+ * [Y2, T] = itk_icp_registration(X, Y)
+ * [Y2, T] = itk_icp_registration(X, Y, 'translation')
+ *
+ *   X, Y are 3-column matrices with the coordinates of the fixed and
+ *   moving point sets, respectively. Each row contains the coordinates
+ *   of a point.
+ *
+ *   Y2 is the moving point set after registration.
+ *
+ *   T is the vector with the translation that registers Y onto X.
+ *
+ *   The 'translation' transform uses ITK's
+ *   EuclideanDistancePointMetric and LevenbergMarquardtOptimizer. This
+ *   syntax is a derived work of IterativeClosestPoint3.cxx
+ *   https://github.com/Kitware/ITK/blob/master/Examples/Registration/IterativeClosestPoint3.cxx
+ *
+ * [Y2, T, RMS] = itk_icp_registration(X, Y, TRANSFORM, NITER, TOL, METRIC, SAMPLING, NSAMPLES)
+ *
+ *   Native ICP engine: the fixed points are stored in a k-d tree built
+ *   once, and at each iteration the closest fixed point of each moving
+ *   point is found in parallel. The transform update has a closed form
+ *   solution ('point' metric) or is the solution of the linearised
+ *   normal equations ('plane' metric).
+ *
+ *   TRANSFORM is a string with the transform type:
+ *
+ *     'rigid':      rotation and translation
+ *     'similarity': rotation, translation and isotropic scaling
+ *     'affine':     general affine transform
+ *
+ *   NITER is the maximum number of iterations. By default, NITER=50.
+ *
+ *   TOL is the tolerance for the stopping criterion. The algorithm
+ *   stops when the relative change in RMS between iterations is below
+ *   TOL. By default, TOL=1e-6.
+ *
+ *   METRIC is a string with the error minimised at each iteration:
+ *
+ *     'point' (default): point-to-point, squared distance between each
+ *                        moving point and its closest fixed point.
+ *     'plane':           point-to-plane, squared distance between each
+ *                        moving point and the tangent plane at the
+ *                        closest fixed point. Usually converges in far
+ *                        fewer iterations on surfaces. The normals of
+ *                        the fixed points are estimated from their 10
+ *                        nearest neighbours.
+ *
+ *   SAMPLING is a string to select which moving points are used to
+ *   compute the transform (all points are warped for the output Y2):
+ *
+ *     'all' (default): all points.
+ *     'random':        NSAMPLES points, selected at random.
+ *     'normal':        NSAMPLES points, selected with normal-space
+ *                      sampling (Rusinkiewicz and Levoy, 2001), so
+ *                      that the samples are spread evenly over the
+ *                      normal directions of the surface.
+ *
+ *   NSAMPLES is the number of samples for 'random' and 'normal'
+ *   SAMPLING. By default, 10% of the moving points.
+ *
+ *   T is a (4, 4) matrix with the homogeneous transform that maps Y
+ *   onto X, i.e. [Y2, ones(N, 1)]' = T * [Y, ones(N, 1)]'.
+ *
+ *   RMS is the root mean square distance between the (sampled) moving
+ *   points and their closest fixed points after registration.
  *
  */
 
  /*
   * Author: Ramon Casero <rcasero@gmail.com>
-  * Copyright © 2013 University of Oxford
-  * Version: 0.0.5
+  * Copyright © 2013-2015 University of Oxford
+  * Version: 0.1.0
   * $Rev$
   * $Date$
   *
@@ -43,17 +106,20 @@
 #ifndef ITKICPREGISTRATION
 #define ITKICPREGISTRATION
 
-#define DEBUG
 
 /* mex headers */
 #include <mex.h>
 
 /* C++ headers */
+#include <cmath>
 #include <iostream>
+#include <string>
 
 /* Gerardus headers */
 #include "MatlabImportFilter.h"
 #include "MatlabExportFilter.h"
+#include "GerardusParallel.h"
+#include "ICPEngine.h"
 
 /* ITK headers */
 #include "itkTranslationTransform.h"
@@ -70,6 +136,125 @@ typedef double CoordinateType;
 typedef itk::PointSet<CoordinateType, Dimension> PointSetType;
 typedef PointSetType::PointType PointType;
 
+/* Inputs/outputs interfaces */
+enum InputIndexType {IN_X, IN_Y, IN_TRANSFORM, 
+		     IN_NITER, IN_GRADTOL, IN_VALTOL, IN_EPSFUN, 
+		     InputIndexType_MAX}; // IN_GRADTOL, IN_VALTOL, IN_EPSFUN only for ITK
+enum OutputIndexType {OUT_YY, OUT_T, OUT_RMS, OutputIndexType_MAX}; // OUT_RMS only for native engine
+
+/*
+ * runNativeRegistration(): ICP registration with the k-d tree engine
+ * in ICPEngine.h
+ */
+void runNativeRegistration(MatlabImportFilter::Pointer matlabImport,
+			   MatlabExportFilter::Pointer matlabExport,
+			   ICPTransformType transformType) {
+
+  // inputs exclusive to the native engine (they take the place of
+  // GRADTOL, VALTOL, EPSFUN in the ITK syntax)
+  enum NativeInputIndexType {IN_TOL = IN_NITER + 1, IN_METRIC, IN_SAMPLING,
+			     IN_NSAMPLES, NativeInputIndexType_MAX};
+
+  // check number of input arguments
+  matlabImport->CheckNumberOfArguments(2, NativeInputIndexType_MAX);
+
+  // retrieve pointers to the inputs that we are going to need here
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer; 
+  MatlabInputPointer inX        = matlabImport->GetRegisteredInput("X");
+  MatlabInputPointer inY        = matlabImport->GetRegisteredInput("Y");
+  MatlabInputPointer inNITER    = matlabImport->GetRegisteredInput("NITER");
+
+  // register the inputs exclusive to this function
+  MatlabInputPointer inTOL      = matlabImport->RegisterInput(IN_TOL, "TOL");
+  MatlabInputPointer inMETRIC   = matlabImport->RegisterInput(IN_METRIC, "METRIC");
+  MatlabInputPointer inSAMPLING = matlabImport->RegisterInput(IN_SAMPLING, "SAMPLING");
+  MatlabInputPointer inNSAMPLES = matlabImport->RegisterInput(IN_NSAMPLES, "NSAMPLES");
+
+  // outputs
+  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
+  MatlabOutputPointer outYY  = matlabExport->RegisterOutput(OUT_YY, "Y2");
+  MatlabOutputPointer outT   = matlabExport->RegisterOutput(OUT_T, "T");
+  MatlabOutputPointer outRMS = matlabExport->RegisterOutput(OUT_RMS, "RMS");
+
+  // point sets
+  if (!mxIsDouble(inX->pm) || !mxIsDouble(inY->pm)) {
+    mexErrMsgTxt("X and Y must be of type double");
+  }
+  const double *x = mxGetPr(inX->pm);
+  const double *y = mxGetPr(inY->pm);
+  mwSize nx = mxGetM(inX->pm);
+  mwSize ny = mxGetM(inY->pm);
+
+  // read parameters
+  unsigned int niter = matlabImport->ReadScalarFromMatlab<unsigned int>(inNITER, 50);
+  double tol = matlabImport->ReadScalarFromMatlab<double>(inTOL, 1e-6);
+
+  std::string metricStr = matlabImport->ReadStringFromMatlab(inMETRIC, "point");
+  ICPMetricType metric = ICP_POINT_TO_POINT;
+  if (metricStr == "point") {
+    metric = ICP_POINT_TO_POINT;
+  } else if (metricStr == "plane") {
+    metric = ICP_POINT_TO_PLANE;
+  } else {
+    mexErrMsgTxt("METRIC must be 'point' or 'plane'");
+  }
+
+  std::string samplingStr = matlabImport->ReadStringFromMatlab(inSAMPLING, "all");
+  ICPSamplingType sampling = ICP_SAMPLING_ALL;
+  if (samplingStr == "all") {
+    sampling = ICP_SAMPLING_ALL;
+  } else if (samplingStr == "random") {
+    sampling = ICP_SAMPLING_RANDOM;
+  } else if (samplingStr == "normal") {
+    sampling = ICP_SAMPLING_NORMAL;
+  } else {
+    mexErrMsgTxt("SAMPLING must be 'all', 'random' or 'normal'");
+  }
+  mwSize nsamples = matlabImport->ReadScalarFromMatlab<mwSize>(inNSAMPLES, 
+			    (mwSize)std::ceil(0.1 * ny));
+  if (nsamples == 0) {
+    mexErrMsgTxt("NSAMPLES must be >= 1");
+  }
+
+  // run registration, starting from the identity
+  double A[9] = {1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0};
+  double b[3] = {0.0, 0.0, 0.0};
+  unsigned int iter;
+  double rms = icpRegister(x, nx, y, ny, transformType, metric, sampling, nsamples,
+			   niter, tol, A, b, iter);
+
+  // warp the moving points according to the solution
+  if (outYY->isRequested) {
+    double *yy = matlabExport->AllocateMatrixInMatlab<double>(outYY, ny, Dimension);
+    for (mwIndex i = 0; i < ny; ++i) {
+      for (mwIndex r = 0; r < Dimension; ++r) {
+	yy[i + ny * r] = A[r * 3] * y[i] + A[r * 3 + 1] * y[i + ny]
+	  + A[r * 3 + 2] * y[i + 2 * ny] + b[r];
+      }
+    }
+  }
+
+  // homogeneous transform
+  if (outT->isRequested) {
+    double *t = matlabExport->AllocateMatrixInMatlab<double>(outT, 4, 4);
+    for (mwIndex r = 0; r < Dimension; ++r) {
+      for (mwIndex c = 0; c < Dimension; ++c) {
+	t[r + 4 * c] = A[r * 3 + c];
+      }
+      t[r + 4 * 3] = b[r];
+      t[3 + 4 * r] = 0.0;
+    }
+    t[15] = 1.0;
+  }
+
+  // final RMS
+  if (outRMS->isRequested) {
+    double *prms = matlabExport->AllocateMatrixInMatlab<double>(outRMS, 1, 1);
+    prms[0] = rms;
+  }
+
+}
+
 /*
  * mexFunction(): entry point for the mex function
  */
@@ -77,13 +262,14 @@ void mexFunction(int nlhs, mxArray *plhs[],
 		 int nrhs, const mxArray *prhs[]) {
 
   // interface to deal with input arguments from Matlab
-  enum InputIndexType {IN_X, IN_Y, IN_TRANSFORM, 
-		       IN_NITER, IN_GRADTOL, IN_VALTOL, IN_EPSFUN, InputIndexType_MAX};
   MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
   matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
 
-  // check the number of input arguments
-  matlabImport->CheckNumberOfArguments(2, InputIndexType_MAX);
+  // the maximum number of input arguments depends on the transform,
+  // and it is checked below
+  if (nrhs < 2) {
+    mexErrMsgTxt("Not enough input arguments");
+  }
 
   // register the inputs for this function at the import filter
   typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
@@ -91,13 +277,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
   MatlabInputPointer inY = matlabImport->RegisterInput(IN_Y, "Y");
   MatlabInputPointer inTRANSFORM = matlabImport->RegisterInput(IN_TRANSFORM, "TRANSFORM");
   MatlabInputPointer inNITER = matlabImport->RegisterInput(IN_NITER, "NITER");
-  MatlabInputPointer inGRADTOL = matlabImport->RegisterInput(IN_GRADTOL, "GRADTOL");
-  MatlabInputPointer inVALTOL = matlabImport->RegisterInput(IN_VALTOL, "VALTOL");
-  MatlabInputPointer inEPSFUN = matlabImport->RegisterInput(IN_EPSFUN, "EPSFUN");
-
 
   // interface to deal with outputs to Matlab
-  enum OutputIndexType {OUT_YY, OUT_T, OutputIndexType_MAX};
   MatlabExportFilter::Pointer matlabExport = MatlabExportFilter::New();
   matlabExport->ConnectToMatlabFunctionOutput(nlhs, plhs);
   
@@ -106,47 +287,69 @@ void mexFunction(int nlhs, mxArray *plhs[],
 
   // register the outputs for this function at the export filter
   typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
-  MatlabOutputPointer outYY = matlabExport->RegisterOutput(OUT_YY, "Y2");
-  MatlabOutputPointer outT  = matlabExport->RegisterOutput(OUT_T, "T");
+  MatlabOutputPointer outYY  = matlabExport->RegisterOutput(OUT_YY, "Y2");
+  MatlabOutputPointer outT   = matlabExport->RegisterOutput(OUT_T, "T");
+  MatlabOutputPointer outRMS = matlabExport->RegisterOutput(OUT_RMS, "RMS");
 
   // if any input point set is empty, the outputs are empty too
-  if (mxIsEmpty(prhs[IN_X]) || mxIsEmpty(prhs[IN_Y])) {
+  if (mxIsEmpty(inX->pm) || mxIsEmpty(inY->pm)) {
     matlabExport->CopyEmptyArrayToMatlab(outYY);
     matlabExport->CopyEmptyArrayToMatlab(outT);
+    matlabExport->CopyEmptyArrayToMatlab(outRMS);
     return;
   }
 
   // get size of input matrix with the points
-  mwSize nrowsX = mxGetM(prhs[IN_X]);
-  mwSize ncolsX = mxGetN(prhs[IN_X]);
-  mwSize nrowsY = mxGetM(prhs[IN_Y]);
-  mwSize ncolsY = mxGetN(prhs[IN_Y]);
+  mwSize nrowsX = mxGetM(inX->pm);
+  mwSize ncolsX = mxGetN(inX->pm);
+  mwSize nrowsY = mxGetM(inY->pm);
+  mwSize ncolsY = mxGetN(inY->pm);
   if (ncolsX != Dimension || ncolsY != Dimension) {
     mexErrMsgTxt("X and Y must have 3 columns");
   }
 
+  // transform type
+  std::string transformStr = matlabImport->ReadStringFromMatlab(inTRANSFORM, "translation");
+  if (transformStr == "rigid") {
+    runNativeRegistration(matlabImport, matlabExport, ICP_RIGID);
+    return;
+  } else if (transformStr == "similarity") {
+    runNativeRegistration(matlabImport, matlabExport, ICP_SIMILARITY);
+    return;
+  } else if (transformStr == "affine") {
+    runNativeRegistration(matlabImport, matlabExport, ICP_AFFINE);
+    return;
+  } else if (transformStr != "translation") {
+    mexErrMsgTxt("TRANSFORM must be 'translation', 'rigid', 'similarity' or 'affine'");
+  }
+
+  // the rest of this function is the ITK syntax
+  matlabImport->CheckNumberOfArguments(2, InputIndexType_MAX);
+  MatlabInputPointer inGRADTOL = matlabImport->RegisterInput(IN_GRADTOL, "GRADTOL");
+  MatlabInputPointer inVALTOL = matlabImport->RegisterInput(IN_VALTOL, "VALTOL");
+  MatlabInputPointer inEPSFUN = matlabImport->RegisterInput(IN_EPSFUN, "EPSFUN");
+  matlabExport->CopyEmptyArrayToMatlab(outRMS);
+
   // if there's some problem reading the point, default is NaN
   PointType def;
   def.Fill(mxGetNaN());
 
   // read point sets
   PointSetType::Pointer fixedPointSet = PointSetType::New();
-  // fixedPointSet->GetPoints()->CastToSTLContainer().resize(nrowsX);
-  PointSetType::Pointer xDef = PointSetType::New();
-  // fixedPointSet->GetPoints()->CastToSTLContainer()
-  //   = matlabImport->ReadVectorOfVectorsFromMatlab<PointType::ValueType, PointType>
-  //   (IN_X, "X", xDef->CastToSTLContainer());
-  //@@
-  // matlabImport->ReadMatrixFromMatlabIntoVectorOfVectors<PointType::ValueType, std::vector<PointType> >
-  //   (IN_X, "X", 
-  //    fixedPointSet->GetPoints()->CastToSTLContainer(), fixedPointSet->GetNumberOfPoints(), Dimension);
-
   PointSetType::Pointer movingPointSet = PointSetType::New();
-  movingPointSet->GetPoints()->CastToSTLContainer().resize(nrowsY);
-  //@@
-  // matlabImport->ReadMatrixFromMatlabIntoVectorOfVectors<PointType::ValueType, std::vector<PointType> >
-  //   (IN_Y, "Y", 
-  //    movingPointSet->GetPoints()->CastToSTLContainer(), movingPointSet->GetNumberOfPoints(), Dimension);
+  PointType point;
+  for (mwIndex i = 0; i < nrowsX; ++i) {
+    for (mwIndex col = 0; col < Dimension; ++col) {
+      point[col] = matlabImport->ReadScalarFromMatlab<CoordinateType>(inX, i, col, def[col]);
+    }
+    fixedPointSet->SetPoint(i, point);
+  }
+  for (mwIndex i = 0; i < nrowsY; ++i) {
+    for (mwIndex col = 0; col < Dimension; ++col) {
+      point[col] = matlabImport->ReadScalarFromMatlab<CoordinateType>(inY, i, col, def[col]);
+    }
+    movingPointSet->SetPoint(i, point);
+  }
 
 #ifdef DEBUG
   // debug
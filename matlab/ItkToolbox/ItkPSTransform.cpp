@@ -45,6 +45,62 @@
  *   pts_tps_map(), as it implements the classic kernel proposed by
  *   Bookstein, r^2 ln(r^2).
  *
+ * YI = itk_pstransform(..., ENGINE, TOL)
+ *
+ *   ENGINE is a string to select how the kernel transform is evaluated
+ *   on the points XI, once it has been fitted to the landmarks:
+ *
+ *   'direct' (default): Exact sum over all landmarks, computed by a
+ *            native cache-blocked loop, multithreaded over blocks of XI
+ *            points. Same result as 'itk', but much faster.
+ *
+ *   'tree':  Treecode approximation (Barnes-Hut type, with 2nd order
+ *            multipole expansions). Clusters of landmarks far from
+ *            the point are replaced by their expansion only when the
+ *            estimated truncation error is within TOL. Recommended for
+ *            thousands of landmarks and large XI. Only available for
+ *            'tps', 'tpsr2' and 'volume'. For 'elastic' and 'elasticr',
+ *            'direct' is used instead.
+ *
+ *   'itk':   Use ITK's KernelTransform::TransformPoint() point by point
+ *            (serial, slow, kept for reference).
+ *
+ *   TOL is a scalar with the maximum absolute error allowed in each
+ *   coordinate of YI by the 'tree' engine. By default,
+ *   TOL = 1e-6 * L, where L is the longest side of the bounding box of
+ *   X.
+ *
+ * [YI, W] = itk_pstransform(TRANSFORM, X, Y, XI, ...)
+ *
+ *   W is a struct with the kernel transform fitted to the landmarks
+ *   (kernel transforms only). W can be reused to warp other points
+ *   without fitting the transform again, e.g. when an image is warped
+ *   block by block. XI can be empty if only W is needed.
+ *
+ *   By default (ENGINE 'direct' or 'tree'), the transform is fitted with
+ *   a native solver: the affine constraints are eliminated with a QR
+ *   decomposition of the landmark coordinates, and the remaining
+ *   symmetric definite system is solved with a blocked, multithreaded
+ *   Cholesky factorization. If that system is not definite (e.g.
+ *   landmarks on a plane, or fewer than Dimension+2 landmarks), ITK's
+ *   SVD solver is used instead. With ENGINE 'itk', the transform is
+ *   always fitted by ITK.
+ *
+ *   W has fields:
+ *
+ *     'transform': TRANSFORM string.
+ *     'X':         landmarks X, as an (N,D)-matrix of type double.
+ *     'W':         (N,D)-matrix with the kernel weights.
+ *     'A', 'B':    affine part of the transform, y = x + x*A' + B.
+ *     'alpha':     alpha parameter of the elastic kernels.
+ *
+ * YI = itk_pstransform(W, XI)
+ * YI = itk_pstransform(W, XI, ENGINE, TOL)
+ *
+ *   Warp points XI with a transform W previously fitted by
+ *   itk_pstransform. ENGINE can be 'direct' (default) or 'tree', and
+ *   TOL is the same as above.
+ *
  * YI = itk_pstransform('bspline', X, Y, XI, ORDER, LEVELS)
  *
  *   'bspline':  itk::BSplineScatteredDataPointSetToImageFilter
@@ -59,14 +115,29 @@
  *   in the algorithm. A higher number of levels will make the spline
  *   more flexible and match the landmarks better. By default, LEVELS=5.
  *
- * See also: pts_tps_map, pts_tps_weights.
+ * YI = itk_pstransform('bspline', X, Y, CI, ...)
+ *
+ *   CI is a cell array CI={XI, YI, ZI} (or CI={XI, YI} in 2D), where
+ *   XI, YI and ZI are vectors that describe a rectangular grid, as in
+ *   cgal_insurftri. This is much faster and uses less memory than
+ *   passing the coordinates of every point of the grid, as the B-spline
+ *   is evaluated separably, one axis at a time, and slices of the grid
+ *   are processed in parallel.
+ *
+ *   The output is then an array of size (ny, nx, nz, 3) (or (ny, nx, 2)
+ *   in 2D), where nx, ny, nz are the lengths of the grid vectors, and
+ *   element (r, c, s, :) is the warped point (CI{1}(c), CI{2}(r),
+ *   CI{3}(s)). Note that rows correspond to the y-coordinate and
+ *   columns to the x-coordinate, as in meshgrid.
+ *
+ * See also: pts_tps_map, pts_tps_weights, cgal_insurftri.
  *
  */
 
  /*
   * Author: Ramon Casero <rcasero@gmail.com>
-  * Copyright © 2011-2013 University of Oxford
-  * Version: 0.5.0
+  * Copyright © 2011-2015 University of Oxford
+  * Version: 0.8.0
   * $Rev$
   * $Date$
   *
@@ -108,8 +179,10 @@
 /* C++ headers */
 #include <iostream>
 #include <cmath>
+#include <cstring>
 #include <limits>
 #include <algorithm>
+#include <string>
 
 /* ITK headers */
 #include "itkImage.h"
@@ -128,11 +201,85 @@
 #include "GerardusCommon.h"
 #include "MatlabImportFilter.h"
 #include "MatlabExportFilter.h"
+#include "GerardusParallel.h"
+#include "KernelTransformEngine.h"
+#include "BSplineGridEngine.h"
 
 /* Inputs/outputs interfaces */
 enum InputIndexType {IN_TRANSFORM, IN_X, IN_Y, IN_XI, 
 		     IN_ORDER, IN_LEVELS, InputIndexType_MAX}; // IN_ORDER, IN_LEVELS only for B-spline
-enum OutputIndexType {OUT_YI, OutputIndexType_MAX};
+enum OutputIndexType {OUT_YI, OUT_W, OutputIndexType_MAX}; // OUT_W only for kernel transforms
+
+/*
+ * KernelTransformAccessor: thin wrapper around an ITK kernel transform
+ * that gives read access to the fitted matrices, so that the transform
+ * can be evaluated by the native engines in KernelTransformEngine.h
+ */
+template <class TTransform>
+class KernelTransformAccessor : public TTransform {
+
+public:
+
+  typedef KernelTransformAccessor        Self;
+  typedef TTransform                     Superclass;
+  typedef itk::SmartPointer<Self>        Pointer;
+  typedef itk::SmartPointer<const Self>  ConstPointer;
+
+  itkNewMacro(Self);
+
+  // copy source landmarks, weights and affine part of the transform
+  // to a model that can be evaluated by the native engines
+  template <unsigned int Dimension>
+  void ExportModel(KernelTransformModel<Dimension> &model) const {
+    mwSize N = this->m_SourceLandmarks->GetNumberOfPoints();
+    model.Resize(N);
+    typename Superclass::PointsIterator sp 
+      = this->m_SourceLandmarks->GetPoints()->Begin();
+    for (mwSize i = 0; i < N; ++i) {
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	model.src[d * N + i] = sp->Value()[d];
+	model.w[d * N + i] = this->m_DMatrix(d, i);
+      }
+      ++sp;
+    }
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      for (unsigned int j = 0; j < Dimension; ++j) {
+	model.A[i * Dimension + j] = this->m_AMatrix(i, j);
+      }
+      model.B[i] = this->m_BVector[i];
+    }
+  }
+
+protected:
+
+  KernelTransformAccessor() {}
+  ~KernelTransformAccessor() {}
+
+private:
+
+  KernelTransformAccessor(const Self&); // purposely not implemented
+  void operator=(const Self&);          // purposely not implemented
+
+};
+
+/*
+ * getKernelAlpha(): alpha constant of the elastic body kernels. Other
+ * kernels don't have this parameter
+ */
+template <class TTransform>
+double getKernelAlpha(const TTransform *) {
+  return 0.0;
+}
+
+template <class TScalarType, unsigned int Dimension>
+double getKernelAlpha(const itk::ElasticBodySplineKernelTransform<TScalarType, Dimension> *transform) {
+  return transform->GetAlpha();
+}
+
+template <class TScalarType, unsigned int Dimension>
+double getKernelAlpha(const itk::ElasticBodyReciprocalSplineKernelTransform<TScalarType, Dimension> *transform) {
+  return transform->GetAlpha();
+}
 
 /* Functions */
 
@@ -153,31 +300,61 @@ void runBSplineTransform(MatlabImportFilter::Pointer matlabImport,
   typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
   MatlabOutputPointer outYI = matlabExport->RegisterOutput(OUT_YI, "YI");
 
+  // the B-spline transform cannot be returned for reuse
+  matlabExport->CheckNumberOfArguments(0, 1);
+
   // spline order (input argument): default or user-provided
   unsigned int splineOrder = matlabImport->ReadScalarFromMatlab<unsigned int>(inORDER, 3);
 
   // number of levels (input argument): default or user-provided
   unsigned int numOfLevels = matlabImport->ReadScalarFromMatlab<unsigned int>(inLEVELS, 5);
 
+  // XI can be a list of points, or a cell array {XI, YI, ZI} with
+  // the coordinates of a rectangular grid
+  bool isGrid = mxIsCell(inXI->pm);
+
   // get size of input arguments
   mwSize Mx = mxGetM(inX->pm); // number of source points
-  mwSize Mxi = mxGetM(inXI->pm); // number of points to be warped
+  mwSize Mxi = 0; // number of points to be warped
 
   // pointers to input matrices
   TScalarType *x 
     = (TScalarType *)mxGetData(inX->pm); // source points
   TScalarType *y 
     = (TScalarType *)mxGetData(inY->pm); // target points
-  TScalarType *xi 
-    = (TScalarType *)mxGetData(inXI->pm); // points to be warped
+  TScalarType *xi = NULL; // points to be warped
+  const TScalarType *gridAxis[Dimension]; // grid vectors
+  size_t gridLen[Dimension]; // length of the grid vectors
   if (x == NULL) {
     mexErrMsgTxt("Cannot get a pointer to input X");
   }
   if (y == NULL) {
     mexErrMsgTxt("Cannot get a pointer to input Y");
   }
-  if (xi == NULL) {
-    mexErrMsgTxt("Cannot get a pointer to input XI");
+  if (isGrid) {
+    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+      const mxArray *pAxis = mxGetCell(inXI->pm, col);
+      if (pAxis == NULL) {
+	mexErrMsgTxt("Cannot get pointer to vectors inside cell array XI");
+      }
+      if (std::min(mxGetM(pAxis), mxGetN(pAxis)) > 1) {
+	mexErrMsgTxt("Cell array XI must contain vectors");
+      }
+      gridAxis[col] = (TScalarType *)mxGetData(pAxis);
+      gridLen[col] = mxGetNumberOfElements(pAxis);
+
+      // if any of the vectors is empty, the grid is empty
+      if (gridLen[col] == 0) {
+	matlabExport->CopyEmptyArrayToMatlab(outYI);
+	return;
+      }
+    }
+  } else {
+    Mxi = mxGetM(inXI->pm);
+    xi = (TScalarType *)mxGetData(inXI->pm);
+    if (xi == NULL) {
+      mexErrMsgTxt("Cannot get a pointer to input XI");
+    }
   }
 
   // type definitions for the BSPline transform
@@ -217,6 +394,15 @@ void runBSplineTransform(MatlabImportFilter::Pointer matlabImport,
       term[CAST2MWSIZE(col)] = std::max((TScalarType)term[CAST2MWSIZE(col)], xi[Mxi * col + row]);
     }
   }
+  if (isGrid) {
+    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+      const TScalarType *axis = gridAxis[col];
+      orig[CAST2MWSIZE(col)] = std::min((TScalarType)orig[CAST2MWSIZE(col)], 
+				       *std::min_element(axis, axis + gridLen[col]));
+      term[CAST2MWSIZE(col)] = std::max((TScalarType)term[CAST2MWSIZE(col)], 
+				       *std::max_element(axis, axis + gridLen[col]));
+    }
+  }
 
   // compute length of each size of the bounding box
   DataType len = term - orig;
@@ -284,6 +470,51 @@ void runBSplineTransform(MatlabImportFilter::Pointer matlabImport,
   // run transform
   transform->Update();
 
+  // evaluate the B-spline on a rectangular grid with the separable
+  // engine, in parallel
+  if (isGrid) {
+
+    // copy the control point lattice to a plain array
+    const ImageType *lattice = transform->GetPhiLattice();
+    typename ImageType::SizeType latSz = lattice->GetLargestPossibleRegion().GetSize();
+    size_t latSize[Dimension];
+    size_t numNodes = 1;
+    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+      latSize[col] = latSz[CAST2MWSIZE(col)];
+      numNodes *= latSize[col];
+    }
+    std::vector<double> phi(numNodes * Dimension);
+    const DataType *node = lattice->GetBufferPointer();
+    for (size_t i = 0; i < numNodes; ++i) {
+      for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+	phi[i * Dimension + col] = node[i][CAST2MWSIZE(col)];
+      }
+    }
+
+    // output array: rows correspond to YI, columns to XI, slices to
+    // ZI, and the last dimension to the coordinates of the warped
+    // point
+    std::vector<mwSize> size;
+    size.push_back(gridLen[1]);
+    size.push_back(gridLen[0]);
+    if (Dimension == 3) {
+      size.push_back(gridLen[2]);
+    }
+    size.push_back(Dimension);
+    TScalarType *yi 
+      = matlabExport->AllocateNDArrayInMatlab<TScalarType>(outYI, size);
+
+    double origin[Dimension];
+    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+      origin[col] = orig[CAST2MWSIZE(col)];
+    }
+    BSplineGridEvaluator<TScalarType, Dimension> 
+      evaluator(phi, latSize, splineOrder, gridAxis, gridLen, origin, lenmax, yi);
+    parallelFor(0, gridLen[Dimension - 1], evaluator);
+
+    return;
+  }
+
   // create output vector and pointer to populate it
   mwSize ndimxi = mxGetNumberOfDimensions(inXI->pm); 
   const mwSize *dimsxi = mxGetDimensions(inXI->pm);
@@ -335,14 +566,192 @@ void runBSplineTransform(MatlabImportFilter::Pointer matlabImport,
 
 }
 
+// kernelTypeToString(), stringToKernelType(): convert between the
+// TRANSFORM strings and the kernel types of the native engines
+const char *kernelTypeToString(KernelType kernel) {
+  switch (kernel) {
+  case KERNEL_TPS:
+    return "tps";
+  case KERNEL_TPSR2:
+    return "tpsr2";
+  case KERNEL_VOLUME:
+    return "volume";
+  case KERNEL_ELASTIC:
+    return "elastic";
+  case KERNEL_ELASTICR:
+    return "elasticr";
+  default:
+    mexErrMsgTxt("Unknown kernel type");
+  }
+  return "";
+}
+
+bool stringToKernelType(std::string str, KernelType &kernel) {
+  if (str == "tps") {
+    kernel = KERNEL_TPS;
+  } else if (str == "tpsr2") {
+    kernel = KERNEL_TPSR2;
+  } else if (str == "volume") {
+    kernel = KERNEL_VOLUME;
+  } else if (str == "elastic") {
+    kernel = KERNEL_ELASTIC;
+  } else if (str == "elasticr") {
+    kernel = KERNEL_ELASTICR;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// exportKernelTransformModel<Dimension>()
+//
+// copy a fitted kernel transform to a Matlab struct W, so that it can
+// be reused with the syntax YI = itk_pstransform(W, XI)
+template <unsigned int Dimension>
+void exportKernelTransformModel(MatlabExportFilter::MatlabOutputPointer outW,
+				const KernelTransformModel<Dimension> &model) {
+
+  const char *fieldNames[] = {"transform", "X", "W", "A", "B", "alpha"};
+  mxArray *w = mxCreateStructMatrix(1, 1, 6, fieldNames);
+  if (w == NULL) {
+    mexErrMsgTxt(("Cannot allocate memory for output " + outW->name).c_str());
+  }
+
+  // landmarks and weights: (N x Dimension) matrices, like X, Y
+  mxArray *srcMx = mxCreateDoubleMatrix(model.N, Dimension, mxREAL);
+  mxArray *wMx = mxCreateDoubleMatrix(model.N, Dimension, mxREAL);
+  mxArray *aMx = mxCreateDoubleMatrix(Dimension, Dimension, mxREAL);
+  mxArray *bMx = mxCreateDoubleMatrix(1, Dimension, mxREAL);
+  if (srcMx == NULL || wMx == NULL || aMx == NULL || bMx == NULL) {
+    mexErrMsgTxt(("Cannot allocate memory for output " + outW->name).c_str());
+  }
+  if (model.N > 0) {
+    std::copy(model.src.begin(), model.src.end(), mxGetPr(srcMx));
+    std::copy(model.w.begin(), model.w.end(), mxGetPr(wMx));
+  }
+  double *a = mxGetPr(aMx);
+  for (mwSize i = 0; i < Dimension; ++i) {
+    for (mwSize j = 0; j < Dimension; ++j) {
+      a[Dimension * j + i] = model.A[i * Dimension + j];
+    }
+  }
+  std::copy(model.B, model.B + Dimension, mxGetPr(bMx));
+
+  mxSetField(w, 0, "transform", mxCreateString(kernelTypeToString(model.kernel)));
+  mxSetField(w, 0, "X", srcMx);
+  mxSetField(w, 0, "W", wMx);
+  mxSetField(w, 0, "A", aMx);
+  mxSetField(w, 0, "B", bMx);
+  mxSetField(w, 0, "alpha", mxCreateDoubleScalar(model.alpha));
+
+  *outW->ppm = w;
+}
+
+// importKernelTransformModel<Dimension>()
+//
+// read a fitted kernel transform from a Matlab struct W created by
+// exportKernelTransformModel()
+template <unsigned int Dimension>
+void importKernelTransformModel(MatlabImportFilter::Pointer matlabImport,
+				MatlabImportFilter::MatlabInputPointer inW,
+				KernelTransformModel<Dimension> &model) {
+
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
+  MatlabInputPointer inWTRANSFORM = matlabImport->RegisterStructFieldInput(inW, "transform");
+  MatlabInputPointer inWX         = matlabImport->RegisterStructFieldInput(inW, "X");
+  MatlabInputPointer inWW         = matlabImport->RegisterStructFieldInput(inW, "W");
+  MatlabInputPointer inWA         = matlabImport->RegisterStructFieldInput(inW, "A");
+  MatlabInputPointer inWB         = matlabImport->RegisterStructFieldInput(inW, "B");
+  MatlabInputPointer inWALPHA     = matlabImport->RegisterStructFieldInput(inW, "alpha");
+
+  if (!stringToKernelType(matlabImport->ReadStringFromMatlab(inWTRANSFORM, ""),
+			  model.kernel)) {
+    mexErrMsgTxt("W.transform is not a valid kernel transform");
+  }
+  model.alpha = matlabImport->ReadScalarFromMatlab<double>(inWALPHA, 0.0);
+
+  // landmarks and weights
+  if (!inWX->isProvided || !inWW->isProvided || !inWA->isProvided || !inWB->isProvided) {
+    mexErrMsgTxt("W must have non-empty fields X, W, A and B");
+  }
+  if (!mxIsDouble(inWX->pm) || !mxIsDouble(inWW->pm) 
+      || !mxIsDouble(inWA->pm) || !mxIsDouble(inWB->pm)) {
+    mexErrMsgTxt("W.X, W.W, W.A and W.B must be of type double");
+  }
+  mwSize N = mxGetM(inWX->pm);
+  if (mxGetN(inWX->pm) != Dimension || mxGetM(inWW->pm) != N
+      || mxGetN(inWW->pm) != Dimension
+      || mxGetNumberOfElements(inWA->pm) != Dimension * Dimension
+      || mxGetNumberOfElements(inWB->pm) != Dimension) {
+    mexErrMsgTxt("Fields of W have inconsistent sizes");
+  }
+  model.Resize(N);
+  const double *src = mxGetPr(inWX->pm);
+  const double *w = mxGetPr(inWW->pm);
+  std::copy(src, src + Dimension * N, model.src.begin());
+  std::copy(w, w + Dimension * N, model.w.begin());
+  const double *a = mxGetPr(inWA->pm);
+  for (mwSize i = 0; i < Dimension; ++i) {
+    for (mwSize j = 0; j < Dimension; ++j) {
+      model.A[i * Dimension + j] = a[Dimension * j + i];
+    }
+  }
+  const double *bvec = mxGetPr(inWB->pm);
+  std::copy(bvec, bvec + Dimension, model.B);
+}
+
+// evaluateKernelTransformModel<TScalarType, Dimension>()
+//
+// evaluate a fitted kernel transform on points XI with the native
+// engines
+template <class TScalarType, unsigned int Dimension>
+void evaluateKernelTransformModel(MatlabImportFilter::Pointer matlabImport,
+				  MatlabImportFilter::MatlabInputPointer inTOL,
+				  const KernelTransformModel<Dimension> &model,
+				  const std::string &engine,
+				  const TScalarType *xi, TScalarType *yi, mwSize Mxi) {
+
+  // transform points with the treecode, if requested and available
+  // for this kernel
+  if (engine == "tree" && model.IsRadial()) {
+
+    // default tolerance, relative to the size of the landmark cloud
+    double lenmax = 0.0;
+    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+      std::vector<double>::const_iterator xcol = model.src.begin() + model.N * col;
+      lenmax = std::max(lenmax, *std::max_element(xcol, xcol + model.N)
+			- *std::min_element(xcol, xcol + model.N));
+    }
+    double tol = matlabImport->ReadScalarFromMatlab<double>(inTOL, 1e-6 * lenmax);
+    if (tol <= 0.0) {
+      mexErrMsgTxt("TOL must be > 0");
+    }
+
+    KernelTreecodeEvaluator<TScalarType, Dimension> evaluator(model, xi, yi, Mxi, tol);
+    parallelFor(0, Mxi, evaluator);
+    return;
+  }
+
+  // transform points by direct summation
+  KernelDirectEvaluator<TScalarType, Dimension> evaluator(model, xi, yi, Mxi);
+  parallelFor(0, Mxi, evaluator);
+
+}
+
 // runKernelTransform<TScalarType, Dimension, TransformType>()
 template <class TScalarType, unsigned int Dimension, class TransformType>
 void runKernelTransform(MatlabImportFilter::Pointer matlabImport,
-			MatlabExportFilter::Pointer matlabExport) {
+			MatlabExportFilter::Pointer matlabExport,
+			KernelType kernel) {
+
+  // inputs exclusive to the kernel transforms (they take the place
+  // of ORDER, LEVELS in the B-spline syntax. Thus, we cannot use
+  // InputIndexType_MAX)
+  enum KernelInputIndexType {IN_ENGINE = IN_XI + 1, IN_TOL, 
+			     KernelInputIndexType_MAX};
 
-  // check number of input arguments (the kernel transform syntax
-  // accepts up to 4 arguments only. Thus, we cannot use InputIndexType_MAX)
-  matlabImport->CheckNumberOfArguments(4, 4);
+  // check number of input arguments
+  matlabImport->CheckNumberOfArguments(4, KernelInputIndexType_MAX);
 
   // retrieve pointers to the inputs that we are going to need here
   typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer; 
@@ -350,9 +759,25 @@ void runKernelTransform(MatlabImportFilter::Pointer matlabImport,
   MatlabInputPointer inY         = matlabImport->GetRegisteredInput("Y");
   MatlabInputPointer inXI        = matlabImport->GetRegisteredInput("XI");
 
+  // register the inputs exclusive to this function
+  MatlabInputPointer inENGINE    = matlabImport->RegisterInput(IN_ENGINE, "ENGINE");
+  MatlabInputPointer inTOL       = matlabImport->RegisterInput(IN_TOL, "TOL");
+
+  // the grid syntax is only implemented for the B-spline
+  if (mxIsCell(inXI->pm)) {
+    mexErrMsgTxt("XI can only be a cell array with the 'bspline' transform");
+  }
+
+  // evaluation engine
+  std::string engine = matlabImport->ReadStringFromMatlab(inENGINE, "direct");
+  if (engine != "direct" && engine != "tree" && engine != "itk") {
+    mexErrMsgTxt("ENGINE must be 'direct', 'tree' or 'itk'");
+  }
+
   // register the outputs for this function at the export filter
   typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
   MatlabOutputPointer outYI = matlabExport->RegisterOutput(OUT_YI, "YI");
+  MatlabOutputPointer outW = matlabExport->RegisterOutput(OUT_W, "W");
 
   // get size of input arguments
   mwSize Mx = mxGetM(inX->pm); // number of source points
@@ -373,47 +798,68 @@ void runKernelTransform(MatlabImportFilter::Pointer matlabImport,
   if (y == NULL) {
     mexErrMsgTxt("Cannot get a pointer to input Y");
   }
-  if (xi == NULL) {
+  if (xi == NULL && Mxi > 0) {
     mexErrMsgTxt("Cannot get a pointer to input XI");
   }
 
-  // type definitions and variables to store points for the kernel transform
-  typedef typename TransformType::PointSetType PointSetType;
-  typename PointSetType::Pointer fixedPointSet = PointSetType::New();
-  typename PointSetType::Pointer movingPointSet = PointSetType::New();
-  typename PointSetType::Pointer toWarpPointSet = PointSetType::New();
-  typedef typename PointSetType::PointsContainer PointsContainer;
-  typename PointsContainer::Pointer fixedPointContainer = PointsContainer::New();
-  typename PointsContainer::Pointer movingPointContainer = PointsContainer::New();
-  typedef typename PointSetType::PointType PointType;
-  PointType fixedPoint;
-  PointType movingPoint;
-  PointType toWarpPoint;
-  PointType warpedPoint;
+  // we use the accessor, so that the weights fitted by ITK can be
+  // passed to the native engines
+  typedef KernelTransformAccessor<TransformType> AccessorType;
+  typename AccessorType::Pointer transform = AccessorType::New();
+
+  // fit the transform with the native solver, unless the user wants
+  // ITK to do all the work
+  KernelTransformModel<Dimension> model;
+  model.kernel = kernel;
+  model.alpha = getKernelAlpha(static_cast<const TransformType *>(transform.GetPointer()));
+  bool isFitted = false;
+  if (engine != "itk") {
+    isFitted = fitKernelTransformModel<TScalarType, Dimension>(model, x, y, Mx);
+  }
 
-  // duplicate the input x and y matrices to PointSet format so that
-  // we can pass it to the ITK function
-  mwSize pointId=0;
-  for (mwSize row=0; row < Mx; ++row) {
-    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
-      fixedPoint[CAST2MWSIZE(col)] = y[Mx * col + row];
-      movingPoint[CAST2MWSIZE(col)] = x[Mx * col + row];
+  // fit the transform with ITK's solver (SVD). This is also the
+  // fallback when the native Cholesky solver cannot be used, e.g. with
+  // fewer landmarks than Dimension+2, or coplanar landmarks
+  if (!isFitted) {
+
+    // type definitions and variables to store points for the kernel transform
+    typedef typename TransformType::PointSetType PointSetType;
+    typename PointSetType::Pointer fixedPointSet = PointSetType::New();
+    typename PointSetType::Pointer movingPointSet = PointSetType::New();
+    typedef typename PointSetType::PointsContainer PointsContainer;
+    typename PointsContainer::Pointer fixedPointContainer = PointsContainer::New();
+    typename PointsContainer::Pointer movingPointContainer = PointsContainer::New();
+    typedef typename PointSetType::PointType PointType;
+    PointType fixedPoint;
+    PointType movingPoint;
+
+    // duplicate the input x and y matrices to PointSet format so that
+    // we can pass it to the ITK function
+    mwSize pointId=0;
+    for (mwSize row=0; row < Mx; ++row) {
+      for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+	fixedPoint[CAST2MWSIZE(col)] = y[Mx * col + row];
+	movingPoint[CAST2MWSIZE(col)] = x[Mx * col + row];
+      }
+      fixedPointContainer->InsertElement(pointId, fixedPoint);
+      movingPointContainer->InsertElement(pointId, movingPoint);
+      ++pointId;
     }
-    fixedPointContainer->InsertElement(pointId, fixedPoint);
-    movingPointContainer->InsertElement(pointId, movingPoint);
-    ++pointId;
+    fixedPointSet->SetPoints(fixedPointContainer);
+    movingPointSet->SetPoints(movingPointContainer);
+
+    // compute the transform
+    transform->SetSourceLandmarks(movingPointSet);
+    transform->SetTargetLandmarks(fixedPointSet);
+    transform->ComputeWMatrix();
+    transform->template ExportModel<Dimension>(model);
+  }
+
+  // return the fitted transform, so that it can be reused
+  if (outW->isRequested) {
+    exportKernelTransformModel<Dimension>(outW, model);
   }
-  fixedPointSet->SetPoints(fixedPointContainer);
-  movingPointSet->SetPoints(movingPointContainer);
 
-  // compute the transform
-  typename TransformType::Pointer transform;
-  transform = TransformType::New();
-  
-  transform->SetSourceLandmarks(movingPointSet);
-  transform->SetTargetLandmarks(fixedPointSet);
-  transform->ComputeWMatrix();
-  
   // create output vector and pointer to populate it
   ndimxi = mxGetNumberOfDimensions(inXI->pm);
   dimsxi = mxGetDimensions(inXI->pm);
@@ -424,23 +870,150 @@ void runKernelTransform(MatlabImportFilter::Pointer matlabImport,
 
   TScalarType *yi 
     = matlabExport->AllocateNDArrayInMatlab<TScalarType>(outYI, size);
+  if (Mxi == 0) {
+    return;
+  }
 
-  // transform points
-  for (mwSize row=0; row < Mxi; ++row) {
-    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
-      toWarpPoint[CAST2MWSIZE(col)] = xi[Mxi * col + row];
-    }
-    warpedPoint = transform->TransformPoint(toWarpPoint);
-    for (mwSize col=0; col < (mwSize)Dimension; ++col) {
-      yi[Mxi * col + row] = warpedPoint[CAST2MWSIZE(col)];
+  // transform points with ITK, point by point
+  if (engine == "itk") {
+    typename TransformType::InputPointType toWarpPoint;
+    typename TransformType::OutputPointType warpedPoint;
+    for (mwSize row=0; row < Mxi; ++row) {
+      for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+	toWarpPoint[CAST2MWSIZE(col)] = xi[Mxi * col + row];
+      }
+      warpedPoint = transform->TransformPoint(toWarpPoint);
+      for (mwSize col=0; col < (mwSize)Dimension; ++col) {
+	yi[Mxi * col + row] = warpedPoint[CAST2MWSIZE(col)];
+      }
     }
+    return;
   }
-  
+
+  // transform points with the native engines
+  evaluateKernelTransformModel<TScalarType, Dimension>(matlabImport, inTOL, model,
+						       engine, xi, yi, Mxi);
+
   // exit function
   return;
   
 }
 
+// runFittedKernelTransform<TScalarType, Dimension>()
+//
+// syntax YI = itk_pstransform(W, XI, ENGINE, TOL), where W is a
+// kernel transform previously fitted by this function
+template <class TScalarType, unsigned int Dimension>
+void runFittedKernelTransform(MatlabImportFilter::Pointer matlabImport,
+			      MatlabExportFilter::Pointer matlabExport) {
+
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer; 
+  MatlabInputPointer inW      = matlabImport->GetRegisteredInput("W");
+  MatlabInputPointer inXI     = matlabImport->GetRegisteredInput("XI");
+  MatlabInputPointer inENGINE = matlabImport->GetRegisteredInput("ENGINE");
+  MatlabInputPointer inTOL    = matlabImport->GetRegisteredInput("TOL");
+
+  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
+  MatlabOutputPointer outYI = matlabExport->RegisterOutput(OUT_YI, "YI");
+
+  // evaluation engine (ITK is not available here, because the
+  // transform was not fitted by ITK)
+  std::string engine = matlabImport->ReadStringFromMatlab(inENGINE, "direct");
+  if (engine != "direct" && engine != "tree") {
+    mexErrMsgTxt("ENGINE must be 'direct' or 'tree' when the transform is given as a struct");
+  }
+
+  // read fitted transform
+  KernelTransformModel<Dimension> model;
+  importKernelTransformModel<Dimension>(matlabImport, inW, model);
+
+  // allocate output
+  mwSize Mxi = mxGetM(inXI->pm);
+  mwSize ndimxi = mxGetNumberOfDimensions(inXI->pm);
+  const mwSize *dimsxi = mxGetDimensions(inXI->pm);
+  std::vector<mwSize> size;
+  for (mwIndex i = 0; i < ndimxi; ++i) {
+    size.push_back(dimsxi[i]);
+  }
+  TScalarType *yi 
+    = matlabExport->AllocateNDArrayInMatlab<TScalarType>(outYI, size);
+  const TScalarType *xi = (TScalarType *)mxGetData(inXI->pm);
+  if (xi == NULL) {
+    mexErrMsgTxt("Cannot get a pointer to input XI");
+  }
+
+  evaluateKernelTransformModel<TScalarType, Dimension>(matlabImport, inTOL, model,
+						       engine, xi, yi, Mxi);
+
+}
+
+// runFittedKernelTransformSyntax()
+//
+// parse the types of syntax YI = itk_pstransform(W, XI, ENGINE, TOL)
+void runFittedKernelTransformSyntax(int nlhs, mxArray *plhs[], 
+				    int nrhs, const mxArray *prhs[]) {
+
+  enum FittedInputIndexType {IN_W, IN_FITTED_XI, IN_ENGINE, IN_TOL, 
+			     FittedInputIndexType_MAX};
+
+  MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
+  matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
+  MatlabInputPointer inW      = matlabImport->RegisterInput(IN_W, "W");
+  MatlabInputPointer inXI     = matlabImport->RegisterInput(IN_FITTED_XI, "XI");
+  MatlabInputPointer inENGINE = matlabImport->RegisterInput(IN_ENGINE, "ENGINE");
+  MatlabInputPointer inTOL    = matlabImport->RegisterInput(IN_TOL, "TOL");
+
+  MatlabExportFilter::Pointer matlabExport = MatlabExportFilter::New();
+  matlabExport->ConnectToMatlabFunctionOutput(nlhs, plhs);
+  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
+  MatlabOutputPointer outYI = matlabExport->RegisterOutput(OUT_YI, "YI");
+
+  matlabImport->CheckNumberOfArguments(2, FittedInputIndexType_MAX);
+  matlabExport->CheckNumberOfArguments(0, 1);
+
+  // if there are no points to warp, return empty array
+  if (mxIsEmpty(inXI->pm)) {
+    matlabExport->CopyEmptyArrayToMatlab(outYI);
+    return;
+  }
+
+  // the dimension of the transform is given by the landmarks
+  const mxArray *wx = mxGetField(inW->pm, 0, "X");
+  if (wx == NULL) {
+    mexErrMsgTxt("W must have a field X");
+  }
+  mwSize Dimension = mxGetN(wx);
+  if (mxGetN(inXI->pm) != Dimension) {
+    mexErrMsgTxt("XI must have the same number of columns as W.X");
+  }
+
+  switch (mxGetClassID(inXI->pm)) {
+  case mxDOUBLE_CLASS:
+    if (Dimension == 2) {
+      runFittedKernelTransform<double, 2>(matlabImport, matlabExport);
+    } else if (Dimension == 3) {
+      runFittedKernelTransform<double, 3>(matlabImport, matlabExport);
+    } else {
+      mexErrMsgTxt("Input points can only have dimensions 2 or 3");
+    }
+    break;
+  case mxSINGLE_CLASS:
+    if (Dimension == 2) {
+      runFittedKernelTransform<float, 2>(matlabImport, matlabExport);
+    } else if (Dimension == 3) {
+      runFittedKernelTransform<float, 3>(matlabImport, matlabExport);
+    } else {
+      mexErrMsgTxt("Input points can only have dimensions 2 or 3");
+    }
+    break;
+  default:
+    mexErrMsgTxt("Point coordinates can only be of type single or double");
+    break;
+  }
+
+}
+
 // parseTransformType<TScalarType, Dimension>()
 template <class TScalarType, unsigned int Dimension>
 void parseTransformType(MatlabImportFilter::Pointer matlabImport,
@@ -472,19 +1045,24 @@ void parseTransformType(MatlabImportFilter::Pointer matlabImport,
   // select transform function
   if (!strcmp(transform, "elastic")) {
     runKernelTransform<TScalarType, Dimension, 
-		       ElasticTransformType>(matlabImport, matlabExport);
+		       ElasticTransformType>(matlabImport, matlabExport, 
+						   KERNEL_ELASTIC);
   } else if (!strcmp(transform, "elasticr")) {
     runKernelTransform<TScalarType, Dimension, 
-		       ElasticReciprocalTransformType>(matlabImport, matlabExport);
+		       ElasticReciprocalTransformType>(matlabImport, matlabExport, 
+						   KERNEL_ELASTICR);
   } else if (!strcmp(transform, "tps")) {
     runKernelTransform<TScalarType, Dimension, 
-		       TpsTransformType>(matlabImport, matlabExport);
+		       TpsTransformType>(matlabImport, matlabExport, 
+						   KERNEL_TPS);
   } else if (!strcmp(transform, "tpsr2")) {
     runKernelTransform<TScalarType, Dimension, 
-		       TpsR2LogRTransformType>(matlabImport, matlabExport);
+		       TpsR2LogRTransformType>(matlabImport, matlabExport, 
+						   KERNEL_TPSR2);
   } else if (!strcmp(transform, "volume")) {
     runKernelTransform<TScalarType, Dimension, 
-		       VolumeTransformType>(matlabImport, matlabExport);
+		       VolumeTransformType>(matlabImport, matlabExport, 
+						   KERNEL_VOLUME);
   } else if (!strcmp(transform, "bspline")) {
     runBSplineTransform<TScalarType, Dimension>(matlabImport, matlabExport);
   } else if (!strcmp(transform, "")) {
@@ -547,9 +1125,18 @@ void parseInputTypeToTemplate(MatlabImportFilter::Pointer matlabImport,
   // check that all point coordinates have the same type (it simplifies
   // things with templates)
   if ((pointCoordClassId != mxGetClassID(inY->pm))
-      | (pointCoordClassId != mxGetClassID(inXI->pm))) {
+      | (!mxIsEmpty(inXI->pm) && !mxIsCell(inXI->pm)
+	 && (pointCoordClassId != mxGetClassID(inXI->pm)))) {
     mexErrMsgTxt("Input arguments X, Y and XI must have the same type");
   }
+  if (mxIsCell(inXI->pm)) {
+    for (mwIndex i = 0; i < mxGetNumberOfElements(inXI->pm); ++i) {
+      const mxArray *pAxis = mxGetCell(inXI->pm, i);
+      if ((pAxis == NULL) || (pointCoordClassId != mxGetClassID(pAxis))) {
+	mexErrMsgTxt("Vectors in cell array XI must have the same type as X, Y");
+      }
+    }
+  }
   
   // swith input point type
   switch(pointCoordClassId) {
@@ -578,6 +1165,12 @@ void parseInputTypeToTemplate(MatlabImportFilter::Pointer matlabImport,
 void mexFunction(int nlhs, mxArray *plhs[], 
 		 int nrhs, const mxArray *prhs[]) {
 
+  // syntax with a previously fitted kernel transform
+  if (nrhs > 0 && mxIsStruct(prhs[0])) {
+    runFittedKernelTransformSyntax(nlhs, plhs, nrhs, prhs);
+    return;
+  }
+
   // interface to deal with input arguments from Matlab
   MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
   matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
@@ -598,13 +1191,16 @@ void mexFunction(int nlhs, mxArray *plhs[],
   // register the outputs for this function at the export filter
   typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
   MatlabOutputPointer outYI = matlabExport->RegisterOutput(OUT_YI, "YI");
+  MatlabOutputPointer outW = matlabExport->RegisterOutput(OUT_W, "W");
 
   // check number of input and output arguments
   matlabImport->CheckNumberOfArguments(4, InputIndexType_MAX);
   matlabExport->CheckNumberOfArguments(0, OutputIndexType_MAX);
     
-  // if there are no points to warp, return empty array
-  if (mxIsEmpty(inXI->pm)) {
+  // if there are no points to warp, return empty array (unless the
+  // user wants the fitted transform, in which case we still have to
+  // fit it)
+  if (mxIsEmpty(inXI->pm) && !outW->isRequested) {
     matlabExport->CopyEmptyArrayToMatlab(outYI);
     return;
   }
@@ -614,7 +1210,8 @@ void mexFunction(int nlhs, mxArray *plhs[],
   mwSize My = mxGetM(inY->pm); // number of target points
   mwSize Dimension = mxGetN(inX->pm); // dimension of source points
   mwSize dimy = mxGetN(inY->pm); // dimension of target points
-  mwSize dimxi = mxGetN(inXI->pm); // dimension of points to be warped
+  mwSize dimxi = mxIsCell(inXI->pm) ? mxGetNumberOfElements(inXI->pm) 
+    : mxGetN(inXI->pm); // dimension of points to be warped
   
   // the landmark arrays must have the same number of points
   // (degenerate case, both are empty)
@@ -625,12 +1222,16 @@ void mexFunction(int nlhs, mxArray *plhs[],
   // if there are no landmarks, we apply no transformation to the
   // points to warp
   if (mxIsEmpty(inX->pm)) {
+    if (mxIsCell(inXI->pm)) {
+      mexErrMsgTxt("X and Y cannot be empty when XI is a cell array");
+    }
     *outYI->ppm = mxDuplicateArray(inXI->pm);
+    matlabExport->CopyEmptyArrayToMatlab(outW);
     return;
   }
 
   // if there are landmarks and points to warp, all must have the same dimension
-  if (Dimension != dimy || Dimension != dimxi) {
+  if (Dimension != dimy || (!mxIsEmpty(inXI->pm) && Dimension != dimxi)) {
     mexErrMsgTxt("X, Y and XI must all have the same dimension (i.e. number of columns).");
   }
 
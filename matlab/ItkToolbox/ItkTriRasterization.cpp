@@ -2,9 +2,6 @@
  * ITK_TRI_RASTERIZATION  Rasterization of triangular mesh to binary
  * segmentation
  *
- * This function provides a Matlab interface to
- * itk::TriangleMeshToBinaryImageFilter.
- *
  * BW = itk_tri_rasterization(TRI, X, RES, SIZE, ORIGIN)
  *
  *   TRI, X describe a triangular mesh.
@@ -25,11 +22,38 @@
  *   bottom-left image voxel, in (x, y, z) format.
  *
  *   BW is the output uint8 binary segmentation. Voxels inside the mesh will
- *   be set to 1, and voxels outside to 0. Note that voxels with their
- *   centre exactly on the mesh offer different results depending on whether
- *   they are at the left, right, top or bottom of the mesh. This is a
- *   limitation in itk::TriangleMeshToBinaryImageFilter. See
- *   test_itk_tri_rasterization.m in Gerardus for an example.
+ *   be set to 1, and voxels outside to 0. Voxels with their centre exactly
+ *   on the mesh are considered inside.
+ *
+ * BW = itk_tri_rasterization(..., ENGINE)
+ *
+ *   ENGINE is a string with the rasterization method:
+ *
+ *     'scanline' (default): Native multithreaded scanline rasterizer. The
+ *     triangles are binned into slabs of slices, and each row of voxels
+ *     is filled between pairs of crossings with the mesh (even-odd
+ *     parity). Crossings are computed with exact geometric predicates,
+ *     so the result is consistent for voxels with their centre exactly on
+ *     the mesh, at any side of the mesh. If the mesh is not closed, rows
+ *     with an odd number of crossings ignore the last one.
+ *
+ *     'itk': itk::TriangleMeshToBinaryImageFilter. This filter is
+ *     single-threaded, and voxels with their centre exactly on the mesh
+ *     offer different results depending on whether they are at the left,
+ *     right, top or bottom of the mesh. See test_itk_tri_rasterization.m
+ *     in Gerardus for an example.
+ *
+ * PV = itk_tri_rasterization(..., 'scanline', K)
+ *
+ *   K is a positive integer. PV is a single-precision image with the
+ *   fraction of each voxel inside the mesh (partial volume), in [0, 1].
+ *   Each row of voxels is sampled by K x K lines parallel to the x-axis,
+ *   and the inside intervals of each line are clipped exactly to the
+ *   voxels. Thus, the coverage is exact along x, and supersampled with K
+ *   samples along y and z. Voxels not crossed by the surface are set to 0
+ *   or 1 by the parity fill, so the cost of the supersampling depends on
+ *   the number of voxels crossed by the surface, not on the volume.
+ *   By default, K=0, and the output is the binary segmentation BW.
  */
 
 /*
@@ -55,7 +79,7 @@
  /*
   * Author: Ramon Casero <rcasero@gmail.com>
   * Copyright © 2013 University of Oxford
-  * Version: 0.1.2
+  * Version: 0.3.0
   * $Rev$
   * $Date$
   *
@@ -90,11 +114,15 @@
 #include <mex.h>
 
 /* C++ headers */
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 /* Gerardus headers */
 #include "MatlabImportFilter.h"
 #include "MatlabExportFilter.h"
+#include "TriRasterizationEngine.h"
 
 /* ITK headers */
 #include <itkImage.h>
@@ -116,44 +144,139 @@ typedef itk::TriangleCell<CellType>             TriangleType;
 typedef CellType::CellAutoPointer               CellAutoPointer;
 typedef itk::TriangleMeshToBinaryImageFilter<MeshType, ImageType> MeshFilterType;
 
+// interface to deal with input arguments from Matlab
+enum InputIndexType {IN_TRI, IN_X, IN_RES, IN_SIZE, IN_ORIGIN, IN_ENGINE,
+		     IN_K, InputIndexType_MAX};
+
+// interface to deal with outputs to Matlab
+enum OutputIndexType {OUT_IM, OutputIndexType_MAX};
+
 /*
- * mexFunction(): entry point for the mex function
+ * readRasterGrid(): voxel size and number of voxels in (row, column,
+ * slice) format, and origin in (x, y, z) format
  */
-void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+void readRasterGrid(MatlabImportFilter::Pointer matlabImport,
+		    double *res, size_t *size, double *origin) {
+
+  std::vector<double> resDef(Dimension, 1.0);
+  std::vector<double> sizeDef(Dimension, 10.0);
+  std::vector<double> originDef(Dimension, 0.0);
+  std::vector<double> resVec = matlabImport->ReadRowVectorFromMatlab<double, std::vector<double> >
+    (matlabImport->GetRegisteredInput("RES"), resDef);
+  std::vector<double> sizeVec = matlabImport->ReadRowVectorFromMatlab<double, std::vector<double> >
+    (matlabImport->GetRegisteredInput("SIZE"), sizeDef);
+  std::vector<double> originVec = matlabImport->ReadRowVectorFromMatlab<double, std::vector<double> >
+    (matlabImport->GetRegisteredInput("ORIGIN"), originDef);
+  if (resVec.size() != Dimension || sizeVec.size() != Dimension
+      || originVec.size() != Dimension) {
+    mexErrMsgTxt("RES, SIZE and ORIGIN must be 3-vectors");
+  }
 
-  // interface to deal with input arguments from Matlab
-  enum InputIndexType {IN_TRI, IN_X, IN_RES, IN_SIZE, IN_ORIGIN, InputIndexType_MAX};
-  MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
-  matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
+  for (unsigned int i = 0; i < Dimension; ++i) {
+    if (!(resVec[i] > 0.0)) {
+      mexErrMsgTxt("RES values must be > 0");
+    }
+    if (!(sizeVec[i] >= 0.0)) {
+      mexErrMsgTxt("SIZE values must be >= 0");
+    }
+    res[i] = resVec[i];
+    size[i] = (size_t)sizeVec[i];
+    origin[i] = originVec[i];
+  }
 
-  // check the number of input arguments
-  matlabImport->CheckNumberOfArguments(2, InputIndexType_MAX);
+}
 
-  // register the inputs for this function at the import filter
-  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
-  MatlabInputPointer inTRI = matlabImport->RegisterInput(IN_TRI, "TRI");
-  MatlabInputPointer inX = matlabImport->RegisterInput(IN_X, "X"); // (x, y, z)
-  MatlabInputPointer inRES = matlabImport->RegisterInput(IN_RES, "RES"); // (r, c, s)
-  MatlabInputPointer inSIZE = matlabImport->RegisterInput(IN_SIZE, "SIZE"); // (r, c, s)
-  MatlabInputPointer inORIGIN = matlabImport->RegisterInput(IN_ORIGIN, "ORIGIN"); // (x, y, z)
+/*
+ * runScanlineRasterization(): native scanline rasterizer. The output
+ * image is allocated in Matlab, and the slabs write directly to it.
+ *
+ * k: number of sub-lines per voxel along y and z for the partial
+ *    volume output. If 0, the output is a binary segmentation
+ */
+void runScanlineRasterization(MatlabImportFilter::Pointer matlabImport,
+			      MatlabExportFilter::Pointer matlabExport,
+			      unsigned int k) {
+
+  // get pointers to the inputs and outputs
+  MatlabImportFilter::MatlabInputPointer inTRI = matlabImport->GetRegisteredInput("TRI");
+  MatlabImportFilter::MatlabInputPointer inX = matlabImport->GetRegisteredInput("X");
+  MatlabExportFilter::MatlabOutputPointer outIM = matlabExport->RegisterOutput(OUT_IM, "IM");
+
+  // check inputs
+  if (mxGetN(inX->pm) != Dimension) {
+    mexErrMsgTxt("X must have 3 columns");
+  }
+  if (mxGetN(inTRI->pm) != 3) {
+    mexErrMsgTxt("TRI must have 3 columns");
+  }
 
-  // interface to deal with outputs to Matlab
-  enum OutputIndexType {OUT_IM, OutputIndexType_MAX};
-  MatlabExportFilter::Pointer matlabExport = MatlabExportFilter::New();
-  matlabExport->ConnectToMatlabFunctionOutput(nlhs, plhs);
-  
-  // check that the number of outputs the user is asking for is valid
-  matlabExport->CheckNumberOfArguments(0, OutputIndexType_MAX);
+  // read vertices, (x, y, z) in consecutive positions
+  mwSize nrowsX = mxGetM(inX->pm);
+  std::vector<double> x(Dimension * nrowsX);
+  for (mwIndex i = 0; i < nrowsX; ++i) {
+    for (mwIndex j = 0; j < Dimension; ++j) {
+      x[Dimension * i + j] = matlabImport->ReadScalarFromMatlab<double>(inX, i, j, mxGetNaN());
+    }
+  }
 
-  // register the outputs for this function at the export filter
-  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
-  MatlabOutputPointer outIM = matlabExport->RegisterOutput(OUT_IM, "IM");
+  // read triangles, converting Matlab's index convention 1, 2, 3,
+  // ... to C++ convention 0, 1, 2, ...
+  mwSize nrowsTRI = mxGetM(inTRI->pm);
+  std::vector<size_t> tri(3 * nrowsTRI);
+  for (mwIndex i = 0; i < nrowsTRI; ++i) {
+    for (mwIndex j = 0; j < 3; ++j) {
+      double v = matlabImport->ReadScalarFromMatlab<double>(inTRI, i, j, mxGetNaN());
+      if (!(v >= 1.0 && v <= (double)nrowsX)) {
+	mexErrMsgTxt("TRI contains indices out of range");
+      }
+      tri[3 * i + j] = (size_t)v - 1;
+    }
+  }
 
-  // if any input point set is empty, the outputs are empty too
-  if (mxIsEmpty(inTRI->pm) || mxIsEmpty(inX->pm)) {
-    matlabExport->CopyEmptyArrayToMatlab(outIM);
-    return;
+  // get user input parameters for the output rasterization
+  double res[Dimension];
+  size_t size[Dimension];
+  double origin[Dimension];
+  readRasterGrid(matlabImport, res, size, origin);
+
+  // allocate output image in Matlab. The voxels are initialized to 0
+  std::vector<mwSize> sizeStdVector(Dimension);
+  for (unsigned int i = 0; i < Dimension; ++i) {
+    sizeStdVector[i] = size[i];
   }
+  TriScanlineRasterizer raster(&x[0], &tri[0], nrowsTRI, size, res, origin);
+  if (k == 0) {
+
+    // binary segmentation
+    PixelType *im = matlabExport->AllocateNDArrayInMatlab<PixelType>(outIM, sizeStdVector);
+    triScanlineRasterization<PixelType>(raster, im);
+
+  } else {
+
+    // partial volume
+    float *im = matlabExport->AllocateNDArrayInMatlab<float>(outIM, sizeStdVector);
+    triScanlineCoverage<float>(raster, im, k);
+
+  }
+
+}
+
+/*
+ * runItkRasterization(): rasterization with
+ * itk::TriangleMeshToBinaryImageFilter
+ */
+void runItkRasterization(MatlabImportFilter::Pointer matlabImport,
+			 MatlabExportFilter::Pointer matlabExport) {
+
+  // get pointers to the inputs and outputs
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
+  MatlabInputPointer inTRI = matlabImport->GetRegisteredInput("TRI");
+  MatlabInputPointer inX = matlabImport->GetRegisteredInput("X"); // (x, y, z)
+  MatlabInputPointer inRES = matlabImport->GetRegisteredInput("RES"); // (r, c, s)
+  MatlabInputPointer inSIZE = matlabImport->GetRegisteredInput("SIZE"); // (r, c, s)
+  MatlabInputPointer inORIGIN = matlabImport->GetRegisteredInput("ORIGIN"); // (x, y, z)
+  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
+  MatlabOutputPointer outIM = matlabExport->RegisterOutput(OUT_IM, "IM");
 
   // get number of rows in inputs X and TRI
   mwSize nrowsX = mxGetM(inX->pm);
@@ -281,3 +404,61 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   meshFilter->Update();
 
 }
+
+/*
+ * mexFunction(): entry point for the mex function
+ */
+void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+
+  // interface to deal with input arguments from Matlab
+  MatlabImportFilter::Pointer matlabImport = MatlabImportFilter::New();
+  matlabImport->ConnectToMatlabFunctionInput(nrhs, prhs);
+
+  // check the number of input arguments
+  matlabImport->CheckNumberOfArguments(2, InputIndexType_MAX);
+
+  // register the inputs for this function at the import filter
+  typedef MatlabImportFilter::MatlabInputPointer MatlabInputPointer;
+  MatlabInputPointer inTRI = matlabImport->RegisterInput(IN_TRI, "TRI");
+  MatlabInputPointer inX = matlabImport->RegisterInput(IN_X, "X"); // (x, y, z)
+  matlabImport->RegisterInput(IN_RES, "RES"); // (r, c, s)
+  matlabImport->RegisterInput(IN_SIZE, "SIZE"); // (r, c, s)
+  matlabImport->RegisterInput(IN_ORIGIN, "ORIGIN"); // (x, y, z)
+  MatlabInputPointer inENGINE = matlabImport->RegisterInput(IN_ENGINE, "ENGINE");
+  MatlabInputPointer inK = matlabImport->RegisterInput(IN_K, "K");
+
+  // interface to deal with outputs to Matlab
+  MatlabExportFilter::Pointer matlabExport = MatlabExportFilter::New();
+  matlabExport->ConnectToMatlabFunctionOutput(nlhs, plhs);
+  
+  // check that the number of outputs the user is asking for is valid
+  matlabExport->CheckNumberOfArguments(0, OutputIndexType_MAX);
+
+  // register the outputs for this function at the export filter
+  typedef MatlabExportFilter::MatlabOutputPointer MatlabOutputPointer;
+  MatlabOutputPointer outIM = matlabExport->RegisterOutput(OUT_IM, "IM");
+
+  // if any input point set is empty, the outputs are empty too
+  if (mxIsEmpty(inTRI->pm) || mxIsEmpty(inX->pm)) {
+    matlabExport->CopyEmptyArrayToMatlab(outIM);
+    return;
+  }
+
+  // rasterization method
+  std::string engine = matlabImport->ReadStringFromMatlab(inENGINE, "scanline");
+  double k = matlabImport->ReadScalarFromMatlab<double>(inK, 0.0);
+  if (!(k >= 0.0) || k != std::floor(k)) {
+    mexErrMsgTxt("K must be a non-negative integer");
+  }
+  if (engine == "scanline") {
+    runScanlineRasterization(matlabImport, matlabExport, (unsigned int)k);
+  } else if (engine == "itk") {
+    if (k != 0.0) {
+      mexErrMsgTxt("Partial volume output (K > 0) only available with ENGINE='scanline'");
+    }
+    runItkRasterization(matlabImport, matlabExport);
+  } else {
+    mexErrMsgTxt(("Unknown ENGINE: " + engine).c_str());
+  }
+
+}
@@ -0,0 +1,1219 @@
+/*
+ * KernelTransformEngine.h
+ *
+ * Native evaluation engines for the landmark kernel transforms used by
+ * itk_pstransform ('elastic', 'elasticr', 'tps', 'tpsr2', 'volume').
+ *
+ * ITK's KernelTransform::TransformPoint() evaluates the warp of a
+ * single point with a serial O(N) loop over the N landmarks, calling a
+ * virtual function per landmark. Warping a full image grid that way is
+ * not practical. This file provides two alternatives that reproduce
+ * the same transform once the weights have been fitted:
+ *
+ *   KernelDirectEvaluator:   exact direct sum. Query points are
+ *                            processed in blocks, landmarks in tiles
+ *                            stored as structure-of-arrays, so that
+ *                            the inner loop is branch-free and can be
+ *                            auto-vectorised by the compiler. Blocks
+ *                            of query points run in parallel.
+ *
+ *   KernelTreecodeEvaluator: Barnes-Hut treecode. Landmarks are
+ *                            clustered in a 2^D-tree, and the
+ *                            contribution of clusters far from the
+ *                            query point is approximated by a 2nd order
+ *                            Taylor (multipole) expansion. A cluster is
+ *                            only approximated if the estimated
+ *                            truncation error is below its share of the
+ *                            user tolerance TOL. Only radial kernels
+ *                            ('tps', 'tpsr2', 'volume') are supported.
+ *
+ * The transform is (ITK convention, solved for displacements)
+ *
+ *   y = x + A*x + B + sum_i G(x - s_i) * w_i
+ *
+ * where s_i are the source landmarks, w_i the D-vector of weights of
+ * landmark i, and G the DxD kernel matrix:
+ *
+ *   'tps':      G = r * I
+ *   'tpsr2':    G = r^2 log(r) * I
+ *   'volume':   G = r^3 * I
+ *   'elastic':  G = alpha r^3 I - 3 r (x x^T)
+ *   'elasticr': G = alpha r I   - 1/r (x x^T)
+ *
+ * All accumulations are carried out in double precision, regardless of
+ * the type of the input points.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.2.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef KERNELTRANSFORMENGINE_H
+#define KERNELTRANSFORMENGINE_H
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/* Gerardus headers */
+#include "GerardusParallel.h"
+
+// kernels supported by the native engines
+enum KernelType {KERNEL_TPS, KERNEL_TPSR2, KERNEL_VOLUME,
+		 KERNEL_ELASTIC, KERNEL_ELASTICR};
+
+/*
+ * KernelTransformModel: fitted kernel transform, stored in the layout
+ * that the evaluators need.
+ *
+ * src:   source landmarks, structure-of-arrays, src[d * N + i]
+ * w:     kernel weights, w[d * N + i] = ITK's m_DMatrix(d, i)
+ * A:     affine matrix, A[i * Dimension + j] = ITK's m_AMatrix(i, j)
+ * B:     translation vector
+ * alpha: constant of the elastic kernels (ignored otherwise)
+ */
+template <unsigned int Dimension>
+class KernelTransformModel {
+
+ public:
+
+  KernelType kernel;
+  double alpha;
+  mwSize N;
+  std::vector<double> src;
+  std::vector<double> w;
+  double A[Dimension * Dimension];
+  double B[Dimension];
+
+  KernelTransformModel() : kernel(KERNEL_TPS), alpha(0.0), N(0) {
+    std::fill(A, A + Dimension * Dimension, 0.0);
+    std::fill(B, B + Dimension, 0.0);
+  }
+
+  // allocate memory for N landmarks
+  void Resize(mwSize _N) {
+    this->N = _N;
+    this->src.assign(Dimension * _N, 0.0);
+    this->w.assign(Dimension * _N, 0.0);
+  }
+
+  // returns true if the kernel is of the form phi(r) * I
+  bool IsRadial() const {
+    return (this->kernel == KERNEL_TPS) || (this->kernel == KERNEL_TPSR2)
+      || (this->kernel == KERNEL_VOLUME);
+  }
+
+  // affine part of the transform: y = x + A*x + B
+  void ApplyAffine(const double *x, double *y) const {
+    for (unsigned int i = 0; i < Dimension; ++i) {
+      double acc = x[i] + this->B[i];
+      for (unsigned int j = 0; j < Dimension; ++j) {
+	acc += this->A[i * Dimension + j] * x[j];
+      }
+      y[i] = acc;
+    }
+  }
+
+};
+
+/*
+ * radialKernel(): phi(r) for the radial kernels, as a function of r^2
+ * to avoid unnecessary square roots.
+ */
+inline
+double radialKernel(KernelType kernel, double r2) {
+  switch (kernel) {
+  case KERNEL_TPS:
+    return std::sqrt(r2);
+  case KERNEL_TPSR2:
+    // r^2 log(r) = 0.5 r^2 log(r^2); ITK sets the kernel to 0 for r <= 1e-8
+    return (r2 > 1e-16) ? 0.5 * r2 * std::log(r2) : 0.0;
+  case KERNEL_VOLUME:
+    return r2 * std::sqrt(r2);
+  default:
+    return 0.0;
+  }
+}
+
+/*
+ * radialKernelDerivatives(): phi'(r), phi''(r) for the radial
+ * kernels. Only used far from the landmarks, so r > 0.
+ */
+inline
+void radialKernelDerivatives(KernelType kernel, double r,
+			     double &d1, double &d2) {
+  switch (kernel) {
+  case KERNEL_TPS:
+    d1 = 1.0;
+    d2 = 0.0;
+    break;
+  case KERNEL_TPSR2:
+    d1 = 2.0 * r * std::log(r) + r;
+    d2 = 2.0 * std::log(r) + 3.0;
+    break;
+  case KERNEL_VOLUME:
+    d1 = 3.0 * r * r;
+    d2 = 6.0 * r;
+    break;
+  default:
+    d1 = d2 = 0.0;
+  }
+}
+
+/*
+ * radialKernelThirdDerivativeBound(): upper bound of the norm of the
+ * 3rd derivative tensor of phi(|x|) at distance >= rmin. Used to
+ * estimate the truncation error of the 2nd order expansion.
+ */
+inline
+double radialKernelThirdDerivativeBound(KernelType kernel, double rmin) {
+  switch (kernel) {
+  case KERNEL_TPS:
+    return 3.0 / (rmin * rmin);
+  case KERNEL_TPSR2:
+    return 6.0 / rmin;
+  case KERNEL_VOLUME:
+    return 9.0;
+  default:
+    return std::numeric_limits<double>::infinity();
+  }
+}
+
+/*
+ * KernelDirectEvaluator: exact evaluation of the kernel transform by
+ * direct summation. Run with parallelFor() over the range of query
+ * points, [0, Mxi).
+ *
+ * xi, yi: query and output points, Matlab (Mxi x Dimension) matrices
+ */
+template <class TScalarType, unsigned int Dimension>
+class KernelDirectEvaluator {
+
+ public:
+
+  // number of query points per block, and number of landmarks per
+  // tile. A tile of landmarks (Dimension coordinates + Dimension
+  // weights) fits in L1 cache, and is reused by all the query points
+  // of the block
+  static const mwSize QUERY_BLOCK = 64;
+  static const mwSize LANDMARK_TILE = 512;
+
+  KernelDirectEvaluator(const KernelTransformModel<Dimension> &_model,
+			const TScalarType *_xi, TScalarType *_yi, mwSize _Mxi)
+    : model(_model), xi(_xi), yi(_yi), Mxi(_Mxi) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+
+    const mwSize N = this->model.N;
+    double p[QUERY_BLOCK][Dimension];
+    double acc[QUERY_BLOCK][Dimension];
+
+    for (mwSize b0 = begin; b0 < end; b0 += QUERY_BLOCK) {
+      mwSize nq = std::min((mwSize)QUERY_BLOCK, (mwSize)end - b0);
+
+      // copy block of query points, and init accumulators
+      for (mwSize q = 0; q < nq; ++q) {
+	for (unsigned int d = 0; d < Dimension; ++d) {
+	  p[q][d] = (double)this->xi[this->Mxi * d + b0 + q];
+	  acc[q][d] = 0.0;
+	}
+      }
+
+      // loop tiles of landmarks
+      for (mwSize t0 = 0; t0 < N; t0 += LANDMARK_TILE) {
+	mwSize t1 = std::min(N, t0 + LANDMARK_TILE);
+	for (mwSize q = 0; q < nq; ++q) {
+	  if (this->model.IsRadial()) {
+	    this->AccumulateRadial(p[q], t0, t1, acc[q]);
+	  } else {
+	    this->AccumulateElastic(p[q], t0, t1, acc[q]);
+	  }
+	}
+      }
+
+      // add affine part and write result
+      double y[Dimension];
+      for (mwSize q = 0; q < nq; ++q) {
+	this->model.ApplyAffine(p[q], y);
+	for (unsigned int d = 0; d < Dimension; ++d) {
+	  this->yi[this->Mxi * d + b0 + q] = (TScalarType)(y[d] + acc[q][d]);
+	}
+      }
+    }
+
+  }
+
+ private:
+
+  const KernelTransformModel<Dimension> &model;
+  const TScalarType *xi;
+  TScalarType *yi;
+  mwSize Mxi;
+
+  // contribution of landmarks [t0, t1) to point p, radial kernel
+  void AccumulateRadial(const double *p, mwSize t0, mwSize t1, double *acc) const {
+    const mwSize N = this->model.N;
+    const double *src = &this->model.src[0];
+    const double *w = &this->model.w[0];
+    const KernelType kernel = this->model.kernel;
+    double a[Dimension];
+    std::fill(a, a + Dimension, 0.0);
+    for (mwSize i = t0; i < t1; ++i) {
+      double r2 = 0.0;
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	double delta = p[d] - src[d * N + i];
+	r2 += delta * delta;
+      }
+      double phi = radialKernel(kernel, r2);
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	a[d] += phi * w[d * N + i];
+      }
+    }
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      acc[d] += a[d];
+    }
+  }
+
+  // contribution of landmarks [t0, t1) to point p, elastic kernels
+  //
+  // G(x) * w = radial * w + factor * x * (x . w)
+  void AccumulateElastic(const double *p, mwSize t0, mwSize t1, double *acc) const {
+    const mwSize N = this->model.N;
+    const double *src = &this->model.src[0];
+    const double *w = &this->model.w[0];
+    const bool reciprocal = (this->model.kernel == KERNEL_ELASTICR);
+    const double alpha = this->model.alpha;
+    double a[Dimension];
+    std::fill(a, a + Dimension, 0.0);
+    for (mwSize i = t0; i < t1; ++i) {
+      double x[Dimension];
+      double r2 = 0.0;
+      double xw = 0.0;
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	x[d] = p[d] - src[d * N + i];
+	r2 += x[d] * x[d];
+	xw += x[d] * w[d * N + i];
+      }
+      double r = std::sqrt(r2);
+      double radial, factor;
+      if (reciprocal) {
+	radial = alpha * r;
+	factor = (r > 1e-8) ? -1.0 / r : 0.0;
+      } else {
+	radial = alpha * r2 * r;
+	factor = -3.0 * r;
+      }
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	a[d] += radial * w[d * N + i] + factor * x[d] * xw;
+      }
+    }
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      acc[d] += a[d];
+    }
+  }
+
+};
+
+/*
+ * KernelTreecodeEvaluator: approximate evaluation of a radial kernel
+ * transform with a Barnes-Hut treecode and error control. Run with
+ * parallelFor() over the range of query points, [0, Mxi).
+ *
+ * tol:      maximum absolute error allowed in each coordinate of
+ *           each warped point, in the units of the points. The error
+ *           budget is split between the tree clusters proportionally
+ *           to their number of landmarks.
+ *
+ * theta:    opening angle. A cluster is only considered for the
+ *           expansion if radius < theta * distance.
+ *
+ * leafSize: maximum number of landmarks in a leaf of the tree.
+ */
+template <class TScalarType, unsigned int Dimension>
+class KernelTreecodeEvaluator {
+
+ public:
+
+  static const unsigned int NUM_CHILDREN = 1u << Dimension;
+
+  // node of the tree (a cluster of landmarks)
+  struct Node {
+    mwSize begin, end;                  // range of landmarks in the permuted arrays
+    mwSize firstChild;                  // index of first child, 0 for leaves
+    unsigned int numChildren;
+    double center[Dimension];           // expansion centre (centroid of landmarks)
+    double radius;                      // max distance from centre to a landmark
+    double wabs;                        // sum_i |w_i|_1
+    double m0[Dimension];               // sum_i w_i
+    double m1[Dimension][Dimension];    // sum_i w_i (s_i - c)^T
+    double m2[Dimension][Dimension][Dimension]; // sum_i w_i (s_i - c)(s_i - c)^T
+  };
+
+  KernelTreecodeEvaluator(const KernelTransformModel<Dimension> &_model,
+			  const TScalarType *_xi, TScalarType *_yi, mwSize _Mxi,
+			  double _tol, double _theta = 0.5, mwSize _leafSize = 32)
+    : model(_model), xi(_xi), yi(_yi), Mxi(_Mxi),
+      tol(_tol), theta(_theta), leafSize(_leafSize) {
+
+    if (!this->model.IsRadial()) {
+      mexErrMsgTxt("Treecode engine only implemented for radial kernels (tps, tpsr2, volume)");
+    }
+
+    // copy the landmarks to arrays that will be reordered so that
+    // each tree node contains a contiguous range of landmarks
+    const mwSize N = this->model.N;
+    this->src.resize(N);
+    this->w.resize(N);
+    for (mwSize i = 0; i < N; ++i) {
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	this->src[i].x[d] = this->model.src[d * N + i];
+	this->w[i].x[d] = this->model.w[d * N + i];
+      }
+    }
+
+    // bounding box of the landmarks
+    double bmin[Dimension], bmax[Dimension];
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      bmin[d] = std::numeric_limits<double>::max();
+      bmax[d] = -std::numeric_limits<double>::max();
+    }
+    for (mwSize i = 0; i < N; ++i) {
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	bmin[d] = std::min(bmin[d], this->src[i].x[d]);
+	bmax[d] = std::max(bmax[d], this->src[i].x[d]);
+      }
+    }
+
+    // build tree recursively from the root
+    this->nodes.reserve(4 * (N / this->leafSize + 1));
+    this->nodes.push_back(Node());
+    this->Build(0, 0, N, bmin, bmax, 0);
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+
+    std::vector<mwSize> stack;
+    stack.reserve(64 * NUM_CHILDREN);
+    const double tolPerLandmark = this->tol / (double)this->model.N;
+
+    for (mwSize q = begin; q < end; ++q) {
+
+      double p[Dimension];
+      double acc[Dimension];
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	p[d] = (double)this->xi[this->Mxi * d + q];
+	acc[d] = 0.0;
+      }
+
+      // traverse the tree
+      stack.clear();
+      stack.push_back(0);
+      while (!stack.empty()) {
+	const Node &node = this->nodes[stack.back()];
+	stack.pop_back();
+
+	double delta[Dimension];
+	double dist2 = 0.0;
+	for (unsigned int d = 0; d < Dimension; ++d) {
+	  delta[d] = p[d] - node.center[d];
+	  dist2 += delta[d] * delta[d];
+	}
+	double dist = std::sqrt(dist2);
+
+	// far-field: try the expansion of the cluster
+	if (node.radius < this->theta * dist) {
+	  double rmin = dist - node.radius;
+	  double r3 = node.radius * node.radius * node.radius;
+	  double err = radialKernelThirdDerivativeBound(this->model.kernel, rmin)
+	    * r3 * node.wabs / 6.0;
+	  if (err <= tolPerLandmark * (double)(node.end - node.begin)) {
+	    this->AccumulateExpansion(node, delta, dist, acc);
+	    continue;
+	  }
+	}
+
+	// near-field: open the cluster, or sum directly if it's a leaf
+	if (node.numChildren == 0) {
+	  this->AccumulateDirect(node, p, acc);
+	} else {
+	  for (unsigned int c = 0; c < node.numChildren; ++c) {
+	    stack.push_back(node.firstChild + c);
+	  }
+	}
+      }
+
+      // add affine part and write result
+      double y[Dimension];
+      this->model.ApplyAffine(p, y);
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	this->yi[this->Mxi * d + q] = (TScalarType)(y[d] + acc[d]);
+      }
+    }
+
+  }
+
+ private:
+
+  struct Vec {
+    double x[Dimension];
+  };
+
+  const KernelTransformModel<Dimension> &model;
+  const TScalarType *xi;
+  TScalarType *yi;
+  mwSize Mxi;
+  double tol;
+  double theta;
+  mwSize leafSize;
+  std::vector<Vec> src;
+  std::vector<Vec> w;
+  std::vector<Node> nodes;
+
+  // build node idx, with landmarks [begin, end) inside box [bmin, bmax]
+  void Build(mwSize idx, mwSize begin, mwSize end,
+	     const double *bmin, const double *bmax, unsigned int depth) {
+
+    this->nodes[idx].begin = begin;
+    this->nodes[idx].end = end;
+    this->nodes[idx].firstChild = 0;
+    this->nodes[idx].numChildren = 0;
+    this->ComputeMoments(this->nodes[idx]);
+
+    // leaf node
+    if ((end - begin <= this->leafSize) || (depth >= 48)) {
+      return;
+    }
+
+    // partition landmarks into 2^Dimension boxes around the centre of the box
+    double mid[Dimension];
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      mid[d] = 0.5 * (bmin[d] + bmax[d]);
+    }
+    std::vector<mwSize> first(NUM_CHILDREN + 1, begin);
+    mwSize split = begin;
+    for (unsigned int c = 0; c < NUM_CHILDREN; ++c) {
+      first[c] = split;
+      for (mwSize i = split; i < end; ++i) {
+	if (this->Octant(this->src[i], mid) == c) {
+	  std::swap(this->src[i], this->src[split]);
+	  std::swap(this->w[i], this->w[split]);
+	  ++split;
+	}
+      }
+    }
+    first[NUM_CHILDREN] = end;
+
+    // create non-empty children
+    mwSize firstChild = this->nodes.size();
+    unsigned int numChildren = 0;
+    for (unsigned int c = 0; c < NUM_CHILDREN; ++c) {
+      if (first[c + 1] > first[c]) {
+	this->nodes.push_back(Node());
+	++numChildren;
+      }
+    }
+
+    // all landmarks are in the same position, nothing to split
+    if (numChildren <= 1) {
+      this->nodes.resize(firstChild);
+      return;
+    }
+    this->nodes[idx].firstChild = firstChild;
+    this->nodes[idx].numChildren = numChildren;
+
+    mwSize child = firstChild;
+    for (unsigned int c = 0; c < NUM_CHILDREN; ++c) {
+      if (first[c + 1] == first[c]) {
+	continue;
+      }
+      double cmin[Dimension], cmax[Dimension];
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	if (c & (1u << d)) {
+	  cmin[d] = mid[d];
+	  cmax[d] = bmax[d];
+	} else {
+	  cmin[d] = bmin[d];
+	  cmax[d] = mid[d];
+	}
+      }
+      this->Build(child, first[c], first[c + 1], cmin, cmax, depth + 1);
+      ++child;
+    }
+
+  }
+
+  unsigned int Octant(const Vec &v, const double *mid) const {
+    unsigned int c = 0;
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      if (v.x[d] >= mid[d]) {
+	c |= (1u << d);
+      }
+    }
+    return c;
+  }
+
+  // centre, radius and moments of the landmarks in a node
+  void ComputeMoments(Node &node) const {
+    const double n = (double)(node.end - node.begin);
+    std::fill(node.center, node.center + Dimension, 0.0);
+    for (mwSize i = node.begin; i < node.end; ++i) {
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	node.center[d] += this->src[i].x[d];
+      }
+    }
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      node.center[d] /= n;
+    }
+    node.radius = 0.0;
+    node.wabs = 0.0;
+    std::fill(&node.m0[0], &node.m0[0] + Dimension, 0.0);
+    std::fill(&node.m1[0][0], &node.m1[0][0] + Dimension * Dimension, 0.0);
+    std::fill(&node.m2[0][0][0], &node.m2[0][0][0] + Dimension * Dimension * Dimension, 0.0);
+    for (mwSize i = node.begin; i < node.end; ++i) {
+      double s[Dimension];
+      double r2 = 0.0;
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	s[d] = this->src[i].x[d] - node.center[d];
+	r2 += s[d] * s[d];
+      }
+      node.radius = std::max(node.radius, std::sqrt(r2));
+      for (unsigned int o = 0; o < Dimension; ++o) {
+	const double wo = this->w[i].x[o];
+	node.wabs += std::fabs(wo);
+	node.m0[o] += wo;
+	for (unsigned int j = 0; j < Dimension; ++j) {
+	  node.m1[o][j] += wo * s[j];
+	  for (unsigned int k = 0; k < Dimension; ++k) {
+	    node.m2[o][j][k] += wo * s[j] * s[k];
+	  }
+	}
+      }
+    }
+  }
+
+  // far-field contribution of a cluster, with delta = p - centre
+  //
+  // phi(|delta - s|) ~ phi - grad(phi) . s + 1/2 s^T H s
+  void AccumulateExpansion(const Node &node, const double *delta, double r,
+			   double *acc) const {
+    double phi = radialKernel(this->model.kernel, r * r);
+    double d1, d2;
+    radialKernelDerivatives(this->model.kernel, r, d1, d2);
+    double g = d1 / r;                      // grad = g * delta
+    double h = (d2 - d1 / r) / (r * r);     // H = h * delta delta^T + g * I
+    for (unsigned int o = 0; o < Dimension; ++o) {
+      double val = node.m0[o] * phi;
+      double quad = 0.0;
+      for (unsigned int j = 0; j < Dimension; ++j) {
+	val -= g * delta[j] * node.m1[o][j];
+	quad += g * node.m2[o][j][j];
+	for (unsigned int k = 0; k < Dimension; ++k) {
+	  quad += h * delta[j] * delta[k] * node.m2[o][j][k];
+	}
+      }
+      acc[o] += val + 0.5 * quad;
+    }
+  }
+
+  // near-field contribution of a leaf
+  void AccumulateDirect(const Node &node, const double *p, double *acc) const {
+    for (mwSize i = node.begin; i < node.end; ++i) {
+      double r2 = 0.0;
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	double delta = p[d] - this->src[i].x[d];
+	r2 += delta * delta;
+      }
+      double phi = radialKernel(this->model.kernel, r2);
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	acc[d] += phi * this->w[i].x[d];
+      }
+    }
+  }
+
+};
+
+/*
+ * kernelMatrix(): DxD kernel matrix G(x), row-major.
+ */
+template <unsigned int Dimension>
+void kernelMatrix(const KernelTransformModel<Dimension> &model,
+		  const double *x, double *G) {
+  double r2 = 0.0;
+  for (unsigned int d = 0; d < Dimension; ++d) {
+    r2 += x[d] * x[d];
+  }
+  std::fill(G, G + Dimension * Dimension, 0.0);
+  if (model.IsRadial()) {
+    double phi = radialKernel(model.kernel, r2);
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      G[d * Dimension + d] = phi;
+    }
+    return;
+  }
+  double r = std::sqrt(r2);
+  double radial, factor;
+  if (model.kernel == KERNEL_ELASTICR) {
+    radial = model.alpha * r;
+    factor = (r > 1e-8) ? -1.0 / r : 0.0;
+  } else {
+    radial = model.alpha * r2 * r;
+    factor = -3.0 * r;
+  }
+  for (unsigned int i = 0; i < Dimension; ++i) {
+    for (unsigned int j = 0; j < Dimension; ++j) {
+      G[i * Dimension + j] = factor * x[i] * x[j];
+    }
+    G[i * Dimension + i] += radial;
+  }
+}
+
+/*
+ * Dense symmetric positive definite solver.
+ *
+ * CholeskyPanelUpdater, CholeskyTrailingUpdater: steps of the blocked
+ * right-looking Cholesky factorisation run in parallel. The matrix is
+ * stored row-major, and only the lower triangle is used, so that all
+ * the inner products run over contiguous memory.
+ */
+class CholeskyPanelUpdater {
+
+ public:
+
+  CholeskyPanelUpdater(double *_a, mwSize _n, mwSize _k0, mwSize _k1)
+    : a(_a), n(_n), k0(_k0), k1(_k1) {}
+
+  // rows [begin, end) are relative to k1
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (mwSize i = this->k1 + begin; i < this->k1 + end; ++i) {
+      double *ai = this->a + i * this->n;
+      for (mwSize j = this->k0; j < this->k1; ++j) {
+	const double *aj = this->a + j * this->n;
+	double s = ai[j];
+	for (mwSize p = this->k0; p < j; ++p) {
+	  s -= ai[p] * aj[p];
+	}
+	ai[j] = s / aj[j];
+      }
+    }
+  }
+
+ private:
+
+  double *a;
+  mwSize n, k0, k1;
+
+};
+
+class CholeskyTrailingUpdater {
+
+ public:
+
+  CholeskyTrailingUpdater(double *_a, mwSize _n, mwSize _k0, mwSize _k1)
+    : a(_a), n(_n), k0(_k0), k1(_k1) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (mwSize i = this->k1 + begin; i < this->k1 + end; ++i) {
+      double *ai = this->a + i * this->n;
+      for (mwSize j = this->k1; j <= i; ++j) {
+	const double *aj = this->a + j * this->n;
+	double s = 0.0;
+	for (mwSize p = this->k0; p < this->k1; ++p) {
+	  s += ai[p] * aj[p];
+	}
+	ai[j] -= s;
+      }
+    }
+  }
+
+ private:
+
+  double *a;
+  mwSize n, k0, k1;
+
+};
+
+/*
+ * choleskyFactorize(): in-place Cholesky factorisation A = L*L^T of
+ * the n x n row-major matrix a. Returns false if the matrix is not
+ * numerically positive definite.
+ */
+inline
+bool choleskyFactorize(double *a, mwSize n) {
+
+  const mwSize nb = 64; // block size
+
+  for (mwSize k0 = 0; k0 < n; k0 += nb) {
+    mwSize k1 = std::min(n, k0 + nb);
+
+    // factorise diagonal block
+    for (mwSize i = k0; i < k1; ++i) {
+      double *ai = a + i * n;
+      for (mwSize j = k0; j <= i; ++j) {
+	const double *aj = a + j * n;
+	double s = ai[j];
+	for (mwSize p = k0; p < j; ++p) {
+	  s -= ai[p] * aj[p];
+	}
+	if (i == j) {
+	  if (!(s > 0.0) || !(s < std::numeric_limits<double>::infinity())) {
+	    return false;
+	  }
+	  ai[i] = std::sqrt(s);
+	} else {
+	  ai[j] = s / aj[j];
+	}
+      }
+    }
+    if (k1 == n) {
+      break;
+    }
+
+    // panel below the diagonal block
+    CholeskyPanelUpdater panel(a, n, k0, k1);
+    parallelFor(0, n - k1, panel);
+
+    // rank-nb update of the trailing matrix. Row i has i - k1 + 1
+    // elements to update, so rows are scheduled dynamically
+    CholeskyTrailingUpdater trailing(a, n, k0, k1);
+    parallelForDynamic(0, n - k1, 16, trailing);
+  }
+
+  return true;
+}
+
+/*
+ * choleskySolve(): solve L*L^T * X = B in place, where L is the output
+ * of choleskyFactorize(), and B is a row-major n x nrhs matrix.
+ */
+inline
+void choleskySolve(const double *a, mwSize n, double *b, mwSize nrhs) {
+  // forward substitution, L * Z = B
+  for (mwSize i = 0; i < n; ++i) {
+    const double *ai = a + i * n;
+    for (mwSize r = 0; r < nrhs; ++r) {
+      double s = b[i * nrhs + r];
+      for (mwSize p = 0; p < i; ++p) {
+	s -= ai[p] * b[p * nrhs + r];
+      }
+      b[i * nrhs + r] = s / ai[i];
+    }
+  }
+  // backward substitution, L^T * X = Z
+  for (mwSize i = n; i-- > 0; ) {
+    const double lii = a[i * n + i];
+    for (mwSize r = 0; r < nrhs; ++r) {
+      b[i * nrhs + r] /= lii;
+    }
+    const double *ai = a + i * n;
+    for (mwSize p = 0; p < i; ++p) {
+      for (mwSize r = 0; r < nrhs; ++r) {
+	b[p * nrhs + r] -= ai[p] * b[i * nrhs + r];
+      }
+    }
+  }
+}
+
+/*
+ * Householder QR of the N x (Dimension+1) matrix of the affine
+ * constraints, P = [1 x]. The orthogonal matrix Q = H_0 * ... * H_D is
+ * stored as the Householder vectors, so that it can be applied to
+ * segments of length N in O(N * Dimension).
+ */
+template <unsigned int Dimension>
+class AffineConstraintQR {
+
+ public:
+
+  static const unsigned int Q = Dimension + 1;
+
+  mwSize N;
+  std::vector<double> v;    // v[k * N + i], Householder vectors
+  std::vector<double> beta; // H_k = I - beta_k * v_k * v_k^T
+  double R[Q][Q];           // upper triangular factor
+
+  // returns false if P is rank deficient (e.g. all landmarks coplanar)
+  template <class TScalarType>
+  bool Factorize(const TScalarType *x, mwSize _N) {
+    this->N = _N;
+    std::vector<double> P(N * Q);
+    double scale = 0.0;
+    for (mwSize i = 0; i < N; ++i) {
+      P[i] = 1.0;
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	P[(d + 1) * N + i] = (double)x[d * N + i];
+	scale = std::max(scale, std::fabs(P[(d + 1) * N + i]));
+      }
+    }
+    scale = std::max(scale, 1.0);
+    this->v.assign(Q * N, 0.0);
+    this->beta.assign(Q, 0.0);
+    for (unsigned int k = 0; k < Q; ++k) {
+      double *pk = &P[k * N];
+      double norm2 = 0.0;
+      for (mwSize i = k; i < N; ++i) {
+	norm2 += pk[i] * pk[i];
+      }
+      double alpha = (pk[k] > 0.0) ? -std::sqrt(norm2) : std::sqrt(norm2);
+      if (std::fabs(alpha) <= 1e-12 * scale * std::sqrt((double)N)) {
+	return false;
+      }
+      double *vk = &this->v[k * N];
+      double vnorm2 = 0.0;
+      for (mwSize i = k; i < N; ++i) {
+	vk[i] = pk[i];
+      }
+      vk[k] -= alpha;
+      for (mwSize i = k; i < N; ++i) {
+	vnorm2 += vk[i] * vk[i];
+      }
+      this->beta[k] = 2.0 / vnorm2;
+      for (unsigned int j = k; j < Q; ++j) {
+	this->ApplyReflection(k, &P[j * N], 1);
+      }
+      for (unsigned int j = 0; j < Q; ++j) {
+	this->R[k][j] = (j >= k) ? P[j * N + k] : 0.0;
+      }
+    }
+    return true;
+  }
+
+  // z <- H_k * z, z is a segment of length N with stride
+  void ApplyReflection(unsigned int k, double *z, mwSize stride) const {
+    const double *vk = &this->v[k * this->N];
+    double s = 0.0;
+    for (mwSize i = k; i < this->N; ++i) {
+      s += vk[i] * z[i * stride];
+    }
+    s *= this->beta[k];
+    for (mwSize i = k; i < this->N; ++i) {
+      z[i * stride] -= s * vk[i];
+    }
+  }
+
+  // z <- Q^T * z
+  void ApplyQt(double *z, mwSize stride) const {
+    for (unsigned int k = 0; k < Q; ++k) {
+      this->ApplyReflection(k, z, stride);
+    }
+  }
+
+  // z <- Q * z
+  void ApplyQ(double *z, mwSize stride) const {
+    for (unsigned int k = Q; k-- > 0; ) {
+      this->ApplyReflection(k, z, stride);
+    }
+  }
+
+};
+
+/*
+ * KernelSystemBuilder: fill rows of the kernel system matrix K and
+ * right-multiply them by blockdiag(Q, ..., Q). Run with parallelFor()
+ * over the rows of K.
+ */
+template <unsigned int Dimension>
+class KernelSystemBuilder {
+
+ public:
+
+  KernelSystemBuilder(const KernelTransformModel<Dimension> &_model,
+		      const AffineConstraintQR<Dimension> &_qr,
+		      double *_K, mwSize _nblocks, double _sign)
+    : model(_model), qr(_qr), K(_K), nblocks(_nblocks), sign(_sign) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const mwSize N = this->model.N;
+    const mwSize n = this->nblocks * N;
+    double x[Dimension];
+    double G[Dimension * Dimension];
+    for (mwSize row = begin; row < end; ++row) {
+      mwSize bi = row / N; // block (output component) of the row
+      mwSize i = row % N;  // landmark of the row
+      double *Krow = this->K + row * n;
+      for (mwSize j = 0; j < N; ++j) {
+	for (unsigned int d = 0; d < Dimension; ++d) {
+	  x[d] = this->model.src[d * N + i] - this->model.src[d * N + j];
+	}
+	kernelMatrix(this->model, x, G);
+	for (mwSize bj = 0; bj < this->nblocks; ++bj) {
+	  Krow[bj * N + j] = this->sign * G[bi * Dimension + bj];
+	}
+      }
+      for (mwSize bj = 0; bj < this->nblocks; ++bj) {
+	this->qr.ApplyQt(Krow + bj * N, 1);
+      }
+    }
+  }
+
+ private:
+
+  const KernelTransformModel<Dimension> &model;
+  const AffineConstraintQR<Dimension> &qr;
+  double *K;
+  mwSize nblocks;
+  double sign;
+
+};
+
+/*
+ * KernelSystemRowTransformer: right-multiply rows of a matrix by
+ * blockdiag(Q, ..., Q).
+ */
+template <unsigned int Dimension>
+class KernelSystemRowTransformer {
+
+ public:
+
+  KernelSystemRowTransformer(const AffineConstraintQR<Dimension> &_qr,
+			     double *_K, mwSize _nblocks)
+    : qr(_qr), K(_K), nblocks(_nblocks) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const mwSize n = this->nblocks * this->qr.N;
+    for (mwSize row = begin; row < end; ++row) {
+      for (mwSize b = 0; b < this->nblocks; ++b) {
+	this->qr.ApplyQt(this->K + row * n + b * this->qr.N, 1);
+      }
+    }
+  }
+
+ private:
+
+  const AffineConstraintQR<Dimension> &qr;
+  double *K;
+  mwSize nblocks;
+
+};
+
+/*
+ * fitKernelTransformModel(): compute the weights and affine part of a
+ * kernel transform from the landmarks x -> y. model.kernel and
+ * model.alpha must be set before calling this function.
+ *
+ * The interpolation conditions plus the side conditions
+ *
+ *   [K   P] [w]   [y - x]
+ *   [P^T 0] [a] = [  0  ]
+ *
+ * are a symmetric indefinite system. Instead of factorising it with a
+ * generic SVD (as ITK's ComputeWMatrix() does), we eliminate the side
+ * conditions with a QR factorisation of P = Q*R (null space method):
+ * w = Q2*g, where Q2 spans the null space of P^T, and Q2^T*K*Q2 is
+ * (+/-) positive definite for the conditionally positive definite
+ * kernels, so it can be solved by Cholesky. For radial kernels, K
+ * decouples into one N x N matrix shared by all Dimension right hand
+ * sides.
+ *
+ * Returns false if the system cannot be solved this way (rank
+ * deficient landmarks, too few landmarks, or matrix not definite); the
+ * caller can then fall back to ITK's solver.
+ */
+template <class TScalarType, unsigned int Dimension>
+bool fitKernelTransformModel(KernelTransformModel<Dimension> &model,
+			     const TScalarType *x, const TScalarType *y, mwSize N) {
+
+  const unsigned int q = Dimension + 1;
+  if (N <= q) {
+    return false;
+  }
+
+  model.Resize(N);
+  for (mwSize i = 0; i < Dimension * N; ++i) {
+    model.src[i] = (double)x[i];
+  }
+
+  // QR of the affine constraints
+  AffineConstraintQR<Dimension> qr;
+  if (!qr.Factorize(x, N)) {
+    return false;
+  }
+
+  // radial kernels: one block, Dimension right hand sides. Elastic
+  // kernels: Dimension blocks (one per output component), 1 right hand side
+  const mwSize nblocks = model.IsRadial() ? 1 : Dimension;
+  const mwSize nrhs = model.IsRadial() ? Dimension : 1;
+  const mwSize n = nblocks * N;
+  const mwSize m = nblocks * (N - q);
+
+  // right hand side F = Q^T * (y - x), row-major n x nrhs
+  std::vector<double> F(n * nrhs);
+  for (mwSize i = 0; i < N; ++i) {
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      double disp = (double)y[d * N + i] - (double)x[d * N + i];
+      if (model.IsRadial()) {
+	F[i * nrhs + d] = disp;
+      } else {
+	F[d * N + i] = disp;
+      }
+    }
+  }
+  for (mwSize b = 0; b < nblocks; ++b) {
+    for (mwSize r = 0; r < nrhs; ++r) {
+      qr.ApplyQt(&F[b * N * nrhs + r], nrhs);
+    }
+  }
+
+  // sign that makes the projected matrix positive definite. -r is
+  // conditionally positive definite of order 1, r^3 and r^2 log(r) of
+  // order 2. For the elastic kernels we try both signs
+  std::vector<double> signs;
+  if (model.kernel == KERNEL_TPS) {
+    signs.push_back(-1.0);
+  } else if (model.IsRadial()) {
+    signs.push_back(1.0);
+  } else {
+    signs.push_back(1.0);
+    signs.push_back(-1.0);
+  }
+
+  std::vector<double> K;
+  std::vector<double> Ktop(nblocks * q * n);
+  double sign = 0.0;
+  bool success = false;
+  for (size_t s = 0; s < signs.size() && !success; ++s) {
+    sign = signs[s];
+
+    // K1 = sign * K * blockdiag(Q); K1^T = blockdiag(Q^T) * sign * K
+    K.assign(n * n, 0.0);
+    KernelSystemBuilder<Dimension> builder(model, qr, &K[0], nblocks, sign);
+    parallelFor(0, n, builder);
+
+    // K2 = blockdiag(Q^T) * sign * K * blockdiag(Q) = (K1^T * blockdiag(Q))
+    for (mwSize i = 0; i < n; ++i) {
+      for (mwSize j = i + 1; j < n; ++j) {
+	std::swap(K[i * n + j], K[j * n + i]);
+      }
+    }
+    KernelSystemRowTransformer<Dimension> transformer(qr, &K[0], nblocks);
+    parallelFor(0, n, transformer);
+
+    // keep the rows that correspond to the affine part, to recover
+    // the affine coefficients later
+    for (mwSize b = 0; b < nblocks; ++b) {
+      for (unsigned int k = 0; k < q; ++k) {
+	std::copy(&K[(b * N + k) * n], &K[(b * N + k) * n] + n,
+		  &Ktop[(b * q + k) * n]);
+      }
+    }
+
+    // compact the null space block M = Q2^T * K * Q2 to the top-left
+    // corner of the buffer, with row stride m. Destination indices are
+    // never ahead of source indices, so this can be done in place
+    mwSize dst = 0;
+    for (mwSize bi = 0; bi < nblocks; ++bi) {
+      for (mwSize i = q; i < N; ++i) {
+	const mwSize srcRow = (bi * N + i) * n;
+	for (mwSize bj = 0; bj < nblocks; ++bj) {
+	  for (mwSize j = q; j < N; ++j) {
+	    K[dst++] = K[srcRow + bj * N + j];
+	  }
+	}
+      }
+    }
+
+    success = choleskyFactorize(&K[0], m);
+  }
+  if (!success) {
+    return false;
+  }
+
+  // solve for the null space coordinates g
+  std::vector<double> g(m * nrhs);
+  for (mwSize b = 0, row = 0; b < nblocks; ++b) {
+    for (mwSize i = q; i < N; ++i, ++row) {
+      for (mwSize r = 0; r < nrhs; ++r) {
+	g[row * nrhs + r] = sign * F[(b * N + i) * nrhs + r];
+      }
+    }
+  }
+  choleskySolve(&K[0], m, &g[0], nrhs);
+
+  // W' = [0; g] for each block, in the rotated coordinates
+  std::vector<double> Wt(n * nrhs, 0.0);
+  for (mwSize b = 0, row = 0; b < nblocks; ++b) {
+    for (mwSize i = q; i < N; ++i, ++row) {
+      for (mwSize r = 0; r < nrhs; ++r) {
+	Wt[(b * N + i) * nrhs + r] = g[row * nrhs + r];
+      }
+    }
+  }
+
+  // affine part: R * a = F_top - (Q^T K Q)_top * W' (for each block and rhs)
+  for (mwSize b = 0; b < nblocks; ++b) {
+    for (mwSize r = 0; r < nrhs; ++r) {
+      double rhs[Dimension + 1];
+      for (unsigned int k = 0; k < q; ++k) {
+	const double *Kk = &Ktop[(b * q + k) * n];
+	double s = 0.0;
+	for (mwSize j = 0; j < n; ++j) {
+	  s += Kk[j] * Wt[j * nrhs + r];
+	}
+	rhs[k] = F[(b * N + k) * nrhs + r] - sign * s;
+      }
+      // back substitution with R
+      double a[Dimension + 1];
+      for (unsigned int k = q; k-- > 0; ) {
+	double s = rhs[k];
+	for (unsigned int j = k + 1; j < q; ++j) {
+	  s -= qr.R[k][j] * a[j];
+	}
+	a[k] = s / qr.R[k][k];
+      }
+      // output component of this block/rhs
+      unsigned int o = (unsigned int)(model.IsRadial() ? r : b);
+      model.B[o] = a[0];
+      for (unsigned int d = 0; d < Dimension; ++d) {
+	model.A[o * Dimension + d] = a[d + 1];
+      }
+    }
+  }
+
+  // rotate weights back, W = blockdiag(Q) * W'
+  for (mwSize b = 0; b < nblocks; ++b) {
+    for (mwSize r = 0; r < nrhs; ++r) {
+      qr.ApplyQ(&Wt[b * N * nrhs + r], nrhs);
+    }
+  }
+  for (mwSize i = 0; i < N; ++i) {
+    for (unsigned int d = 0; d < Dimension; ++d) {
+      model.w[d * N + i] = model.IsRadial() ? Wt[i * nrhs + d] : Wt[d * N + i];
+    }
+  }
+
+  return true;
+}
+
+#endif /* KERNELTRANSFORMENGINE_H */
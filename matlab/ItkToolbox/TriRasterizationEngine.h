@@ -0,0 +1,797 @@
+/*
+ * TriRasterizationEngine.h
+ *
+ * Native scanline rasterization of a closed triangular mesh onto a
+ * voxel grid (itk_tri_rasterization(..., 'scanline')).
+ *
+ * The image is filled one row at a time. Each row of voxel centres
+ * lies on a line parallel to the x-axis, at (y, z). The line crosses a
+ * triangle if and only if (y, z) is inside the projection of the
+ * triangle onto the yz-plane, so the crossings of all rows of a slice
+ * are the crossings of the slice polygons with the rows. Each
+ * crossing is decided with exact 2D orientation predicates (a
+ * floating point filter followed by exact expansion arithmetic when
+ * the sign is uncertain), and points that fall exactly on an edge or
+ * vertex of the projection are assigned to one triangle only by a
+ * symbolic perturbation of the point. Thus, on a closed mesh, each
+ * row always sees an even number of crossings, and the voxels between
+ * consecutive pairs of crossings are inside (even-odd parity).
+ *
+ * Voxels with their centre exactly on the surface are always
+ * considered inside, independently of whether they are at the left,
+ * right, top or bottom of the mesh. To this effect, the contacts of
+ * the rows with the surface are filled in addition to the parity
+ * intervals.
+ *
+ * Triangles are binned into slabs of consecutive slices. Each slab
+ * only writes to its own slices of the output image, so slabs are
+ * rasterized in parallel directly into the output buffer.
+ *
+ * The same crossings are used to compute the partial volume of the
+ * voxels crossed by the surface (see TriScanlineCoverage).
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.2.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef TRIRASTERIZATIONENGINE_H
+#define TRIRASTERIZATIONENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+/* Gerardus headers */
+#include "GerardusParallel.h"
+
+/*
+ * Exact arithmetic on floating point expansions (Dekker, Knuth,
+ * Shewchuk). An expansion is a sum of non-overlapping doubles, sorted
+ * by increasing magnitude, that represents a number exactly.
+ */
+
+// x + y = a + b exactly, with x = fl(a + b)
+inline
+void exactTwoSum(double a, double b, double &x, double &y) {
+  x = a + b;
+  double bvirt = x - a;
+  double avirt = x - bvirt;
+  y = (a - avirt) + (b - bvirt);
+}
+
+// a = hi + lo, with hi and lo having at most 26 significant bits
+inline
+void exactSplit(double a, double &hi, double &lo) {
+  const double splitter = 134217729.0; // 2^27 + 1
+  double c = splitter * a;
+  double abig = c - a;
+  hi = c - abig;
+  lo = a - hi;
+}
+
+// x + y = a * b exactly, with x = fl(a * b)
+inline
+void exactTwoProduct(double a, double b, double &x, double &y) {
+  x = a * b;
+  double ahi, alo, bhi, blo;
+  exactSplit(a, ahi, alo);
+  exactSplit(b, bhi, blo);
+  double err1 = x - ahi * bhi;
+  double err2 = err1 - alo * bhi;
+  double err3 = err2 - ahi * blo;
+  y = alo * blo - err3;
+}
+
+// add b to the expansion e with n components, in place. The array
+// must have room for n + 1 components. Returns the new length
+inline
+int exactGrowExpansion(double *e, int n, double b) {
+  double q = b;
+  for (int i = 0; i < n; ++i) {
+    double qnew, h;
+    exactTwoSum(q, e[i], qnew, h);
+    e[i] = h;
+    q = qnew;
+  }
+  e[n] = q;
+  return n + 1;
+}
+
+/*
+ * orient2dSign(): sign of the determinant
+ *
+ *   | au - cu   av - cv |
+ *   | bu - cu   bv - cv |
+ *
+ * that is +1 if a, b, c are in counter-clockwise order, -1 if they
+ * are in clockwise order, and 0 if they are collinear. The result is
+ * exact. The floating point approximation is used when its error
+ * bound guarantees the sign, and otherwise the determinant is
+ * evaluated exactly as the expansion of its six products.
+ */
+inline
+int orient2dSign(double au, double av, double bu, double bv,
+		 double cu, double cv) {
+
+  double detleft = (au - cu) * (bv - cv);
+  double detright = (av - cv) * (bu - cu);
+  double det = detleft - detright;
+
+  double detsum;
+  if (detleft > 0.0) {
+    if (detright <= 0.0) {
+      return (det > 0.0) - (det < 0.0);
+    }
+    detsum = detleft + detright;
+  } else if (detleft < 0.0) {
+    if (detright >= 0.0) {
+      return (det > 0.0) - (det < 0.0);
+    }
+    detsum = -detleft - detright;
+  } else {
+    return (det > 0.0) - (det < 0.0);
+  }
+
+  // error bound of the floating point evaluation (Shewchuk's
+  // ccwerrboundA = (3 + 16 eps) eps, eps = 2^-53)
+  const double errbound = 3.3306690738754716e-16 * detsum;
+  if (det >= errbound || -det >= errbound) {
+    return (det > 0.0) - (det < 0.0);
+  }
+
+  // exact evaluation:
+  // au*bv - au*cv - cu*bv - av*bu + av*cu + cv*bu
+  double p[6][2];
+  exactTwoProduct(au, bv, p[0][0], p[0][1]);
+  exactTwoProduct(-au, cv, p[1][0], p[1][1]);
+  exactTwoProduct(-cu, bv, p[2][0], p[2][1]);
+  exactTwoProduct(-av, bu, p[3][0], p[3][1]);
+  exactTwoProduct(av, cu, p[4][0], p[4][1]);
+  exactTwoProduct(cv, bu, p[5][0], p[5][1]);
+  double e[12];
+  int n = 0;
+  for (int i = 0; i < 6; ++i) {
+    n = exactGrowExpansion(e, n, p[i][1]);
+    n = exactGrowExpansion(e, n, p[i][0]);
+  }
+
+  // the sign of an expansion is the sign of its largest component
+  for (int i = n - 1; i >= 0; --i) {
+    if (e[i] != 0.0) {
+      return (e[i] > 0.0) ? 1 : -1;
+    }
+  }
+  return 0;
+
+}
+
+/*
+ * TriScanlineRasterizer: mesh and voxel grid of the rasterization.
+ *
+ * x:      vertex coordinates, x[3*i + d], d = 0, 1, 2 for (x, y, z)
+ * tri:    0-based vertex indices of the triangles, tri[3*j + k]
+ * ntri:   number of triangles
+ * size:   number of voxels in (row, column, slice) format
+ * res:    voxel size in (row, column, slice) format
+ * origin: centre of the first voxel in (x, y, z) format
+ *
+ * Rows run along y, columns along x and slices along z, so voxel (r,
+ * c, s) has its centre at
+ *
+ *   (origin[0] + c*res[1], origin[1] + r*res[0], origin[2] + s*res[2])
+ *
+ * and it's stored at im[r + size[0] * (c + size[1] * s)].
+ */
+class TriScanlineRasterizer {
+
+ public:
+
+  TriScanlineRasterizer(const double *_x, const size_t *_tri, size_t _ntri,
+			const size_t *_size, const double *_res, const double *_origin)
+    : x(_x), tri(_tri), ntri(_ntri) {
+    for (unsigned int i = 0; i < 3; ++i) {
+      this->size[i] = _size[i];
+      this->res[i] = _res[i];
+      this->origin[i] = _origin[i];
+    }
+  }
+
+  size_t GetNumberOfTriangles() const {
+    return this->ntri;
+  }
+
+  // x-, y- or z-range of a triangle
+  void GetRange(size_t t, unsigned int d, double &lo, double &hi) const {
+    const size_t *v = this->tri + 3 * t;
+    lo = hi = this->x[3 * v[0] + d];
+    for (unsigned int k = 1; k < 3; ++k) {
+      double val = this->x[3 * v[k] + d];
+      lo = std::min(lo, val);
+      hi = std::max(hi, val);
+    }
+  }
+
+  // range of grid lines first + i*step, i = 0, ..., n-1, that may
+  // cross the interval [lo, hi]. The range is conservative (it can
+  // include one more line at each end). Returns false if there are
+  // none
+  static bool GridRange(double lo, double hi, double first, double step, size_t n,
+			size_t &i0, size_t &i1) {
+    if (n == 0) {
+      return false;
+    }
+    double f0 = std::floor((lo - first) / step);
+    double f1 = std::ceil((hi - first) / step);
+    if (!(f1 >= 0.0) || !(f0 <= (double)(n - 1))) { // also catches NaNs
+      return false;
+    }
+    i0 = (f0 < 0.0) ? 0 : (size_t)f0;
+    i1 = (f1 > (double)(n - 1)) ? n - 1 : (size_t)f1;
+    return true;
+  }
+
+  /*
+   * BinTriangles(): assign each triangle to the slabs of slabSize
+   * slices it may cross. slabSize and margin (in voxels) allow to
+   * bin triangles for lines that are not at the slice centres
+   */
+  void BinTriangles(size_t slabSize, double margin,
+		    std::vector<std::vector<size_t> > &slabs) const {
+    size_t nslices = this->size[2];
+    slabs.clear();
+    slabs.resize((nslices + slabSize - 1) / slabSize);
+    for (size_t t = 0; t < this->ntri; ++t) {
+      double zmin, zmax;
+      this->GetRange(t, 2, zmin, zmax);
+      size_t s0, s1;
+      if (!GridRange(zmin - margin * this->res[2], zmax + margin * this->res[2],
+		     this->origin[2], this->res[2], nslices, s0, s1)) {
+	continue;
+      }
+      for (size_t b = s0 / slabSize; b <= s1 / slabSize; ++b) {
+	slabs[b].push_back(t);
+      }
+    }
+  }
+
+  // flags returned by Intersect()
+  enum IntersectionType {NONE = 0, CROSSING = 1, TOUCHING = 2};
+
+  /*
+   * Intersect(): intersection of the line parallel to the x-axis at
+   * (y, z) with triangle t.
+   *
+   * The line crosses the triangle (CROSSING flag, x-coordinate in
+   * xcross) if (y, z) is inside the projection of the triangle onto
+   * the yz-plane. Points on an edge or vertex of the projection are
+   * solved by perturbing (y, z) an infinitesimal amount towards (+1,
+   * -eps), so that on a closed mesh exactly one of the triangles that
+   * share the edge or vertex is crossed, and the parity of the number
+   * of crossings is preserved. Triangles parallel to the line are
+   * never crossed.
+   *
+   * Separately, the line touches the triangle (TOUCHING flag) if
+   * (y, z) is on the boundary of the projection, or if the triangle
+   * is parallel to the line and contains it. The x-range of the
+   * contact is returned in [xlo, xhi]. Voxel centres in this range
+   * are on the surface, and are set as inside even if the perturbed
+   * line misses the triangle.
+   */
+  int Intersect(size_t t, double y, double z,
+		double &xcross, double &xlo, double &xhi) const {
+
+    const size_t *v = this->tri + 3 * t;
+    const double *a = this->x + 3 * v[0];
+    const double *b = this->x + 3 * v[1];
+    const double *c = this->x + 3 * v[2];
+
+    // orient the projected triangle counter-clockwise
+    int o = orient2dSign(a[1], a[2], b[1], b[2], c[1], c[2]);
+    if (o == 0) {
+      return this->IntersectParallel(a, b, c, y, z, xlo, xhi) ? TOUCHING : NONE;
+    }
+    if (o < 0) {
+      std::swap(b, c);
+    }
+
+    // the point must be to the left of or on the three edges
+    int sab = orient2dSign(a[1], a[2], b[1], b[2], y, z);
+    int sbc = orient2dSign(b[1], b[2], c[1], c[2], y, z);
+    int sca = orient2dSign(c[1], c[2], a[1], a[2], y, z);
+    if (sab < 0 || sbc < 0 || sca < 0) {
+      return NONE;
+    }
+
+    // barycentric interpolation of the x-coordinate
+    double wa = (b[1] - y) * (c[2] - z) - (b[2] - z) * (c[1] - y);
+    double wb = (c[1] - y) * (a[2] - z) - (c[2] - z) * (a[1] - y);
+    double wc = (a[1] - y) * (b[2] - z) - (a[2] - z) * (b[1] - y);
+    double w = wa + wb + wc;
+    double xmin = std::min(a[0], std::min(b[0], c[0]));
+    double xmax = std::max(a[0], std::max(b[0], c[0]));
+    if (w > 0.0) {
+      xcross = (wa * a[0] + wb * b[0] + wc * c[0]) / w;
+      xcross = std::min(xmax, std::max(xmin, xcross));
+    } else {
+      xcross = 0.5 * (xmin + xmax);
+    }
+
+    // strictly inside the projection
+    if (sab > 0 && sbc > 0 && sca > 0) {
+      return CROSSING;
+    }
+
+    // on the boundary of the projection
+    xlo = xhi = xcross;
+    if ((sab > 0 || PerturbedInside(a, b))
+	&& (sbc > 0 || PerturbedInside(b, c))
+	&& (sca > 0 || PerturbedInside(c, a))) {
+      return CROSSING | TOUCHING;
+    }
+    return TOUCHING;
+
+  }
+
+  /*
+   * RowCrossings(): sorted crossings of the lines at (y0 + r*dy, z), r
+   * = 0, ..., nrows-1, with the candidate triangles.
+   *
+   * rowTri:    scratch buffer, with nrows elements
+   * crossings: output, with nrows elements
+   * touches:   output, with nrows elements. Pairs (xlo, xhi) of
+   *            contacts of the line with the surface that are not
+   *            crossings. Can be NULL
+   */
+  void RowCrossings(double z, double y0, double dy, size_t nrows,
+		    const std::vector<size_t> &candidates,
+		    std::vector<std::vector<size_t> > &rowTri,
+		    std::vector<std::vector<double> > &crossings,
+		    std::vector<std::vector<double> > *touches) const {
+
+    for (size_t r = 0; r < nrows; ++r) {
+      rowTri[r].clear();
+      crossings[r].clear();
+      if (touches) {
+	(*touches)[r].clear();
+      }
+    }
+
+    // triangles that span the slice, sorted into the rows they may
+    // cross
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      size_t t = candidates[i];
+      double lo, hi;
+      this->GetRange(t, 2, lo, hi);
+      if (lo > z || hi < z) {
+	continue;
+      }
+      this->GetRange(t, 1, lo, hi);
+      size_t r0, r1;
+      if (!GridRange(lo, hi, y0, dy, nrows, r0, r1)) {
+	continue;
+      }
+      for (size_t r = r0; r <= r1; ++r) {
+	rowTri[r].push_back(t);
+      }
+    }
+
+    for (size_t r = 0; r < nrows; ++r) {
+      double y = y0 + r * dy;
+      for (size_t i = 0; i < rowTri[r].size(); ++i) {
+	double xcross, xlo, xhi;
+	int flags = this->Intersect(rowTri[r][i], y, z, xcross, xlo, xhi);
+	if (flags & CROSSING) {
+	  crossings[r].push_back(xcross);
+	}
+	if ((flags & TOUCHING) && touches) {
+	  (*touches)[r].push_back(xlo);
+	  (*touches)[r].push_back(xhi);
+	}
+      }
+      std::sort(crossings[r].begin(), crossings[r].end());
+    }
+
+  }
+
+  // first column with its centre at or after xx (size[1] if none)
+  size_t FirstColumnFrom(double xx) const {
+    size_t ncols = this->size[1];
+    double f = std::ceil((xx - this->origin[0]) / this->res[1]);
+    size_t c = (f <= 0.0) ? 0 : ((f >= (double)ncols) ? ncols : (size_t)f);
+    // correct rounding errors, so that the comparison is exact with
+    // the voxel centre coordinates
+    while (c > 0 && this->ColumnCentre(c - 1) >= xx) {
+      --c;
+    }
+    while (c < ncols && this->ColumnCentre(c) < xx) {
+      ++c;
+    }
+    return c;
+  }
+
+  // first column with its centre after xx (size[1] if none)
+  size_t FirstColumnAfter(double xx) const {
+    size_t ncols = this->size[1];
+    double f = std::floor((xx - this->origin[0]) / this->res[1]) + 1.0;
+    size_t c = (f <= 0.0) ? 0 : ((f >= (double)ncols) ? ncols : (size_t)f);
+    while (c > 0 && this->ColumnCentre(c - 1) > xx) {
+      --c;
+    }
+    while (c < ncols && this->ColumnCentre(c) <= xx) {
+      ++c;
+    }
+    return c;
+  }
+
+  double ColumnCentre(size_t c) const {
+    return this->origin[0] + c * this->res[1];
+  }
+
+  const size_t *GetSize() const { return this->size; }
+  const double *GetSpacing() const { return this->res; }
+  const double *GetOrigin() const { return this->origin; }
+
+ private:
+
+  // a point on edge a->b, perturbed towards (+1, -eps), is to the
+  // left of the edge if the edge goes down, or horizontally backwards
+  static bool PerturbedInside(const double *a, const double *b) {
+    double dv = b[2] - a[2];
+    double du = b[1] - a[1];
+    return (dv < 0.0) || (dv == 0.0 && du < 0.0);
+  }
+
+  // contact of the line at (y, z) with a triangle whose projection
+  // onto the yz-plane is a segment or a point
+  static bool IntersectParallel(const double *a, const double *b, const double *c,
+				double y, double z, double &xlo, double &xhi) {
+
+    const double *p[3] = {a, b, c};
+
+    // the point must be in the bounding box of the projection...
+    double umin = std::min(a[1], std::min(b[1], c[1]));
+    double umax = std::max(a[1], std::max(b[1], c[1]));
+    double vmin = std::min(a[2], std::min(b[2], c[2]));
+    double vmax = std::max(a[2], std::max(b[2], c[2]));
+    if (y < umin || y > umax || z < vmin || z > vmax) {
+      return false;
+    }
+
+    // ...and on the line that contains it
+    for (unsigned int i = 0; i < 3; ++i) {
+      const double *q0 = p[i];
+      const double *q1 = p[(i + 1) % 3];
+      if (orient2dSign(q0[1], q0[2], q1[1], q1[2], y, z) != 0) {
+	return false;
+      }
+    }
+
+    // all vertices project onto the point
+    if (umin == umax && vmin == vmax) {
+      xlo = std::min(a[0], std::min(b[0], c[0]));
+      xhi = std::max(a[0], std::max(b[0], c[0]));
+      return true;
+    }
+
+    // clip the triangle edges with the line, parameterizing the
+    // projection by its longest coordinate
+    unsigned int d = (umax - umin >= vmax - vmin) ? 1 : 2;
+    double w0 = (d == 1) ? y : z;
+    bool found = false;
+    for (unsigned int i = 0; i < 3; ++i) {
+      const double *q0 = p[i];
+      const double *q1 = p[(i + 1) % 3];
+      double xx;
+      if (q0[d] == w0) {
+	xx = q0[0];
+      } else if ((q0[d] < w0 && q1[d] > w0) || (q0[d] > w0 && q1[d] < w0)) {
+	xx = q0[0] + (w0 - q0[d]) / (q1[d] - q0[d]) * (q1[0] - q0[0]);
+      } else {
+	continue;
+      }
+      if (!found) {
+	xlo = xhi = xx;
+	found = true;
+      } else {
+	xlo = std::min(xlo, xx);
+	xhi = std::max(xhi, xx);
+      }
+    }
+    return found;
+
+  }
+
+  const double *x;
+  const size_t *tri;
+  size_t ntri;
+  size_t size[3];
+  double res[3];
+  double origin[3];
+
+};
+
+/*
+ * TriScanlineFill: functor that rasterizes slabs of slices into a
+ * binary image, for parallelForDynamic().
+ */
+template <class TPixel>
+class TriScanlineFill {
+
+ public:
+
+  TriScanlineFill(const TriScanlineRasterizer &_raster,
+		  const std::vector<std::vector<size_t> > &_slabs,
+		  size_t _slabSize, TPixel *_im)
+    : raster(_raster), slabs(_slabs), slabSize(_slabSize), im(_im) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+
+    const size_t *size = this->raster.GetSize();
+    const double *res = this->raster.GetSpacing();
+    const double *origin = this->raster.GetOrigin();
+    std::vector<std::vector<size_t> > rowTri(size[0]);
+    std::vector<std::vector<double> > crossings(size[0]);
+    std::vector<std::vector<double> > touches(size[0]);
+
+    for (size_t b = begin; b < end; ++b) {
+      if (this->slabs[b].empty()) {
+	continue;
+      }
+      size_t sEnd = std::min(size[2], (b + 1) * this->slabSize);
+      for (size_t s = b * this->slabSize; s < sEnd; ++s) {
+	double z = origin[2] + s * res[2];
+	this->raster.RowCrossings(z, origin[1], res[0], size[0],
+				  this->slabs[b], rowTri, crossings, &touches);
+	for (size_t r = 0; r < size[0]; ++r) {
+	  TPixel *row = this->im + r + size[0] * size[1] * s;
+	  // pairs of crossings delimit the inside of the mesh. If the
+	  // mesh is not closed, the last unpaired crossing is ignored
+	  for (size_t k = 0; k + 1 < crossings[r].size(); k += 2) {
+	    size_t c0 = this->raster.FirstColumnFrom(crossings[r][k]);
+	    size_t c1 = this->raster.FirstColumnAfter(crossings[r][k+1]);
+	    for (size_t c = c0; c < c1; ++c) {
+	      row[size[0] * c] = 1;
+	    }
+	  }
+	  // voxel centres on the surface
+	  for (size_t k = 0; k + 1 < touches[r].size(); k += 2) {
+	    size_t c0 = this->raster.FirstColumnFrom(touches[r][k]);
+	    size_t c1 = this->raster.FirstColumnAfter(touches[r][k+1]);
+	    for (size_t c = c0; c < c1; ++c) {
+	      row[size[0] * c] = 1;
+	    }
+	  }
+	}
+      }
+    }
+
+  }
+
+ private:
+
+  const TriScanlineRasterizer &raster;
+  const std::vector<std::vector<size_t> > &slabs;
+  size_t slabSize;
+  TPixel *im;
+
+};
+
+/*
+ * triScanlineRasterization(): rasterize the mesh into im, that must
+ * be zero-initialized and have size[0]*size[1]*size[2] voxels.
+ */
+template <class TPixel>
+void triScanlineRasterization(const TriScanlineRasterizer &raster, TPixel *im,
+			      unsigned int numThreads = 0) {
+
+  // several slabs per thread, so that the dynamic scheduler can
+  // balance slabs with very different numbers of triangles
+  size_t nslices = raster.GetSize()[2];
+  numThreads = getNumberOfThreads(numThreads);
+  size_t slabSize = std::max((size_t)1, nslices / (4 * (size_t)numThreads));
+
+  std::vector<std::vector<size_t> > slabs;
+  raster.BinTriangles(slabSize, 0.0, slabs);
+
+  TriScanlineFill<TPixel> fill(raster, slabs, slabSize, im);
+  parallelForDynamic(0, slabs.size(), 1, fill, numThreads);
+
+}
+
+/*
+ * TriScanlineCoverage: functor that computes the fraction of each
+ * voxel inside the mesh (partial volume), for parallelForDynamic().
+ *
+ * Each row of voxels is sampled by k x k lines parallel to the x-axis,
+ * at the centres of a regular subdivision of the (y, z) footprint of
+ * the row. Along each line, the parity intervals are clipped exactly
+ * to the voxels, so the coverage is exact in x and supersampled in y
+ * and z. Voxels completely covered by an interval are counted in O(1)
+ * with a difference array, so the cost of the supersampling is only
+ * paid by the voxels crossed by the surface, while interior voxels are
+ * set to 1 by the parity fill.
+ */
+template <class TPixel>
+class TriScanlineCoverage {
+
+ public:
+
+  TriScanlineCoverage(const TriScanlineRasterizer &_raster,
+		      const std::vector<std::vector<size_t> > &_slabs,
+		      size_t _slabSize, unsigned int _k, TPixel *_im,
+		      unsigned int numThreads)
+    : raster(_raster), slabs(_slabs), slabSize(_slabSize), k(_k), im(_im),
+      buffers(numThreads) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+
+    const size_t *size = this->raster.GetSize();
+    const double *res = this->raster.GetSpacing();
+    const double *origin = this->raster.GetOrigin();
+    size_t nrows = size[0];
+    size_t ncols = size[1];
+    size_t nsub = nrows * this->k;
+
+    // scratch buffers of this thread: partial coverage of the voxels
+    // at the ends of each interval, difference array of the fully
+    // covered voxels, and range of columns touched in each row
+    Buffer &buf = this->buffers[thread];
+    if (buf.part.size() != nrows * ncols) {
+      buf.part.assign(nrows * ncols, 0.0);
+      buf.diff.assign(nrows * ncols, 0.0);
+      buf.lo.assign(nrows, ncols);
+      buf.hi.assign(nrows, 0);
+      buf.rowTri.resize(nsub);
+      buf.crossings.resize(nsub);
+    }
+
+    // sub-line offsets in voxel units, relative to the voxel centre
+    std::vector<double> offset(this->k);
+    for (unsigned int i = 0; i < this->k; ++i) {
+      offset[i] = (i + 0.5) / this->k - 0.5;
+    }
+    double nsamples = (double)this->k * this->k;
+
+    for (size_t b = begin; b < end; ++b) {
+      if (this->slabs[b].empty()) {
+	continue;
+      }
+      size_t sEnd = std::min(size[2], (b + 1) * this->slabSize);
+      for (size_t s = b * this->slabSize; s < sEnd; ++s) {
+
+	// accumulate the coverage of the k x k sub-lines of each row
+	for (unsigned int kz = 0; kz < this->k; ++kz) {
+	  double z = origin[2] + (s + offset[kz]) * res[2];
+	  this->raster.RowCrossings(z, origin[1] + offset[0] * res[0], res[0] / this->k,
+				    nsub, this->slabs[b], buf.rowTri, buf.crossings, NULL);
+	  for (size_t q = 0; q < nsub; ++q) {
+	    const std::vector<double> &xs = buf.crossings[q];
+	    size_t r = q / this->k;
+	    double *part = &buf.part[r * ncols];
+	    double *diff = &buf.diff[r * ncols];
+	    for (size_t i = 0; i + 1 < xs.size(); i += 2) {
+	      // interval in voxel units, where column c spans [c, c+1)
+	      double ua = (xs[i] - origin[0]) / res[1] + 0.5;
+	      double ub = (xs[i+1] - origin[0]) / res[1] + 0.5;
+	      ua = std::max(0.0, ua);
+	      ub = std::min((double)ncols, ub);
+	      if (!(ub > ua)) {
+		continue;
+	      }
+	      size_t ca = std::min(ncols - 1, (size_t)ua);
+	      size_t cb = std::min(ncols - 1, (size_t)ub);
+	      if (ca == cb) {
+		part[ca] += ub - ua;
+	      } else {
+		part[ca] += (ca + 1) - ua;
+		part[cb] += ub - cb;
+		diff[ca + 1] += 1.0;
+		diff[cb] -= 1.0;
+	      }
+	      buf.lo[r] = std::min(buf.lo[r], ca);
+	      buf.hi[r] = std::max(buf.hi[r], cb);
+	    }
+	  }
+	}
+
+	// write the coverage of the touched columns and reset the
+	// buffers. Columns outside the touched range are outside the mesh
+	for (size_t r = 0; r < nrows; ++r) {
+	  if (buf.lo[r] > buf.hi[r]) {
+	    continue;
+	  }
+	  double *part = &buf.part[r * ncols];
+	  double *diff = &buf.diff[r * ncols];
+	  TPixel *row = this->im + r + nrows * ncols * s;
+	  double full = 0.0;
+	  for (size_t c = buf.lo[r]; c <= buf.hi[r]; ++c) {
+	    full += diff[c];
+	    double v = (full + part[c]) / nsamples;
+	    row[nrows * c] = (TPixel)std::min(1.0, v);
+	    part[c] = 0.0;
+	    diff[c] = 0.0;
+	  }
+	  buf.lo[r] = ncols;
+	  buf.hi[r] = 0;
+	}
+
+      }
+    }
+
+  }
+
+ private:
+
+  struct Buffer {
+    std::vector<double> part;
+    std::vector<double> diff;
+    std::vector<size_t> lo;
+    std::vector<size_t> hi;
+    std::vector<std::vector<size_t> > rowTri;
+    std::vector<std::vector<double> > crossings;
+  };
+
+  const TriScanlineRasterizer &raster;
+  const std::vector<std::vector<size_t> > &slabs;
+  size_t slabSize;
+  unsigned int k;
+  TPixel *im;
+  std::vector<Buffer> buffers;
+
+};
+
+/*
+ * triScanlineCoverage(): fraction of each voxel inside the mesh, with
+ * k x k sub-lines per row of voxels. im must be zero-initialized and
+ * have size[0]*size[1]*size[2] voxels.
+ */
+template <class TPixel>
+void triScanlineCoverage(const TriScanlineRasterizer &raster, TPixel *im,
+			 unsigned int k, unsigned int numThreads = 0) {
+
+  size_t nslices = raster.GetSize()[2];
+  numThreads = getNumberOfThreads(numThreads);
+  size_t slabSize = std::max((size_t)1, nslices / (4 * (size_t)numThreads));
+
+  // the sub-lines are up to half a voxel away from the slice centres
+  std::vector<std::vector<size_t> > slabs;
+  raster.BinTriangles(slabSize, 0.5, slabs);
+
+  TriScanlineCoverage<TPixel> coverage(raster, slabs, slabSize, std::max(1u, k),
+				       im, numThreads);
+  parallelForDynamic(0, slabs.size(), 1, coverage, numThreads);
+
+}
+
+#endif /* TRIRASTERIZATIONENGINE_H */
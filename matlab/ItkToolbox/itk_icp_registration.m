@@ -0,0 +1,100 @@
+function varargout = itk_icp_registration(varargin)
+% ITK_ICP_REGISTRATION  Iterative Closest Point registration
+%
+% [Y2, T] = itk_icp_registration(X, Y)
+% [Y2, T] = itk_icp_registration(X, Y, 'translation')
+%
+%   X, Y are 3-column matrices with the coordinates of the fixed and
+%   moving point sets, respectively. Each row contains the coordinates
+%   of a point.
+%
+%   Y2 is the moving point set after registration.
+%
+%   T is the vector with the translation that registers Y onto X.
+%
+%   The 'translation' transform uses ITK's
+%   EuclideanDistancePointMetric and LevenbergMarquardtOptimizer. This
+%   syntax is a derived work of IterativeClosestPoint3.cxx
+%   https://github.com/Kitware/ITK/blob/master/Examples/Registration/IterativeClosestPoint3.cxx
+%
+% [Y2, T, RMS] = itk_icp_registration(X, Y, TRANSFORM, NITER, TOL, METRIC, SAMPLING, NSAMPLES)
+%
+%   Native ICP engine: the fixed points are stored in a k-d tree built
+%   once, and at each iteration the closest fixed point of each moving
+%   point is found in parallel. The transform update has a closed form
+%   solution ('point' metric) or is the solution of the linearised
+%   normal equations ('plane' metric).
+%
+%   TRANSFORM is a string with the transform type:
+%
+%     'rigid':      rotation and translation
+%     'similarity': rotation, translation and isotropic scaling
+%     'affine':     general affine transform
+%
+%   NITER is the maximum number of iterations. By default, NITER=50.
+%
+%   TOL is the tolerance for the stopping criterion. The algorithm
+%   stops when the relative change in RMS between iterations is below
+%   TOL. By default, TOL=1e-6.
+%
+%   METRIC is a string with the error minimised at each iteration:
+%
+%     'point' (default): point-to-point, squared distance between each
+%                        moving point and its closest fixed point.
+%     'plane':           point-to-plane, squared distance between each
+%                        moving point and the tangent plane at the
+%                        closest fixed point. Usually converges in far
+%                        fewer iterations on surfaces. The normals of
+%                        the fixed points are estimated from their 10
+%                        nearest neighbours.
+%
+%   SAMPLING is a string to select which moving points are used to
+%   compute the transform (all points are warped for the output Y2):
+%
+%     'all' (default): all points.
+%     'random':        NSAMPLES points, selected at random.
+%     'normal':        NSAMPLES points, selected with normal-space
+%                      sampling (Rusinkiewicz and Levoy, 2001), so
+%                      that the samples are spread evenly over the
+%                      normal directions of the surface.
+%
+%   NSAMPLES is the number of samples for 'random' and 'normal'
+%   SAMPLING. By default, 10% of the moving points.
+%
+%   T is a (4, 4) matrix with the homogeneous transform that maps Y
+%   onto X, i.e. [Y2, ones(N, 1)]' = T * [Y, ones(N, 1)]'.
+%
+%   RMS is the root mean square distance between the (sampled) moving
+%   points and their closest fixed points after registration.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2013-2015 University of Oxford
+% Version: 0.1.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK. 
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX file not found')
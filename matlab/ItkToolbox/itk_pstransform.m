@@ -43,6 +43,62 @@
 %   pts_tps_map(), as it implements the classic kernel proposed by
 %   Bookstein, r^2 ln(r^2).
 %
+% YI = itk_pstransform(..., ENGINE, TOL)
+%
+%   ENGINE is a string to select how the kernel transform is evaluated
+%   on the points XI, once it has been fitted to the landmarks:
+%
+%   'direct' (default): Exact sum over all landmarks, computed by a
+%            native cache-blocked loop, multithreaded over blocks of XI
+%            points. Same result as 'itk', but much faster.
+%
+%   'tree':  Treecode approximation (Barnes-Hut type, with 2nd order
+%            multipole expansions). Clusters of landmarks far from
+%            the point are replaced by their expansion only when the
+%            estimated truncation error is within TOL. Recommended for
+%            thousands of landmarks and large XI. Only available for
+%            'tps', 'tpsr2' and 'volume'. For 'elastic' and 'elasticr',
+%            'direct' is used instead.
+%
+%   'itk':   Use ITK's KernelTransform::TransformPoint() point by point
+%            (serial, slow, kept for reference).
+%
+%   TOL is a scalar with the maximum absolute error allowed in each
+%   coordinate of YI by the 'tree' engine. By default,
+%   TOL = 1e-6 * L, where L is the longest side of the bounding box of
+%   X.
+%
+% [YI, W] = itk_pstransform(TRANSFORM, X, Y, XI, ...)
+%
+%   W is a struct with the kernel transform fitted to the landmarks
+%   (kernel transforms only). W can be reused to warp other points
+%   without fitting the transform again, e.g. when an image is warped
+%   block by block. XI can be empty if only W is needed.
+%
+%   By default (ENGINE 'direct' or 'tree'), the transform is fitted with
+%   a native solver: the affine constraints are eliminated with a QR
+%   decomposition of the landmark coordinates, and the remaining
+%   symmetric definite system is solved with a blocked, multithreaded
+%   Cholesky factorization. If that system is not definite (e.g.
+%   landmarks on a plane, or fewer than Dimension+2 landmarks), ITK's
+%   SVD solver is used instead. With ENGINE 'itk', the transform is
+%   always fitted by ITK.
+%
+%   W has fields:
+%
+%     'transform': TRANSFORM string.
+%     'X':         landmarks X, as an (N,D)-matrix of type double.
+%     'W':         (N,D)-matrix with the kernel weights.
+%     'A', 'B':    affine part of the transform, y = x + x*A' + B.
+%     'alpha':     alpha parameter of the elastic kernels.
+%
+% YI = itk_pstransform(W, XI)
+% YI = itk_pstransform(W, XI, ENGINE, TOL)
+%
+%   Warp points XI with a transform W previously fitted by
+%   itk_pstransform. ENGINE can be 'direct' (default) or 'tree', and
+%   TOL is the same as above.
+%
 % YI = itk_pstransform('bspline', X, Y, XI, ORDER, LEVELS)
 %
 %   'bspline':  itk::BSplineScatteredDataPointSetToImageFilter
@@ -57,11 +113,26 @@
 %   in the algorithm. A higher number of levels will make the spline
 %   more flexible and match the landmarks better. By default, LEVELS=5.
 %
-% See also: pts_tps_map, pts_tps_weights.
+% YI = itk_pstransform('bspline', X, Y, CI, ...)
+%
+%   CI is a cell array CI={XI, YI, ZI} (or CI={XI, YI} in 2D), where
+%   XI, YI and ZI are vectors that describe a rectangular grid, as in
+%   cgal_insurftri. This is much faster and uses less memory than
+%   passing the coordinates of every point of the grid, as the B-spline
+%   is evaluated separably, one axis at a time, and slices of the grid
+%   are processed in parallel.
+%
+%   The output is then an array of size (ny, nx, nz, 3) (or (ny, nx, 2)
+%   in 2D), where nx, ny, nz are the lengths of the grid vectors, and
+%   element (r, c, s, :) is the warped point (CI{1}(c), CI{2}(r),
+%   CI{3}(s)). Note that rows correspond to the y-coordinate and
+%   columns to the x-coordinate, as in meshgrid.
+%
+% See also: pts_tps_map, pts_tps_weights, cgal_insurftri.
 
 % Author: Ramon Casero <rcasero@gmail.com>
-% Copyright © 2011 University of Oxford
-% Version: 0.1.1
+% Copyright © 2011-2015 University of Oxford
+% Version: 0.4.0
 % $Rev$
 % $Date$
 %
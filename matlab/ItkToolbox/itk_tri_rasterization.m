@@ -2,9 +2,6 @@ function varargout = itk_tri_rasterization(varargin)
 % ITK_TRI_RASTERIZATION  Rasterization of triangular mesh to binary
 % segmentation
 %
-% This function provides a Matlab interface to
-% itk::TriangleMeshToBinaryImageFilter.
-%
 % BW = itk_tri_rasterization(TRI, X, RES, SIZE, ORIGIN)
 %
 %   TRI, X describe a triangular mesh.
@@ -25,15 +22,42 @@ function varargout = itk_tri_rasterization(varargin)
 %   bottom-left image voxel, in (x, y, z) format.
 %
 %   BW is the output uint8 binary segmentation. Voxels inside the mesh will
-%   be set to 1, and voxels outside to 0. Note that voxels with their
-%   centre exactly on the mesh offer different results depending on whether
-%   they are at the left, right, top or bottom of the mesh. This is a
-%   limitation in itk::TriangleMeshToBinaryImageFilter. See
-%   test_itk_tri_rasterization.m in Gerardus for an example.
+%   be set to 1, and voxels outside to 0. Voxels with their centre exactly
+%   on the mesh are considered inside.
+%
+% BW = itk_tri_rasterization(..., ENGINE)
+%
+%   ENGINE is a string with the rasterization method:
+%
+%     'scanline' (default): Native multithreaded scanline rasterizer. The
+%     triangles are binned into slabs of slices, and each row of voxels
+%     is filled between pairs of crossings with the mesh (even-odd
+%     parity). Crossings are computed with exact geometric predicates,
+%     so the result is consistent for voxels with their centre exactly on
+%     the mesh, at any side of the mesh. If the mesh is not closed, rows
+%     with an odd number of crossings ignore the last one.
+%
+%     'itk': itk::TriangleMeshToBinaryImageFilter. This filter is
+%     single-threaded, and voxels with their centre exactly on the mesh
+%     offer different results depending on whether they are at the left,
+%     right, top or bottom of the mesh. See test_itk_tri_rasterization.m
+%     in Gerardus for an example.
+%
+% PV = itk_tri_rasterization(..., 'scanline', K)
+%
+%   K is a positive integer. PV is a single-precision image with the
+%   fraction of each voxel inside the mesh (partial volume), in [0, 1].
+%   Each row of voxels is sampled by K x K lines parallel to the x-axis,
+%   and the inside intervals of each line are clipped exactly to the
+%   voxels. Thus, the coverage is exact along x, and supersampled with K
+%   samples along y and z. Voxels not crossed by the surface are set to 0
+%   or 1 by the parity fill, so the cost of the supersampling depends on
+%   the number of voxels crossed by the surface, not on the volume.
+%   By default, K=0, and the output is the binary segmentation BW.
 
 % Author: Ramon Casero <rcasero@gmail.com>
 % Copyright © 2013 University of Oxford
-% Version: 0.1.0
+% Version: 0.3.0
 % $Rev$
 % $Date$
 %
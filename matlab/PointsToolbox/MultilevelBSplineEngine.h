@@ -0,0 +1,632 @@
+/*
+ * MultilevelBSplineEngine.h
+ *
+ * Native multilevel B-spline approximation (MBA) of scattered data
+ * (x, y, z) by a height field z = f(x, y), used by
+ * mba_surface_interpolation.cpp.
+ *
+ * The algorithm is the one by Lee, Wolberg and Shin [1]. A hierarchy
+ * of uniform bicubic B-spline lattices is fitted to the residuals of
+ * the previous levels with the B-spline approximation (BA) algorithm,
+ * and each level doubles the resolution of the previous one. The
+ * levels are merged on the fly by refining the accumulated lattice
+ * to the next resolution and adding the new level, so the result is
+ * a single lattice, MBALattice, that can be evaluated as many times
+ * as needed without fitting the data again.
+ *
+ * [1] S. Lee, G. Wolberg and S. Y. Shin, "Scattered data interpolation
+ * with multilevel B-splines", IEEE Transactions on Visualization and
+ * Computer Graphics, 3(3):228-244, 1997.
+ *
+ * Parallelisation:
+ *
+ *   - Points are counting-sorted once by the row of the finest
+ *     lattice they fall in. Because each level doubles the number of
+ *     rows, the points of any row at any level are then a contiguous
+ *     range. The BA accumulation processes horizontal stripes of at
+ *     least 3 rows of cells in parallel, first the even and then the
+ *     odd stripes, so that threads never write to the same control
+ *     points.
+ *
+ *   - Residuals, lattice refinement (separable, first along x, then
+ *     along y) and evaluation are parallel loops over points, rows or
+ *     columns.
+ *
+ * Evaluation on a grid is separable: each column of the output grid
+ * contracts the lattice along x once, and then each output value
+ * only needs 4 products along y.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2015 University of Oxford
+  * Version: 0.1.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+#ifndef MULTILEVELBSPLINEENGINE_H
+#define MULTILEVELBSPLINEENGINE_H
+
+/* C++ headers */
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * MBAMaxLevels: maximum number of levels of the hierarchy. The finest
+ * lattice already has 2^29 times more cells per side than the
+ * coarsest one, and larger values would overflow the lattice size.
+ */
+const unsigned int MBAMaxLevels = 30;
+
+/*
+ * bsplineWeights(): uniform cubic B-spline basis functions
+ * B0(t),...,B3(t). t is normally in [0, 1], but values outside are
+ * valid too, and extrapolate the polynomial of the cell.
+ */
+inline
+void bsplineWeights(double t, double *w) {
+  const double t2 = t * t;
+  const double t3 = t2 * t;
+  const double u = 1.0 - t;
+  w[0] = u * u * u / 6.0;
+  w[1] = (3.0 * t3 - 6.0 * t2 + 4.0) / 6.0;
+  w[2] = (-3.0 * t3 + 3.0 * t2 + 3.0 * t + 1.0) / 6.0;
+  w[3] = t3 / 6.0;
+}
+
+/*
+ * mbaLocate(): cell index and local coordinate of coordinate u,
+ * already scaled so that the lattice spans [0, ncells]. Points
+ * outside use the closest cell.
+ */
+inline
+void mbaLocate(double u, size_t ncells, size_t &cell, double &t) {
+  double f = std::floor(u);
+  if (!(f >= 0.0)) {
+    f = 0.0;
+  } else if (f > (double)(ncells - 1)) {
+    f = (double)(ncells - 1);
+  }
+  cell = (size_t)f;
+  t = u - f;
+}
+
+/*
+ * mbaIsFinite(): false for NaN and Inf.
+ */
+inline
+bool mbaIsFinite(double a) {
+  return a - a == 0.0;
+}
+
+/*
+ * MBALattice: bicubic B-spline control lattice on the rectangle
+ * domain = [xmin, xmax, ymin, ymax], split into m x n cells.
+ *
+ * phi has (m+3) x (n+3) control points, with the x index running
+ * fastest, i.e. control point (a, b) is phi[a + (m+3)*b]. Control
+ * point (a, b) sits at cell coordinates (a-1, b-1).
+ */
+class MBALattice {
+
+ public:
+
+  MBALattice() : m(0), n(0) {
+    this->domain[0] = this->domain[2] = 0.0;
+    this->domain[1] = this->domain[3] = 1.0;
+  }
+
+  // (re)allocate the lattice with m x n cells, and set all control
+  // points to zero
+  void Resize(size_t _m, size_t _n) {
+    this->m = _m;
+    this->n = _n;
+    this->phi.assign((_m + 3) * (_n + 3), 0.0);
+  }
+
+  size_t GetStride() const {
+    return this->m + 3;
+  }
+
+  // cell index and local coordinate of x (dim=0) or y (dim=1)
+  void Locate(double x, int dim, size_t &cell, double &t) const {
+    const size_t ncells = (dim == 0) ? this->m : this->n;
+    const double lo = this->domain[2 * dim];
+    const double hi = this->domain[2 * dim + 1];
+    mbaLocate((x - lo) / (hi - lo) * (double)ncells, ncells, cell, t);
+  }
+
+  // evaluate the surface at (x, y)
+  double Evaluate(double x, double y) const {
+    size_t i, j;
+    double s, t;
+    this->Locate(x, 0, i, s);
+    this->Locate(y, 1, j, t);
+    return this->Evaluate(i, s, j, t);
+  }
+
+  // evaluate the surface at normalised coordinates (u, v), where the
+  // domain is mapped to the unit square
+  double EvaluateNormalised(double u, double v) const {
+    size_t i, j;
+    double s, t;
+    mbaLocate(u * (double)this->m, this->m, i, s);
+    mbaLocate(v * (double)this->n, this->n, j, t);
+    return this->Evaluate(i, s, j, t);
+  }
+
+  // evaluate the surface in cell (i, j) at local coordinates (s, t)
+  double Evaluate(size_t i, double s, size_t j, double t) const {
+    double wx[4], wy[4];
+    bsplineWeights(s, wx);
+    bsplineWeights(t, wy);
+    const size_t stride = this->GetStride();
+    const double *p = &this->phi[i + stride * j];
+    double z = 0.0;
+    for (int l = 0; l < 4; ++l, p += stride) {
+      z += wy[l] * (wx[0] * p[0] + wx[1] * p[1] + wx[2] * p[2] + wx[3] * p[3]);
+    }
+    return z;
+  }
+
+  size_t m, n;
+  double domain[4];
+  std::vector<double> phi;
+
+};
+
+/*
+ * MBARefineFunctor: one separable pass of the refinement of a lattice
+ * from k to 2k cells along one dimension. The 1D subdivision rule for
+ * cubic B-splines is
+ *
+ *   f(2i)   = (c(i-1) + 6*c(i) + c(i+1)) / 8
+ *   f(2i+1) = (c(i) + c(i+1)) / 2
+ *
+ * Each call processes lines [begin, end). A line has nIn input
+ * control points with step stepIn between them, and lines are lineIn
+ * apart (similarly for the output).
+ */
+class MBARefineFunctor {
+
+ public:
+
+  MBARefineFunctor(const double *_in, size_t _nIn, size_t _stepIn, size_t _lineIn,
+		   double *_out, size_t _stepOut, size_t _lineOut)
+    : in(_in), nIn(_nIn), stepIn(_stepIn), lineIn(_lineIn),
+      out(_out), stepOut(_stepOut), lineOut(_lineOut) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    // input control points with storage index a = 0,...,k+2 map to
+    // output control points 2a-1 (even rule) and 2a (odd rule)
+    const size_t k = this->nIn - 3;
+    for (size_t line = begin; line < end; ++line) {
+      const double *c = this->in + line * this->lineIn;
+      double *f = this->out + line * this->lineOut;
+      const size_t si = this->stepIn;
+      const size_t so = this->stepOut;
+      for (size_t a = 0; a < k + 2; ++a) {
+	f[(2 * a) * so] = 0.5 * (c[a * si] + c[(a + 1) * si]);
+      }
+      for (size_t a = 1; a < k + 2; ++a) {
+	f[(2 * a - 1) * so] = 0.125 * (c[(a - 1) * si] + 6.0 * c[a * si]
+				       + c[(a + 1) * si]);
+      }
+    }
+  }
+
+ private:
+
+  const double *in;
+  size_t nIn, stepIn, lineIn;
+  double *out;
+  size_t stepOut, lineOut;
+
+};
+
+/*
+ * mbaRefine(): refine lattice in with m x n cells to lattice out with
+ * 2m x 2n cells that represents exactly the same surface.
+ */
+inline
+void mbaRefine(const MBALattice &in, MBALattice &out, unsigned int numThreads = 0) {
+  const size_t mi = in.m + 3;
+  const size_t ni = in.n + 3;
+  const size_t mo = 2 * in.m + 3;
+
+  // along x: (mi x ni) -> (mo x ni)
+  std::vector<double> tmp(mo * ni);
+  MBARefineFunctor fx(&in.phi[0], mi, 1, mi, &tmp[0], 1, mo);
+  parallelFor(0, ni, fx, numThreads);
+
+  // along y: (mo x ni) -> (mo x no)
+  out.Resize(2 * in.m, 2 * in.n);
+  std::copy(in.domain, in.domain + 4, out.domain);
+  MBARefineFunctor fy(&tmp[0], ni, mo, 1, &out.phi[0], mo, 1);
+  parallelFor(0, mo, fy, numThreads);
+}
+
+/*
+ * MBAAccumulateFunctor: BA algorithm, accumulation of the
+ * contributions delta and weights omega of the points in stripes of
+ * rows of cells. Stripe s contains the cell rows [s*height,
+ * (s+1)*height), and the functor processes stripes phase, phase+2,
+ * phase+4, ..., so that concurrent stripes are at least one stripe
+ * apart, and touch disjoint control points when height >= 3.
+ */
+class MBAAccumulateFunctor {
+
+ public:
+
+  MBAAccumulateFunctor(const double *_u, const double *_v, const double *_r,
+		       const size_t *_rowStart, size_t _m, size_t _n,
+		       size_t _height, size_t _phase,
+		       double *_delta, double *_omega)
+    : u(_u), v(_v), r(_r), rowStart(_rowStart), m(_m), n(_n),
+      height(_height), phase(_phase), delta(_delta), omega(_omega) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    const size_t stride = this->m + 3;
+    for (size_t k = begin; k < end; ++k) {
+      const size_t s = 2 * k + this->phase;
+      const size_t row0 = s * this->height;
+      const size_t row1 = std::min(row0 + this->height, this->n);
+      for (size_t p = this->rowStart[row0]; p < this->rowStart[row1]; ++p) {
+	size_t i, j;
+	double s, t, wx[4], wy[4], w[16];
+	mbaLocate(this->u[p] * (double)this->m, this->m, i, s);
+	mbaLocate(this->v[p] * (double)this->n, this->n, j, t);
+	bsplineWeights(s, wx);
+	bsplineWeights(t, wy);
+	double sum2 = 0.0;
+	for (int l = 0; l < 4; ++l) {
+	  for (int c = 0; c < 4; ++c) {
+	    w[4 * l + c] = wx[c] * wy[l];
+	    sum2 += w[4 * l + c] * w[4 * l + c];
+	  }
+	}
+	const double rs = this->r[p] / sum2;
+	double *pd = this->delta + i + stride * j;
+	double *po = this->omega + i + stride * j;
+	for (int l = 0; l < 4; ++l, pd += stride, po += stride) {
+	  for (int c = 0; c < 4; ++c) {
+	    const double w2 = w[4 * l + c] * w[4 * l + c];
+	    // w^2 * phi_c, with phi_c = w * r / sum(w^2)
+	    pd[c] += w2 * w[4 * l + c] * rs;
+	    po[c] += w2;
+	  }
+	}
+      }
+    }
+  }
+
+ private:
+
+  const double *u, *v, *r;
+  const size_t *rowStart;
+  size_t m, n, height, phase;
+  double *delta, *omega;
+
+};
+
+/*
+ * MBASolveFunctor: control points of the BA lattice, phi =
+ * delta/omega, or 0 where no point contributes. The result is added
+ * to the accumulated lattice.
+ */
+class MBASolveFunctor {
+
+ public:
+
+  MBASolveFunctor(const double *_delta, const double *_omega, double *_phi)
+    : delta(_delta), omega(_omega), phi(_phi) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t a = begin; a < end; ++a) {
+      if (this->omega[a] > 0.0) {
+	this->phi[a] += this->delta[a] / this->omega[a];
+      }
+    }
+  }
+
+ private:
+
+  const double *delta, *omega;
+  double *phi;
+
+};
+
+/*
+ * MBAResidualFunctor: residual of each point with respect to the
+ * accumulated lattice, r = z - f(x, y).
+ */
+class MBAResidualFunctor {
+
+ public:
+
+  MBAResidualFunctor(const MBALattice &_lat, const double *_u, const double *_v,
+		     const double *_z, double *_r)
+    : lat(_lat), u(_u), v(_v), z(_z), r(_r) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t p = begin; p < end; ++p) {
+      this->r[p] = this->z[p] - this->lat.EvaluateNormalised(this->u[p], this->v[p]);
+    }
+  }
+
+ private:
+
+  const MBALattice &lat;
+  const double *u, *v, *z;
+  double *r;
+
+};
+
+/*
+ * mbaFit(): fit a multilevel B-spline approximation to the N points
+ * (x, y, z), and return the merged lattice.
+ *
+ * domain:  [xmin, xmax, ymin, ymax] of the lattice. Points outside the
+ *          domain are extrapolated with the closest cell. Points with
+ *          NaN or Inf coordinates are ignored.
+ * m0, n0:  number of cells of the coarsest lattice in x and y.
+ * nLevels: number of levels, at most MBAMaxLevels. The finest
+ *          lattice has (m0*2^(nLevels-1)) x (n0*2^(nLevels-1)) cells.
+ */
+inline
+void mbaFit(const double *x, const double *y, const double *z, size_t N,
+	    const double *domain, size_t m0, size_t n0, unsigned int nLevels,
+	    MBALattice &lat, unsigned int numThreads = 0) {
+
+  if (m0 == 0 || n0 == 0 || nLevels == 0) {
+    throw std::runtime_error("Lattice must have at least 1 cell and 1 level");
+  }
+  if (nLevels > MBAMaxLevels) {
+    throw std::runtime_error("Too many levels");
+  }
+  if (!(domain[1] > domain[0]) || !(domain[3] > domain[2])) {
+    throw std::runtime_error("Domain must have positive width and height");
+  }
+  numThreads = getNumberOfThreads(numThreads);
+
+  // rows of the finest lattice
+  const size_t nMax = n0 << (nLevels - 1);
+  if ((nMax >> (nLevels - 1)) != n0) {
+    throw std::runtime_error("Too many levels");
+  }
+
+  // normalised coordinates, and row of each valid point in the
+  // finest lattice
+  const double w = domain[1] - domain[0];
+  const double h = domain[3] - domain[2];
+  std::vector<size_t> count(nMax + 1, 0);
+  std::vector<size_t> row(N);
+  for (size_t p = 0; p < N; ++p) {
+    if (!mbaIsFinite(x[p]) || !mbaIsFinite(y[p]) || !mbaIsFinite(z[p])) {
+      row[p] = nMax; // invalid point
+      continue;
+    }
+    double t;
+    mbaLocate((y[p] - domain[2]) / h * (double)nMax, nMax, row[p], t);
+    ++count[row[p]];
+  }
+
+  // counting sort of the valid points by row. rowStart[j] is the
+  // first point in row j
+  std::vector<size_t> rowStart(nMax + 1, 0);
+  for (size_t j = 0; j < nMax; ++j) {
+    rowStart[j + 1] = rowStart[j] + count[j];
+  }
+  const size_t nValid = rowStart[nMax];
+  std::vector<double> u(nValid), v(nValid), zs(nValid), r(nValid);
+  std::copy(rowStart.begin(), rowStart.end() - 1, count.begin());
+  for (size_t p = 0; p < N; ++p) {
+    if (row[p] == nMax) {
+      continue;
+    }
+    const size_t q = count[row[p]]++;
+    u[q] = (x[p] - domain[0]) / w;
+    v[q] = (y[p] - domain[2]) / h;
+    zs[q] = z[p];
+  }
+  std::vector<size_t>().swap(row);
+  std::vector<size_t>().swap(count);
+  std::copy(zs.begin(), zs.end(), r.begin());
+
+  lat.Resize(m0, n0);
+  std::copy(domain, domain + 4, lat.domain);
+  if (nValid == 0) {
+    return;
+  }
+
+  MBALattice refined;
+  std::vector<double> delta, omega;
+  std::vector<size_t> levelRowStart;
+  for (unsigned int level = 0; level < nLevels; ++level) {
+
+    if (level > 0) {
+      // merge the previous levels into the resolution of this one
+      mbaRefine(lat, refined, numThreads);
+      std::swap(lat.phi, refined.phi);
+      lat.m = refined.m;
+      lat.n = refined.n;
+
+      // residuals of the points with respect to the previous levels
+      MBAResidualFunctor fr(lat, &u[0], &v[0], &zs[0], &r[0]);
+      parallelFor(0, nValid, fr, numThreads);
+    }
+
+    // first point of each row at this level
+    const size_t m = lat.m;
+    const size_t n = lat.n;
+    const size_t shift = nLevels - 1 - level;
+    levelRowStart.resize(n + 1);
+    for (size_t j = 0; j <= n; ++j) {
+      levelRowStart[j] = rowStart[j << shift];
+    }
+
+    // BA accumulation in stripes of rows. The height of the stripes
+    // doesn't depend on the number of threads, so that the sums are
+    // always done in the same order, and the result is reproducible
+    delta.assign(lat.phi.size(), 0.0);
+    omega.assign(lat.phi.size(), 0.0);
+    size_t height = std::max((size_t)3, (n + 63) / 64);
+    size_t nStripes = (n + height - 1) / height;
+    for (size_t phase = 0; phase < 2; ++phase) {
+      MBAAccumulateFunctor fa(&u[0], &v[0], &r[0], &levelRowStart[0], m, n,
+			      height, phase, &delta[0], &omega[0]);
+      parallelForDynamic(0, (nStripes + 1 - phase) / 2, 1, fa, numThreads);
+    }
+
+    // add this level to the lattice
+    MBASolveFunctor fs(&delta[0], &omega[0], &lat.phi[0]);
+    parallelFor(0, lat.phi.size(), fs, numThreads);
+  }
+
+}
+
+/*
+ * MBAGridFunctor: evaluation of the lattice on the grid of points
+ * (xi(c), yi(r)), for the columns c in [begin, end). zi is a column
+ * major matrix with ny rows. Each column contracts the lattice along
+ * x into a buffer of n+3 values, and then combines 4 of them for each
+ * output value.
+ */
+class MBAGridFunctor {
+
+ public:
+
+  MBAGridFunctor(const MBALattice &_lat, const double *_xi, const size_t *_jy,
+		 const double *_wy, size_t _ny, double *_zi, unsigned int numThreads)
+    : lat(_lat), xi(_xi), jy(_jy), wy(_wy), ny(_ny), zi(_zi),
+      buffer(numThreads, std::vector<double>(_lat.n + 3)) {}
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    const size_t stride = this->lat.GetStride();
+    const size_t nb = this->lat.n + 3;
+    std::vector<double> &col = this->buffer[thread];
+    for (size_t c = begin; c < end; ++c) {
+      size_t i;
+      double s, wx[4];
+      this->lat.Locate(this->xi[c], 0, i, s);
+      bsplineWeights(s, wx);
+      const double *p = &this->lat.phi[i];
+      for (size_t b = 0; b < nb; ++b, p += stride) {
+	col[b] = wx[0] * p[0] + wx[1] * p[1] + wx[2] * p[2] + wx[3] * p[3];
+      }
+      double *out = this->zi + c * this->ny;
+      for (size_t r = 0; r < this->ny; ++r) {
+	const double *q = &col[this->jy[r]];
+	const double *w = this->wy + 4 * r;
+	out[r] = w[0] * q[0] + w[1] * q[1] + w[2] * q[2] + w[3] * q[3];
+      }
+    }
+  }
+
+ private:
+
+  const MBALattice &lat;
+  const double *xi;
+  const size_t *jy;
+  const double *wy;
+  size_t ny;
+  double *zi;
+  std::vector<std::vector<double> > buffer;
+
+};
+
+/*
+ * mbaEvaluateGrid(): evaluate the lattice on the grid defined by
+ * vectors xi (nx elements) and yi (ny elements). zi must be
+ * preallocated with ny x nx elements, and zi[r + ny*c] =
+ * f(xi[c], yi[r]), as in meshgrid().
+ */
+inline
+void mbaEvaluateGrid(const MBALattice &lat, const double *xi, size_t nx,
+		     const double *yi, size_t ny, double *zi,
+		     unsigned int numThreads = 0) {
+  if (nx == 0 || ny == 0) {
+    return;
+  }
+  numThreads = getNumberOfThreads(numThreads);
+
+  // cell and weights of each row, shared by all columns
+  std::vector<size_t> jy(ny);
+  std::vector<double> wy(4 * ny);
+  for (size_t r = 0; r < ny; ++r) {
+    double t;
+    lat.Locate(yi[r], 1, jy[r], t);
+    bsplineWeights(t, &wy[4 * r]);
+  }
+
+  MBAGridFunctor f(lat, xi, &jy[0], &wy[0], ny, zi, numThreads);
+  parallelFor(0, nx, f, numThreads);
+}
+
+/*
+ * MBAPointsFunctor: evaluation of the lattice at scattered points.
+ */
+class MBAPointsFunctor {
+
+ public:
+
+  MBAPointsFunctor(const MBALattice &_lat, const double *_x, const double *_y,
+		   double *_z)
+    : lat(_lat), x(_x), y(_y), z(_z) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t p = begin; p < end; ++p) {
+      this->z[p] = this->lat.Evaluate(this->x[p], this->y[p]);
+    }
+  }
+
+ private:
+
+  const MBALattice &lat;
+  const double *x, *y;
+  double *z;
+
+};
+
+/*
+ * mbaEvaluatePoints(): evaluate the lattice at the N points (x, y).
+ */
+inline
+void mbaEvaluatePoints(const MBALattice &lat, const double *x, const double *y,
+		       size_t N, double *z, unsigned int numThreads = 0) {
+  MBAPointsFunctor f(lat, x, y, z);
+  parallelFor(0, N, f, numThreads);
+}
+
+#endif /* MULTILEVELBSPLINEENGINE_H */
@@ -0,0 +1,372 @@
+/*
+ * mba_surface_interpolation.cpp
+ *
+ * MBA_SURFACE_INTERPOLATION  Scattered data Multilevel B-spline
+ * approximation of a height field
+ *
+ * ZI = mba_surface_interpolation(X, Y, Z, XI, YI)
+ *
+ *   X, Y, Z are vectors of class double with the coordinates of N
+ *   scattered points. Points with NaN or Inf coordinates are ignored.
+ *
+ *   XI, YI are vectors of class double that define a grid, as in
+ *   meshgrid(XI, YI).
+ *
+ *   ZI is a matrix with length(YI) rows and length(XI) columns, with
+ *   the values of the approximating surface z = f(x, y) on the grid,
+ *   ZI(i, j) = f(XI(j), YI(i)). This is the same convention as
+ *   gridfit(X, Y, Z, XI, YI).
+ *
+ *   The surface is computed with the Multilevel B-spline
+ *   Approximation (MBA) algorithm of Lee, Wolberg and Shin [1]. A
+ *   hierarchy of bicubic B-spline lattices is fitted to the data, each
+ *   one to the residuals of the previous ones and with twice their
+ *   resolution. Outside the domain of the lattice, the surface is
+ *   extrapolated with the polynomial of the closest cell.
+ *
+ * ZI = mba_surface_interpolation(X, Y, Z, XI, YI, NLEVELS, LAT0, DOMAIN, NUMTHREADS)
+ *
+ *   NLEVELS is the number of levels in the hierarchy. The more levels,
+ *   the closer the surface follows the data points. By default, the
+ *   largest number of levels such that the finest lattice has no more
+ *   control points than valid data points. NLEVELS can be at most 30.
+ *
+ *   LAT0 is a 2-vector [M0 N0] with the number of cells of the
+ *   coarsest lattice in the x and y directions. Level k has
+ *   M0*2^(k-1) x N0*2^(k-1) cells. By default, the shortest side of
+ *   the domain has 1 cell, and the longest side has as many cells as
+ *   needed to make them approximately square.
+ *
+ *   DOMAIN is a 4-vector [XMIN XMAX YMIN YMAX] with the rectangle
+ *   covered by the lattice. By default, the bounding box of the data.
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * [ZI, LAT] = mba_surface_interpolation(...)
+ *
+ *   LAT is a struct with the fitted lattice, that can be evaluated
+ *   again without fitting the data:
+ *
+ *     LAT.phi:    (M+3) x (N+3) matrix with the control points of the
+ *                 merged lattice, where M x N is the number of cells
+ *                 of the finest level. The x index runs along rows.
+ *     LAT.domain: [XMIN XMAX YMIN YMAX], as DOMAIN.
+ *
+ *   If only LAT is needed, XI and YI can be empty.
+ *
+ * ZI = mba_surface_interpolation(LAT, XI, YI)
+ * ZI = mba_surface_interpolation(LAT, XI, YI, MODE, NUMTHREADS)
+ *
+ *   Evaluate a lattice computed previously.
+ *
+ *   MODE is a string:
+ *
+ *     'grid' (default): ZI is evaluated on the grid meshgrid(XI, YI),
+ *                       as above.
+ *
+ *     'points':         XI, YI are arrays of the same size with the
+ *                       coordinates of scattered points, and ZI has
+ *                       the same size, ZI(i) = f(XI(i), YI(i)).
+ *
+ * [1] S. Lee, G. Wolberg and S. Y. Shin, "Scattered data interpolation
+ * with multilevel B-splines", IEEE Transactions on Visualization and
+ * Computer Graphics, 3(3):228-244, 1997.
+ *
+ * See also: gridfit, griddata, scatteredInterpolant.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2011-2015 University of Oxford
+  * Version: 0.3.1
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <cmath>
+#include <exception>
+#include <string>
+
+/* Gerardus headers */
+#include "MultilevelBSplineEngine.h"
+
+// check that the input is a real vector of class double, or empty
+static void checkVector(const mxArray *pm, const char *name) {
+  if (!mxIsDouble(pm) || mxIsComplex(pm) || mxIsSparse(pm)) {
+    mexErrMsgTxt((std::string(name) + " must be a real array of class double").c_str());
+  }
+}
+
+// read a non-negative scalar from a Matlab input, or return its
+// default value if the input is empty or not provided
+static double readScalar(int nrhs, const mxArray *prhs[], int pos,
+			 double def, const char *name) {
+  if (nrhs <= pos || mxIsEmpty(prhs[pos])) {
+    return def;
+  }
+  if (!mxIsNumeric(prhs[pos]) || mxGetNumberOfElements(prhs[pos]) != 1) {
+    mexErrMsgTxt((std::string(name) + " must be a scalar").c_str());
+  }
+  double v = mxGetScalar(prhs[pos]);
+  if (!(v >= 0.0)) {
+    mexErrMsgTxt((std::string(name) + " must be non-negative").c_str());
+  }
+  return v;
+}
+
+// evaluate the lattice on a grid or at scattered points, and return
+// the result in a new Matlab array
+static mxArray *evaluateLattice(const MBALattice &lat, const mxArray *xi,
+				const mxArray *yi, bool grid,
+				unsigned int numThreads) {
+  checkVector(xi, "XI");
+  checkVector(yi, "YI");
+  size_t nx = mxGetNumberOfElements(xi);
+  size_t ny = mxGetNumberOfElements(yi);
+  mxArray *zi = NULL;
+  if (grid) {
+    zi = mxCreateDoubleMatrix(ny, nx, mxREAL);
+    if (zi == NULL) {
+      mexErrMsgTxt("Not enough memory for output");
+    }
+    mbaEvaluateGrid(lat, mxGetPr(xi), nx, mxGetPr(yi), ny, mxGetPr(zi),
+		    numThreads);
+  } else {
+    if (nx != ny) {
+      mexErrMsgTxt("XI and YI must have the same number of elements");
+    }
+    zi = mxCreateNumericArray(mxGetNumberOfDimensions(xi), mxGetDimensions(xi),
+			      mxDOUBLE_CLASS, mxREAL);
+    if (zi == NULL) {
+      mexErrMsgTxt("Not enough memory for output");
+    }
+    mbaEvaluatePoints(lat, mxGetPr(xi), mxGetPr(yi), nx, mxGetPr(zi),
+		      numThreads);
+  }
+  return zi;
+}
+
+// convert a lattice to a Matlab struct
+static mxArray *latticeToStruct(const MBALattice &lat) {
+  const char *fieldNames[] = {"phi", "domain"};
+  mxArray *s = mxCreateStructMatrix(1, 1, 2, fieldNames);
+  mxArray *phi = mxCreateDoubleMatrix(lat.m + 3, lat.n + 3, mxREAL);
+  mxArray *domain = mxCreateDoubleMatrix(1, 4, mxREAL);
+  if (s == NULL || phi == NULL || domain == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  std::copy(lat.phi.begin(), lat.phi.end(), mxGetPr(phi));
+  std::copy(lat.domain, lat.domain + 4, mxGetPr(domain));
+  mxSetField(s, 0, "phi", phi);
+  mxSetField(s, 0, "domain", domain);
+  return s;
+}
+
+// convert a Matlab struct to a lattice
+static void structToLattice(const mxArray *s, MBALattice &lat) {
+  if (!mxIsStruct(s) || mxGetNumberOfElements(s) != 1) {
+    mexErrMsgTxt("LAT must be a struct");
+  }
+  const mxArray *phi = mxGetField(s, 0, "phi");
+  const mxArray *domain = mxGetField(s, 0, "domain");
+  if (phi == NULL || domain == NULL) {
+    mexErrMsgTxt("LAT must have fields phi and domain");
+  }
+  if (!mxIsDouble(phi) || mxIsComplex(phi) || mxGetNumberOfDimensions(phi) != 2
+      || mxGetM(phi) < 4 || mxGetN(phi) < 4) {
+    mexErrMsgTxt("LAT.phi must be a real matrix of class double with at least 4x4 elements");
+  }
+  if (!mxIsDouble(domain) || mxGetNumberOfElements(domain) != 4) {
+    mexErrMsgTxt("LAT.domain must be a 4-vector of class double");
+  }
+  lat.Resize(mxGetM(phi) - 3, mxGetN(phi) - 3);
+  const double *p = mxGetPr(phi);
+  std::copy(p, p + lat.phi.size(), lat.phi.begin());
+  std::copy(mxGetPr(domain), mxGetPr(domain) + 4, lat.domain);
+  if (!(lat.domain[1] > lat.domain[0]) || !(lat.domain[3] > lat.domain[2])) {
+    mexErrMsgTxt("LAT.domain must have positive width and height");
+  }
+}
+
+// the MBA hierarchy is fitted and evaluated in C++, so catch
+// exceptions (e.g. out of memory) and turn them into Matlab errors
+static void fitLattice(const double *x, const double *y, const double *z, size_t N,
+		       const double *domain, size_t m0, size_t n0,
+		       unsigned int nLevels, MBALattice &lat,
+		       unsigned int numThreads) {
+  std::string msg;
+  try {
+    mbaFit(x, y, z, N, domain, m0, n0, nLevels, lat, numThreads);
+    return;
+  } catch (std::exception &e) {
+    msg = e.what();
+  }
+  mexErrMsgTxt(msg.c_str());
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  // syntax ZI = mba_surface_interpolation(LAT, XI, YI, MODE, NUMTHREADS)
+  if (nrhs > 0 && mxIsStruct(prhs[0])) {
+    if (nrhs < 3 || nrhs > 5) {
+      mexErrMsgTxt("Between three and five input arguments required with LAT");
+    }
+    if (nlhs > 1) {
+      mexErrMsgTxt("Too many output arguments");
+    }
+    MBALattice lat;
+    structToLattice(prhs[0], lat);
+    bool grid = true;
+    if (nrhs > 3 && !mxIsEmpty(prhs[3])) {
+      if (!mxIsChar(prhs[3])) {
+	mexErrMsgTxt("MODE must be a string");
+      }
+      char *buf = mxArrayToString(prhs[3]);
+      std::string mode(buf);
+      mxFree(buf);
+      if (mode == "points") {
+	grid = false;
+      } else if (mode != "grid") {
+	mexErrMsgTxt("MODE must be 'grid' or 'points'");
+      }
+    }
+    unsigned int numThreads = (unsigned int)readScalar(nrhs, prhs, 4, 0.0, "NUMTHREADS");
+    plhs[0] = evaluateLattice(lat, prhs[1], prhs[2], grid, numThreads);
+    return;
+  }
+
+  // syntax [ZI, LAT] = mba_surface_interpolation(X, Y, Z, XI, YI, ...)
+  if (nrhs < 5 || nrhs > 9) {
+    mexErrMsgTxt("Between five and nine input arguments required");
+  }
+  if (nlhs > 2) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+
+  // scattered points
+  checkVector(prhs[0], "X");
+  checkVector(prhs[1], "Y");
+  checkVector(prhs[2], "Z");
+  size_t N = mxGetNumberOfElements(prhs[0]);
+  if (mxGetNumberOfElements(prhs[1]) != N || mxGetNumberOfElements(prhs[2]) != N) {
+    mexErrMsgTxt("X, Y and Z must have the same number of elements");
+  }
+  const double *x = mxGetPr(prhs[0]);
+  const double *y = mxGetPr(prhs[1]);
+  const double *z = mxGetPr(prhs[2]);
+
+  // domain: by default, the bounding box of the valid points
+  double domain[4];
+  if (nrhs > 7 && !mxIsEmpty(prhs[7])) {
+    if (!mxIsDouble(prhs[7]) || mxGetNumberOfElements(prhs[7]) != 4) {
+      mexErrMsgTxt("DOMAIN must be a 4-vector of class double");
+    }
+    std::copy(mxGetPr(prhs[7]), mxGetPr(prhs[7]) + 4, domain);
+    if (!(domain[1] > domain[0]) || !(domain[3] > domain[2])) {
+      mexErrMsgTxt("DOMAIN must have XMIN < XMAX and YMIN < YMAX");
+    }
+  } else {
+    domain[0] = domain[2] = HUGE_VAL;
+    domain[1] = domain[3] = -HUGE_VAL;
+    for (size_t p = 0; p < N; ++p) {
+      if (mbaIsFinite(x[p]) && mbaIsFinite(y[p]) && mbaIsFinite(z[p])) {
+	domain[0] = std::min(domain[0], x[p]);
+	domain[1] = std::max(domain[1], x[p]);
+	domain[2] = std::min(domain[2], y[p]);
+	domain[3] = std::max(domain[3], y[p]);
+      }
+    }
+    if (domain[0] > domain[1]) {
+      mexErrMsgTxt("There are no valid points in X, Y, Z");
+    }
+    // degenerate bounding box (e.g. collinear points)
+    for (int d = 0; d < 4; d += 2) {
+      if (domain[d + 1] == domain[d]) {
+	domain[d] -= 0.5;
+	domain[d + 1] += 0.5;
+      }
+    }
+  }
+  const double w = domain[1] - domain[0];
+  const double h = domain[3] - domain[2];
+
+  // size of the coarsest lattice: approximately square cells
+  size_t m0, n0;
+  if (nrhs > 6 && !mxIsEmpty(prhs[6])) {
+    if (!mxIsDouble(prhs[6]) || mxGetNumberOfElements(prhs[6]) != 2) {
+      mexErrMsgTxt("LAT0 must be a 2-vector of class double");
+    }
+    const double *p = mxGetPr(prhs[6]);
+    if (!(p[0] >= 1.0) || !(p[1] >= 1.0)) {
+      mexErrMsgTxt("LAT0 must have at least 1 cell in each direction");
+    }
+    m0 = (size_t)p[0];
+    n0 = (size_t)p[1];
+  } else if (w >= h) {
+    n0 = 1;
+    m0 = (size_t)std::max(1.0, std::floor(w / h + 0.5));
+  } else {
+    m0 = 1;
+    n0 = (size_t)std::max(1.0, std::floor(h / w + 0.5));
+  }
+
+  // number of levels: the finest lattice has no more control points
+  // than points
+  double levels = readScalar(nrhs, prhs, 5, 0.0, "NLEVELS");
+  if (levels > (double)MBAMaxLevels) {
+    mexErrMsgTxt("NLEVELS must be at most 30");
+  }
+  unsigned int nLevels = (unsigned int)levels;
+  if (nLevels == 0) {
+    nLevels = 1;
+    while (nLevels < MBAMaxLevels) {
+      double m = (double)m0 * std::pow(2.0, (double)nLevels);
+      double n = (double)n0 * std::pow(2.0, (double)nLevels);
+      if ((m + 3.0) * (n + 3.0) > (double)N) {
+	break;
+      }
+      ++nLevels;
+    }
+  }
+
+  unsigned int numThreads = (unsigned int)readScalar(nrhs, prhs, 8, 0.0, "NUMTHREADS");
+
+  // fit and evaluate the lattice
+  MBALattice lat;
+  fitLattice(x, y, z, N, domain, m0, n0, nLevels, lat, numThreads);
+  plhs[0] = evaluateLattice(lat, prhs[3], prhs[4], true, numThreads);
+  if (nlhs > 1) {
+    plhs[1] = latticeToStruct(lat);
+  }
+
+}
@@ -0,0 +1,106 @@
+function [zi, lat] = mba_surface_interpolation(x, y, z, xi, yi, nlevels, lat0, domain, numthreads)
+% MBA_SURFACE_INTERPOLATION  Scattered data Multilevel B-spline
+% approximation of a height field
+%
+% ZI = mba_surface_interpolation(X, Y, Z, XI, YI)
+%
+%   X, Y, Z are vectors of class double with the coordinates of N
+%   scattered points. Points with NaN or Inf coordinates are ignored.
+%
+%   XI, YI are vectors of class double that define a grid, as in
+%   meshgrid(XI, YI).
+%
+%   ZI is a matrix with length(YI) rows and length(XI) columns, with
+%   the values of the approximating surface z = f(x, y) on the grid,
+%   ZI(i, j) = f(XI(j), YI(i)). This is the same convention as
+%   gridfit(X, Y, Z, XI, YI).
+%
+%   The surface is computed with the Multilevel B-spline
+%   Approximation (MBA) algorithm of Lee, Wolberg and Shin [1]. A
+%   hierarchy of bicubic B-spline lattices is fitted to the data, each
+%   one to the residuals of the previous ones and with twice their
+%   resolution. Outside the domain of the lattice, the surface is
+%   extrapolated with the polynomial of the closest cell.
+%
+% ZI = mba_surface_interpolation(X, Y, Z, XI, YI, NLEVELS, LAT0, DOMAIN, NUMTHREADS)
+%
+%   NLEVELS is the number of levels in the hierarchy. The more levels,
+%   the closer the surface follows the data points. By default, the
+%   largest number of levels such that the finest lattice has no more
+%   control points than valid data points. NLEVELS can be at most 30.
+%
+%   LAT0 is a 2-vector [M0 N0] with the number of cells of the
+%   coarsest lattice in the x and y directions. Level k has
+%   M0*2^(k-1) x N0*2^(k-1) cells. By default, the shortest side of
+%   the domain has 1 cell, and the longest side has as many cells as
+%   needed to make them approximately square.
+%
+%   DOMAIN is a 4-vector [XMIN XMAX YMIN YMAX] with the rectangle
+%   covered by the lattice. By default, the bounding box of the data.
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% [ZI, LAT] = mba_surface_interpolation(...)
+%
+%   LAT is a struct with the fitted lattice, that can be evaluated
+%   again without fitting the data:
+%
+%     LAT.phi:    (M+3) x (N+3) matrix with the control points of the
+%                 merged lattice, where M x N is the number of cells
+%                 of the finest level. The x index runs along rows.
+%     LAT.domain: [XMIN XMAX YMIN YMAX], as DOMAIN.
+%
+%   If only LAT is needed, XI and YI can be empty.
+%
+% ZI = mba_surface_interpolation(LAT, XI, YI)
+% ZI = mba_surface_interpolation(LAT, XI, YI, MODE, NUMTHREADS)
+%
+%   Evaluate a lattice computed previously.
+%
+%   MODE is a string:
+%
+%     'grid' (default): ZI is evaluated on the grid meshgrid(XI, YI),
+%                       as above.
+%
+%     'points':         XI, YI are arrays of the same size with the
+%                       coordinates of scattered points, and ZI has
+%                       the same size, ZI(i) = f(XI(i), YI(i)).
+%
+% [1] S. Lee, G. Wolberg and S. Y. Shin, "Scattered data interpolation
+% with multilevel B-splines", IEEE Transactions on Visualization and
+% Computer Graphics, 3(3):228-244, 1997.
+%
+% See also: gridfit, griddata, scatteredInterpolant.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2011-2015 University of Oxford
+% Version: 0.3.1
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
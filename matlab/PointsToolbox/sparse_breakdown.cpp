@@ -0,0 +1,421 @@
+/*
+ * sparse_breakdown.cpp
+ *
+ * SPARSE_BREAKDOWN  Extract the internal arrays of a sparse matrix, or
+ * build a sparse matrix from them
+ *
+ * [IR, JC, PR] = sparse_breakdown(A)
+ *
+ *   A is a real sparse matrix of class double or logical, with size
+ *   (M, N).
+ *
+ *   IR, JC, PR are column vectors with the arrays that Matlab uses
+ *   internally to store A in Compressed Sparse Column (CSC) format:
+ *
+ *     IR: int64 vector with the row index of each non-zero element,
+ *         0-based, sorted by column, and within each column by row.
+ *
+ *     JC: int64 vector with N+1 elements. The non-zero elements of
+ *         column j (1-based) are IR(JC(j)+1:JC(j+1)) and
+ *         PR(JC(j)+1:JC(j+1)). JC(end) is the number of non-zero
+ *         elements.
+ *
+ *     PR: vector with the values of the non-zero elements, of the
+ *         same class as A.
+ *
+ *   The arrays are copied in one pass, without building the (row,
+ *   column, value) triplets of find(A). To get them from the CSC
+ *   arrays, the column indices are
+ *
+ *     >> j = repelem((1:N)', diff(JC));
+ *
+ * A = sparse_breakdown(IR, JC, PR, M)
+ *
+ *   Build sparse matrix A with M rows and length(JC)-1 columns from
+ *   its CSC arrays. IR and JC can be of class int64 or double, and
+ *   follow the 0-based convention above. PR can be of class double or
+ *   logical, and A has the same class.
+ *
+ *   The common case, when row indices in each column are sorted and
+ *   without repetitions, and all values are non-zero, is a copy of
+ *   the arrays in one pass. Otherwise, only the columns that need it
+ *   are sorted, and as with sparse(), repeated elements are added
+ *   (logical OR for logical matrices), and zeros are removed. This is
+ *   much faster than sparse(i, j, v, M, N), that sorts all the
+ *   elements.
+ *
+ * ... = sparse_breakdown(..., NUMTHREADS)
+ *
+ *   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+ *   one thread per processor is used.
+ *
+ * See also: sparse, find, im2dmatrix.
+ */
+
+ /*
+  * Author: Ramon Casero <rcasero@gmail.com>
+  * Copyright © 2010-2015 University of Oxford
+  * Version: 0.2.0
+  * $Rev$
+  * $Date$
+  *
+  * University of Oxford means the Chancellor, Masters and Scholars of
+  * the University of Oxford, having an administrative office at
+  * Wellington Square, Oxford OX1 2JD, UK.
+  *
+  * This file is part of Gerardus.
+  *
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * (at your option) any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  * GNU General Public License for more details. The offer of this
+  * program under the terms of the License is subject to the License
+  * being interpreted in accordance with English Law and subject to any
+  * action against the University of Oxford being under the jurisdiction
+  * of the English Courts.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see
+  * <http://www.gnu.org/licenses/>.
+  */
+
+/* mex headers */
+#include <mex.h>
+
+/* C++ headers */
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Gerardus headers */
+#include "../GerardusParallel.h"
+
+/*
+ * CopyFunctor: out[i] = in[i] for i in [begin, end), with type
+ * conversion.
+ */
+template <class TIn, class TOut>
+class CopyFunctor {
+
+ public:
+
+  CopyFunctor(const TIn *_in, TOut *_out) : in(_in), out(_out) {}
+
+  void operator()(size_t begin, size_t end, unsigned int) {
+    for (size_t i = begin; i < end; ++i) {
+      this->out[i] = (TOut)this->in[i];
+    }
+  }
+
+ private:
+
+  const TIn *in;
+  TOut *out;
+
+};
+
+// parallel copy of n elements, with type conversion
+template <class TIn, class TOut>
+void parallelCopy(const TIn *in, TOut *out, size_t n, unsigned int numThreads) {
+  CopyFunctor<TIn, TOut> f(in, out);
+  parallelFor(0, n, f, numThreads);
+}
+
+/*
+ * add(): accumulate repeated elements, as in sparse(). Logical
+ * elements are combined with OR.
+ */
+inline
+void add(double &a, double b) {
+  a += b;
+}
+
+inline
+void add(mxLogical &a, mxLogical b) {
+  a = a || b;
+}
+
+/*
+ * ColumnBuildFunctor: build the columns [begin, end) of the output
+ * sparse matrix from the input CSC arrays (ir, jc, pr).
+ *
+ * The functor is run twice. In the first pass (outIr == NULL), it
+ * validates the input and counts the number of non-zero elements of
+ * each output column into nnzCol. In the second pass, it writes the
+ * elements of each column starting at outJc[col].
+ *
+ * Columns that are already sorted, without repeated rows or zeros,
+ * are copied directly. Other columns are sorted in a per-thread
+ * buffer, and repeated rows and zeros are merged or removed.
+ */
+template <class TIdx, class TVal>
+class ColumnBuildFunctor {
+
+ public:
+
+  ColumnBuildFunctor(const TIdx *_ir, const TIdx *_jc, const TVal *_pr, size_t _m,
+		     mwIndex *_nnzCol, unsigned int numThreads)
+    : ir(_ir), jc(_jc), pr(_pr), m(_m), nnzCol(_nnzCol),
+      outIr(NULL), outJc(NULL), outPr(NULL), buffer(numThreads) {}
+
+  void SetOutput(mwIndex *_outIr, const mwIndex *_outJc, TVal *_outPr) {
+    this->outIr = _outIr;
+    this->outJc = _outJc;
+    this->outPr = _outPr;
+  }
+
+  void operator()(size_t begin, size_t end, unsigned int thread) {
+    std::vector<std::pair<mwIndex, TVal> > &buf = this->buffer[thread];
+    for (size_t col = begin; col < end; ++col) {
+      const size_t first = (size_t)this->jc[col];
+      const size_t last = (size_t)this->jc[col + 1];
+
+      // check whether the column can be copied directly
+      bool isClean = true;
+      for (size_t k = first; k < last; ++k) {
+	const TIdx r = this->ir[k];
+	if (!(r >= 0) || !((size_t)r < this->m) || r != (TIdx)(size_t)r) {
+	  throw std::runtime_error("IR must contain integer row indices in [0, M-1]");
+	}
+	if ((k > first && !(this->ir[k - 1] < r)) || this->pr[k] == 0) {
+	  isClean = false;
+	}
+      }
+
+      if (isClean) {
+	if (this->outIr == NULL) {
+	  this->nnzCol[col] = last - first;
+	} else {
+	  mwIndex *pir = this->outIr + this->outJc[col];
+	  TVal *ppr = this->outPr + this->outJc[col];
+	  for (size_t k = first; k < last; ++k) {
+	    *pir++ = (mwIndex)this->ir[k];
+	    *ppr++ = this->pr[k];
+	  }
+	}
+	continue;
+      }
+
+      // sort the column, merge repeated rows and remove zeros
+      buf.clear();
+      for (size_t k = first; k < last; ++k) {
+	buf.push_back(std::make_pair((mwIndex)this->ir[k], this->pr[k]));
+      }
+      std::stable_sort(buf.begin(), buf.end(), RowLess());
+      size_t nOut = 0;
+      for (size_t k = 0; k < buf.size(); ) {
+	mwIndex r = buf[k].first;
+	TVal v = buf[k].second;
+	for (++k; k < buf.size() && buf[k].first == r; ++k) {
+	  add(v, buf[k].second);
+	}
+	if (v == 0) {
+	  continue;
+	}
+	if (this->outIr != NULL) {
+	  this->outIr[this->outJc[col] + nOut] = r;
+	  this->outPr[this->outJc[col] + nOut] = v;
+	}
+	++nOut;
+      }
+      if (this->outIr == NULL) {
+	this->nnzCol[col] = nOut;
+      }
+    }
+  }
+
+ private:
+
+  struct RowLess {
+    bool operator()(const std::pair<mwIndex, TVal> &a,
+		    const std::pair<mwIndex, TVal> &b) const {
+      return a.first < b.first;
+    }
+  };
+
+  const TIdx *ir;
+  const TIdx *jc;
+  const TVal *pr;
+  size_t m;
+  mwIndex *nnzCol;
+  mwIndex *outIr;
+  const mwIndex *outJc;
+  TVal *outPr;
+  std::vector<std::vector<std::pair<mwIndex, TVal> > > buffer;
+
+};
+
+// [IR, JC, PR] = sparse_breakdown(A)
+void breakdown(int nlhs, mxArray *plhs[], const mxArray *a,
+	       unsigned int numThreads) {
+  if ((!mxIsDouble(a) && !mxIsLogical(a)) || mxIsComplex(a)) {
+    mexErrMsgTxt("A must be a real sparse matrix of class double or logical");
+  }
+  const size_t n = mxGetN(a);
+  const mwIndex *ir = mxGetIr(a);
+  const mwIndex *jc = mxGetJc(a);
+  const size_t nnz = jc[n];
+
+  plhs[0] = mxCreateNumericMatrix(nnz, 1, mxINT64_CLASS, mxREAL);
+  if (plhs[0] == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  parallelCopy(ir, (int64_T *)mxGetData(plhs[0]), nnz, numThreads);
+  if (nlhs > 1) {
+    plhs[1] = mxCreateNumericMatrix(n + 1, 1, mxINT64_CLASS, mxREAL);
+    if (plhs[1] == NULL) {
+      mexErrMsgTxt("Not enough memory for output");
+    }
+    parallelCopy(jc, (int64_T *)mxGetData(plhs[1]), n + 1, numThreads);
+  }
+  if (nlhs > 2) {
+    if (mxIsLogical(a)) {
+      plhs[2] = mxCreateLogicalMatrix(nnz, 1);
+      if (plhs[2] == NULL) {
+	mexErrMsgTxt("Not enough memory for output");
+      }
+      parallelCopy(mxGetLogicals(a), mxGetLogicals(plhs[2]), nnz, numThreads);
+    } else {
+      plhs[2] = mxCreateDoubleMatrix(nnz, 1, mxREAL);
+      if (plhs[2] == NULL) {
+	mexErrMsgTxt("Not enough memory for output");
+      }
+      parallelCopy(mxGetPr(a), mxGetPr(plhs[2]), nnz, numThreads);
+    }
+  }
+}
+
+// A = sparse_breakdown(IR, JC, PR, M), with the index and value
+// arrays cast to their types
+template <class TIdx, class TVal>
+mxArray *buildup(const mxArray *irArray, const mxArray *jcArray,
+		 const mxArray *prArray, size_t m, unsigned int numThreads) {
+  const TIdx *ir = (const TIdx *)mxGetData(irArray);
+  const TIdx *jc = (const TIdx *)mxGetData(jcArray);
+  const TVal *pr = (const TVal *)mxGetData(prArray);
+  const size_t n = mxGetNumberOfElements(jcArray) - 1;
+  const size_t nnzIn = mxGetNumberOfElements(irArray);
+
+  // JC must be a valid cumulative count of the elements
+  if (jc[0] != 0 || jc[n] != (TIdx)nnzIn) {
+    mexErrMsgTxt("JC must start with 0 and end with the number of elements in IR");
+  }
+  for (size_t col = 0; col < n; ++col) {
+    if (!(jc[col] <= jc[col + 1])) {
+      mexErrMsgTxt("JC must be non-decreasing");
+    }
+  }
+
+  // first pass: validate rows and count output elements per column
+  numThreads = getNumberOfThreads(numThreads);
+  std::vector<mwIndex> nnzCol(n);
+  ColumnBuildFunctor<TIdx, TVal> f(ir, jc, pr, m,
+				   n > 0 ? &nnzCol[0] : NULL, numThreads);
+  parallelFor(0, n, f, numThreads);
+  mwIndex nnzOut = 0;
+  for (size_t col = 0; col < n; ++col) {
+    nnzOut += nnzCol[col];
+  }
+
+  // second pass: write the output matrix
+  mxArray *a = NULL;
+  if (mxIsLogical(prArray)) {
+    a = mxCreateSparseLogicalMatrix(m, n, std::max(nnzOut, (mwIndex)1));
+  } else {
+    a = mxCreateSparse(m, n, std::max(nnzOut, (mwIndex)1), mxREAL);
+  }
+  if (a == NULL) {
+    mexErrMsgTxt("Not enough memory for output");
+  }
+  mwIndex *outJc = mxGetJc(a);
+  outJc[0] = 0;
+  for (size_t col = 0; col < n; ++col) {
+    outJc[col + 1] = outJc[col] + nnzCol[col];
+  }
+  f.SetOutput(mxGetIr(a), outJc, (TVal *)mxGetData(a));
+  parallelFor(0, n, f, numThreads);
+
+  return a;
+}
+
+template <class TIdx>
+mxArray *buildup(const mxArray *ir, const mxArray *jc, const mxArray *pr,
+		 size_t m, unsigned int numThreads) {
+  if (mxIsLogical(pr)) {
+    return buildup<TIdx, mxLogical>(ir, jc, pr, m, numThreads);
+  } else {
+    return buildup<TIdx, double>(ir, jc, pr, m, numThreads);
+  }
+}
+
+void mexFunction(int nlhs, mxArray *plhs[],
+		 int nrhs, const mxArray *prhs[]) {
+
+  if (nrhs < 1) {
+    mexErrMsgTxt("Not enough input arguments");
+  }
+
+  // syntax [IR, JC, PR] = sparse_breakdown(A, NUMTHREADS)
+  if (mxIsSparse(prhs[0])) {
+    if (nrhs > 2) {
+      mexErrMsgTxt("Too many input arguments");
+    }
+    if (nlhs > 3) {
+      mexErrMsgTxt("Too many output arguments");
+    }
+    unsigned int numThreads = 0;
+    if (nrhs > 1 && !mxIsEmpty(prhs[1])) {
+      numThreads = (unsigned int)mxGetScalar(prhs[1]);
+    }
+    breakdown(nlhs, plhs, prhs[0], numThreads);
+    return;
+  }
+
+  // syntax A = sparse_breakdown(IR, JC, PR, M, NUMTHREADS)
+  if (nrhs < 4 || nrhs > 5) {
+    mexErrMsgTxt("Four or five input arguments required to build a sparse matrix");
+  }
+  if (nlhs > 1) {
+    mexErrMsgTxt("Too many output arguments");
+  }
+  const mxArray *ir = prhs[0];
+  const mxArray *jc = prhs[1];
+  const mxArray *pr = prhs[2];
+  mxClassID idxClass = mxGetClassID(ir);
+  if ((idxClass != mxINT64_CLASS && idxClass != mxDOUBLE_CLASS)
+      || mxGetClassID(jc) != idxClass || mxIsComplex(ir) || mxIsComplex(jc)) {
+    mexErrMsgTxt("IR and JC must be both of class int64 or double");
+  }
+  if ((!mxIsDouble(pr) && !mxIsLogical(pr)) || mxIsComplex(pr)) {
+    mexErrMsgTxt("PR must be real, of class double or logical");
+  }
+  if (mxGetNumberOfElements(pr) != mxGetNumberOfElements(ir)) {
+    mexErrMsgTxt("IR and PR must have the same number of elements");
+  }
+  if (mxGetNumberOfElements(jc) < 1) {
+    mexErrMsgTxt("JC must have at least one element");
+  }
+  if (!mxIsNumeric(prhs[3]) || mxGetNumberOfElements(prhs[3]) != 1
+      || !(mxGetScalar(prhs[3]) >= 0.0)) {
+    mexErrMsgTxt("M must be a non-negative scalar");
+  }
+  size_t m = (size_t)mxGetScalar(prhs[3]);
+  unsigned int numThreads = 0;
+  if (nrhs > 4 && !mxIsEmpty(prhs[4])) {
+    numThreads = (unsigned int)mxGetScalar(prhs[4]);
+  }
+
+  if (idxClass == mxINT64_CLASS) {
+    plhs[0] = buildup<int64_T>(ir, jc, pr, m, numThreads);
+  } else {
+    plhs[0] = buildup<double>(ir, jc, pr, m, numThreads);
+  }
+
+}
@@ -0,0 +1,82 @@
+function varargout = sparse_breakdown(varargin)
+% SPARSE_BREAKDOWN  Extract the internal arrays of a sparse matrix, or
+% build a sparse matrix from them
+%
+% [IR, JC, PR] = sparse_breakdown(A)
+%
+%   A is a real sparse matrix of class double or logical, with size
+%   (M, N).
+%
+%   IR, JC, PR are column vectors with the arrays that Matlab uses
+%   internally to store A in Compressed Sparse Column (CSC) format:
+%
+%     IR: int64 vector with the row index of each non-zero element,
+%         0-based, sorted by column, and within each column by row.
+%
+%     JC: int64 vector with N+1 elements. The non-zero elements of
+%         column j (1-based) are IR(JC(j)+1:JC(j+1)) and
+%         PR(JC(j)+1:JC(j+1)). JC(end) is the number of non-zero
+%         elements.
+%
+%     PR: vector with the values of the non-zero elements, of the
+%         same class as A.
+%
+%   The arrays are copied in one pass, without building the (row,
+%   column, value) triplets of find(A). To get them from the CSC
+%   arrays, the column indices are
+%
+%     >> j = repelem((1:N)', diff(JC));
+%
+% A = sparse_breakdown(IR, JC, PR, M)
+%
+%   Build sparse matrix A with M rows and length(JC)-1 columns from
+%   its CSC arrays. IR and JC can be of class int64 or double, and
+%   follow the 0-based convention above. PR can be of class double or
+%   logical, and A has the same class.
+%
+%   The common case, when row indices in each column are sorted and
+%   without repetitions, and all values are non-zero, is a copy of
+%   the arrays in one pass. Otherwise, only the columns that need it
+%   are sorted, and as with sparse(), repeated elements are added
+%   (logical OR for logical matrices), and zeros are removed. This is
+%   much faster than sparse(i, j, v, M, N), that sorts all the
+%   elements.
+%
+% ... = sparse_breakdown(..., NUMTHREADS)
+%
+%   NUMTHREADS is the number of threads. By default, NUMTHREADS=0, and
+%   one thread per processor is used.
+%
+% See also: sparse, find, im2dmatrix.
+
+% Author: Ramon Casero <rcasero@gmail.com>
+% Copyright © 2010-2015 University of Oxford
+% Version: 0.2.0
+% $Rev$
+% $Date$
+%
+% University of Oxford means the Chancellor, Masters and Scholars of
+% the University of Oxford, having an administrative office at
+% Wellington Square, Oxford OX1 2JD, UK.
+%
+% This file is part of Gerardus.
+%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU General Public License for more details. The offer of this
+% program under the terms of the License is subject to the License
+% being interpreted in accordance with English Law and subject to any
+% action against the University of Oxford being under the jurisdiction
+% of the English Courts.
+%
+% You should have received a copy of the GNU General Public License
+% along with this program.  If not, see
+% <http://www.gnu.org/licenses/>.
+
+error('MEX function not found')
@@ -28,6 +28,11 @@ function [TiffInfo,Img]=tiff_read_header(filename)
 %
 % Written by D.Kroon 31-05-2012
 %
+% Gerardus: new code should use tiff_read_info(), that returns the same
+% tags much faster for files with many images, and also reads BigTIFF
+% files. The image data can be read with tiff_read_roi().
+%
+% See also: tiff_read_info, tiff_read_roi.
 
 % Create the Tiff-tag Dictionary
 i=1;